@@ -5,7 +5,9 @@
 from __future__ import with_statement
 import os
 import re
+import atexit
 from subprocess import Popen, PIPE
+from ctypes import *
 import datetime
 from loadconfig import *
 
@@ -15,6 +17,11 @@ __all__ = ['check_path', 'find_path', ]
 
 _IMG_FS_OFFSET_SECTOR = '063'
 
+# Inspection engine library and the handles opened through it, one per
+# disk image.  _engine_lib is False once loading the library has failed.
+_engine_lib = None
+_engine_handles = {}
+
 class PathNotFoundError(Exception):
     """ Exception if path does not exist.
     """
@@ -95,10 +102,143 @@ def find_path(path):
 
     return result
 
+def load_engine():
+    """ Load the inspection engine library. Returns None if it is not
+        available, the fls/icat tools are used then.
+    """
+    global _engine_lib
+    if _engine_lib is None:
+        try:
+            lib = cdll.LoadLibrary('vmenginelib')
+        except OSError:
+            _engine_lib = False
+            return None
+
+        lib.vme_open.argtypes = [c_char_p]
+        lib.vme_open.restype = c_void_p
+        lib.vme_close.argtypes = [c_void_p]
+        lib.vme_close.restype = None
+        lib.vme_lookup.argtypes = [c_void_p, c_char_p, POINTER(c_uint64)]
+        lib.vme_lookup.restype = c_int
+        lib.vme_list_dir.argtypes = [c_void_p, c_uint64]
+        lib.vme_list_dir.restype = c_void_p
+        lib.vme_file_size.argtypes = [c_void_p, c_uint64]
+        lib.vme_file_size.restype = c_int64
+        lib.vme_read.argtypes = [c_void_p, c_uint64, c_int64, c_char_p,
+                                 c_size_t]
+        lib.vme_read.restype = c_int64
+        lib.vme_error.argtypes = []
+        lib.vme_error.restype = c_char_p
+        lib.vme_free.argtypes = [c_void_p]
+        lib.vme_free.restype = None
+        _engine_lib = lib
+    return _engine_lib or None
+
+def engine_open(diskfile):
+    """ Return the engine handle of diskfile, opening it on first use.
+    """
+    if _engine_handles.has_key(diskfile):
+        return _engine_handles[diskfile]
+
+    handle = _engine_lib.vme_open(diskfile)
+    if not handle:
+        raise Exception("Unable to open %s: %s" % (diskfile,
+                                                   _engine_lib.vme_error()))
+    _engine_handles[diskfile] = handle
+    return handle
+
+def engine_close(diskfile=None):
+    """ Close the engine handle of diskfile, or all of them.
+    """
+    if diskfile is None:
+        disks = _engine_handles.keys()
+    else:
+        disks = [diskfile]
+
+    for disk in disks:
+        handle = _engine_handles.pop(disk, None)
+        if handle:
+            _engine_lib.vme_close(handle)
+
+atexit.register(engine_close)
+
+def engine_lookup(diskfile, path):
+    """ Return inode of path as string, None if it does not exist.
+    """
+    inum = c_uint64(0)
+    ret = _engine_lib.vme_lookup(engine_open(diskfile), path, byref(inum))
+    if ret < 0:
+        raise Exception("Error while finding %s: %s" % (path,
+                                                        _engine_lib.vme_error()))
+    if ret != 0:
+        return None
+    return str(inum.value)
+
+def engine_read(diskfile, inode):
+    """ Return content of the file with given inode.
+    """
+    handle = engine_open(diskfile)
+    inum = long(str(inode).split('-')[0])
+    size = _engine_lib.vme_file_size(handle, inum)
+    if size < 0:
+        raise Exception("Unable to read inode %s: %s" % (inode,
+                                                         _engine_lib.vme_error()))
+    buf = create_string_buffer(size)
+    if size and _engine_lib.vme_read(handle, inum, 0, buf, size) != size:
+        raise Exception("Unable to read inode %s: %s" % (inode,
+                                                         _engine_lib.vme_error()))
+    return buf.raw
+
+def engine_file_reader(diskfile, inode):
+    """ Return (read, size) to read the file with given inode in place.
+        read(offset, address, length) reads into the memory at address and
+        returns the number of bytes read or -1 on error.
+    """
+    handle = engine_open(diskfile)
+    inum = long(str(inode).split('-')[0])
+    size = _engine_lib.vme_file_size(handle, inum)
+    if size < 0:
+        raise Exception("Unable to read inode %s: %s" % (inode,
+                                                         _engine_lib.vme_error()))
+
+    def read(offset, address, length):
+        return _engine_lib.vme_read(handle, inum, offset,
+                                    cast(address, c_char_p), length)
+    return read, size
+
+def vm_list_dir(diskfile, path):
+    """ Return list of (inode, type, name) of the directory entries in path.
+    """
+    if not load_engine():
+        raise Exception("Directory listing needs the inspection engine.")
+
+    inode = engine_lookup(diskfile, path)
+    if inode is None:
+        raise Exception("Unable to find %s" %(path))
+
+    ptr = _engine_lib.vme_list_dir(engine_open(diskfile), long(inode))
+    if not ptr:
+        raise Exception("Unable to list %s: %s" % (path,
+                                                   _engine_lib.vme_error()))
+    try:
+        listing = string_at(ptr)
+    finally:
+        _engine_lib.vme_free(ptr)
+
+    return [tuple(x.split('\t', 2)) for x in listing.splitlines()]
+
 def vm_find_path(diskfile, path, inode=None, returntype=None):
     """
         find if path is available
     """
+    if load_engine():
+        inode = engine_lookup(diskfile, path)
+        if inode is None:
+            raise Exception("Unable to find %s" %(path))
+        if returntype:
+            return readfile(diskfile, inode, returntype)
+        return inode
+
     inode = None
     for a in path.split("/"):
         p = fls(diskfile, inode)
@@ -145,9 +285,16 @@ def fls(diskfile, inode=None):
         cmd.append(inode)
     return Popen(cmd, stdout=PIPE)
 
+def skip_img_info(lines):
+    """ Drop the image info banner older qemu-img-lib prints on stdout.
+    """
+    if lines and lines[0].startswith('Image info:'):
+        return lines[4:]
+    return lines
+
 def parse_inode(p, path):
     base, target = os.path.split(path)
-    for a in p.stdout.readlines()[4:]:
+    for a in skip_img_info(p.stdout.readlines()):
         inode = parse_directory(a, target)        
         if inode:
             return inode
@@ -162,22 +309,26 @@ def readfile(disk, inode, returntype=None):
     """
     read a file and return its content
     """
-    offset = _IMG_FS_OFFSET_SECTOR
-    cmd = [os.path.join(conf["bin_dir"], "icat"), '-o', offset, '-i', "QEMU", 
-           disk, inode]
-    p = Popen(cmd, stdout=PIPE)
+    if load_engine():
+        lines = engine_read(disk, inode).splitlines(True)
+    else:
+        offset = _IMG_FS_OFFSET_SECTOR
+        cmd = [os.path.join(conf["bin_dir"], "icat"), '-o', offset, '-i',
+               "QEMU", disk, inode]
+        p = Popen(cmd, stdout=PIPE)
+        lines = skip_img_info(p.stdout.readlines())
     if returntype:
         if returntype == "file":
             dirname, filename = os.path.split(disk)
             filename = os.path.abspath(os.path.join(conf["tmp_dir"], filename)) 
             with open(filename, "wb") as fd:
-                for line in p.stdout.readlines()[4:]:
+                for line in lines:
                     fd.write(line)
             return filename
         elif returntype == "list":
            filedata = []
-           for line in p.stdout.readlines()[4:]:
+           for line in lines:
                filedata.append(line)
            return filedata
         elif returntype == "data":
-           return ''.join(p.stdout.readlines()[4:])
+           return ''.join(lines)
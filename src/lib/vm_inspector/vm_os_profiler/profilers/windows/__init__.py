@@ -7,9 +7,13 @@ from ctypes import *
 
 from vm_inspector.vm_os_profiler.os_consts import *
 from vm_inspector.vm_os_profiler import *
-from vm_inspector.utils import find_path , readfile, vm_find_path
+from vm_inspector.utils import find_path , readfile, vm_find_path, \
+        load_engine, engine_file_reader
 from loadconfig import conf
 
+# read callback of rll_open_cb(): (state, offset, buffer, length)
+RLL_READ_CB = CFUNCTYPE(c_long, c_void_p, c_uint, c_void_p, c_uint)
+
 class vm_fs_not_mounted_error(Exception):
     def __init__(self, msg=None):
         if msg:
@@ -41,6 +45,8 @@ class vm_os_windows(vm_os_profiler_base):
     def __init__(self, **args):
         self.fs_mntpt = args["fs_mountpoint"]
         self.reg_path = None
+        self.reg_inode = None
+        self.reg_reader = None
         self.os_details = dict()
         self.installed_apps = []
         self.os_details['os_type'] = 'Windows'
@@ -60,6 +66,11 @@ class vm_os_windows(vm_os_profiler_base):
         if self.reg_path == "":
             raise vm_os_regpath_not_found 
 
+        # the engine reads the hive in place from the image
+        if load_engine():
+            self.reg_inode = self.reg_path
+            return
+
         # write the registry file
         self.reg_path = readfile(self.fs_mntpt, self.reg_path, "file")
 
@@ -166,6 +177,10 @@ class vm_os_windows(vm_os_profiler_base):
             self.fn_reg_open.argtype=c_char_p
             self.fn_reg_open.restype=c_void_p
 
+            self.fn_reg_open_cb = self.dll.rll_open_cb
+            self.fn_reg_open_cb.argtypes = [RLL_READ_CB, c_uint, c_void_p]
+            self.fn_reg_open_cb.restype = c_void_p
+
             #lookup current tree and get strings
             self.fn_get_strings = self.dll.rll_get_value_strings
             self.fn_get_strings.argtype=[c_int, c_char_p, c_int]
@@ -181,8 +196,17 @@ class vm_os_windows(vm_os_profiler_base):
            print "Error loading library: " + str(e)
 
         try:
-            reg_path = c_char_p(self.reg_path)
-            self.reg_handle = self.fn_reg_open(reg_path)
+            if self.reg_inode is not None:
+                read, size = engine_file_reader(self.fs_mntpt, self.reg_inode)
+                # the callback has to live as long as the hive is open
+                self.reg_reader = RLL_READ_CB(
+                        lambda state, offset, buf, length:
+                            read(offset, buf, length))
+                self.reg_handle = self.fn_reg_open_cb(self.reg_reader, size,
+                                                      None)
+            else:
+                reg_path = c_char_p(self.reg_path)
+                self.reg_handle = self.fn_reg_open(reg_path)
         except Exception, e:
            print "Error opening registry hive: " + str(e)
 
@@ -27,6 +27,15 @@ static QLIST_HEAD(, AioHandler) aio_handlers;
  */
 static int walking_handlers;
 
+/* Owner of the requests the thread starts (see qemu_aio_set_owner_ops()) */
+#ifdef CONFIG_POSIX
+static __thread void *aio_owner;
+#else
+static void *aio_owner;
+#endif
+static AioOwnerLock *aio_owner_lock;
+static AioOwnerUnlock *aio_owner_unlock;
+
 struct AioHandler
 {
     int fd;
@@ -98,6 +107,37 @@ int qemu_aio_set_fd_handler(int fd,
     return 0;
 }
 
+void qemu_aio_set_owner_ops(AioOwnerLock *lock, AioOwnerUnlock *unlock)
+{
+    aio_owner_lock = lock;
+    aio_owner_unlock = unlock;
+}
+
+void *qemu_aio_owner(void)
+{
+    return aio_owner;
+}
+
+int qemu_aio_owner_enter(void *owner, int wait, void **prev)
+{
+    *prev = aio_owner;
+    if (owner == aio_owner)
+        return 1;
+    if (owner && aio_owner_lock && !aio_owner_lock(owner, wait))
+        return 0;
+    aio_owner = owner;
+    return 1;
+}
+
+void qemu_aio_owner_leave(void *owner, void *prev)
+{
+    if (owner == prev)
+        return;
+    aio_owner = prev;
+    if (owner && aio_owner_unlock)
+        aio_owner_unlock(owner);
+}
+
 void qemu_aio_flush(void)
 {
     AioHandler *node;
@@ -138,7 +178,8 @@ int qemu_aio_process_queue(void)
     return ret;
 }
 
-void qemu_aio_wait(void)
+/* Dispatch AIO events; tv is the select() timeout, NULL waits for one */
+static void qemu_aio_dispatch(struct timeval *tv)
 {
     int ret;
 
@@ -188,7 +229,7 @@ void qemu_aio_wait(void)
             break;
 
         /* wait until next event */
-        ret = select(max_fd, &rdfds, &wrfds, NULL, NULL);
+        ret = select(max_fd, &rdfds, &wrfds, NULL, tv);
         if (ret == -1 && errno == EINTR)
             continue;
 
@@ -224,5 +265,17 @@ void qemu_aio_wait(void)
 
             walking_handlers = 0;
         }
-    } while (ret == 0);
+    } while (ret == 0 && tv == NULL);
+}
+
+void qemu_aio_wait(void)
+{
+    qemu_aio_dispatch(NULL);
+}
+
+void qemu_aio_poll(void)
+{
+    struct timeval tv = { 0, 0 };
+
+    qemu_aio_dispatch(&tv);
 }
@@ -42,6 +42,10 @@
 #include <windows.h>
 #endif
 
+#ifdef CONFIG_POSIX
+#include <pthread.h>
+#endif
+
 static BlockDriverAIOCB *bdrv_aio_readv_em(BlockDriverState *bs,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockDriverCompletionFunc *cb, void *opaque);
@@ -1390,6 +1394,53 @@ int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return drv->bdrv_get_info(bs, bdi);
 }
 
+/* Set the memory budget of the metadata cache of an image, dropping
+   what it holds */
+int bdrv_set_cache_size(BlockDriverState *bs, int64_t size)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv)
+        return -ENOMEDIUM;
+    if (!drv->bdrv_set_cache_size)
+        return -ENOTSUP;
+    return drv->bdrv_set_cache_size(bs, size);
+}
+
+/* Load all mapping tables of an image into its metadata cache */
+int bdrv_prefetch_metadata(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv)
+        return -ENOMEDIUM;
+    if (!drv->bdrv_prefetch_metadata)
+        return -ENOTSUP;
+    return drv->bdrv_prefetch_metadata(bs);
+}
+
+int bdrv_get_cache_info(BlockDriverState *bs, BlockCacheInfo *bci)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv)
+        return -ENOMEDIUM;
+    if (!drv->bdrv_get_cache_info)
+        return -ENOTSUP;
+    memset(bci, 0, sizeof(*bci));
+    return drv->bdrv_get_cache_info(bs, bci);
+}
+
+/* Set the memory budget of the decompressed cluster cache of an image and
+   the number of threads inflating ahead of sequential reads, dropping what
+   it holds */
+int bdrv_set_data_cache(BlockDriverState *bs, int64_t size, int threads)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv)
+        return -ENOMEDIUM;
+    if (!drv->bdrv_set_data_cache)
+        return -ENOTSUP;
+    return drv->bdrv_set_data_cache(bs, size, threads);
+}
+
 int bdrv_save_vmstate(BlockDriverState *bs, const uint8_t *buf,
                       int64_t pos, int size)
 {
@@ -1985,21 +2036,35 @@ void bdrv_init_with_whitelist(void)
     bdrv_init();
 }
 
+/* The pools are shared by the images that threads read at the same time
+   (see qemu_aio_set_owner_ops()) */
+#ifdef CONFIG_POSIX
+static pthread_mutex_t aio_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#define AIO_POOL_LOCK()     pthread_mutex_lock(&aio_pool_lock)
+#define AIO_POOL_UNLOCK()   pthread_mutex_unlock(&aio_pool_lock)
+#else
+#define AIO_POOL_LOCK()
+#define AIO_POOL_UNLOCK()
+#endif
+
 void *qemu_aio_get(AIOPool *pool, BlockDriverState *bs,
                    BlockDriverCompletionFunc *cb, void *opaque)
 {
     BlockDriverAIOCB *acb;
 
-    if (pool->free_aiocb) {
-        acb = pool->free_aiocb;
+    AIO_POOL_LOCK();
+    acb = pool->free_aiocb;
+    if (acb)
         pool->free_aiocb = acb->next;
-    } else {
+    AIO_POOL_UNLOCK();
+    if (!acb) {
         acb = qemu_mallocz(pool->aiocb_size);
         acb->pool = pool;
     }
     acb->bs = bs;
     acb->cb = cb;
     acb->opaque = opaque;
+    acb->owner = qemu_aio_owner();
     return acb;
 }
 
@@ -2007,8 +2072,11 @@ void qemu_aio_release(void *p)
 {
     BlockDriverAIOCB *acb = (BlockDriverAIOCB *)p;
     AIOPool *pool = acb->pool;
+
+    AIO_POOL_LOCK();
     acb->next = pool->free_aiocb;
     pool->free_aiocb = acb;
+    AIO_POOL_UNLOCK();
 }
 
 /**************************************************************/
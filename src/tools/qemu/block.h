@@ -16,6 +16,22 @@ typedef struct BlockDriverInfo {
     int64_t vm_state_offset;
 } BlockDriverInfo;
 
+typedef struct BlockCacheInfo {
+    /* memory budget of the metadata (L2 table) cache in bytes */
+    int64_t size;
+    /* bytes of the budget holding tables */
+    int64_t used;
+    uint64_t hits;
+    uint64_t misses;
+    /* decompressed cluster cache, zero for formats without one */
+    int64_t data_size;
+    int64_t data_used;
+    uint64_t data_hits;
+    uint64_t data_misses;
+    /* clusters inflated ahead of the reader */
+    uint64_t data_prefetched;
+} BlockCacheInfo;
+
 typedef struct QEMUSnapshotInfo {
     char id_str[128]; /* unique snapshot id */
     /* the following fields are informative. They are not needed for
@@ -170,6 +186,10 @@ const char *bdrv_get_device_name(BlockDriverState *bs);
 int bdrv_write_compressed(BlockDriverState *bs, int64_t sector_num,
                           const uint8_t *buf, int nb_sectors);
 int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi);
+int bdrv_set_cache_size(BlockDriverState *bs, int64_t size);
+int bdrv_prefetch_metadata(BlockDriverState *bs);
+int bdrv_get_cache_info(BlockDriverState *bs, BlockCacheInfo *bci);
+int bdrv_set_data_cache(BlockDriverState *bs, int64_t size, int threads);
 
 const char *bdrv_get_encrypted_filename(BlockDriverState *bs);
 void bdrv_get_backing_filename(BlockDriverState *bs,
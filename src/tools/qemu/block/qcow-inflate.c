@@ -0,0 +1,546 @@
+/*
+ * Decompressed cluster cache for the qcow and qcow2 formats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+
+/*
+ * Compressed clusters are inflated into a cache of whole clusters, keyed
+ * by the offset of their compressed data in the image file. Clusters are
+ * found through a hash table and replaced with the CLOCK algorithm, like
+ * the qcow2 L2 cache.
+ *
+ * The format calls qcow_inflate_prefetch() for the compressed clusters
+ * ahead of a sequential reader. Their compressed data is read right away
+ * and inflated on a pool of worker threads, so that the reader finds
+ * them ready. A reader that gets to a cluster no worker has started yet
+ * inflates it itself.
+ *
+ * Only one thread calls into a cache at a time (the block layer is not
+ * reentrant); the lock protects the entries against the workers.
+ */
+
+#include <zlib.h>
+#include "qemu-common.h"
+#include "block_int.h"
+#include "block/qcow-inflate.h"
+
+#ifdef CONFIG_POSIX
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+enum {
+    INFLATE_READY,      /* data holds the cluster */
+    INFLATE_QUEUED,     /* waiting for a worker, cdata holds the input */
+    INFLATE_BUSY,       /* being inflated */
+    INFLATE_ERROR,      /* the compressed data is corrupt */
+};
+
+typedef struct QCowInflateEntry {
+    uint64_t coffset;   /* offset of the compressed data (0 if unused) */
+    int state;
+    int next;           /* next entry in the hash chain (-1 at end) */
+    int qnext;          /* next entry in the work queue (-1 at end) */
+    uint8_t ref;        /* CLOCK reference bit */
+    uint8_t *data;      /* inflated cluster (allocated on first use) */
+    uint8_t *cdata;     /* compressed data while queued */
+    int csize;
+} QCowInflateEntry;
+
+struct QCowInflateCache {
+    int cluster_size;
+    int nb_entries;
+    int nb_used;        /* entries handed out so far */
+    int hand;           /* CLOCK hand */
+    QCowInflateEntry *ent;
+    int *hash;          /* first entry of each chain (-1 if empty) */
+    uint32_t hash_mask;
+
+    uint8_t *cbuf;      /* compressed data of clusters inflated inline */
+    int cbuf_size;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t prefetched;
+
+    int nb_threads;
+#ifdef CONFIG_POSIX
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* queued work or quit */
+    pthread_cond_t done;        /* an entry is no longer INFLATE_BUSY */
+    pthread_t *threads;         /* started on the first prefetch */
+    int nb_pending;             /* entries queued or being inflated */
+    int queue_head;
+    int queue_tail;
+    int quit;
+#endif
+};
+
+#ifdef CONFIG_POSIX
+#define INFLATE_LOCK(c)     pthread_mutex_lock(&(c)->lock)
+#define INFLATE_UNLOCK(c)   pthread_mutex_unlock(&(c)->lock)
+#else
+#define INFLATE_LOCK(c)
+#define INFLATE_UNLOCK(c)
+#endif
+
+static int inflate_buffer(uint8_t *out_buf, int out_buf_size,
+                          const uint8_t *buf, int buf_size)
+{
+    z_stream strm1, *strm = &strm1;
+    int ret, out_len;
+
+    memset(strm, 0, sizeof(*strm));
+
+    strm->next_in = (uint8_t *)buf;
+    strm->avail_in = buf_size;
+    strm->next_out = out_buf;
+    strm->avail_out = out_buf_size;
+
+    ret = inflateInit2(strm, -12);
+    if (ret != Z_OK)
+        return -1;
+    ret = inflate(strm, Z_FINISH);
+    out_len = strm->next_out - out_buf;
+    if ((ret != Z_STREAM_END && ret != Z_BUF_ERROR) ||
+        out_len != out_buf_size) {
+        inflateEnd(strm);
+        return -1;
+    }
+    inflateEnd(strm);
+    return 0;
+}
+
+static inline uint32_t inflate_hash(QCowInflateCache *c, uint64_t coffset)
+{
+    return (uint32_t)((coffset * 0x9E3779B97F4A7C15ULL) >> 32) &
+        c->hash_mask;
+}
+
+static int inflate_find(QCowInflateCache *c, uint64_t coffset)
+{
+    int i;
+
+    for (i = c->hash[inflate_hash(c, coffset)]; i != -1; i = c->ent[i].next) {
+        if (c->ent[i].coffset == coffset)
+            return i;
+    }
+    return -1;
+}
+
+static void inflate_link(QCowInflateCache *c, int idx, uint64_t coffset)
+{
+    uint32_t h = inflate_hash(c, coffset);
+
+    c->ent[idx].coffset = coffset;
+    c->ent[idx].ref = 1;
+    c->ent[idx].next = c->hash[h];
+    c->hash[h] = idx;
+}
+
+static void inflate_unlink(QCowInflateCache *c, int idx)
+{
+    int *prev = &c->hash[inflate_hash(c, c->ent[idx].coffset)];
+
+    while (*prev != -1) {
+        if (*prev == idx) {
+            *prev = c->ent[idx].next;
+            break;
+        }
+        prev = &c->ent[*prev].next;
+    }
+    c->ent[idx].coffset = 0;
+    c->ent[idx].next = -1;
+}
+
+/* Pick an entry for a new cluster and take it out of the hash table.
+   Entries that are queued or being inflated are passed over.
+   Called with the lock held. */
+static int inflate_victim(QCowInflateCache *c)
+{
+    QCowInflateEntry *e;
+    int idx;
+
+    if (c->nb_used < c->nb_entries) {
+        idx = c->nb_used++;
+    } else {
+        for(;;) {
+            idx = c->hand;
+            c->hand = (c->hand + 1) % c->nb_entries;
+            e = &c->ent[idx];
+
+            if (e->coffset == 0)
+                break;
+            if (e->state == INFLATE_QUEUED || e->state == INFLATE_BUSY)
+                continue;
+            if (e->ref) {
+                e->ref = 0;
+                continue;
+            }
+            inflate_unlink(c, idx);
+            break;
+        }
+    }
+
+    e = &c->ent[idx];
+    if (!e->data)
+        e->data = qemu_malloc(c->cluster_size);
+    e->state = INFLATE_READY;
+    return idx;
+}
+
+#ifdef CONFIG_POSIX
+/* Remove an entry from the work queue. Called with the lock held. */
+static void inflate_unqueue(QCowInflateCache *c, int idx)
+{
+    int *prev = &c->queue_head;
+    int last = -1;
+
+    while (*prev != -1 && *prev != idx) {
+        last = *prev;
+        prev = &c->ent[*prev].qnext;
+    }
+    if (*prev == idx) {
+        *prev = c->ent[idx].qnext;
+        if (c->queue_tail == idx)
+            c->queue_tail = last;
+    }
+    c->ent[idx].qnext = -1;
+}
+
+/* Inflate a queued entry. Called with the lock held, which is dropped
+   while the entry is inflated. */
+static void inflate_run(QCowInflateCache *c, QCowInflateEntry *e)
+{
+    int ret;
+
+    e->state = INFLATE_BUSY;
+    INFLATE_UNLOCK(c);
+    ret = inflate_buffer(e->data, c->cluster_size, e->cdata, e->csize);
+    INFLATE_LOCK(c);
+
+    qemu_free(e->cdata);
+    e->cdata = NULL;
+    e->state = ret < 0 ? INFLATE_ERROR : INFLATE_READY;
+    c->nb_pending--;
+    pthread_cond_broadcast(&c->done);
+}
+
+static void *inflate_worker(void *opaque)
+{
+    QCowInflateCache *c = opaque;
+    int idx;
+
+    INFLATE_LOCK(c);
+    for(;;) {
+        while (c->queue_head == -1 && !c->quit)
+            pthread_cond_wait(&c->work, &c->lock);
+        if (c->quit)
+            break;
+
+        idx = c->queue_head;
+        inflate_unqueue(c, idx);
+        inflate_run(c, &c->ent[idx]);
+    }
+    INFLATE_UNLOCK(c);
+    return NULL;
+}
+
+static void inflate_start_threads(QCowInflateCache *c)
+{
+    sigset_t set, oldset;
+    int i;
+
+    /* the workers must not take the AIO completion signal */
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &oldset);
+
+    c->threads = qemu_mallocz(c->nb_threads * sizeof(pthread_t));
+    for (i = 0; i < c->nb_threads; i++) {
+        if (pthread_create(&c->threads[i], NULL, inflate_worker, c) != 0)
+            break;
+    }
+    c->nb_threads = i;
+
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+}
+#endif
+
+/*
+ * qcow_inflate_new
+ *
+ * Create a cache of as many clusters as fit into budget bytes (at least
+ * QCOW_INFLATE_MIN_CLUSTERS) that inflates prefetched clusters on
+ * threads workers.
+ */
+QCowInflateCache *qcow_inflate_new(int cluster_size, int64_t budget,
+                                   int threads)
+{
+    QCowInflateCache *c;
+    int64_t n = budget / cluster_size;
+    uint32_t hash_size = 1;
+    int i;
+
+    if (n < QCOW_INFLATE_MIN_CLUSTERS)
+        n = QCOW_INFLATE_MIN_CLUSTERS;
+    if (n > INT_MAX / 2)
+        n = INT_MAX / 2;
+    while (hash_size < n * 2)
+        hash_size <<= 1;
+
+    c = qemu_mallocz(sizeof(QCowInflateCache));
+    c->cluster_size = cluster_size;
+    c->nb_entries = n;
+    c->ent = qemu_mallocz(n * sizeof(QCowInflateEntry));
+    c->hash = qemu_malloc(hash_size * sizeof(int));
+    c->hash_mask = hash_size - 1;
+    for (i = 0; i < n; i++) {
+        c->ent[i].next = -1;
+        c->ent[i].qnext = -1;
+    }
+    memset(c->hash, 0xff, hash_size * sizeof(int));
+
+#ifdef CONFIG_POSIX
+    if (threads < 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads <= 1)
+            threads = 0;
+        if (threads > QCOW_INFLATE_MAX_THREADS)
+            threads = QCOW_INFLATE_MAX_THREADS;
+    }
+    c->nb_threads = threads;
+    c->queue_head = -1;
+    c->queue_tail = -1;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->work, NULL);
+    pthread_cond_init(&c->done, NULL);
+#endif
+    return c;
+}
+
+/* Wait for the workers to finish the entries they inflate and drop the
+   queued ones. Called with the lock held. */
+static void inflate_drain(QCowInflateCache *c)
+{
+#ifdef CONFIG_POSIX
+    int i, busy;
+
+    while (c->queue_head != -1) {
+        QCowInflateEntry *e = &c->ent[c->queue_head];
+
+        inflate_unqueue(c, c->queue_head);
+        qemu_free(e->cdata);
+        e->cdata = NULL;
+        e->state = INFLATE_ERROR;
+        c->nb_pending--;
+    }
+
+    do {
+        busy = 0;
+        for (i = 0; i < c->nb_used; i++) {
+            if (c->ent[i].state == INFLATE_BUSY)
+                busy = 1;
+        }
+        if (busy)
+            pthread_cond_wait(&c->done, &c->lock);
+    } while (busy);
+#endif
+}
+
+void qcow_inflate_delete(QCowInflateCache *c)
+{
+    int i;
+
+    if (!c)
+        return;
+
+    INFLATE_LOCK(c);
+    inflate_drain(c);
+#ifdef CONFIG_POSIX
+    c->quit = 1;
+    pthread_cond_broadcast(&c->work);
+#endif
+    INFLATE_UNLOCK(c);
+
+#ifdef CONFIG_POSIX
+    if (c->threads) {
+        for (i = 0; i < c->nb_threads; i++)
+            pthread_join(c->threads[i], NULL);
+        qemu_free(c->threads);
+    }
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->work);
+    pthread_cond_destroy(&c->done);
+#endif
+
+    for (i = 0; i < c->nb_used; i++)
+        qemu_free(c->ent[i].data);
+    qemu_free(c->ent);
+    qemu_free(c->hash);
+    qemu_free(c->cbuf);
+    qemu_free(c);
+}
+
+/* Drop all clusters, e.g. when a write may reuse compressed data space */
+void qcow_inflate_reset(QCowInflateCache *c)
+{
+    int i;
+
+    INFLATE_LOCK(c);
+    inflate_drain(c);
+    for (i = 0; i < c->nb_used; i++) {
+        c->ent[i].coffset = 0;
+        c->ent[i].next = -1;
+        c->ent[i].ref = 0;
+    }
+    memset(c->hash, 0xff, (c->hash_mask + 1) * sizeof(int));
+    INFLATE_UNLOCK(c);
+}
+
+/*
+ * qcow_inflate_get
+ *
+ * Return the inflated cluster whose csize bytes of compressed data are
+ * at coffset in hd, inflating it if it is not cached. The data stays
+ * valid until the next call on the cache.
+ *
+ * Returns NULL if the data could not be read or inflated.
+ */
+uint8_t *qcow_inflate_get(QCowInflateCache *c, BlockDriverState *hd,
+                          uint64_t coffset, int csize)
+{
+    QCowInflateEntry *e;
+    int idx;
+
+    INFLATE_LOCK(c);
+    idx = inflate_find(c, coffset);
+    if (idx != -1) {
+        e = &c->ent[idx];
+#ifdef CONFIG_POSIX
+        /* no worker got to it yet, do not wait for one */
+        if (e->state == INFLATE_QUEUED) {
+            inflate_unqueue(c, idx);
+            inflate_run(c, e);
+        }
+        while (e->state == INFLATE_BUSY)
+            pthread_cond_wait(&c->done, &c->lock);
+#endif
+        if (e->state == INFLATE_READY) {
+            e->ref = 1;
+            c->hits++;
+            INFLATE_UNLOCK(c);
+            return e->data;
+        }
+        /* the prefetch failed, try once more below */
+        inflate_unlink(c, idx);
+    }
+
+    c->misses++;
+    idx = inflate_victim(c);
+    e = &c->ent[idx];
+    INFLATE_UNLOCK(c);
+
+    /* the entry is in no hash chain or queue, so no worker touches it */
+    if (csize > c->cbuf_size) {
+        c->cbuf = qemu_realloc(c->cbuf, csize);
+        c->cbuf_size = csize;
+    }
+    if (bdrv_pread(hd, coffset, c->cbuf, csize) != csize)
+        return NULL;
+    if (inflate_buffer(e->data, c->cluster_size, c->cbuf, csize) < 0)
+        return NULL;
+
+    INFLATE_LOCK(c);
+    inflate_link(c, idx, coffset);
+    INFLATE_UNLOCK(c);
+    return e->data;
+}
+
+/*
+ * qcow_inflate_ahead
+ *
+ * Number of clusters worth prefetching ahead of a sequential reader, 0
+ * if there are no workers.
+ */
+int qcow_inflate_ahead(QCowInflateCache *c)
+{
+    return MIN(c->nb_threads * 2, c->nb_entries / 2);
+}
+
+/*
+ * qcow_inflate_prefetch
+ *
+ * Read the compressed data of a cluster and queue it for the workers,
+ * unless it is cached already.
+ */
+void qcow_inflate_prefetch(QCowInflateCache *c, BlockDriverState *hd,
+                           uint64_t coffset, int csize)
+{
+#ifdef CONFIG_POSIX
+    QCowInflateEntry *e;
+    uint8_t *cdata;
+    int idx;
+
+    if (c->nb_threads == 0)
+        return;
+    if (!c->threads) {
+        inflate_start_threads(c);
+        if (c->nb_threads == 0)
+            return;
+    }
+
+    INFLATE_LOCK(c);
+    /* keep half of the entries for clusters that are ready, so that
+       inflate_victim() always finds one */
+    if (inflate_find(c, coffset) != -1 ||
+        c->nb_pending >= c->nb_entries / 2) {
+        INFLATE_UNLOCK(c);
+        return;
+    }
+    idx = inflate_victim(c);
+    e = &c->ent[idx];
+    INFLATE_UNLOCK(c);
+
+    cdata = qemu_malloc(csize);
+    if (bdrv_pread(hd, coffset, cdata, csize) != csize) {
+        qemu_free(cdata);
+        return;
+    }
+
+    INFLATE_LOCK(c);
+    e->cdata = cdata;
+    e->csize = csize;
+    e->state = INFLATE_QUEUED;
+    c->nb_pending++;
+    inflate_link(c, idx, coffset);
+
+    e->qnext = -1;
+    if (c->queue_tail == -1)
+        c->queue_head = idx;
+    else
+        c->ent[c->queue_tail].qnext = idx;
+    c->queue_tail = idx;
+    c->prefetched++;
+    pthread_cond_signal(&c->work);
+    INFLATE_UNLOCK(c);
+#endif
+}
+
+void qcow_inflate_get_info(QCowInflateCache *c, BlockCacheInfo *bci)
+{
+    int i, used = 0;
+
+    INFLATE_LOCK(c);
+    for (i = 0; i < c->nb_used; i++) {
+        if (c->ent[i].coffset)
+            used++;
+    }
+    bci->data_size = (int64_t)c->nb_entries * c->cluster_size;
+    bci->data_used = (int64_t)used * c->cluster_size;
+    bci->data_hits = c->hits;
+    bci->data_misses = c->misses;
+    bci->data_prefetched = c->prefetched;
+    INFLATE_UNLOCK(c);
+}
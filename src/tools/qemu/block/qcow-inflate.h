@@ -0,0 +1,35 @@
+/*
+ * Decompressed cluster cache for the qcow and qcow2 formats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ */
+#ifndef BLOCK_QCOW_INFLATE_H
+#define BLOCK_QCOW_INFLATE_H
+
+#include "block_int.h"
+
+/* default memory budget of the cache and the fewest clusters it holds */
+#define QCOW_INFLATE_DEFAULT_BUDGET (4 * 1024 * 1024)
+#define QCOW_INFLATE_MIN_CLUSTERS 4
+
+/* most worker threads started by default */
+#define QCOW_INFLATE_MAX_THREADS 8
+
+typedef struct QCowInflateCache QCowInflateCache;
+
+/* threads < 0 starts one worker per online CPU (none on a single CPU) */
+QCowInflateCache *qcow_inflate_new(int cluster_size, int64_t budget,
+                                   int threads);
+void qcow_inflate_delete(QCowInflateCache *c);
+void qcow_inflate_reset(QCowInflateCache *c);
+
+uint8_t *qcow_inflate_get(QCowInflateCache *c, BlockDriverState *hd,
+                          uint64_t coffset, int csize);
+int qcow_inflate_ahead(QCowInflateCache *c);
+void qcow_inflate_prefetch(QCowInflateCache *c, BlockDriverState *hd,
+                           uint64_t coffset, int csize);
+
+void qcow_inflate_get_info(QCowInflateCache *c, BlockCacheInfo *bci);
+
+#endif
@@ -26,6 +26,7 @@
 #include "module.h"
 #include <zlib.h>
 #include "aes.h"
+#include "block/qcow-inflate.h"
 
 /**************************************************************/
 /* QEMU COW block driver with compression and encryption support */
@@ -67,16 +68,16 @@ typedef struct BDRVQcowState {
     uint64_t *l2_cache;
     uint64_t l2_cache_offsets[L2_CACHE_SIZE];
     uint32_t l2_cache_counts[L2_CACHE_SIZE];
-    uint8_t *cluster_cache;
+    QCowInflateCache *inflate;
+    int64_t inflate_next;
     uint8_t *cluster_data;
-    uint64_t cluster_cache_offset;
     uint32_t crypt_method; /* current crypt method, 0 if no key yet */
     uint32_t crypt_method_header;
     AES_KEY aes_encrypt_key;
     AES_KEY aes_decrypt_key;
 } BDRVQcowState;
 
-static int decompress_cluster(BDRVQcowState *s, uint64_t cluster_offset);
+static uint8_t *decompress_cluster(BDRVQcowState *s, uint64_t cluster_offset);
 
 static int qcow_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -145,13 +146,12 @@ static int qcow_open(BlockDriverState *bs, const char *filename, int flags)
     s->l2_cache = qemu_malloc(s->l2_size * L2_CACHE_SIZE * sizeof(uint64_t));
     if (!s->l2_cache)
         goto fail;
-    s->cluster_cache = qemu_malloc(s->cluster_size);
-    if (!s->cluster_cache)
-        goto fail;
     s->cluster_data = qemu_malloc(s->cluster_size);
     if (!s->cluster_data)
         goto fail;
-    s->cluster_cache_offset = -1;
+    s->inflate = qcow_inflate_new(s->cluster_size,
+                                  QCOW_INFLATE_DEFAULT_BUDGET, -1);
+    s->inflate_next = -1;
 
     /* read the backing file name */
     if (header.backing_file_offset != 0) {
@@ -167,7 +167,7 @@ static int qcow_open(BlockDriverState *bs, const char *filename, int flags)
  fail:
     qemu_free(s->l1_table);
     qemu_free(s->l2_cache);
-    qemu_free(s->cluster_cache);
+    qcow_inflate_delete(s->inflate);
     qemu_free(s->cluster_data);
     bdrv_delete(s->hd);
     return -1;
@@ -329,13 +329,14 @@ static uint64_t get_cluster_offset(BlockDriverState *bs,
             /* if the cluster is already compressed, we must
                decompress it in the case it is not completely
                overwritten */
-            if (decompress_cluster(s, cluster_offset) < 0)
+            uint8_t *data = decompress_cluster(s, cluster_offset);
+            if (!data)
                 return 0;
             cluster_offset = bdrv_getlength(s->hd);
             cluster_offset = (cluster_offset + s->cluster_size - 1) &
                 ~(s->cluster_size - 1);
             /* write the cluster content */
-            if (bdrv_pwrite(s->hd, cluster_offset, s->cluster_cache, s->cluster_size) !=
+            if (bdrv_pwrite(s->hd, cluster_offset, data, s->cluster_size) !=
                 s->cluster_size)
                 return -1;
         } else {
@@ -395,52 +396,47 @@ static int qcow_is_allocated(BlockDriverState *bs, int64_t sector_num,
     return (cluster_offset != 0);
 }
 
-static int decompress_buffer(uint8_t *out_buf, int out_buf_size,
-                             const uint8_t *buf, int buf_size)
+/* offset and size in the image file of a compressed cluster */
+static int compressed_size(BDRVQcowState *s, uint64_t cluster_offset,
+                           uint64_t *coffset)
 {
-    z_stream strm1, *strm = &strm1;
-    int ret, out_len;
-
-    memset(strm, 0, sizeof(*strm));
-
-    strm->next_in = (uint8_t *)buf;
-    strm->avail_in = buf_size;
-    strm->next_out = out_buf;
-    strm->avail_out = out_buf_size;
-
-    ret = inflateInit2(strm, -12);
-    if (ret != Z_OK)
-        return -1;
-    ret = inflate(strm, Z_FINISH);
-    out_len = strm->next_out - out_buf;
-    if ((ret != Z_STREAM_END && ret != Z_BUF_ERROR) ||
-        out_len != out_buf_size) {
-        inflateEnd(strm);
-        return -1;
-    }
-    inflateEnd(strm);
-    return 0;
+    *coffset = cluster_offset & s->cluster_offset_mask;
+    return (cluster_offset >> (63 - s->cluster_bits)) & (s->cluster_size - 1);
 }
 
-static int decompress_cluster(BDRVQcowState *s, uint64_t cluster_offset)
+static uint8_t *decompress_cluster(BDRVQcowState *s, uint64_t cluster_offset)
 {
-    int ret, csize;
     uint64_t coffset;
+    int csize;
 
-    coffset = cluster_offset & s->cluster_offset_mask;
-    if (s->cluster_cache_offset != coffset) {
-        csize = cluster_offset >> (63 - s->cluster_bits);
-        csize &= (s->cluster_size - 1);
-        ret = bdrv_pread(s->hd, coffset, s->cluster_data, csize);
-        if (ret != csize)
-            return -1;
-        if (decompress_buffer(s->cluster_cache, s->cluster_size,
-                              s->cluster_data, csize) < 0) {
-            return -1;
-        }
-        s->cluster_cache_offset = coffset;
+    csize = compressed_size(s, cluster_offset, &coffset);
+    return qcow_inflate_get(s->inflate, s->hd, coffset, csize);
+}
+
+/* start inflating the compressed clusters following a sequential read */
+static void inflate_ahead(BlockDriverState *bs, int64_t sector_num)
+{
+    BDRVQcowState *s = bs->opaque;
+    int64_t cluster = sector_num >> (s->cluster_bits - 9);
+    int64_t next = s->inflate_next;
+    uint64_t cluster_offset, coffset;
+    int i, csize, ahead;
+
+    s->inflate_next = cluster + 1;
+    if (cluster != next || (ahead = qcow_inflate_ahead(s->inflate)) == 0)
+        return;
+
+    for (i = 1; i <= ahead; i++) {
+        int64_t offset = (cluster + i) << s->cluster_bits;
+
+        if (offset >= bs->total_sectors * 512)
+            break;
+        cluster_offset = get_cluster_offset(bs, offset, 0, 0, 0, 0);
+        if (!(cluster_offset & QCOW_OFLAG_COMPRESSED))
+            break;
+        csize = compressed_size(s, cluster_offset, &coffset);
+        qcow_inflate_prefetch(s->inflate, s->hd, coffset, csize);
     }
-    return 0;
 }
 
 #if 0
@@ -468,9 +464,10 @@ static int qcow_read(BlockDriverState *bs, int64_t sector_num,
                 memset(buf, 0, 512 * n);
             }
         } else if (cluster_offset & QCOW_OFLAG_COMPRESSED) {
-            if (decompress_cluster(s, cluster_offset) < 0)
+            uint8_t *data = decompress_cluster(s, cluster_offset);
+            if (!data)
                 return -1;
-            memcpy(buf, s->cluster_cache + index_in_cluster * 512, 512 * n);
+            memcpy(buf, data + index_in_cluster * 512, 512 * n);
         } else {
             ret = bdrv_pread(s->hd, cluster_offset + index_in_cluster * 512, buf, n * 512);
             if (ret != n * 512)
@@ -601,10 +598,11 @@ static void qcow_aio_read_cb(void *opaque, int ret)
         }
     } else if (acb->cluster_offset & QCOW_OFLAG_COMPRESSED) {
         /* add AIO support for compressed blocks ? */
-        if (decompress_cluster(s, acb->cluster_offset) < 0)
+        uint8_t *data = decompress_cluster(s, acb->cluster_offset);
+        if (!data)
             goto done;
-        memcpy(acb->buf,
-               s->cluster_cache + index_in_cluster * 512, 512 * acb->n);
+        memcpy(acb->buf, data + index_in_cluster * 512, 512 * acb->n);
+        inflate_ahead(bs, acb->sector_num);
         goto redo;
     } else {
         if ((acb->cluster_offset & 511) != 0) {
@@ -721,7 +719,7 @@ static BlockDriverAIOCB *qcow_aio_writev(BlockDriverState *bs,
     BDRVQcowState *s = bs->opaque;
     QCowAIOCB *acb;
 
-    s->cluster_cache_offset = -1; /* disable compressed cache */
+    qcow_inflate_reset(s->inflate); /* disable compressed cache */
 
     acb = qcow_aio_setup(bs, sector_num, qiov, nb_sectors, cb, opaque, 1);
     if (!acb)
@@ -737,7 +735,7 @@ static void qcow_close(BlockDriverState *bs)
     BDRVQcowState *s = bs->opaque;
     qemu_free(s->l1_table);
     qemu_free(s->l2_cache);
-    qemu_free(s->cluster_cache);
+    qcow_inflate_delete(s->inflate);
     qemu_free(s->cluster_data);
     bdrv_delete(s->hd);
 }
@@ -848,6 +846,7 @@ static int qcow_write_compressed(BlockDriverState *bs, int64_t sector_num,
     if (nb_sectors != s->cluster_sectors)
         return -EINVAL;
 
+    qcow_inflate_reset(s->inflate);
     out_buf = qemu_malloc(s->cluster_size + (s->cluster_size / 1000) + 128);
     if (!out_buf)
         return -1;
@@ -907,6 +906,31 @@ static int qcow_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+static int qcow_get_cache_info(BlockDriverState *bs, BlockCacheInfo *bci)
+{
+    BDRVQcowState *s = bs->opaque;
+    int i;
+
+    bci->size = L2_CACHE_SIZE * s->l2_size * sizeof(uint64_t);
+    for (i = 0; i < L2_CACHE_SIZE; i++) {
+        if (s->l2_cache_offsets[i])
+            bci->used += s->l2_size * sizeof(uint64_t);
+    }
+    qcow_inflate_get_info(s->inflate, bci);
+    return 0;
+}
+
+static int qcow_set_data_cache(BlockDriverState *bs, int64_t size,
+                               int threads)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    qcow_inflate_delete(s->inflate);
+    s->inflate = qcow_inflate_new(s->cluster_size, size, threads);
+    s->inflate_next = -1;
+    return 0;
+}
+
 
 static QEMUOptionParameter qcow_create_options[] = {
     {
@@ -942,6 +966,8 @@ static BlockDriver bdrv_qcow = {
     .bdrv_aio_writev	= qcow_aio_writev,
     .bdrv_write_compressed = qcow_write_compressed,
     .bdrv_get_info	= qcow_get_info,
+    .bdrv_get_cache_info = qcow_get_cache_info,
+    .bdrv_set_data_cache = qcow_set_data_cache,
 
     .create_options = qcow_create_options,
 };
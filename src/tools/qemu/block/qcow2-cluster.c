@@ -87,31 +87,139 @@ int qcow2_grow_l1_table(BlockDriverState *bs, int min_size)
     return ret < 0 ? ret : -EIO;
 }
 
+/*
+ * The L2 cache holds whole L2 tables. Its size is set by a memory budget
+ * when the image is opened (see qcow2_set_cache_size()). Tables are found
+ * through a hash table on their offset and replaced with the CLOCK
+ * algorithm, so neither a lookup nor an eviction scans all entries.
+ */
+
+static inline uint32_t l2_cache_hash(BDRVQcowState *s, uint64_t l2_offset)
+{
+    uint64_t n = l2_offset >> s->cluster_bits;
+
+    return (uint32_t)((n * 0x9E3779B97F4A7C15ULL) >> 32) &
+        s->l2_cache_hash_mask;
+}
+
+/*
+ * qcow2_l2_cache_init
+ *
+ * Allocate an empty L2 cache of as many tables as fit into budget bytes
+ * (at least L2_CACHE_MIN_TABLES), replacing the current one.
+ */
+void qcow2_l2_cache_init(BlockDriverState *bs, int64_t budget)
+{
+    BDRVQcowState *s = bs->opaque;
+    int64_t table_size = s->l2_size * sizeof(uint64_t);
+    int64_t tables = budget / table_size;
+    uint32_t hash_size = 1;
+
+    if (tables < L2_CACHE_MIN_TABLES)
+        tables = L2_CACHE_MIN_TABLES;
+    if (tables > INT_MAX / 2)
+        tables = INT_MAX / 2;
+
+    /* at least two buckets per table keep the chains short */
+    while (hash_size < tables * 2)
+        hash_size <<= 1;
+
+    qcow2_l2_cache_free(bs);
+    s->l2_cache = qemu_malloc(tables * table_size);
+    s->l2_cache_offsets = qemu_malloc(tables * sizeof(uint64_t));
+    s->l2_cache_refs = qemu_malloc(tables);
+    s->l2_cache_next = qemu_malloc(tables * sizeof(int));
+    s->l2_cache_hash = qemu_malloc(hash_size * sizeof(int));
+    s->l2_cache_size = tables;
+    s->l2_cache_hash_mask = hash_size - 1;
+    qcow2_l2_cache_reset(bs);
+}
+
+void qcow2_l2_cache_free(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    qemu_free(s->l2_cache);
+    qemu_free(s->l2_cache_offsets);
+    qemu_free(s->l2_cache_refs);
+    qemu_free(s->l2_cache_next);
+    qemu_free(s->l2_cache_hash);
+    s->l2_cache = NULL;
+    s->l2_cache_offsets = NULL;
+    s->l2_cache_refs = NULL;
+    s->l2_cache_next = NULL;
+    s->l2_cache_hash = NULL;
+    s->l2_cache_size = 0;
+}
+
 void qcow2_l2_cache_reset(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
 
-    memset(s->l2_cache, 0, s->l2_size * L2_CACHE_SIZE * sizeof(uint64_t));
-    memset(s->l2_cache_offsets, 0, L2_CACHE_SIZE * sizeof(uint64_t));
-    memset(s->l2_cache_counts, 0, L2_CACHE_SIZE * sizeof(uint32_t));
+    memset(s->l2_cache_offsets, 0, s->l2_cache_size * sizeof(uint64_t));
+    memset(s->l2_cache_refs, 0, s->l2_cache_size);
+    memset(s->l2_cache_next, 0xff, s->l2_cache_size * sizeof(int));
+    memset(s->l2_cache_hash, 0xff,
+           (s->l2_cache_hash_mask + 1) * sizeof(int));
+    s->l2_cache_used = 0;
+    s->l2_cache_hand = 0;
+}
+
+/* remove an entry from its hash chain */
+static void l2_cache_unlink(BDRVQcowState *s, int idx)
+{
+    int *prev = &s->l2_cache_hash[l2_cache_hash(s, s->l2_cache_offsets[idx])];
+
+    while (*prev != -1) {
+        if (*prev == idx) {
+            *prev = s->l2_cache_next[idx];
+            break;
+        }
+        prev = &s->l2_cache_next[*prev];
+    }
+    s->l2_cache_offsets[idx] = 0;
+    s->l2_cache_next[idx] = -1;
 }
 
-static inline int l2_cache_new_entry(BlockDriverState *bs)
+/*
+ * l2_cache_new_entry
+ *
+ * Pick the entry to load a new table into (an unused one or the first
+ * one the CLOCK hand finds without its reference bit) and remove it from
+ * the hash table. The caller fills it with l2_cache_link().
+ */
+static int l2_cache_new_entry(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
-    uint32_t min_count;
-    int min_index, i;
-
-    /* find a new entry in the least used one */
-    min_index = 0;
-    min_count = 0xffffffff;
-    for(i = 0; i < L2_CACHE_SIZE; i++) {
-        if (s->l2_cache_counts[i] < min_count) {
-            min_count = s->l2_cache_counts[i];
-            min_index = i;
+    int idx;
+
+    if (s->l2_cache_used < s->l2_cache_size)
+        return s->l2_cache_used++;
+
+    for(;;) {
+        idx = s->l2_cache_hand;
+        s->l2_cache_hand = (s->l2_cache_hand + 1) % s->l2_cache_size;
+
+        if (s->l2_cache_offsets[idx] == 0)
+            return idx;
+        if (s->l2_cache_refs[idx]) {
+            s->l2_cache_refs[idx] = 0;
+            continue;
         }
+        l2_cache_unlink(s, idx);
+        return idx;
     }
-    return min_index;
+}
+
+/* add the table at l2_offset that was loaded into entry idx */
+static void l2_cache_link(BDRVQcowState *s, int idx, uint64_t l2_offset)
+{
+    uint32_t h = l2_cache_hash(s, l2_offset);
+
+    s->l2_cache_offsets[idx] = l2_offset;
+    s->l2_cache_refs[idx] = 1;
+    s->l2_cache_next[idx] = s->l2_cache_hash[h];
+    s->l2_cache_hash[h] = idx;
 }
 
 /*
@@ -120,25 +228,21 @@ static inline int l2_cache_new_entry(BlockDriverState *bs)
  * seek l2_offset in the l2_cache table
  * if not found, return NULL,
  * if found,
- *   increments the l2 cache hit count of the entry,
- *   if counter overflow, divide by two all counters
+ *   sets the reference bit of the entry,
  *   return the pointer to the l2 cache entry
  *
  */
 
 static uint64_t *seek_l2_table(BDRVQcowState *s, uint64_t l2_offset)
 {
-    int i, j;
+    int i;
 
-    for(i = 0; i < L2_CACHE_SIZE; i++) {
+    for (i = s->l2_cache_hash[l2_cache_hash(s, l2_offset)]; i != -1;
+         i = s->l2_cache_next[i]) {
         if (l2_offset == s->l2_cache_offsets[i]) {
-            /* increment the hit count */
-            if (++s->l2_cache_counts[i] == 0xffffffff) {
-                for(j = 0; j < L2_CACHE_SIZE; j++) {
-                    s->l2_cache_counts[j] >>= 1;
-                }
-            }
-            return s->l2_cache + (i << s->l2_bits);
+            s->l2_cache_refs[i] = 1;
+            s->l2_cache_hits++;
+            return s->l2_cache + ((int64_t)i << s->l2_bits);
         }
     }
     return NULL;
@@ -168,17 +272,65 @@ static uint64_t *l2_load(BlockDriverState *bs, uint64_t l2_offset)
 
     /* not found: load a new entry in the least used one */
 
+    s->l2_cache_misses++;
     min_index = l2_cache_new_entry(bs);
-    l2_table = s->l2_cache + (min_index << s->l2_bits);
+    l2_table = s->l2_cache + ((int64_t)min_index << s->l2_bits);
     if (bdrv_pread(s->hd, l2_offset, l2_table, s->l2_size * sizeof(uint64_t)) !=
         s->l2_size * sizeof(uint64_t))
         return NULL;
-    s->l2_cache_offsets[min_index] = l2_offset;
-    s->l2_cache_counts[min_index] = 1;
+    l2_cache_link(s, min_index, l2_offset);
 
     return l2_table;
 }
 
+static int l2_offset_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * qcow2_l2_prefetch
+ *
+ * Load the L2 tables of the active L1 table into the cache, in the order
+ * of their offsets in the image file, so that a scan of the whole disk
+ * does not read a table before each data cluster. The cache keeps its
+ * budget: if it holds fewer tables, only the first ones are loaded.
+ *
+ * Returns the number of tables loaded, or -errno on failure.
+ */
+int qcow2_l2_prefetch(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t *offsets;
+    int i, n = 0, ret = 0;
+
+    if (s->l1_size == 0)
+        return 0;
+
+    offsets = qemu_malloc(s->l1_size * sizeof(uint64_t));
+    for (i = 0; i < s->l1_size; i++) {
+        uint64_t l2_offset = s->l1_table[i] & ~QCOW_OFLAG_COPIED;
+        if (l2_offset)
+            offsets[n++] = l2_offset;
+    }
+    qsort(offsets, n, sizeof(uint64_t), l2_offset_cmp);
+
+    if (n > s->l2_cache_size)
+        n = s->l2_cache_size;
+
+    for (i = 0; i < n; i++) {
+        if (l2_load(bs, offsets[i]) == NULL) {
+            ret = -EIO;
+            break;
+        }
+    }
+
+    qemu_free(offsets);
+    return ret < 0 ? ret : n;
+}
+
 /*
  * Writes one sector of the L1 table to the disk (can't update single entries
  * and we really don't want bdrv_pread to perform a read-modify-write)
@@ -241,7 +393,7 @@ static uint64_t *l2_allocate(BlockDriverState *bs, int l1_index)
     /* allocate a new entry in the l2 cache */
 
     min_index = l2_cache_new_entry(bs);
-    l2_table = s->l2_cache + (min_index << s->l2_bits);
+    l2_table = s->l2_cache + ((int64_t)min_index << s->l2_bits);
 
     if (old_l2_offset == 0) {
         /* if there was no old l2 table, clear the new table */
@@ -261,8 +413,7 @@ static uint64_t *l2_allocate(BlockDriverState *bs, int l1_index)
 
     /* update the l2 cache entry */
 
-    s->l2_cache_offsets[min_index] = l2_offset;
-    s->l2_cache_counts[min_index] = 1;
+    l2_cache_link(s, min_index, l2_offset);
 
     return l2_table;
 }
@@ -343,9 +494,11 @@ static int qcow_read(BlockDriverState *bs, int64_t sector_num,
                 memset(buf, 0, 512 * n);
             }
         } else if (cluster_offset & QCOW_OFLAG_COMPRESSED) {
-            if (qcow2_decompress_cluster(s, cluster_offset) < 0)
+            uint8_t *data = qcow2_decompress_cluster(bs, cluster_offset);
+            if (!data)
                 return -1;
-            memcpy(buf, s->cluster_cache + index_in_cluster * 512, 512 * n);
+            memcpy(buf, data + index_in_cluster * 512, 512 * n);
+            qcow2_inflate_ahead(bs, sector_num);
         } else {
             ret = bdrv_pread(s->hd, cluster_offset + index_in_cluster * 512, buf, n * 512);
             if (ret != n * 512)
@@ -829,52 +982,62 @@ out:
     return 0;
 }
 
-static int decompress_buffer(uint8_t *out_buf, int out_buf_size,
-                             const uint8_t *buf, int buf_size)
+/* offset and size in the image file of a compressed cluster */
+static int compressed_size(BDRVQcowState *s, uint64_t cluster_offset,
+                           uint64_t *coffset)
 {
-    z_stream strm1, *strm = &strm1;
-    int ret, out_len;
+    int nb_csectors;
 
-    memset(strm, 0, sizeof(*strm));
+    *coffset = cluster_offset & s->cluster_offset_mask;
+    nb_csectors = ((cluster_offset >> s->csize_shift) & s->csize_mask) + 1;
+    return nb_csectors * 512 - (*coffset & 511);
+}
 
-    strm->next_in = (uint8_t *)buf;
-    strm->avail_in = buf_size;
-    strm->next_out = out_buf;
-    strm->avail_out = out_buf_size;
+/*
+ * qcow2_decompress_cluster
+ *
+ * Returns the inflated data of a compressed cluster, valid until the next
+ * call, or NULL on error.
+ */
+uint8_t *qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t coffset;
+    int csize;
 
-    ret = inflateInit2(strm, -12);
-    if (ret != Z_OK)
-        return -1;
-    ret = inflate(strm, Z_FINISH);
-    out_len = strm->next_out - out_buf;
-    if ((ret != Z_STREAM_END && ret != Z_BUF_ERROR) ||
-        out_len != out_buf_size) {
-        inflateEnd(strm);
-        return -1;
-    }
-    inflateEnd(strm);
-    return 0;
+    csize = compressed_size(s, cluster_offset, &coffset);
+    return qcow_inflate_get(s->inflate, s->hd, coffset, csize);
 }
 
-int qcow2_decompress_cluster(BDRVQcowState *s, uint64_t cluster_offset)
+/*
+ * qcow2_inflate_ahead
+ *
+ * Called after the compressed cluster at sector_num was read. If it
+ * follows the previous one, start inflating the compressed clusters after
+ * it on the worker threads.
+ */
+void qcow2_inflate_ahead(BlockDriverState *bs, int64_t sector_num)
 {
-    int ret, csize, nb_csectors, sector_offset;
-    uint64_t coffset;
+    BDRVQcowState *s = bs->opaque;
+    int64_t cluster = sector_num >> (s->cluster_bits - 9);
+    int64_t next = s->inflate_next;
+    uint64_t cluster_offset, coffset;
+    int i, n, csize, ahead;
 
-    coffset = cluster_offset & s->cluster_offset_mask;
-    if (s->cluster_cache_offset != coffset) {
-        nb_csectors = ((cluster_offset >> s->csize_shift) & s->csize_mask) + 1;
-        sector_offset = coffset & 511;
-        csize = nb_csectors * 512 - sector_offset;
-        ret = bdrv_read(s->hd, coffset >> 9, s->cluster_data, nb_csectors);
-        if (ret < 0) {
-            return -1;
-        }
-        if (decompress_buffer(s->cluster_cache, s->cluster_size,
-                              s->cluster_data + sector_offset, csize) < 0) {
-            return -1;
-        }
-        s->cluster_cache_offset = coffset;
+    s->inflate_next = cluster + 1;
+    if (cluster != next || (ahead = qcow_inflate_ahead(s->inflate)) == 0)
+        return;
+
+    for (i = 1; i <= ahead; i++) {
+        int64_t offset = (cluster + i) << s->cluster_bits;
+
+        if (offset >= bs->total_sectors * 512)
+            break;
+        n = s->cluster_sectors;
+        cluster_offset = qcow2_get_cluster_offset(bs, offset, &n);
+        if (!(cluster_offset & QCOW_OFLAG_COMPRESSED))
+            break;
+        csize = compressed_size(s, cluster_offset, &coffset);
+        qcow_inflate_prefetch(s->inflate, s->hd, coffset, csize);
     }
-    return 0;
 }
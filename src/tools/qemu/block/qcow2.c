@@ -210,12 +210,13 @@ static int qcow_open(BlockDriverState *bs, const char *filename, int flags)
         }
     }
     /* alloc L2 cache */
-    s->l2_cache = qemu_malloc(s->l2_size * L2_CACHE_SIZE * sizeof(uint64_t));
-    s->cluster_cache = qemu_malloc(s->cluster_size);
+    qcow2_l2_cache_init(bs, L2_CACHE_DEFAULT_BUDGET);
     /* one more sector for decompressed data alignment */
     s->cluster_data = qemu_malloc(QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size
                                   + 512);
-    s->cluster_cache_offset = -1;
+    s->inflate = qcow_inflate_new(s->cluster_size,
+                                  QCOW_INFLATE_DEFAULT_BUDGET, -1);
+    s->inflate_next = -1;
 
     if (qcow2_refcount_init(bs) < 0)
         goto fail;
@@ -251,8 +252,8 @@ static int qcow_open(BlockDriverState *bs, const char *filename, int flags)
     qcow2_free_snapshots(bs);
     qcow2_refcount_close(bs);
     qemu_free(s->l1_table);
-    qemu_free(s->l2_cache);
-    qemu_free(s->cluster_cache);
+    qcow2_l2_cache_free(bs);
+    qcow_inflate_delete(s->inflate);
     qemu_free(s->cluster_data);
     bdrv_delete(s->hd);
     return -1;
@@ -448,10 +449,11 @@ static void qcow_aio_read_cb(void *opaque, int ret)
         }
     } else if (acb->cluster_offset & QCOW_OFLAG_COMPRESSED) {
         /* add AIO support for compressed blocks ? */
-        if (qcow2_decompress_cluster(s, acb->cluster_offset) < 0)
+        uint8_t *data = qcow2_decompress_cluster(bs, acb->cluster_offset);
+        if (!data)
             goto done;
-        memcpy(acb->buf,
-               s->cluster_cache + index_in_cluster * 512, 512 * acb->n);
+        memcpy(acb->buf, data + index_in_cluster * 512, 512 * acb->n);
+        qcow2_inflate_ahead(bs, acb->sector_num);
         ret = qcow_schedule_bh(qcow_aio_read_bh, acb);
         if (ret < 0)
             goto done;
@@ -647,7 +649,7 @@ static BlockDriverAIOCB *qcow_aio_writev(BlockDriverState *bs,
     BDRVQcowState *s = bs->opaque;
     QCowAIOCB *acb;
 
-    s->cluster_cache_offset = -1; /* disable compressed cache */
+    qcow_inflate_reset(s->inflate); /* disable compressed cache */
 
     acb = qcow_aio_setup(bs, sector_num, qiov, nb_sectors, cb, opaque, 1);
     if (!acb)
@@ -661,8 +663,8 @@ static void qcow_close(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
     qemu_free(s->l1_table);
-    qemu_free(s->l2_cache);
-    qemu_free(s->cluster_cache);
+    qcow2_l2_cache_free(bs);
+    qcow_inflate_delete(s->inflate);
     qemu_free(s->cluster_data);
     qcow2_refcount_close(bs);
     bdrv_delete(s->hd);
@@ -970,6 +972,7 @@ static int qcow_write_compressed(BlockDriverState *bs, int64_t sector_num,
     if (nb_sectors != s->cluster_sectors)
         return -EINVAL;
 
+    qcow_inflate_reset(s->inflate);
     out_buf = qemu_malloc(s->cluster_size + (s->cluster_size / 1000) + 128);
 
     /* best compression, small window, no zlib header */
@@ -1123,6 +1126,43 @@ static QEMUOptionParameter qcow_create_options[] = {
     { NULL }
 };
 
+static int qcow_set_cache_size(BlockDriverState *bs, int64_t size)
+{
+    qcow2_l2_cache_init(bs, size);
+    return 0;
+}
+
+static int qcow_prefetch_metadata(BlockDriverState *bs)
+{
+    int ret = qcow2_l2_prefetch(bs);
+
+    return ret < 0 ? ret : 0;
+}
+
+static int qcow_get_cache_info(BlockDriverState *bs, BlockCacheInfo *bci)
+{
+    BDRVQcowState *s = bs->opaque;
+    int64_t table_size = s->l2_size * sizeof(uint64_t);
+
+    bci->size = s->l2_cache_size * table_size;
+    bci->used = s->l2_cache_used * table_size;
+    bci->hits = s->l2_cache_hits;
+    bci->misses = s->l2_cache_misses;
+    qcow_inflate_get_info(s->inflate, bci);
+    return 0;
+}
+
+static int qcow_set_data_cache(BlockDriverState *bs, int64_t size,
+                               int threads)
+{
+    BDRVQcowState *s = bs->opaque;
+
+    qcow_inflate_delete(s->inflate);
+    s->inflate = qcow_inflate_new(s->cluster_size, size, threads);
+    s->inflate_next = -1;
+    return 0;
+}
+
 static BlockDriver bdrv_qcow2 = {
     .format_name	= "qcow2",
     .instance_size	= sizeof(BDRVQcowState),
@@ -1145,6 +1185,11 @@ static BlockDriver bdrv_qcow2 = {
     .bdrv_snapshot_list     = qcow2_snapshot_list,
     .bdrv_get_info	= qcow_get_info,
 
+    .bdrv_set_cache_size    = qcow_set_cache_size,
+    .bdrv_prefetch_metadata = qcow_prefetch_metadata,
+    .bdrv_get_cache_info    = qcow_get_cache_info,
+    .bdrv_set_data_cache    = qcow_set_data_cache,
+
     .bdrv_save_vmstate    = qcow_save_vmstate,
     .bdrv_load_vmstate    = qcow_load_vmstate,
 
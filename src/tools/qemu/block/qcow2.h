@@ -26,6 +26,7 @@
 #define BLOCK_QCOW2_H
 
 #include "aes.h"
+#include "block/qcow-inflate.h"
 
 //#define DEBUG_ALLOC
 //#define DEBUG_ALLOC2
@@ -49,7 +50,10 @@
 #define MIN_CLUSTER_BITS 9
 #define MAX_CLUSTER_BITS 21
 
-#define L2_CACHE_SIZE 16
+/* default memory budget of the L2 table cache and the fewest tables it
+ * holds (see qcow2_set_cache_size()) */
+#define L2_CACHE_DEFAULT_BUDGET (4 * 1024 * 1024)
+#define L2_CACHE_MIN_TABLES 16
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -93,11 +97,19 @@ typedef struct BDRVQcowState {
     uint64_t l1_table_offset;
     uint64_t *l1_table;
     uint64_t *l2_cache;
-    uint64_t l2_cache_offsets[L2_CACHE_SIZE];
-    uint32_t l2_cache_counts[L2_CACHE_SIZE];
-    uint8_t *cluster_cache;
+    int l2_cache_size;          /* number of tables in l2_cache */
+    int l2_cache_used;          /* entries handed out so far */
+    int l2_cache_hand;          /* CLOCK hand */
+    uint64_t *l2_cache_offsets; /* offset of the table in each entry (0 if unused) */
+    uint8_t *l2_cache_refs;     /* CLOCK reference bits */
+    int *l2_cache_next;         /* next entry in the hash chain (-1 at end) */
+    int *l2_cache_hash;         /* first entry of each chain (-1 if empty) */
+    uint32_t l2_cache_hash_mask;
+    uint64_t l2_cache_hits;
+    uint64_t l2_cache_misses;
+    QCowInflateCache *inflate;  /* inflated compressed clusters */
+    int64_t inflate_next;       /* cluster after the last compressed one read */
     uint8_t *cluster_data;
-    uint64_t cluster_cache_offset;
     QLIST_HEAD(QCowClusterAlloc, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -183,8 +195,12 @@ int qcow2_check_refcounts(BlockDriverState *bs);
 
 /* qcow2-cluster.c functions */
 int qcow2_grow_l1_table(BlockDriverState *bs, int min_size);
+void qcow2_l2_cache_init(BlockDriverState *bs, int64_t budget);
+void qcow2_l2_cache_free(BlockDriverState *bs);
 void qcow2_l2_cache_reset(BlockDriverState *bs);
-int qcow2_decompress_cluster(BDRVQcowState *s, uint64_t cluster_offset);
+int qcow2_l2_prefetch(BlockDriverState *bs);
+uint8_t *qcow2_decompress_cluster(BlockDriverState *bs, uint64_t cluster_offset);
+void qcow2_inflate_ahead(BlockDriverState *bs, int64_t sector_num);
 void qcow2_encrypt_sectors(BDRVQcowState *s, int64_t sector_num,
                      uint8_t *out_buf, const uint8_t *in_buf,
                      int nb_sectors, int enc,
@@ -60,8 +60,28 @@ typedef struct {
 
 #define L2_CACHE_SIZE 16
 
-typedef struct BDRVVmdkState {
-    BlockDriverState *hd;
+/* default budget for the grain tables loaded at open */
+#define VMDK_PRELOAD_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+/* largest run of adjacent grain tables read at once */
+#define VMDK_LOAD_CHUNK (1024 * 1024)
+
+/*
+ * An image is a list of extents laid end to end: the single sparse file
+ * of a monolithicSparse image, or the sparse, flat and zero extents
+ * listed by a descriptor file (twoGbMaxExtentSparse/Flat, monolithicFlat,
+ * vmfs). The grain tables of sparse extents are loaded at open into one
+ * map per extent when they fit into the budget, and read through a small
+ * cache otherwise.
+ */
+typedef struct VmdkExtent {
+    BlockDriverState *file;
+    int flat;                   /* data at flat_offset, no grain tables */
+    int zero;                   /* no data, reads as zeroes */
+    int64_t flat_offset;
+    int64_t start_sector;       /* first sector of the extent in the disk */
+    int64_t end_sector;         /* first sector after it */
+
     int64_t l1_table_offset;
     int64_t l1_backup_table_offset;
     uint32_t *l1_table;
@@ -74,7 +94,24 @@ typedef struct BDRVVmdkState {
     uint32_t l2_cache_offsets[L2_CACHE_SIZE];
     uint32_t l2_cache_counts[L2_CACHE_SIZE];
 
+    /* all grain tables in host order (l1_size * l2_size entries), or
+       NULL if they are read through l2_cache */
+    uint32_t *grains;
+
     unsigned int cluster_sectors;
+} VmdkExtent;
+
+typedef struct BDRVVmdkState {
+    BlockDriverState *hd;       /* sparse file or descriptor file */
+    int64_t desc_offset;
+    VmdkExtent *extents;
+    int nb_extents;
+    int last_extent;            /* extent of the last lookup */
+
+    int64_t preload_budget;
+    uint64_t l2_hits;
+    uint64_t l2_misses;
+
     uint32_t parent_cid;
     int is_parent;
 } BDRVVmdkState;
@@ -87,13 +124,7 @@ typedef struct VmdkMetaData {
     int valid;
 } VmdkMetaData;
 
-typedef struct ActiveBDRVState{
-    BlockDriverState *hd;            // active image handler
-    uint64_t cluster_offset;         // current write offset
-}ActiveBDRVState;
-
-static ActiveBDRVState activeBDRV;
-
+#define DESC_MAGIC "# Disk DescriptorFile"
 
 static int vmdk_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -105,26 +136,41 @@ static int vmdk_probe(const uint8_t *buf, int buf_size, const char *filename)
     if (magic == VMDK3_MAGIC ||
         magic == VMDK4_MAGIC)
         return 100;
-    else
-        return 0;
+    if (buf_size >= sizeof(DESC_MAGIC) - 1 &&
+        !memcmp(buf, DESC_MAGIC, sizeof(DESC_MAGIC) - 1))
+        return 100;
+    return 0;
 }
 
 #define CHECK_CID 1
 
 #define SECTOR_SIZE 512
 #define DESC_SIZE 20*SECTOR_SIZE	// 20 sectors of 512 bytes each
+#define DESC_MAX (1024*1024)		// largest descriptor file
 #define HEADER_SIZE 512   			// first sector of 512 bytes
 
-static uint32_t vmdk_read_cid(BlockDriverState *bs, int parent)
+/* Read the descriptor (at most DESC_SIZE bytes) into desc, which has room
+   for DESC_SIZE + 1 bytes. Returns the number of bytes read or -1. */
+static int vmdk_read_desc(BlockDriverState *bs, char *desc)
 {
     BDRVVmdkState *s = bs->opaque;
-    char desc[DESC_SIZE];
-    uint32_t cid;
+    int ret;
+
+    ret = bdrv_pread(s->hd, s->desc_offset, desc, DESC_SIZE);
+    if (ret <= 0)
+        return -1;
+    desc[ret] = '\0';
+    return ret;
+}
+
+static uint32_t vmdk_read_cid(BlockDriverState *bs, int parent)
+{
+    char desc[DESC_SIZE + 1];
+    uint32_t cid = 0;
     const char *p_name, *cid_str;
     size_t cid_str_size;
 
-    /* the descriptor offset = 0x200 */
-    if (bdrv_pread(s->hd, 0x200, desc, DESC_SIZE) != DESC_SIZE)
+    if (vmdk_read_desc(bs, desc) < 0)
         return 0;
 
     if (parent) {
@@ -146,14 +192,16 @@ static uint32_t vmdk_read_cid(BlockDriverState *bs, int parent)
 static int vmdk_write_cid(BlockDriverState *bs, uint32_t cid)
 {
     BDRVVmdkState *s = bs->opaque;
-    char desc[DESC_SIZE], tmp_desc[DESC_SIZE];
+    char desc[DESC_SIZE + 1], tmp_desc[DESC_SIZE + 1];
     char *p_name, *tmp_str;
+    int len;
 
-    /* the descriptor offset = 0x200 */
-    if (bdrv_pread(s->hd, 0x200, desc, DESC_SIZE) != DESC_SIZE)
+    if ((len = vmdk_read_desc(bs, desc)) < 0)
         return -1;
 
     tmp_str = strstr(desc,"parentCID");
+    if (tmp_str == NULL)
+        return -1;
     pstrcpy(tmp_desc, sizeof(tmp_desc), tmp_str);
     if ((p_name = strstr(desc,"CID")) != NULL) {
         p_name += sizeof("CID");
@@ -161,7 +209,14 @@ static int vmdk_write_cid(BlockDriverState *bs, uint32_t cid)
         pstrcat(desc, sizeof(desc), tmp_desc);
     }
 
-    if (bdrv_pwrite(s->hd, 0x200, desc, DESC_SIZE) != DESC_SIZE)
+    /* a descriptor file holds the descriptor only */
+    if (s->desc_offset == 0) {
+        len = strlen(desc);
+        if (bdrv_pwrite(s->hd, 0, desc, len) != len)
+            return -1;
+        return bdrv_truncate(s->hd, len);
+    }
+    if (bdrv_pwrite(s->hd, s->desc_offset, desc, len) != len)
         return -1;
     return 0;
 }
@@ -313,6 +368,7 @@ static int vmdk_snapshot_create(const char *filename, const char *backing_file)
     return -1;
 }
 
+
 static void vmdk_parent_close(BlockDriverState *bs)
 {
     if (bs->backing_hd)
@@ -324,11 +380,10 @@ static int vmdk_parent_open(BlockDriverState *bs, const char * filename)
 {
     BDRVVmdkState *s = bs->opaque;
     char *p_name;
-    char desc[DESC_SIZE];
+    char desc[DESC_SIZE + 1];
     char parent_img_name[1024];
 
-    /* the descriptor offset = 0x200 */
-    if (bdrv_pread(s->hd, 0x200, desc, DESC_SIZE) != DESC_SIZE)
+    if (vmdk_read_desc(bs, desc) < 0)
         return -1;
 
     if ((p_name = strstr(desc,"parentFileNameHint")) != NULL) {
@@ -365,11 +420,241 @@ static int vmdk_parent_open(BlockDriverState *bs, const char * filename)
     return 0;
 }
 
+/* Read the header and the grain directories of a sparse extent. The size
+   of the extent is taken from the header unless the descriptor gave it. */
+static int vmdk_open_sparse(VmdkExtent *e)
+{
+    uint32_t magic;
+    int l1_size, i;
+
+    if (bdrv_pread(e->file, 0, &magic, sizeof(magic)) != sizeof(magic))
+        return -1;
+
+    magic = be32_to_cpu(magic);
+    if (magic == VMDK3_MAGIC) {
+        VMDK3Header header;
+
+        if (bdrv_pread(e->file, sizeof(magic), &header, sizeof(header)) != sizeof(header))
+            return -1;
+        e->cluster_sectors = le32_to_cpu(header.granularity);
+        e->l2_size = 1 << 9;
+        e->l1_size = 1 << 6;
+        if (e->end_sector == e->start_sector)
+            e->end_sector += le32_to_cpu(header.disk_sectors);
+        e->l1_table_offset = le32_to_cpu(header.l1dir_offset) << 9;
+        e->l1_backup_table_offset = 0;
+        e->l1_entry_sectors = e->l2_size * e->cluster_sectors;
+    } else if (magic == VMDK4_MAGIC) {
+        VMDK4Header header;
+        int64_t capacity;
+
+        if (bdrv_pread(e->file, sizeof(magic), &header, sizeof(header)) != sizeof(header))
+            return -1;
+        capacity = le64_to_cpu(header.capacity);
+        if (e->end_sector == e->start_sector)
+            e->end_sector += capacity;
+        e->cluster_sectors = le64_to_cpu(header.granularity);
+        e->l2_size = le32_to_cpu(header.num_gtes_per_gte);
+        e->l1_entry_sectors = e->l2_size * e->cluster_sectors;
+        if (e->l1_entry_sectors <= 0)
+            return -1;
+        e->l1_size = (capacity + e->l1_entry_sectors - 1)
+            / e->l1_entry_sectors;
+        e->l1_table_offset = le64_to_cpu(header.rgd_offset) << 9;
+        e->l1_backup_table_offset = le64_to_cpu(header.gd_offset) << 9;
+    } else {
+        return -1;
+    }
+    if (e->cluster_sectors == 0)
+        return -1;
+
+    /* read the L1 table */
+    l1_size = e->l1_size * sizeof(uint32_t);
+    e->l1_table = qemu_malloc(l1_size);
+    if (bdrv_pread(e->file, e->l1_table_offset, e->l1_table, l1_size) != l1_size)
+        return -1;
+    for(i = 0; i < e->l1_size; i++) {
+        le32_to_cpus(&e->l1_table[i]);
+    }
+
+    if (e->l1_backup_table_offset) {
+        e->l1_backup_table = qemu_malloc(l1_size);
+        if (bdrv_pread(e->file, e->l1_backup_table_offset, e->l1_backup_table, l1_size) != l1_size)
+            return -1;
+        for(i = 0; i < e->l1_size; i++) {
+            le32_to_cpus(&e->l1_backup_table[i]);
+        }
+    }
+    return 0;
+}
+
+static VmdkExtent *vmdk_add_extent(BlockDriverState *bs)
+{
+    BDRVVmdkState *s = bs->opaque;
+    VmdkExtent *e;
+
+    s->extents = qemu_realloc(s->extents,
+                              (s->nb_extents + 1) * sizeof(VmdkExtent));
+    e = &s->extents[s->nb_extents++];
+    memset(e, 0, sizeof(*e));
+    e->start_sector = e->end_sector = s->nb_extents > 1 ? e[-1].end_sector : 0;
+    return e;
+}
+
+/* Open the extents listed in a descriptor file, e.g.
+ *   RW 4192256 SPARSE "disk-s001.vmdk"
+ *   RW 8388608 FLAT "disk-flat.vmdk" 0
+ *   RW 1024 ZERO
+ */
+static int vmdk_open_desc(BlockDriverState *bs, const char *filename,
+                          int flags)
+{
+    BDRVVmdkState *s = bs->opaque;
+    char *desc, *line, *next, *p;
+    int64_t length;
+    int ret = -1;
+
+    length = bdrv_getlength(s->hd);
+    if (length <= 0 || length > DESC_MAX)
+        return -1;
+    desc = qemu_malloc(length + 1);
+    if (bdrv_pread(s->hd, 0, desc, length) != length)
+        goto fail;
+    desc[length] = '\0';
+
+    for (line = desc; line != NULL; line = next) {
+        char access[16], type[16], fname[1024], path[1024];
+        int64_t sectors;
+        VmdkExtent *e;
+        int pos;
+
+        if ((next = strchr(line, '\n')) != NULL)
+            *next++ = '\0';
+        if (sscanf(line, "%15s%n", access, &pos) != 1 ||
+            (strcmp(access, "RW") && strcmp(access, "RDONLY") &&
+             strcmp(access, "NOACCESS")))
+            continue;
+        p = line + pos;
+        sectors = strtoll(p, &p, 10);
+        if (sectors <= 0 || sscanf(p, "%15s%n", type, &pos) != 1)
+            goto fail;
+        p += pos;
+
+        e = vmdk_add_extent(bs);
+        e->end_sector += sectors;
+        if (!strcmp(type, "ZERO") || !strcmp(access, "NOACCESS")) {
+            e->zero = 1;
+            continue;
+        }
+
+        if (sscanf(p, " \"%1023[^\"]\"%n", fname, &pos) != 1)
+            goto fail;
+        path_combine(path, sizeof(path), filename, fname);
+        if (bdrv_file_open(&e->file, path, flags) < 0)
+            goto fail;
+
+        if (!strcmp(type, "FLAT") || !strcmp(type, "VMFS")) {
+            e->flat = 1;
+            e->flat_offset = strtoll(p + pos, NULL, 10) * 512;
+        } else if (!strcmp(type, "SPARSE") || !strcmp(type, "VMFSSPARSE")) {
+            if (vmdk_open_sparse(e) < 0)
+                goto fail;
+        } else {
+            /* streamOptimized and SESparse extents are not supported */
+            goto fail;
+        }
+    }
+    if (s->nb_extents > 0)
+        ret = 0;
+
+ fail:
+    qemu_free(desc);
+    return ret;
+}
+
+static void vmdk_free_extents(BlockDriverState *bs)
+{
+    BDRVVmdkState *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < s->nb_extents; i++) {
+        VmdkExtent *e = &s->extents[i];
+
+        qemu_free(e->l1_table);
+        qemu_free(e->l1_backup_table);
+        qemu_free(e->l2_cache);
+        qemu_free(e->grains);
+        if (e->file && e->file != s->hd)
+            bdrv_delete(e->file);
+    }
+    qemu_free(s->extents);
+    s->extents = NULL;
+    s->nb_extents = 0;
+}
+
+/* Load all grain tables of a sparse extent into its grain map. Tables
+   that follow each other in the file are read at once. */
+static int vmdk_load_grains(VmdkExtent *e)
+{
+    unsigned int table_size = e->l2_size * sizeof(uint32_t);
+    unsigned int i, j, len;
+    uint64_t k, nb_grains = (uint64_t)e->l1_size * e->l2_size;
+
+    e->grains = qemu_mallocz(nb_grains * sizeof(uint32_t));
+    for (i = 0; i < e->l1_size; i = j) {
+        j = i + 1;
+        if (!e->l1_table[i])
+            continue;
+        while (j < e->l1_size && (table_size & 511) == 0 &&
+               e->l1_table[j] == e->l1_table[j - 1] + table_size / 512 &&
+               (j - i) * table_size < VMDK_LOAD_CHUNK)
+            j++;
+        len = (j - i) * table_size;
+        if (bdrv_pread(e->file, (int64_t)e->l1_table[i] * 512,
+                       e->grains + (uint64_t)i * e->l2_size, len) != len) {
+            qemu_free(e->grains);
+            e->grains = NULL;
+            return -1;
+        }
+    }
+    for (k = 0; k < nb_grains; k++)
+        le32_to_cpus(&e->grains[k]);
+    return 0;
+}
+
+/* Load the grain tables of the sparse extents that fit into the budget,
+   or of all of them if force is set */
+static int vmdk_preload(BlockDriverState *bs, int force)
+{
+    BDRVVmdkState *s = bs->opaque;
+    int64_t used = 0, size;
+    int i, ret = 0;
+
+    for (i = 0; i < s->nb_extents; i++) {
+        VmdkExtent *e = &s->extents[i];
+
+        if (e->flat || e->zero)
+            continue;
+        size = (int64_t)e->l1_size * e->l2_size * sizeof(uint32_t);
+        if (!e->grains) {
+            if (!force && used + size > s->preload_budget)
+                continue;
+            if (vmdk_load_grains(e) < 0) {
+                ret = -EIO;
+                continue;
+            }
+        }
+        used += size;
+    }
+    return ret;
+}
+
 static int vmdk_open(BlockDriverState *bs, const char *filename, int flags)
 {
     BDRVVmdkState *s = bs->opaque;
+    VmdkExtent *e;
     uint32_t magic;
-    int l1_size, i, ret;
+    int ret;
 
     if (parent_open)
         // Parent must be opened as RO.
@@ -381,124 +666,154 @@ static int vmdk_open(BlockDriverState *bs, const char *filename, int flags)
     if (bdrv_pread(s->hd, 0, &magic, sizeof(magic)) != sizeof(magic))
         goto fail;
 
-    magic = be32_to_cpu(magic);
-    if (magic == VMDK3_MAGIC) {
-        VMDK3Header header;
-
-        if (bdrv_pread(s->hd, sizeof(magic), &header, sizeof(header)) != sizeof(header))
-            goto fail;
-        s->cluster_sectors = le32_to_cpu(header.granularity);
-        s->l2_size = 1 << 9;
-        s->l1_size = 1 << 6;
-        bs->total_sectors = le32_to_cpu(header.disk_sectors);
-        s->l1_table_offset = le32_to_cpu(header.l1dir_offset) << 9;
-        s->l1_backup_table_offset = 0;
-        s->l1_entry_sectors = s->l2_size * s->cluster_sectors;
-    } else if (magic == VMDK4_MAGIC) {
-        VMDK4Header header;
+    if (parent_open)
+        s->is_parent = 1;
+    else
+        s->is_parent = 0;
 
-        if (bdrv_pread(s->hd, sizeof(magic), &header, sizeof(header)) != sizeof(header))
+    magic = be32_to_cpu(magic);
+    if (magic == VMDK3_MAGIC || magic == VMDK4_MAGIC) {
+        /* the descriptor offset = 0x200 */
+        s->desc_offset = 0x200;
+        e = vmdk_add_extent(bs);
+        e->file = s->hd;
+        if (vmdk_open_sparse(e) < 0)
             goto fail;
-        bs->total_sectors = le64_to_cpu(header.capacity);
-        s->cluster_sectors = le64_to_cpu(header.granularity);
-        s->l2_size = le32_to_cpu(header.num_gtes_per_gte);
-        s->l1_entry_sectors = s->l2_size * s->cluster_sectors;
-        if (s->l1_entry_sectors <= 0)
+    } else {
+        s->desc_offset = 0;
+        if (vmdk_open_desc(bs, filename, flags) < 0)
             goto fail;
-        s->l1_size = (bs->total_sectors + s->l1_entry_sectors - 1)
-            / s->l1_entry_sectors;
-        s->l1_table_offset = le64_to_cpu(header.rgd_offset) << 9;
-        s->l1_backup_table_offset = le64_to_cpu(header.gd_offset) << 9;
-
-        if (parent_open)
-            s->is_parent = 1;
-        else
-            s->is_parent = 0;
+    }
+    bs->total_sectors = s->extents[s->nb_extents - 1].end_sector;
 
+    if (magic != VMDK3_MAGIC) {
         // try to open parent images, if exist
         if (vmdk_parent_open(bs, filename) != 0)
             goto fail;
         // write the CID once after the image creation
         s->parent_cid = vmdk_read_cid(bs,1);
-    } else {
-        goto fail;
-    }
-
-    /* read the L1 table */
-    l1_size = s->l1_size * sizeof(uint32_t);
-    s->l1_table = qemu_malloc(l1_size);
-    if (bdrv_pread(s->hd, s->l1_table_offset, s->l1_table, l1_size) != l1_size)
-        goto fail;
-    for(i = 0; i < s->l1_size; i++) {
-        le32_to_cpus(&s->l1_table[i]);
     }
 
-    if (s->l1_backup_table_offset) {
-        s->l1_backup_table = qemu_malloc(l1_size);
-        if (bdrv_pread(s->hd, s->l1_backup_table_offset, s->l1_backup_table, l1_size) != l1_size)
-            goto fail;
-        for(i = 0; i < s->l1_size; i++) {
-            le32_to_cpus(&s->l1_backup_table[i]);
-        }
-    }
-
-    s->l2_cache = qemu_malloc(s->l2_size * L2_CACHE_SIZE * sizeof(uint32_t));
+    s->preload_budget = VMDK_PRELOAD_DEFAULT_BUDGET;
+    vmdk_preload(bs, 0);
     return 0;
  fail:
-    qemu_free(s->l1_backup_table);
-    qemu_free(s->l1_table);
-    qemu_free(s->l2_cache);
+    vmdk_free_extents(bs);
     bdrv_delete(s->hd);
     return -1;
 }
 
-static uint64_t get_cluster_offset(BlockDriverState *bs, VmdkMetaData *m_data,
-                                   uint64_t offset, int allocate);
+/* Find the extent holding a sector, the one of the last lookup first */
+static VmdkExtent *vmdk_find_extent(BDRVVmdkState *s, int64_t sector_num)
+{
+    VmdkExtent *e = &s->extents[s->last_extent];
+    int lo = 0, hi = s->nb_extents - 1, mid;
+
+    if (sector_num >= e->start_sector && sector_num < e->end_sector)
+        return e;
+    if (sector_num < 0 || sector_num >= s->extents[hi].end_sector)
+        return NULL;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (s->extents[mid].end_sector <= sector_num)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    s->last_extent = lo;
+    return &s->extents[lo];
+}
 
-static int get_whole_cluster(BlockDriverState *bs, uint64_t cluster_offset,
-                             uint64_t offset, int allocate)
+/* Grain table holding l2_offset, read into the least used cache entry if
+   it is not cached */
+static uint32_t *l2_load(BDRVVmdkState *s, VmdkExtent *e, uint32_t l2_offset)
 {
-    uint64_t parent_cluster_offset;
-    BDRVVmdkState *s = bs->opaque;
-    uint8_t  whole_grain[s->cluster_sectors*512];        // 128 sectors * 512 bytes each = grain size 64KB
+    int min_index, i, j;
+    uint32_t min_count, *l2_table;
+
+    if (!e->l2_cache)
+        e->l2_cache = qemu_mallocz(e->l2_size * L2_CACHE_SIZE * sizeof(uint32_t));
+
+    for(i = 0; i < L2_CACHE_SIZE; i++) {
+        if (l2_offset == e->l2_cache_offsets[i]) {
+            /* increment the hit count */
+            if (++e->l2_cache_counts[i] == 0xffffffff) {
+                for(j = 0; j < L2_CACHE_SIZE; j++) {
+                    e->l2_cache_counts[j] >>= 1;
+                }
+            }
+            s->l2_hits++;
+            return e->l2_cache + (i * e->l2_size);
+        }
+    }
+    /* not found: load a new entry in the least used one */
+    min_index = 0;
+    min_count = 0xffffffff;
+    for(i = 0; i < L2_CACHE_SIZE; i++) {
+        if (e->l2_cache_counts[i] < min_count) {
+            min_count = e->l2_cache_counts[i];
+            min_index = i;
+        }
+    }
+    l2_table = e->l2_cache + (min_index * e->l2_size);
+    if (bdrv_pread(e->file, (int64_t)l2_offset * 512, l2_table, e->l2_size * sizeof(uint32_t)) !=
+                                                                        e->l2_size * sizeof(uint32_t))
+        return NULL;
+
+    s->l2_misses++;
+    e->l2_cache_offsets[min_index] = l2_offset;
+    e->l2_cache_counts[min_index] = 1;
+    return l2_table;
+}
+
+/* Sector of a grain in the grain map, 0 if it is not allocated */
+static uint32_t vmdk_grain(VmdkExtent *e, uint64_t grain)
+{
+    uint64_t l1_index = grain / e->l2_size;
+
+    if (l1_index >= e->l1_size || !e->l1_table[l1_index])
+        return 0;
+    return e->grains[grain];
+}
+
+static int get_whole_cluster(BlockDriverState *bs, VmdkExtent *e,
+                             uint64_t cluster_offset, uint64_t offset)
+{
+    int64_t sector_num, n;
+    uint8_t  whole_grain[e->cluster_sectors*512];        // 128 sectors * 512 bytes each = grain size 64KB
 
     // we will be here if it's first write on non-exist grain(cluster).
     // try to read from parent image, if exist
     if (bs->backing_hd) {
-        BDRVVmdkState *ps = bs->backing_hd->opaque;
-
         if (!vmdk_is_cid_valid(bs))
             return -1;
 
-        parent_cluster_offset = get_cluster_offset(bs->backing_hd, NULL,
-            offset, allocate);
-
-        if (parent_cluster_offset) {
-            BDRVVmdkState *act_s = activeBDRV.hd->opaque;
-
-            if (bdrv_pread(ps->hd, parent_cluster_offset, whole_grain, ps->cluster_sectors*512) != ps->cluster_sectors*512)
-                return -1;
+        sector_num = e->start_sector +
+            ((offset >> 9) / e->cluster_sectors) * e->cluster_sectors;
+        n = MIN(e->cluster_sectors, bs->backing_hd->total_sectors - sector_num);
+        if (n <= 0)
+            return 0;
+        memset(whole_grain, 0, sizeof(whole_grain));
+        if (bdrv_read(bs->backing_hd, sector_num, whole_grain, n) < 0)
+            return -1;
 
-            //Write grain only into the active image
-            if (bdrv_pwrite(act_s->hd, activeBDRV.cluster_offset << 9, whole_grain, sizeof(whole_grain)) != sizeof(whole_grain))
-                return -1;
-        }
+        //Write grain only into the active image
+        if (bdrv_pwrite(e->file, cluster_offset << 9, whole_grain, sizeof(whole_grain)) != sizeof(whole_grain))
+            return -1;
     }
     return 0;
 }
 
-static int vmdk_L2update(BlockDriverState *bs, VmdkMetaData *m_data)
+static int vmdk_L2update(VmdkExtent *e, VmdkMetaData *m_data)
 {
-    BDRVVmdkState *s = bs->opaque;
-
     /* update L2 table */
-    if (bdrv_pwrite(s->hd, ((int64_t)m_data->l2_offset * 512) + (m_data->l2_index * sizeof(m_data->offset)),
+    if (bdrv_pwrite(e->file, ((int64_t)m_data->l2_offset * 512) + (m_data->l2_index * sizeof(m_data->offset)),
                     &(m_data->offset), sizeof(m_data->offset)) != sizeof(m_data->offset))
         return -1;
     /* update backup L2 table */
-    if (s->l1_backup_table_offset != 0) {
-        m_data->l2_offset = s->l1_backup_table[m_data->l1_index];
-        if (bdrv_pwrite(s->hd, ((int64_t)m_data->l2_offset * 512) + (m_data->l2_index * sizeof(m_data->offset)),
+    if (e->l1_backup_table_offset != 0) {
+        m_data->l2_offset = e->l1_backup_table[m_data->l1_index];
+        if (bdrv_pwrite(e->file, ((int64_t)m_data->l2_offset * 512) + (m_data->l2_index * sizeof(m_data->offset)),
                         &(m_data->offset), sizeof(m_data->offset)) != sizeof(m_data->offset))
             return -1;
     }
@@ -506,77 +821,57 @@ static int vmdk_L2update(BlockDriverState *bs, VmdkMetaData *m_data)
     return 0;
 }
 
-static uint64_t get_cluster_offset(BlockDriverState *bs, VmdkMetaData *m_data,
-                                   uint64_t offset, int allocate)
+/* Offset in the extent file of the grain holding offset (relative to the
+   start of the sparse extent e), 0 if it is not allocated */
+static uint64_t get_cluster_offset(BlockDriverState *bs, VmdkExtent *e,
+                                   VmdkMetaData *m_data, uint64_t offset,
+                                   int allocate)
 {
     BDRVVmdkState *s = bs->opaque;
     unsigned int l1_index, l2_offset, l2_index;
-    int min_index, i, j;
-    uint32_t min_count, *l2_table, tmp = 0;
+    uint32_t *l2_table = NULL, tmp = 0;
     uint64_t cluster_offset;
 
     if (m_data)
         m_data->valid = 0;
 
-    l1_index = (offset >> 9) / s->l1_entry_sectors;
-    if (l1_index >= s->l1_size)
+    l1_index = (offset >> 9) / e->l1_entry_sectors;
+    if (l1_index >= e->l1_size)
         return 0;
-    l2_offset = s->l1_table[l1_index];
+    l2_offset = e->l1_table[l1_index];
     if (!l2_offset)
         return 0;
-    for(i = 0; i < L2_CACHE_SIZE; i++) {
-        if (l2_offset == s->l2_cache_offsets[i]) {
-            /* increment the hit count */
-            if (++s->l2_cache_counts[i] == 0xffffffff) {
-                for(j = 0; j < L2_CACHE_SIZE; j++) {
-                    s->l2_cache_counts[j] >>= 1;
-                }
-            }
-            l2_table = s->l2_cache + (i * s->l2_size);
-            goto found;
-        }
-    }
-    /* not found: load a new entry in the least used one */
-    min_index = 0;
-    min_count = 0xffffffff;
-    for(i = 0; i < L2_CACHE_SIZE; i++) {
-        if (s->l2_cache_counts[i] < min_count) {
-            min_count = s->l2_cache_counts[i];
-            min_index = i;
-        }
+    l2_index = ((offset >> 9) / e->cluster_sectors) % e->l2_size;
+    if (e->grains) {
+        s->l2_hits++;
+        cluster_offset = e->grains[(uint64_t)l1_index * e->l2_size + l2_index];
+    } else {
+        if ((l2_table = l2_load(s, e, l2_offset)) == NULL)
+            return 0;
+        cluster_offset = le32_to_cpu(l2_table[l2_index]);
     }
-    l2_table = s->l2_cache + (min_index * s->l2_size);
-    if (bdrv_pread(s->hd, (int64_t)l2_offset * 512, l2_table, s->l2_size * sizeof(uint32_t)) !=
-                                                                        s->l2_size * sizeof(uint32_t))
-        return 0;
-
-    s->l2_cache_offsets[min_index] = l2_offset;
-    s->l2_cache_counts[min_index] = 1;
- found:
-    l2_index = ((offset >> 9) / s->cluster_sectors) % s->l2_size;
-    cluster_offset = le32_to_cpu(l2_table[l2_index]);
 
     if (!cluster_offset) {
         if (!allocate)
             return 0;
         // Avoid the L2 tables update for the images that have snapshots.
         if (!s->is_parent) {
-            cluster_offset = bdrv_getlength(s->hd);
-            bdrv_truncate(s->hd, cluster_offset + (s->cluster_sectors << 9));
+            cluster_offset = bdrv_getlength(e->file);
+            bdrv_truncate(e->file, cluster_offset + (e->cluster_sectors << 9));
 
             cluster_offset >>= 9;
             tmp = cpu_to_le32(cluster_offset);
-            l2_table[l2_index] = tmp;
-            // Save the active image state
-            activeBDRV.cluster_offset = cluster_offset;
-            activeBDRV.hd = bs;
+            if (e->grains)
+                e->grains[(uint64_t)l1_index * e->l2_size + l2_index] = cluster_offset;
+            else
+                l2_table[l2_index] = tmp;
         }
         /* First of all we write grain itself, to avoid race condition
          * that may to corrupt the image.
          * This problem may occur because of insufficient space on host disk
          * or inappropriate VM shutdown.
          */
-        if (get_whole_cluster(bs, cluster_offset, offset, allocate) == -1)
+        if (get_whole_cluster(bs, e, cluster_offset, offset) == -1)
             return 0;
 
         if (m_data) {
@@ -591,36 +886,88 @@ static uint64_t get_cluster_offset(BlockDriverState *bs, VmdkMetaData *m_data,
     return cluster_offset;
 }
 
+/*
+ * Map sectors of the disk to their file. Returns the number of sectors
+ * from sector_num (at most nb_sectors) that are contiguous in *pfile from
+ * *poffset, with *pfile set to NULL if they are not allocated, or -1 if
+ * sector_num is beyond the end of the disk.
+ *
+ * Grain maps are in memory, so runs of grains that are contiguous in the
+ * file are returned at once without reading any grain table.
+ */
+static int vmdk_map(BlockDriverState *bs, int64_t sector_num, int nb_sectors,
+                    BlockDriverState **pfile, int64_t *poffset)
+{
+    BDRVVmdkState *s = bs->opaque;
+    VmdkExtent *e;
+    int64_t rel;
+    uint64_t cluster_offset, grain;
+    int index_in_cluster, n, max;
+
+    if ((e = vmdk_find_extent(s, sector_num)) == NULL)
+        return -1;
+    rel = sector_num - e->start_sector;
+    max = MIN(nb_sectors, e->end_sector - sector_num);
+
+    *pfile = NULL;
+    if (e->zero)
+        return max;
+    if (e->flat) {
+        *pfile = e->file;
+        *poffset = e->flat_offset + rel * 512;
+        return max;
+    }
+
+    cluster_offset = get_cluster_offset(bs, e, NULL, rel << 9, 0);
+    index_in_cluster = rel % e->cluster_sectors;
+    n = e->cluster_sectors - index_in_cluster;
+    if (e->grains) {
+        for (grain = rel / e->cluster_sectors + 1; n < max; grain++) {
+            uint64_t next = (uint64_t)vmdk_grain(e, grain) << 9;
+
+            if (cluster_offset ? next != cluster_offset + ((uint64_t)n + index_in_cluster) * 512
+                               : next != 0)
+                break;
+            n += e->cluster_sectors;
+        }
+    }
+    if (n > max)
+        n = max;
+    if (cluster_offset) {
+        *pfile = e->file;
+        *poffset = cluster_offset + index_in_cluster * 512;
+    }
+    return n;
+}
+
 static int vmdk_is_allocated(BlockDriverState *bs, int64_t sector_num,
                              int nb_sectors, int *pnum)
 {
-    BDRVVmdkState *s = bs->opaque;
-    int index_in_cluster, n;
-    uint64_t cluster_offset;
+    BlockDriverState *file;
+    int64_t offset;
+    int n;
 
-    cluster_offset = get_cluster_offset(bs, NULL, sector_num << 9, 0);
-    index_in_cluster = sector_num % s->cluster_sectors;
-    n = s->cluster_sectors - index_in_cluster;
-    if (n > nb_sectors)
-        n = nb_sectors;
+    n = vmdk_map(bs, sector_num, nb_sectors, &file, &offset);
+    if (n < 0) {
+        *pnum = 0;
+        return 0;
+    }
     *pnum = n;
-    return (cluster_offset != 0);
+    return (file != NULL);
 }
 
 static int vmdk_read(BlockDriverState *bs, int64_t sector_num,
                     uint8_t *buf, int nb_sectors)
 {
-    BDRVVmdkState *s = bs->opaque;
-    int index_in_cluster, n, ret;
-    uint64_t cluster_offset;
+    BlockDriverState *file;
+    int64_t offset;
+    int n, ret;
 
     while (nb_sectors > 0) {
-        cluster_offset = get_cluster_offset(bs, NULL, sector_num << 9, 0);
-        index_in_cluster = sector_num % s->cluster_sectors;
-        n = s->cluster_sectors - index_in_cluster;
-        if (n > nb_sectors)
-            n = nb_sectors;
-        if (!cluster_offset) {
+        n = vmdk_map(bs, sector_num, nb_sectors, &file, &offset);
+        if (n < 0)
+            return -1;
+        if (!file) {
             // try to read from parent image, if exist
             if (bs->backing_hd) {
                 if (!vmdk_is_cid_valid(bs))
@@ -632,7 +979,7 @@ static int vmdk_read(BlockDriverState *bs, int64_t sector_num,
                 memset(buf, 0, 512 * n);
             }
         } else {
-            if(bdrv_pread(s->hd, cluster_offset + index_in_cluster * 512, buf, n * 512) != n * 512)
+            if(bdrv_pread(file, offset, buf, n * 512) != n * 512)
                 return -1;
         }
         nb_sectors -= n;
@@ -646,7 +993,9 @@ static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
                      const uint8_t *buf, int nb_sectors)
 {
     BDRVVmdkState *s = bs->opaque;
+    VmdkExtent *e;
     VmdkMetaData m_data;
+    int64_t rel;
     int index_in_cluster, n;
     uint64_t cluster_offset;
     static int cid_update = 0;
@@ -660,20 +1009,29 @@ static int vmdk_write(BlockDriverState *bs, int64_t sector_num,
     }
 
     while (nb_sectors > 0) {
-        index_in_cluster = sector_num & (s->cluster_sectors - 1);
-        n = s->cluster_sectors - index_in_cluster;
-        if (n > nb_sectors)
-            n = nb_sectors;
-        cluster_offset = get_cluster_offset(bs, &m_data, sector_num << 9, 1);
-        if (!cluster_offset)
+        if ((e = vmdk_find_extent(s, sector_num)) == NULL || e->zero)
             return -1;
+        rel = sector_num - e->start_sector;
+        if (e->flat) {
+            n = MIN(nb_sectors, e->end_sector - sector_num);
+            if (bdrv_pwrite(e->file, e->flat_offset + rel * 512, buf, n * 512) != n * 512)
+                return -1;
+        } else {
+            index_in_cluster = rel % e->cluster_sectors;
+            n = e->cluster_sectors - index_in_cluster;
+            if (n > nb_sectors)
+                n = nb_sectors;
+            cluster_offset = get_cluster_offset(bs, e, &m_data, rel << 9, 1);
+            if (!cluster_offset)
+                return -1;
 
-        if (bdrv_pwrite(s->hd, cluster_offset + index_in_cluster * 512, buf, n * 512) != n * 512)
-            return -1;
-        if (m_data.valid) {
-            /* update L2 tables */
-            if (vmdk_L2update(bs, &m_data) == -1)
+            if (bdrv_pwrite(e->file, cluster_offset + index_in_cluster * 512, buf, n * 512) != n * 512)
                 return -1;
+            if (m_data.valid) {
+                /* update L2 tables */
+                if (vmdk_L2update(e, &m_data) == -1)
+                    return -1;
+            }
         }
         nb_sectors -= n;
         sector_num += n;
@@ -814,8 +1172,7 @@ static void vmdk_close(BlockDriverState *bs)
 {
     BDRVVmdkState *s = bs->opaque;
 
-    qemu_free(s->l1_table);
-    qemu_free(s->l2_cache);
+    vmdk_free_extents(bs);
     // try to close parent image, if exist
     vmdk_parent_close(s->hd);
     bdrv_delete(s->hd);
@@ -824,7 +1181,55 @@ static void vmdk_close(BlockDriverState *bs)
 static void vmdk_flush(BlockDriverState *bs)
 {
     BDRVVmdkState *s = bs->opaque;
+    int i;
+
     bdrv_flush(s->hd);
+    for (i = 0; i < s->nb_extents; i++) {
+        if (s->extents[i].file && s->extents[i].file != s->hd)
+            bdrv_flush(s->extents[i].file);
+    }
+}
+
+static int vmdk_set_cache_size(BlockDriverState *bs, int64_t size)
+{
+    BDRVVmdkState *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < s->nb_extents; i++) {
+        VmdkExtent *e = &s->extents[i];
+
+        qemu_free(e->grains);
+        e->grains = NULL;
+        memset(e->l2_cache_offsets, 0, sizeof(e->l2_cache_offsets));
+        memset(e->l2_cache_counts, 0, sizeof(e->l2_cache_counts));
+    }
+    s->preload_budget = size;
+    vmdk_preload(bs, 0);
+    return 0;
+}
+
+static int vmdk_prefetch_metadata(BlockDriverState *bs)
+{
+    return vmdk_preload(bs, 1);
+}
+
+static int vmdk_get_cache_info(BlockDriverState *bs, BlockCacheInfo *bci)
+{
+    BDRVVmdkState *s = bs->opaque;
+    int i;
+
+    bci->size = s->preload_budget;
+    for (i = 0; i < s->nb_extents; i++) {
+        VmdkExtent *e = &s->extents[i];
+
+        if (e->grains)
+            bci->used += (int64_t)e->l1_size * e->l2_size * sizeof(uint32_t);
+        if (e->l2_cache)
+            bci->used += e->l2_size * L2_CACHE_SIZE * sizeof(uint32_t);
+    }
+    bci->hits = s->l2_hits;
+    bci->misses = s->l2_misses;
+    return 0;
 }
 
 
@@ -859,6 +1264,10 @@ static BlockDriver bdrv_vmdk = {
     .bdrv_flush		= vmdk_flush,
     .bdrv_is_allocated	= vmdk_is_allocated,
 
+    .bdrv_set_cache_size    = vmdk_set_cache_size,
+    .bdrv_prefetch_metadata = vmdk_prefetch_metadata,
+    .bdrv_get_cache_info    = vmdk_get_cache_info,
+
     .create_options = vmdk_create_options,
 };
 
@@ -93,6 +93,13 @@ struct BlockDriver {
                               QEMUSnapshotInfo **psn_info);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
 
+    /* metadata cache of image formats that map clusters through tables */
+    int (*bdrv_set_cache_size)(BlockDriverState *bs, int64_t size);
+    int (*bdrv_prefetch_metadata)(BlockDriverState *bs);
+    int (*bdrv_get_cache_info)(BlockDriverState *bs, BlockCacheInfo *bci);
+    int (*bdrv_set_data_cache)(BlockDriverState *bs, int64_t size,
+                               int threads);
+
     int (*bdrv_save_vmstate)(BlockDriverState *bs, const uint8_t *buf,
                              int64_t pos, int size);
     int (*bdrv_load_vmstate)(BlockDriverState *bs, uint8_t *buf,
@@ -181,6 +188,7 @@ struct BlockDriverAIOCB {
     BlockDriverState *bs;
     BlockDriverCompletionFunc *cb;
     void *opaque;
+    void *owner;                /* see qemu_aio_owner() */
     BlockDriverAIOCB *next;
 };
 
@@ -14,6 +14,7 @@
 
 #include <sys/eventfd.h>
 #include <libaio.h>
+#include <pthread.h>
 
 /*
  * Queue size (per-device).
@@ -38,6 +39,9 @@ struct qemu_laiocb {
 struct qemu_laio_state {
     io_context_t ctx;
     int efd;
+    /* protects count and completed_reqs: requests are started and
+       completed by different threads (see qemu_aio_set_owner_ops()) */
+    pthread_mutex_t lock;
     int count;
     QLIST_HEAD(, qemu_laiocb) completed_reqs;
 };
@@ -56,7 +60,9 @@ static void qemu_laio_process_completion(struct qemu_laio_state *s,
 {
     int ret;
 
+    pthread_mutex_lock(&s->lock);
     s->count--;
+    pthread_mutex_unlock(&s->lock);
 
     ret = laiocb->ret;
     if (ret != -ECANCELED) {
@@ -82,14 +88,35 @@ static int qemu_laio_process_requests(void *opaque)
 {
     struct qemu_laio_state *s = opaque;
     struct qemu_laiocb *laiocb, *next;
+    void *prev;
     int res = 0;
+    int skipped = 0;
 
+    pthread_mutex_lock(&s->lock);
     QLIST_FOREACH_SAFE (laiocb, &s->completed_reqs, node, next) {
-        if (laiocb->async_context_id == get_async_context_id()) {
-            qemu_laio_process_completion(s, laiocb);
-            QLIST_REMOVE(laiocb, node);
-            res = 1;
+        if (laiocb->async_context_id != get_async_context_id())
+            continue;
+        /* the owner of the request is busy in another thread */
+        if (!qemu_aio_owner_enter(laiocb->common.owner, 0, &prev)) {
+            skipped = 1;
+            continue;
         }
+        QLIST_REMOVE(laiocb, node);
+        pthread_mutex_unlock(&s->lock);
+        qemu_laio_process_completion(s, laiocb);
+        qemu_aio_owner_leave(laiocb->common.owner, prev);
+        res = 1;
+        pthread_mutex_lock(&s->lock);
+        /* the list may have changed while the lock was dropped */
+        next = QLIST_FIRST(&s->completed_reqs);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    /* wake whoever waits for the requests left behind */
+    if (skipped) {
+        uint64_t val = 1;
+
+        write(s->efd, &val, sizeof(val));
     }
 
     return res;
@@ -103,10 +130,16 @@ static int qemu_laio_process_requests(void *opaque)
 static void qemu_laio_enqueue_completed(struct qemu_laio_state *s,
     struct qemu_laiocb* laiocb)
 {
-    if (laiocb->async_context_id == get_async_context_id()) {
+    void *prev;
+
+    if (laiocb->async_context_id == get_async_context_id() &&
+        qemu_aio_owner_enter(laiocb->common.owner, 0, &prev)) {
         qemu_laio_process_completion(s, laiocb);
+        qemu_aio_owner_leave(laiocb->common.owner, prev);
     } else {
+        pthread_mutex_lock(&s->lock);
         QLIST_INSERT_HEAD(&s->completed_reqs, laiocb, node);
+        pthread_mutex_unlock(&s->lock);
     }
 }
 
@@ -149,8 +182,12 @@ static void qemu_laio_completion_cb(void *opaque)
 static int qemu_laio_flush_cb(void *opaque)
 {
     struct qemu_laio_state *s = opaque;
+    int ret;
 
-    return (s->count > 0) ? 1 : 0;
+    pthread_mutex_lock(&s->lock);
+    ret = (s->count > 0) ? 1 : 0;
+    pthread_mutex_unlock(&s->lock);
+    return ret;
 }
 
 static void laio_cancel(BlockDriverAIOCB *blockacb)
@@ -221,7 +258,9 @@ BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
         goto out_free_aiocb;
     }
     io_set_eventfd(&laiocb->iocb, s->efd);
+    pthread_mutex_lock(&s->lock);
     s->count++;
+    pthread_mutex_unlock(&s->lock);
 
     if (io_submit(s->ctx, 1, &iocbs) < 0)
         goto out_dec_count;
@@ -230,7 +269,9 @@ BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
 out_free_aiocb:
     qemu_aio_release(laiocb);
 out_dec_count:
+    pthread_mutex_lock(&s->lock);
     s->count--;
+    pthread_mutex_unlock(&s->lock);
     return NULL;
 }
 
@@ -239,6 +280,7 @@ void *laio_init(void)
     struct qemu_laio_state *s;
 
     s = qemu_mallocz(sizeof(*s));
+    pthread_mutex_init(&s->lock, NULL);
     QLIST_INIT(&s->completed_reqs);
     s->efd = eventfd(0, 0);
     if (s->efd == -1)
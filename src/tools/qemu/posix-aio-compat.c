@@ -59,6 +59,9 @@ typedef struct PosixAioState {
 
 
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* protects first_aio: threads that run different images start and
+   complete requests at the same time (see qemu_aio_set_owner_ops()) */
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 static pthread_t thread_id;
 static pthread_attr_t attr;
@@ -309,6 +312,7 @@ static void *aio_thread(void *unused)
     while (1) {
         struct qemu_paiocb *aiocb;
         ssize_t ret = 0;
+        int signo;
         qemu_timeval tv;
         struct timespec ts;
 
@@ -349,12 +353,14 @@ static void *aio_thread(void *unused)
 		break;
 	}
 
+        /* the request can be completed and reused once ret is set */
         mutex_lock(&lock);
+        signo = aiocb->ev_signo;
         aiocb->ret = ret;
         idle_threads++;
         mutex_unlock(&lock);
 
-        if (kill(pid, aiocb->ev_signo)) die("kill failed");
+        if (kill(pid, signo)) die("kill failed");
     }
 
     idle_threads--;
@@ -382,9 +388,9 @@ static void spawn_thread(void)
 
 static void qemu_paio_submit(struct qemu_paiocb *aiocb)
 {
+    mutex_lock(&lock);
     aiocb->ret = -EINPROGRESS;
     aiocb->active = 0;
-    mutex_lock(&lock);
     if (idle_threads == 0 && cur_threads < max_threads)
         spawn_thread();
     QTAILQ_INSERT_TAIL(&request_list, aiocb, node);
@@ -419,16 +425,27 @@ static int posix_aio_process_queue(void *opaque)
 {
     PosixAioState *s = opaque;
     struct qemu_paiocb *acb, **pacb;
+    void *prev;
     int ret;
     int result = 0;
+    int skipped = 0;
     int async_context_id = get_async_context_id();
 
+    mutex_lock(&list_lock);
     for(;;) {
         pacb = &s->first_aio;
         for(;;) {
             acb = *pacb;
-            if (!acb)
+            if (!acb) {
+                mutex_unlock(&list_lock);
+                /* wake whoever waits for the requests left behind */
+                if (skipped) {
+                    char byte = 0;
+
+                    write(s->wfd, &byte, sizeof(byte));
+                }
                 return result;
+            }
 
             /* we're only interested in requests in the right context */
             if (acb->async_context_id != async_context_id) {
@@ -443,6 +460,12 @@ static int posix_aio_process_queue(void *opaque)
                 qemu_aio_release(acb);
                 result = 1;
             } else if (ret != EINPROGRESS) {
+                /* the owner of the request is busy in another thread */
+                if (!qemu_aio_owner_enter(acb->common.owner, 0, &prev)) {
+                    skipped = 1;
+                    pacb = &acb->next;
+                    continue;
+                }
                 /* end of aio */
                 if (ret == 0) {
                     ret = qemu_paio_return(acb);
@@ -455,10 +478,13 @@ static int posix_aio_process_queue(void *opaque)
                 }
                 /* remove the request */
                 *pacb = acb->next;
+                mutex_unlock(&list_lock);
                 /* call the callback */
                 acb->common.cb(acb->common.opaque, ret);
+                qemu_aio_owner_leave(acb->common.owner, prev);
                 qemu_aio_release(acb);
                 result = 1;
+                mutex_lock(&list_lock);
                 break;
             } else {
                 pacb = &acb->next;
@@ -492,7 +518,12 @@ static void posix_aio_read(void *opaque)
 static int posix_aio_flush(void *opaque)
 {
     PosixAioState *s = opaque;
-    return !!s->first_aio;
+    int ret;
+
+    mutex_lock(&list_lock);
+    ret = !!s->first_aio;
+    mutex_unlock(&list_lock);
+    return ret;
 }
 
 static PosixAioState *posix_aio_state;
@@ -513,6 +544,7 @@ static void paio_remove(struct qemu_paiocb *acb)
     struct qemu_paiocb **pacb;
 
     /* remove the callback from the queue */
+    mutex_lock(&list_lock);
     pacb = &posix_aio_state->first_aio;
     for(;;) {
         if (*pacb == NULL) {
@@ -525,6 +557,7 @@ static void paio_remove(struct qemu_paiocb *acb)
         }
         pacb = &(*pacb)->next;
     }
+    mutex_unlock(&list_lock);
 }
 
 static void paio_cancel(BlockDriverAIOCB *blockacb)
@@ -577,8 +610,12 @@ BlockDriverAIOCB *paio_submit(BlockDriverState *bs, int fd,
     acb->aio_nbytes = nb_sectors * 512;
     acb->aio_offset = sector_num * 512;
 
+    /* a reused request must not look completed once it is queued */
+    mutex_lock(&list_lock);
+    acb->ret = -EINPROGRESS;
     acb->next = posix_aio_state->first_aio;
     posix_aio_state->first_aio = acb;
+    mutex_unlock(&list_lock);
 
     qemu_paio_submit(acb);
     return &acb->common;
@@ -600,8 +637,12 @@ BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
     acb->aio_ioctl_buf = buf;
     acb->aio_ioctl_cmd = req;
 
+    /* a reused request must not look completed once it is queued */
+    mutex_lock(&list_lock);
+    acb->ret = -EINPROGRESS;
     acb->next = posix_aio_state->first_aio;
     posix_aio_state->first_aio = acb;
+    mutex_unlock(&list_lock);
 
     qemu_paio_submit(acb);
     return &acb->common;
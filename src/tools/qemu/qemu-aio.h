@@ -35,6 +35,10 @@ void qemu_aio_flush(void);
  * result of executing I/O completion or bh callbacks. */
 void qemu_aio_wait(void);
 
+/* Like qemu_aio_wait(), but only handles the AIO events that are ready
+ * and returns without waiting if there are none. */
+void qemu_aio_poll(void);
+
 /*
  * Runs all currently allowed AIO callbacks of completed requests. Returns 0
  * if no requests were handled, non-zero if at least one request was
@@ -56,4 +60,30 @@ int qemu_aio_set_fd_handler(int fd,
                             AioProcessQueue *io_process_queue,
                             void *opaque);
 
+/* Takes the lock of an owner, or only tries to if wait is 0. Returns 1 if
+ * the lock was taken. */
+typedef int (AioOwnerLock)(void *owner, int wait);
+typedef void (AioOwnerUnlock)(void *owner);
+
+/*
+ * Programs that read several images from several threads give every
+ * image a lock and run the block layer for an image with its lock held.
+ * The requests a thread starts belong to the owner it entered with
+ * qemu_aio_owner_enter(), and their callbacks run with the lock of that
+ * owner held, whichever thread handles the completion.
+ */
+void qemu_aio_set_owner_ops(AioOwnerLock *lock, AioOwnerUnlock *unlock);
+
+/* Returns the owner the calling thread runs for (NULL if none) */
+void *qemu_aio_owner(void);
+
+/* Makes the calling thread run for owner, taking its lock unless the
+ * thread runs for it already. If wait is 0, the lock is only tried.
+ * Returns 1 and the previous owner in prev on success, 0 if the lock is
+ * held by another thread. */
+int qemu_aio_owner_enter(void *owner, int wait, void **prev);
+
+/* Undoes qemu_aio_owner_enter() */
+void qemu_aio_owner_leave(void *owner, void *prev);
+
 #endif
@@ -6,9 +6,144 @@
 #include "qemu-common.h"
 #include "osdep.h"
 #include "block_int.h"
+#include "qemu-aio.h"
+#include "block/qcow-inflate.h"
 #include "qemu-img-lib.h"
 #include <stdio.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <pthread.h>
+#endif
 
+/* Most buffers merged into one request of a batch */
+#define QEMU_IMG_READV_MAX_IOV  512
+
+static int qemu_img_lib_inited = 0;
+
+/* Each image has a lock that is held while the block layer runs for it,
+ * so threads reading different images do not wait for each other. The
+ * callbacks of its requests run with the same lock held, whichever
+ * thread handles the completion (see qemu_aio_set_owner_ops()), and no
+ * lock is held while waiting for completions (see qemu_img_wait()).
+ * The driver and device lists are shared, so images are opened and
+ * closed one at a time. Raw images are read with pread() on a
+ * descriptor of our own without any lock. */
+#ifndef _WIN32
+static pthread_mutex_t qemu_img_open_lock = PTHREAD_MUTEX_INITIALIZER;
+#define QEMU_IMG_OPEN_LOCK()    pthread_mutex_lock(&qemu_img_open_lock)
+#define QEMU_IMG_OPEN_UNLOCK()  pthread_mutex_unlock(&qemu_img_open_lock)
+
+/* One thread at a time waits in qemu_aio_wait() and handles the
+ * completions of all images, the others sleep until it is done */
+static pthread_mutex_t qemu_img_wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qemu_img_wait_cond = PTHREAD_COND_INITIALIZER;
+static int qemu_img_waiting;            /* a thread is in qemu_aio_wait() */
+static unsigned int qemu_img_wait_round; /* times it returned */
+#else
+#define QEMU_IMG_OPEN_LOCK()
+#define QEMU_IMG_OPEN_UNLOCK()
+#endif
+
+#define QEMU_IMG_LOCK(state)    qemu_img_enter(state)
+#define QEMU_IMG_UNLOCK(state)  qemu_img_leave(state)
+
+/* Asynchronous read submitted with qemu_img_aio_submit() */
+typedef struct QemuImgAioReq {
+    struct QemuImgAioReq *next;
+    struct QemuImgState *state;
+    void *tag;
+    uint8_t *buf;
+    size_t len;
+    uint8_t *bounce;            /* sector aligned buffer for unaligned reads */
+    size_t skip;                /* offset of the data in bounce */
+    struct iovec iov;
+    QEMUIOVector qiov;
+    int ret;
+} QemuImgAioReq;
+
+/* State of an open image, kept in bs->private */
+typedef struct QemuImgState {
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+    int raw_fd;                 /* descriptor for lock free reads or -1 */
+    int in_flight;              /* completion queue of the AIO reads */
+    QemuImgAioReq *done;
+    QemuImgAioReq **done_tail;
+} QemuImgState;
+
+#ifndef _WIN32
+static int qemu_img_owner_lock(void *owner, int wait)
+{
+    QemuImgState *state = owner;
+
+    if (wait)
+        return pthread_mutex_lock(&state->lock) == 0;
+    return pthread_mutex_trylock(&state->lock) == 0;
+}
+
+static void qemu_img_owner_unlock(void *owner)
+{
+    QemuImgState *state = owner;
+
+    pthread_mutex_unlock(&state->lock);
+}
+#endif
+
+static void qemu_img_enter(QemuImgState *state)
+{
+    void *prev;
+
+    qemu_aio_owner_enter(state, 1, &prev);
+}
+
+static void qemu_img_leave(QemuImgState *state)
+{
+    qemu_aio_owner_leave(state, NULL);
+}
+
+/* Handle completed requests, waiting for one if wait is set. Called with
+ * the lock of the image held, which is dropped meanwhile. */
+static void qemu_img_wait(QemuImgState *state, int wait)
+{
+#ifndef _WIN32
+    unsigned int round;
+
+    /* the callbacks of the image cannot run before the lock is dropped,
+       so a round that ends after this point may have handled them */
+    pthread_mutex_lock(&qemu_img_wait_lock);
+    round = qemu_img_wait_round;
+    pthread_mutex_unlock(&qemu_img_wait_lock);
+    QEMU_IMG_UNLOCK(state);
+
+    pthread_mutex_lock(&qemu_img_wait_lock);
+    if (round != qemu_img_wait_round) {
+        /* look again */
+    } else if (qemu_img_waiting) {
+        while (wait && round == qemu_img_wait_round)
+            pthread_cond_wait(&qemu_img_wait_cond, &qemu_img_wait_lock);
+    } else {
+        qemu_img_waiting = 1;
+        pthread_mutex_unlock(&qemu_img_wait_lock);
+        if (wait)
+            qemu_aio_wait();
+        else
+            qemu_aio_poll();
+        pthread_mutex_lock(&qemu_img_wait_lock);
+        qemu_img_waiting = 0;
+        qemu_img_wait_round++;
+        pthread_cond_broadcast(&qemu_img_wait_cond);
+    }
+    pthread_mutex_unlock(&qemu_img_wait_lock);
+
+    QEMU_IMG_LOCK(state);
+#else
+    if (wait)
+        qemu_aio_wait();
+    else
+        qemu_aio_poll();
+#endif
+}
 
 /**
  * Function to open qemu image file.
@@ -18,29 +153,388 @@ __declspec(dllexport) void* qemu_img_open(const char *filename)
 
     BlockDriverState *bs;
     BlockDriver *drv;
-    int ret;
+    QemuImgState *state;
+    const char *aio, *env;
+    char fmt_name[128];
+    int64_t zcache;
+    int ret, flags, threads;
+#ifndef _WIN32
+    struct sigaction act;
+#endif
 
-    bdrv_init();
+    QEMU_IMG_OPEN_LOCK();
+
+    /* Drivers must be registered only once per process; registering
+     * them again links the driver list into a loop. */
+    if (!qemu_img_lib_inited) {
+        bdrv_init();
+#ifndef _WIN32
+        qemu_aio_set_owner_ops(qemu_img_owner_lock, qemu_img_owner_unlock);
+#endif
+        qemu_img_lib_inited = 1;
+    }
 
     bs = bdrv_new("");
-    if (!bs)
+    if (!bs) {
         fprintf(stderr, "Not enough memory");
+        QEMU_IMG_OPEN_UNLOCK();
+        return NULL;
+    }
+
+    /* QEMU_IMG_AIO=native reads with Linux native AIO (and O_DIRECT)
+     * instead of the posix-aio-compat thread pool */
+    flags = BDRV_O_CACHE_WB;
+    if ((aio = getenv("QEMU_IMG_AIO")) != NULL && !strcmp(aio, "native"))
+        flags = BDRV_O_NOCACHE | BDRV_O_NATIVE_AIO;
 
     drv = NULL;
-    if ((ret = bdrv_open2(bs, filename, BDRV_O_CACHE_WB, drv)) < 0) {
+    if ((ret = bdrv_open2(bs, filename, flags, drv)) < 0) {
         fprintf(stderr, "Could not open (error: %d) '%s'", ret, filename);
+        bdrv_delete(bs);
+        QEMU_IMG_OPEN_UNLOCK();
+        return NULL;
     }
 
+    state = qemu_mallocz(sizeof(QemuImgState));
+#ifndef _WIN32
+    pthread_mutex_init(&state->lock, NULL);
+#endif
+    state->raw_fd = -1;
+    state->done_tail = &state->done;
+    bs->private = state;
+
+#ifndef _WIN32
+    /* raw images need no mapping, read them without the lock */
+    bdrv_get_format(bs, fmt_name, sizeof(fmt_name));
+    if (!strcmp(fmt_name, "raw") && !(flags & BDRV_O_NOCACHE))
+        state->raw_fd = open(filename, O_RDONLY);
+#endif
+
+    QEMU_IMG_LOCK(state);
+
+    /* QEMU_IMG_L2_CACHE sets the memory budget in bytes of the L2 table
+     * cache and QEMU_IMG_L2_PREFETCH=1 fills it with L2 tables at open,
+     * for formats that have them */
+    if ((env = getenv("QEMU_IMG_L2_CACHE")) != NULL)
+        bdrv_set_cache_size(bs, strtoll(env, NULL, 0));
+    if ((env = getenv("QEMU_IMG_L2_PREFETCH")) != NULL && atoi(env) > 0)
+        bdrv_prefetch_metadata(bs);
+
+    /* QEMU_IMG_ZCACHE sets the memory budget in bytes of the decompressed
+     * cluster cache and QEMU_IMG_INFLATE_THREADS the number of threads
+     * inflating compressed clusters ahead of sequential reads */
+    zcache = (env = getenv("QEMU_IMG_ZCACHE")) != NULL ?
+        strtoll(env, NULL, 0) : QCOW_INFLATE_DEFAULT_BUDGET;
+    threads = (env = getenv("QEMU_IMG_INFLATE_THREADS")) != NULL ?
+        atoi(env) : -1;
+    if (zcache != QCOW_INFLATE_DEFAULT_BUDGET || threads != -1)
+        bdrv_set_data_cache(bs, zcache, threads);
+
+    QEMU_IMG_UNLOCK(state);
+
+#ifndef _WIN32
+    /* posix-aio-compat signals completions with SIGUSR2 without
+     * SA_RESTART to interrupt select(). select() is never restarted and
+     * is also woken through the completion pipe, so restart everything
+     * else: the program using this library must not see EINTR from its
+     * own reads and writes while reads are in flight. */
+    if (sigaction(SIGUSR2, NULL, &act) == 0 &&
+        act.sa_handler != SIG_DFL && act.sa_handler != SIG_IGN &&
+        !(act.sa_flags & SA_RESTART)) {
+        act.sa_flags |= SA_RESTART;
+        sigaction(SIGUSR2, &act, NULL);
+    }
+#endif
+
+    QEMU_IMG_OPEN_UNLOCK();
     return bs;
 }
 
+/**
+ * Function to close qemu image.
+ */
+__declspec(dllexport) void qemu_img_close(void *opaque)
+{
+    BlockDriverState *bs = (BlockDriverState *)opaque;
+    QemuImgState *state = bs->private;
+
+    if (state) {
+        QEMU_IMG_LOCK(state);
+        while (state->in_flight)
+            qemu_img_wait(state, 1);
+        while (state->done) {
+            QemuImgAioReq *req = state->done;
+
+            state->done = req->next;
+            qemu_free(req);
+        }
+        QEMU_IMG_UNLOCK(state);
+    }
+
+    QEMU_IMG_OPEN_LOCK();
+    bdrv_delete(bs);
+    QEMU_IMG_OPEN_UNLOCK();
+
+    if (state) {
+        if (state->raw_fd >= 0)
+            close(state->raw_fd);
+#ifndef _WIN32
+        pthread_mutex_destroy(&state->lock);
+#endif
+        qemu_free(state);
+    }
+}
+
 /**
  * Function to read qemu image.
  */
-__declspec(dllexport) int qemu_img_read(void *bs, int64_t offset,
+__declspec(dllexport) int qemu_img_read(void *opaque, int64_t offset,
                     uint8_t *buf, size_t len)
 {
-    return bdrv_pread((BlockDriverState *)bs, (uint64_t)offset, buf, len);
+    BlockDriverState *bs = (BlockDriverState *)opaque;
+    QemuImgState *state = bs->private;
+    QEMU_IMG_IOV iov;
+    int64_t total;
+
+#ifndef _WIN32
+    if (state && state->raw_fd >= 0) {
+        size_t done = 0;
+
+        while (done < len) {
+            ssize_t cnt = pread(state->raw_fd, buf + done, len - done,
+                                offset + done);
+            if (cnt < 0 && errno == EINTR)
+                continue;
+            if (cnt < 0)
+                return -errno;
+            if (cnt == 0)
+                break;
+            done += cnt;
+        }
+        return done;
+    }
+#endif
+
+    iov.offset = offset;
+    iov.buf = buf;
+    iov.len = len;
+    total = qemu_img_readv(opaque, &iov, 1);
+    return total < 0 ? (int)total : (int)len;
+}
+
+#define QEMU_IMG_NOT_DONE 0x7fffffff
+
+static void qemu_img_readv_cb(void *opaque, int ret)
+{
+    *(int *)opaque = ret;
+}
+
+static int qemu_img_iov_cmp(const void *a, const void *b)
+{
+    const QEMU_IMG_IOV *x = *(const QEMU_IMG_IOV **)a;
+    const QEMU_IMG_IOV *y = *(const QEMU_IMG_IOV **)b;
+
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/* Read the adjacent requests iov[0..count-1] from start to end and wait
+ * for the data. Runs that are not sector aligned are read into a bounce
+ * buffer. Called with the lock of the image held. */
+static int qemu_img_read_run(BlockDriverState *bs, QEMU_IMG_IOV **iov,
+                             int count, int64_t start, int64_t end)
+{
+    int64_t astart = start & ~(int64_t)(BDRV_SECTOR_SIZE - 1);
+    int64_t aend = (end + BDRV_SECTOR_SIZE - 1) &
+        ~(int64_t)(BDRV_SECTOR_SIZE - 1);
+    uint8_t *bounce = NULL;
+    QEMUIOVector qiov;
+    int i, ret;
+
+    if (astart != start || aend != end) {
+        bounce = qemu_blockalign(bs, aend - astart);
+        qemu_iovec_init(&qiov, 1);
+        qemu_iovec_add(&qiov, bounce, aend - astart);
+    } else {
+        qemu_iovec_init(&qiov, count);
+        for (i = 0; i < count; i++)
+            qemu_iovec_add(&qiov, iov[i]->buf, iov[i]->len);
+    }
+
+    ret = QEMU_IMG_NOT_DONE;
+    if (bdrv_aio_readv(bs, astart >> BDRV_SECTOR_BITS, &qiov,
+                       (aend - astart) >> BDRV_SECTOR_BITS,
+                       qemu_img_readv_cb, &ret) == NULL)
+        ret = -EIO;
+    while (ret == QEMU_IMG_NOT_DONE)
+        qemu_img_wait(bs->private, 1);
+    qemu_iovec_destroy(&qiov);
+
+    if (bounce) {
+        if (ret >= 0) {
+            for (i = 0; i < count; i++)
+                memcpy(iov[i]->buf, bounce + (iov[i]->offset - astart),
+                       iov[i]->len);
+        }
+        qemu_vfree(bounce);
+    }
+    return ret;
+}
+
+/**
+ * Function to read a batch of requests from qemu image. Requests are
+ * sorted by offset and adjacent requests are merged into one scatter
+ * read, so the image format maps each run of clusters once. Runs that
+ * are not sector aligned are read through a bounce buffer.
+ * Returns the number of bytes read or a negative errno value.
+ */
+__declspec(dllexport) int64_t qemu_img_readv(void *opaque, QEMU_IMG_IOV *iov,
+                                             int count)
+{
+    BlockDriverState *bs = (BlockDriverState *)opaque;
+    QemuImgState *state = bs->private;
+    QEMU_IMG_IOV **sorted;
+    int i, j, ret = 0;
+    int64_t total = 0;
+
+    if (count <= 0)
+        return 0;
+
+    sorted = qemu_malloc(sizeof(QEMU_IMG_IOV *) * count);
+    for (i = 0; i < count; i++)
+        sorted[i] = &iov[i];
+    qsort(sorted, count, sizeof(QEMU_IMG_IOV *), qemu_img_iov_cmp);
+
+    QEMU_IMG_LOCK(state);
+
+    for (i = 0; i < count && ret >= 0; i = j) {
+        int64_t start = sorted[i]->offset;
+        int64_t end = start + sorted[i]->len;
+
+        /* extend the run over the requests that follow it directly */
+        for (j = i + 1; j < count && j - i < QEMU_IMG_READV_MAX_IOV; j++) {
+            if (sorted[j]->offset != end)
+                break;
+            end += sorted[j]->len;
+        }
+        total += end - start;
+
+        if (end > start)
+            ret = qemu_img_read_run(bs, &sorted[i], j - i, start, end);
+    }
+
+    QEMU_IMG_UNLOCK(state);
+    qemu_free(sorted);
+
+    return ret < 0 ? ret : total;
+}
+
+static void qemu_img_aio_cb(void *opaque, int ret)
+{
+    QemuImgAioReq *req = opaque;
+    QemuImgState *state = req->state;
+
+    if (req->bounce) {
+        if (ret >= 0)
+            memcpy(req->buf, req->bounce + req->skip, req->len);
+        qemu_vfree(req->bounce);
+        req->bounce = NULL;
+    }
+    req->ret = ret < 0 ? ret : (int)req->len;
+
+    req->next = NULL;
+    *state->done_tail = req;
+    state->done_tail = &req->next;
+    state->in_flight--;
+}
+
+/**
+ * Function to start an asynchronous read of qemu image. The completion
+ * is returned by qemu_img_aio_poll() together with tag. The buffer must
+ * stay valid until then.
+ * Returns 0 or a negative errno value if the read could not be started.
+ */
+__declspec(dllexport) int qemu_img_aio_submit(void *opaque, QEMU_IMG_IOV *iov,
+                                              void *tag)
+{
+    BlockDriverState *bs = (BlockDriverState *)opaque;
+    QemuImgState *state = bs->private;
+    QemuImgAioReq *req;
+    int64_t start, end;
+
+    req = qemu_mallocz(sizeof(QemuImgAioReq));
+    req->state = state;
+    req->tag = tag;
+    req->buf = iov->buf;
+    req->len = iov->len;
+
+    start = iov->offset & ~(int64_t)(BDRV_SECTOR_SIZE - 1);
+    end = (iov->offset + iov->len + BDRV_SECTOR_SIZE - 1) &
+        ~(int64_t)(BDRV_SECTOR_SIZE - 1);
+
+    if (start != iov->offset || end != iov->offset + (int64_t)iov->len) {
+        req->bounce = qemu_blockalign(bs, end - start);
+        req->skip = iov->offset - start;
+        req->iov.iov_base = req->bounce;
+    } else {
+        req->iov.iov_base = iov->buf;
+    }
+    req->iov.iov_len = end - start;
+    qemu_iovec_init_external(&req->qiov, &req->iov, 1);
+
+    /* the completion can run before bdrv_aio_readv() returns */
+    QEMU_IMG_LOCK(state);
+    state->in_flight++;
+    if (bdrv_aio_readv(bs, start >> BDRV_SECTOR_BITS, &req->qiov,
+                       (end - start) >> BDRV_SECTOR_BITS,
+                       qemu_img_aio_cb, req) == NULL) {
+        state->in_flight--;
+        QEMU_IMG_UNLOCK(state);
+        if (req->bounce)
+            qemu_vfree(req->bounce);
+        qemu_free(req);
+        return -EIO;
+    }
+    QEMU_IMG_UNLOCK(state);
+    return 0;
+}
+
+/**
+ * Function to collect completed asynchronous reads of qemu image. Up to
+ * max completions are stored in events. If wait is set and nothing has
+ * completed yet, it blocks until a read completes (unless none is in
+ * flight).
+ * Returns the number of completions stored.
+ */
+__declspec(dllexport) int qemu_img_aio_poll(void *opaque,
+                                            QEMU_IMG_AIO_EVENT *events,
+                                            int max, int wait)
+{
+    BlockDriverState *bs = (BlockDriverState *)opaque;
+    QemuImgState *state = bs->private;
+    int n = 0;
+
+    QEMU_IMG_LOCK(state);
+    if (wait) {
+        while (!state->done && state->in_flight)
+            qemu_img_wait(state, 1);
+    } else if (state->in_flight) {
+        qemu_img_wait(state, 0);
+    }
+
+    while (state->done && n < max) {
+        QemuImgAioReq *req = state->done;
+
+        state->done = req->next;
+        if (!state->done)
+            state->done_tail = &state->done;
+
+        events[n].tag = req->tag;
+        events[n].ret = req->ret;
+        n++;
+        qemu_free(req);
+    }
+    QEMU_IMG_UNLOCK(state);
+    return n;
 }
 
 /**
@@ -49,14 +543,98 @@ __declspec(dllexport) int qemu_img_read(void *bs, int64_t offset,
 __declspec(dllexport) int qemu_img_get_info(void *bs, int64_t *nsectors, 
                                     unsigned int *sect_size, int64_t *size)
 {
+    QemuImgState *state = ((BlockDriverState *)bs)->private;
     char fmt_name[128];
 
+    QEMU_IMG_LOCK(state);
     bdrv_get_format(bs, fmt_name, sizeof(fmt_name));
     bdrv_get_geometry(bs, (uint64_t*)nsectors);
+    QEMU_IMG_UNLOCK(state);
     *sect_size = 512;
     *size = *nsectors * (*sect_size);
-    printf("Image info: \n"
+    fprintf(stderr, "Image info: \n"
            "Format: %s\n sectors: %lld\nVirtual Size:%lld\n",
           fmt_name, (long long int)*nsectors, (long long int)*size);
     return 0;
 }
+
+/**
+ * Function to tell whether an open image can be used from several
+ * threads at once.
+ */
+__declspec(dllexport) int qemu_img_thread_safe(void)
+{
+#ifndef _WIN32
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Function to set the memory budget of the L2 table cache of an image
+ * and optionally fill the cache with its L2 tables.
+ */
+__declspec(dllexport) int qemu_img_set_cache(void *opaque, int64_t size,
+                                             int prefetch)
+{
+    BlockDriverState *bs = (BlockDriverState *)opaque;
+    QemuImgState *state = bs->private;
+    int ret = 0;
+
+    QEMU_IMG_LOCK(state);
+    if (size > 0)
+        ret = bdrv_set_cache_size(bs, size);
+    if (ret == 0 && prefetch)
+        ret = bdrv_prefetch_metadata(bs);
+    QEMU_IMG_UNLOCK(state);
+    return ret;
+}
+
+/**
+ * Function to get the L2 table and decompressed cluster cache counters
+ * of an image.
+ */
+__declspec(dllexport) int qemu_img_get_cache_stats(void *opaque,
+                                                   QEMU_IMG_CACHE_STATS *stats)
+{
+    BlockDriverState *bs = (BlockDriverState *)opaque;
+    QemuImgState *state = bs->private;
+    BlockCacheInfo bci;
+    int ret;
+
+    QEMU_IMG_LOCK(state);
+    ret = bdrv_get_cache_info(bs, &bci);
+    QEMU_IMG_UNLOCK(state);
+    if (ret < 0)
+        return ret;
+
+    stats->size = bci.size;
+    stats->used = bci.used;
+    stats->hits = bci.hits;
+    stats->misses = bci.misses;
+    stats->data_size = bci.data_size;
+    stats->data_used = bci.data_used;
+    stats->data_hits = bci.data_hits;
+    stats->data_misses = bci.data_misses;
+    stats->data_prefetched = bci.data_prefetched;
+    return 0;
+}
+
+/**
+ * Function to set the memory budget of the decompressed cluster cache of
+ * an image and the number of threads inflating clusters ahead of
+ * sequential reads (-1 for one per CPU).
+ */
+__declspec(dllexport) int qemu_img_set_data_cache(void *opaque, int64_t size,
+                                                  int threads)
+{
+    BlockDriverState *bs = (BlockDriverState *)opaque;
+    QemuImgState *state = bs->private;
+    int ret;
+
+    QEMU_IMG_LOCK(state);
+    ret = bdrv_set_data_cache(bs, size, threads);
+    QEMU_IMG_UNLOCK(state);
+    return ret;
+}
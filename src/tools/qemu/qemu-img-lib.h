@@ -1,11 +1,66 @@
 #ifndef QEMU_IMG_LIB_H
 #define QEMU_IMG_LIB_H
 
+/* One request of a batch passed to qemu_img_readv() */
+typedef struct {
+    int64_t offset;
+    size_t len;
+    uint8_t *buf;
+} QEMU_IMG_IOV;
+
+/* Completion returned by qemu_img_aio_poll() */
+typedef struct {
+    void *tag;                  /* tag passed to qemu_img_aio_submit() */
+    int ret;                    /* bytes read or a negative errno value */
+} QEMU_IMG_AIO_EVENT;
+
+/* Cache counters returned by qemu_img_get_cache_stats() */
+typedef struct {
+    int64_t size;               /* L2 cache memory budget in bytes */
+    int64_t used;               /* bytes holding tables */
+    uint64_t hits;
+    uint64_t misses;
+    int64_t data_size;          /* decompressed cluster cache budget */
+    int64_t data_used;          /* bytes holding clusters */
+    uint64_t data_hits;
+    uint64_t data_misses;
+    uint64_t data_prefetched;   /* clusters inflated ahead of reads */
+} QEMU_IMG_CACHE_STATS;
+
+/* Images are read through the posix-aio-compat thread pool. Set
+ * QEMU_IMG_AIO=native before qemu_img_open() to use Linux native AIO
+ * (the image is then opened with O_DIRECT).
+ *
+ * Images can be read from several threads at once if
+ * qemu_img_thread_safe() returns 1. Calls into the block layer are then
+ * serialized, except for reads of raw images.
+ *
+ * qcow2 images keep L2 tables in a cache of 4 MB. Set QEMU_IMG_L2_CACHE
+ * to a budget in bytes and QEMU_IMG_L2_PREFETCH=1 to load as many L2
+ * tables as it holds at open, or call qemu_img_set_cache() on an open
+ * image. vmdk images (including split and flat extents listed by a
+ * descriptor file) load their grain tables at open when they fit into
+ * 64 MB; QEMU_IMG_L2_CACHE sets this budget too.
+ *
+ * qcow and qcow2 images keep decompressed clusters in a cache of 4 MB and
+ * inflate the compressed clusters ahead of sequential reads on one thread
+ * per CPU. Set QEMU_IMG_ZCACHE to a budget in bytes and
+ * QEMU_IMG_INFLATE_THREADS to a number of threads (0 to inflate only on
+ * demand), or call qemu_img_set_data_cache() on an open image. */
+
 #ifndef WIN32
 #define __declspec(x)
 void* qemu_img_open(const char *);
+void qemu_img_close(void *);
 int qemu_img_read(void *, int64_t, uint8_t *, size_t );
+int64_t qemu_img_readv(void *, QEMU_IMG_IOV *, int);
+int qemu_img_aio_submit(void *, QEMU_IMG_IOV *, void *);
+int qemu_img_aio_poll(void *, QEMU_IMG_AIO_EVENT *, int, int);
 int qemu_img_get_info(void *, int64_t *, unsigned int *, int64_t *);
+int qemu_img_thread_safe(void);
+int qemu_img_set_cache(void *, int64_t, int);
+int qemu_img_get_cache_stats(void *, QEMU_IMG_CACHE_STATS *);
+int qemu_img_set_data_cache(void *, int64_t, int);
 #endif
 
 #endif
@@ -87,6 +87,12 @@
 
 #define REGF_OFFSET_NONE	0xffffffff
 
+/* offsets in the REGF block of the sequence numbers, which differ while 
+ * the hive is being written to, and of the last write time */
+#define REGF_SEQ1_OFF		0x0004
+#define REGF_SEQ2_OFF		0x0008
+#define REGF_MTIME_OFF		0x000c
+
 /* Flags for the vk records */
 
 #define VK_FLAG_NAME_PRESENT	0x0001
@@ -99,6 +105,10 @@
 #define NK_TYPE_NORMALKEY	0x0020
 #define NK_TYPE_ROOTKEY		0x002c
 
+/* offsets of the key name length and the name from the "nk" header */
+#define NK_NAME_LEN_OFF		0x0048
+#define NK_NAME_OFF		0x004c
+
 #define HBIN_STORE_REF(x, y) { x->hbin = y; y->ref_count++ };
 /* if the count == 0; we can clean up */
 #define HBIN_REMOVE_REF(x, y){ x->hbin = NULL; y->ref_count-- };
@@ -229,13 +239,41 @@ typedef struct {
 } REGF_NK_REC;
 
 
+/* Source a hive is read from.  regfi_open() reads from a file, 
+ * regfi_open_buffer() from memory and regfi_open_cb() from any 
+ * source the caller provides, such as a file inside of a disk image. 
+ */
+struct _regfi_raw_file;
+typedef struct _regfi_raw_file {
+  /* Reads count bytes at offset into buf.  Returns the number of bytes 
+   * read, which is only less than count at the end of the hive, or -1 
+   * on error. 
+   */
+  ssize_t (*read)(struct _regfi_raw_file* self, uint32 offset, 
+		  void* buf, size_t count);
+  /* Releases state when the hive is closed (may be NULL) */
+  void (*close)(struct _regfi_raw_file* self);
+  uint32 size;		/* size of the hive in bytes */
+  void* state;		/* for use by read and close */
+} REGFI_RAW_FILE;
+
+
 /* REGF block */
 typedef struct {
   /* run time information */
-  int fd;	  /* file descriptor */
+  REGFI_RAW_FILE raw;	/* source the hive is read from */
+  int fd;	  /* file descriptor (-1 if not read from a file) */
   int open_flags; /* flags passed to the open() call */
   void* mem_ctx;  /* memory context for run-time file access information */
-  REGF_HBIN* block_list; /* list of open hbin blocks */
+
+  /* The whole hive is kept in memory: mapped from the file, the caller's 
+   * buffer, or read from the source once at open. 
+   */
+  const char* data;	/* raw.size bytes of the hive */
+  char* data_buf;	/* data, if it was read into memory by regfi */
+  bool data_mapped;	/* data is mapped from fd */
+  REGF_HBIN* hbins;	/* all hbin blocks, sorted by first_hbin_off */
+  uint32 num_hbins;
   
   /* file format information */
   REGF_SK_REC* sec_desc_list;	/* list of security descriptors referenced 
@@ -278,6 +316,58 @@ typedef struct {
 } REGFI_ITER_POSITION;
 
 
+/* Index of the keys of a hive, which can be saved to a file and used 
+ * for later runs as long as the hive has not changed.  See 
+ * regfi_index_build().  The index file is:
+ *
+ *   header (REGFI_INDEX_HDR_SIZE bytes):
+ *     0x00  REGFI_INDEX_MAGIC
+ *     0x08  size, sequence numbers, last write time and root key 
+ *           offset of the hive it was built from
+ *     0x20  hash of the hive (REGFI_HASH_SIZE bytes)
+ *     0x28  number of keys
+ *     0x2c  size of the key names
+ *   keys (REGFI_INDEX_KEY_SIZE bytes each), the root first and the 
+ *   subkeys of every key next to each other, sorted by name:
+ *     0x00  NK record offset
+ *     0x04  number of the parent key (REGF_OFFSET_NONE for the root)
+ *     0x08  number of the first subkey
+ *     0x0c  number of subkeys
+ *     0x10  value list offset (REGF_OFFSET_NONE if there are no values)
+ *     0x14  number of values
+ *     0x18  last write time
+ *     0x20  offset of the key name
+ *   key names, nul terminated
+ *
+ * All numbers are little endian.
+ */
+#define REGFI_INDEX_MAGIC	"regfidx1"
+#define REGFI_INDEX_HDR_SIZE	0x40
+#define REGFI_INDEX_KEY_SIZE	0x24
+#define REGFI_HASH_SIZE		8
+
+typedef struct {
+  const char* data;	/* the index file */
+  uint32 size;
+  bool mapped;		/* data is mapped from the index file */
+  uint32 num_keys;
+  const char* names;	/* the key names */
+  uint32 names_size;
+} REGFI_INDEX;
+
+/* One key of an index, see regfi_index_get_key() */
+typedef struct {
+  uint32 nk_off;	/* for regfi_load_key() */
+  uint32 parent;
+  uint32 first_subkey;
+  uint32 num_subkeys;
+  uint32 values_off;
+  uint32 num_values;
+  NTTIME mtime;
+  const char* keyname;	/* points into the index */
+} REGFI_INDEX_KEY;
+
+
 /******************************************************************************/
 /* Function Declarations */
 
@@ -290,6 +380,8 @@ char*                 regfi_get_owner(SEC_DESC* sec_desc);
 char*                 regfi_get_group(SEC_DESC* sec_desc);
 
 REGF_FILE*            regfi_open(const char* filename);
+REGF_FILE*            regfi_open_buffer(const void* buf, uint32 len);
+REGF_FILE*            regfi_open_cb(const REGFI_RAW_FILE* raw);
 int                   regfi_close(REGF_FILE* r);
 
 REGFI_ITERATOR*       regfi_iterator_new(REGF_FILE* fh);
@@ -313,6 +405,23 @@ const REGF_VK_REC*    regfi_iterator_first_value(REGFI_ITERATOR* i);
 const REGF_VK_REC*    regfi_iterator_cur_value(REGFI_ITERATOR* i);
 const REGF_VK_REC*    regfi_iterator_next_value(REGFI_ITERATOR* i);
 
+REGF_NK_REC*          regfi_load_key(REGF_FILE* file, uint32 nk_off);
+bool                  regfi_hive_hash(REGF_FILE* file, uint8* hash);
+
+REGFI_INDEX*          regfi_index_build(REGF_FILE* file);
+bool                  regfi_index_write(const REGFI_INDEX* idx, 
+					const char* filename);
+REGFI_INDEX*          regfi_index_open(REGF_FILE* file, const char* filename,
+				       bool check_hash);
+bool                  regfi_index_current(const REGFI_INDEX* idx, 
+					  REGF_FILE* file, bool check_hash);
+void                  regfi_index_free(REGFI_INDEX* idx);
+bool                  regfi_index_get_key(const REGFI_INDEX* idx, uint32 num,
+					  REGFI_INDEX_KEY* key);
+bool                  regfi_index_find_key(const REGFI_INDEX* idx, 
+					   const char** path,
+					   REGFI_INDEX_KEY* key);
+
 
 /* Private Functions */
 REGF_NK_REC*          regfi_rootkey(REGF_FILE* file);
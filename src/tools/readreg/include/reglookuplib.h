@@ -0,0 +1,82 @@
+/*
+ * Exported functions of the reglookup library
+ */
+
+#ifndef _REGLOOKUPLIB_H_
+#define _REGLOOKUPLIB_H_
+
+#include <stdint.h>
+#include "win_specific.h"
+
+/* Reads len bytes at offset of a hive into buf for rll_open_cb().  Returns
+ * the number of bytes read (less than len only at the end of the hive) or
+ * -1 on error. */
+typedef long (*RLL_READ_CB)(void *state, unsigned int offset, char *buf,
+    unsigned int len);
+
+DLL_EXPORT void *rll_open_file(char *regfile);
+DLL_EXPORT void *rll_open_buffer(const char *buf, unsigned int len);
+DLL_EXPORT void *rll_open_cb(RLL_READ_CB read, unsigned int size,
+    void *state);
+DLL_EXPORT char **rll_get_value_strings(void *p, char *key, int subtree);
+DLL_EXPORT char **rll_get_value_dwords(void *p, char *key, int subtree);
+DLL_EXPORT char **rll_get_subtree_value_strings(void *p, char *key);
+DLL_EXPORT void rll_close(void *f);
+
+/* Structured queries
+ *
+ * rll_query() runs a batch of queries on a hive through a context and
+ * returns the matching values as typed records.  Nothing is kept in
+ * globals: a context and its hive are used by one thread at a time, and
+ * contexts on different hives can be used by many threads at once.
+ */
+
+/* Any value type in RLL_QUERY.type */
+#define RLL_TYPE_ANY -1
+
+typedef struct {
+    const char *path;           /* key, "/" separated from the root key */
+    const char *value_name;     /* only values of this name, case
+                                 * insensitive ("" is the default value),
+                                 * or NULL for all values */
+    int type;                   /* only values of this REG_* type of
+                                 * regfi.h, or RLL_TYPE_ANY */
+    int recursive;              /* also the values of all keys below */
+} RLL_QUERY;
+
+typedef struct {
+    unsigned int query;         /* index of the query it matched */
+    const char *key;            /* path of the key, names are not quoted */
+    const char *name;           /* value name, "" for the default value */
+    unsigned int type;          /* REG_* type */
+    const unsigned char *data;  /* raw data */
+    unsigned int data_len;
+    const char *str;            /* SZ, EXPAND_SZ and LINK data as UTF-8.
+                                 * MULTI_SZ data as UTF-8 strings that
+                                 * each end with a nul, followed by an
+                                 * empty string.  NULL for other types. */
+    uint64_t num;               /* DWORD, DWORD_BE and QWORD data */
+} RLL_RECORD;
+
+/* Status of each query */
+#define RLL_QUERY_OK 0
+#define RLL_QUERY_NOT_FOUND 1   /* there is no key at path */
+#define RLL_QUERY_ERROR 2       /* the hive could not be parsed */
+
+/* Result of rll_query(), in a single allocation */
+typedef struct {
+    unsigned int num_queries;
+    int *status;                /* RLL_QUERY_* of each query */
+    unsigned int num_records;
+    RLL_RECORD *records;        /* in the order of the queries */
+} RLL_RESULT;
+
+typedef struct _RLL_CTX RLL_CTX;
+
+DLL_EXPORT RLL_CTX *rll_ctx_new(void *hive);
+DLL_EXPORT void rll_ctx_free(RLL_CTX *ctx);
+DLL_EXPORT RLL_RESULT *rll_query(RLL_CTX *ctx, const RLL_QUERY *queries,
+    unsigned int num_queries);
+DLL_EXPORT void rll_result_free(RLL_RESULT *res);
+
+#endif
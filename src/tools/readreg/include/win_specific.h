@@ -16,6 +16,7 @@
 #define snprintf _snprintf
 #define strcasecmp _stricmp
 #define lseek _lseek
+#define ssize_t long
 
 #else
 #define DLL_EXPORT  
@@ -25,6 +25,10 @@
  */
 
 #include "../include/regfi.h"
+#include <stdint.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 
 /* Registry types mapping */
@@ -338,94 +342,129 @@ char* regfi_get_group(SEC_DESC *sec_desc)
 
 
 /*******************************************************************
+ Raw file readers used by regfi_open() and regfi_open_buffer()
  *******************************************************************/
-static int read_block( REGF_FILE *file, prs_struct *ps, uint32 file_offset, 
-		       uint32 block_size )
+static ssize_t regfi_fd_read( REGFI_RAW_FILE *self, uint32 offset, 
+			      void *buf, size_t count )
 {
-  const int hdr_size = 0x20;
-  int bytes_read, returned;
-  char *buffer;
-  SMB_STRUCT_STAT sbuf;
+  REGF_FILE *file = (REGF_FILE*)self->state;
+  size_t bytes_read = 0;
+  ssize_t returned;
 
-  /* check for end of file */
-
-  if ( fstat( file->fd, &sbuf ) ) {
-    /*DEBUG(0,("read_block: stat() failed! (%s)\n", strerror(errno)));*/
+  if ( lseek( file->fd, offset, SEEK_SET ) == -1 ) {
+    /*DEBUG(0,("regfi_fd_read: lseek() failed! (%s)\n", strerror(errno) ));*/
     return -1;
   }
 
-  if ( (size_t)file_offset >= sbuf.st_size )
-    return -1;
-	
-  /* if block_size == 0, we are parsnig HBIN records and need 
-     to read some of the header to get the block_size from there */
-	   
-  if ( block_size == 0 ) {
-    uint8 hdr[0x20];
-
-    if ( lseek( file->fd, file_offset, SEEK_SET ) == -1 ) {
-      /*DEBUG(0,("read_block: lseek() failed! (%s)\n", strerror(errno) ));*/
+  while ( bytes_read < count ) 
+  {
+    returned = read(file->fd, (char*)buf+bytes_read, count-bytes_read);
+    if(returned == -1)
+    {
+      if(errno == EINTR || errno == EAGAIN)
+	continue;
+      /*DEBUG(0,("regfi_fd_read: read() failed (%s)\n", strerror(errno) ));*/
       return -1;
     }
 
-    bytes_read = returned = 0;
-    while (bytes_read < hdr_size)
-    {
-      returned = read(file->fd, hdr + bytes_read, hdr_size - bytes_read);
-      if(returned == -1 && errno != EINTR && errno != EAGAIN)
-      {
-	/*DEBUG(0,("read_block: read of hdr failed (%s)\n",strerror(errno)));*/
-	return -1;
-      }
+    if(returned == 0)
+      break;
 
-      if(returned == 0)
-	return -1;
+    bytes_read += returned;
+  }
 
-      bytes_read += returned;
-    }
+  return bytes_read;
+}
 
-    /* make sure this is an hbin header */
 
-    if ( strncmp( (char*)hdr, "hbin", HBIN_HDR_SIZE ) != 0 ) {
-      /*DEBUG(0,("read_block: invalid block header!\n"));*/
-      return -1;
-    }
+static ssize_t regfi_buffer_read( REGFI_RAW_FILE *self, uint32 offset, 
+				  void *buf, size_t count )
+{
+  if ( offset >= self->size )
+    return 0;
+  if ( count > self->size - offset )
+    count = self->size - offset;
+
+  memcpy(buf, (const char*)self->state + offset, count);
+  return count;
+}
+
+
+/*******************************************************************
+ Read exactly count bytes at offset from the hive.  Returns false on 
+ errors and at the end of the hive.
+ *******************************************************************/
+static bool regfi_raw_read( REGF_FILE *file, uint32 offset, void *buf, 
+			    size_t count )
+{
+  size_t bytes_read = 0;
+  ssize_t returned;
 
-    block_size = IVAL( hdr, 0x08 );
+  while ( bytes_read < count ) 
+  {
+    returned = file->raw.read(&file->raw, offset+bytes_read, 
+			      (char*)buf+bytes_read, count-bytes_read);
+    if ( returned <= 0 )
+      return false;
+    bytes_read += returned;
   }
 
-  /*DEBUG(10,("read_block: block_size == 0x%x\n", block_size ));*/
+  return true;
+}
 
-  /* set the offset, initialize the buffer, and read the block from disk */
 
-  if ( lseek( file->fd, file_offset, SEEK_SET ) == -1 ) {
-    /*DEBUG(0,("read_block: lseek() failed! (%s)\n", strerror(errno) ));*/
-    return -1;
+/*******************************************************************
+ Make the whole hive available at file->data.  Files are mapped, 
+ buffers are used in place and everything else is read once.
+ *******************************************************************/
+static bool regfi_load_data( REGF_FILE *file )
+{
+  if ( file->raw.read == regfi_buffer_read ) {
+    file->data = (const char*)file->raw.state;
+    return true;
   }
-	
-  prs_init( ps, block_size, file->mem_ctx, UNMARSHALL );
-  buffer = ps->data_p;
-  bytes_read = returned = 0;
 
-  while ( bytes_read < block_size ) 
-  {
-    returned = read(file->fd, buffer+bytes_read, block_size-bytes_read);
-    if(returned == -1 && errno != EINTR && errno != EAGAIN)
-    {
-      /*DEBUG(0,("read_block: read() failed (%s)\n", strerror(errno) ));*/
-      return -1;
+#ifndef _WIN32
+  if ( file->fd != -1 ) {
+    void *map = mmap( NULL, file->raw.size, PROT_READ, MAP_SHARED, 
+		      file->fd, 0 );
+    if ( map != MAP_FAILED ) {
+      file->data = (const char*)map;
+      file->data_mapped = true;
+      return true;
     }
+  }
+#endif
 
-    if ((returned == 0) && (bytes_read < block_size)) 
-    {
-      /*DEBUG(0,("read_block: not a vald registry file ?\n" ));*/
-      return -1;
-    }	
+  if ( !(file->data_buf = (char*)malloc(file->raw.size)) )
+    return false;
 
-    bytes_read += returned;
-  }
-	
-  return bytes_read;
+  if ( !regfi_raw_read( file, 0, file->data_buf, file->raw.size ) )
+    return false;
+
+  file->data = file->data_buf;
+  return true;
+}
+
+
+/*******************************************************************
+ Point a parse buffer at len bytes of the hive starting at offset.  
+ The buffer is only ever unmarshalled, so it is never written to or 
+ grown.
+ *******************************************************************/
+static bool map_block( REGF_FILE *file, prs_struct *ps, uint32 offset, 
+		       uint32 len )
+{
+  if ( offset >= file->raw.size || len > file->raw.size - offset )
+    return false;
+
+  if ( !prs_init( ps, 0, file->mem_ctx, UNMARSHALL ) )
+    return false;
+
+  ps->data_p = (char*)file->data + offset;
+  ps->buffer_size = len;
+
+  return true;
 }
 
 
@@ -662,7 +701,7 @@ static bool read_regf_block( REGF_FILE *file )
 	
   /* grab the first block from the file */
 		
-  if ( read_block( file, &ps, 0, REGF_BLOCKSIZE ) == -1 )
+  if ( !map_block( file, &ps, 0, REGF_BLOCKSIZE ) )
     return false;
 	
   /* parse the block and verify the checksum */
@@ -671,12 +710,6 @@ static bool read_regf_block( REGF_FILE *file )
     return false;	
 		
   checksum = regf_block_checksum( &ps );
-	
-  if(ps.is_dynamic)
-    SAFE_FREE(ps.data_p);
-  ps.is_dynamic = false;
-  ps.buffer_size = 0;
-  ps.data_offset = 0;
 
   if ( file->checksum !=  checksum ) {
     /*DEBUG(0,("read_regf_block: invalid checksum\n" ));*/
@@ -689,89 +722,66 @@ static bool read_regf_block( REGF_FILE *file )
 
 /*******************************************************************
  *******************************************************************/
-static REGF_HBIN* read_hbin_block( REGF_FILE *file, off_t offset )
+static int hbin_cmp( const void *a, const void *b )
 {
-  REGF_HBIN *hbin;
-  uint32 record_size, curr_off, block_size, header=0;
-	
-  if ( !(hbin = (REGF_HBIN*)zalloc(sizeof(REGF_HBIN))) ) 
-    return NULL;
-  hbin->file_off = offset;
-  hbin->free_off = -1;
-		
-  if ( read_block( file, &hbin->ps, offset, 0 ) == -1 )
-    return NULL;
-	
-  if ( !prs_hbin_block( "hbin", &hbin->ps, 0, hbin ) )
-    return NULL;	
+  const REGF_HBIN *x = (const REGF_HBIN*)a;
+  const REGF_HBIN *y = (const REGF_HBIN*)b;
 
-  /* this should be the same thing as hbin->block_size but just in case */
-
-  block_size = hbin->ps.buffer_size;
-
-  /* Find the available free space offset.  Always at the end,
-     so walk the record list and stop when you get to the end.
-     The end is defined by a record header of 0xffffffff.  The 
-     previous 4 bytes contains the amount of free space remaining 
-     in the hbin block. */
-
-  /* remember that the record_size is in the 4 bytes preceeding the record itself */
-
-  if ( !prs_set_offset( &hbin->ps, file->data_offset+HBIN_HDR_SIZE-sizeof(uint32) ) )
-    return false;
-
-  record_size = 0;
-  curr_off = hbin->ps.data_offset;
-  while ( header != 0xffffffff ) {
-    /* not done yet so reset the current offset to the 
-       next record_size field */
+  if ( x->first_hbin_off < y->first_hbin_off )
+    return -1;
+  return x->first_hbin_off > y->first_hbin_off;
+}
 
-    curr_off = curr_off+record_size;
 
-    /* for some reason the record_size of the last record in
-       an hbin block can extend past the end of the block
-       even though the record fits within the remaining 
-       space....aaarrrgggghhhhhh */
+/*******************************************************************
+ Walk the hbin blocks following the REGF block once and build a 
+ table of them, sorted by their offset from the first hbin block.  
+ Every block's parse buffer points straight into the hive.
+ *******************************************************************/
+static bool regfi_load_hbins( REGF_FILE *file )
+{
+  REGF_HBIN *hbins = NULL, *tmp, *hbin;
+  uint32 num = 0, alloc = 0;
+  uint32 offset = REGF_BLOCKSIZE;
+  uint32 block_size;
 
-    if ( curr_off >= block_size ) {
-      record_size = -1;
-      curr_off = -1;
+  while ( offset <= file->raw.size - HBIN_HEADER_REC_SIZE
+	  && strncmp( file->data + offset, "hbin", HBIN_HDR_SIZE ) == 0 )
+  {
+    block_size = IVAL( file->data, offset + 0x08 );
+    if ( block_size < HBIN_HEADER_REC_SIZE 
+	 || block_size > file->raw.size - offset )
       break;
-    }
-
-    if ( !prs_set_offset( &hbin->ps, curr_off) )
-      return false;
-
-    if ( !prs_uint32( "rec_size", &hbin->ps, 0, &record_size ) )
-      return false;
-    if ( !prs_uint32( "header", &hbin->ps, 0, &header ) )
-      return false;
-		
-    assert( record_size != 0 );
 
-    if ( record_size & 0x80000000 ) {
-      /* absolute_value(record_size) */
-      record_size = (record_size ^ 0xffffffff) + 1;
+    if ( num == alloc ) {
+      alloc = alloc ? alloc*2 : 64;
+      if ( !(tmp = (REGF_HBIN*)realloc(hbins, alloc*sizeof(REGF_HBIN))) ) {
+	free( hbins );
+	return false;
+      }
+      hbins = tmp;
     }
-  }
 
-  /* save the free space offset */
-
-  if ( header == 0xffffffff ) {
-
-    /* account for the fact that the curr_off is 4 bytes behind the actual 
-       record header */
+    hbin = &hbins[num];
+    memset( hbin, 0, sizeof(REGF_HBIN) );
+    hbin->file_off = offset;
+    hbin->free_off = -1;
+    if ( !map_block( file, &hbin->ps, offset, block_size )
+	 || !prs_hbin_block( "hbin", &hbin->ps, 0, hbin ) )
+      break;
+    prs_set_offset( &hbin->ps, HBIN_HEADER_REC_SIZE );
+    num++;
 
-    hbin->free_off = curr_off + sizeof(uint32);
-    hbin->free_size = record_size;
+    offset += block_size;
   }
 
-  /*DEBUG(10,("read_hbin_block: free space offset == 0x%x\n", hbin->free_off));*/
+  if ( num > 1 )
+    qsort( hbins, num, sizeof(REGF_HBIN), hbin_cmp );
 
-  if ( !prs_set_offset( &hbin->ps, file->data_offset+HBIN_HDR_SIZE )  )
-    return false;
-	
-  return hbin;
+  file->hbins = hbins;
+  file->num_hbins = num;
+
+  return true;
 }
 
 
@@ -797,45 +807,22 @@ static bool hbin_contains_offset( REGF_HBIN *hbin, uint32 offset )
 *******************************************************************/
 static REGF_HBIN* lookup_hbin_block( REGF_FILE *file, uint32 offset )
 {
-  REGF_HBIN *hbin = NULL;
-  uint32 block_off;
-
-  /* start with the open list */
-
-  for ( hbin=file->block_list; hbin; hbin=hbin->next ) {
-    /* DEBUG(10,("lookup_hbin_block: address = 0x%x [0x%x]\n", hbin->file_off, (uint32)hbin ));*/
-    if ( hbin_contains_offset( hbin, offset ) )
-      return hbin;
-  }
-	
-  if ( !hbin ) {
-    /* start at the beginning */
-
-    block_off = REGF_BLOCKSIZE;
-    do {
-      /* cleanup before the next round */
-      if ( hbin )
-      {
-	if(hbin->ps.is_dynamic)
-	  SAFE_FREE(hbin->ps.data_p);
-	hbin->ps.is_dynamic = false;
-	hbin->ps.buffer_size = 0;
-	hbin->ps.data_offset = 0;
-      }
+  uint32 lo = 0, hi = file->num_hbins, mid;
 
-      hbin = read_hbin_block( file, block_off );
+  /* find the last block starting before offset */
 
-      if ( hbin ) 
-	block_off = hbin->file_off + hbin->block_size;
-
-    } while ( hbin && !hbin_contains_offset( hbin, offset ) );
+  while ( lo < hi ) {
+    mid = lo + (hi - lo)/2;
+    if ( file->hbins[mid].first_hbin_off < offset )
+      lo = mid + 1;
+    else
+      hi = mid;
   }
 
-  if ( hbin )
-    /* XXX: this kind of caching needs to be re-evaluated */
-    DLIST_ADD( file->block_list, hbin );
+  if ( lo > 0 && hbin_contains_offset( &file->hbins[lo-1], offset ) )
+    return &file->hbins[lo-1];
 
-  return hbin;
+  return NULL;
 }
 
 
@@ -891,14 +878,30 @@ static bool hbin_prs_lf_records(const char *desc, REGF_HBIN *hbin,
     return false;
 
   if ( hbin->ps.io ) {
+    const char *rec;
+
     if ( !(lf->hashes = (REGF_HASH_REC*)zcalloc(sizeof(REGF_HASH_REC), lf->num_keys )) )
       return false;
-  }
 
-  for ( i=0; i<lf->num_keys; i++ ) {
-    if ( !prs_hash_rec( "hash_rec", &hbin->ps, depth, &lf->hashes[i] ) )
+    /* large lists are common, so decode the records straight from 
+       the block instead of through prs_hash_rec() */
+
+    if ( lf->num_keys > (hbin->ps.buffer_size - hbin->ps.data_offset)/8 )
+      return false;
+    rec = hbin->ps.data_p + hbin->ps.data_offset;
+    for ( i=0; i<lf->num_keys; i++, rec += 8 ) {
+      lf->hashes[i].nk_off = IVAL( rec, 0 );
+      memcpy( lf->hashes[i].keycheck, rec+4, sizeof(lf->hashes[i].keycheck) );
+    }
+    if ( !prs_set_offset( &hbin->ps, hbin->ps.data_offset + 8*lf->num_keys ) )
       return false;
   }
+  else {
+    for ( i=0; i<lf->num_keys; i++ ) {
+      if ( !prs_hash_rec( "hash_rec", &hbin->ps, depth, &lf->hashes[i] ) )
+	return false;
+    }
+  }
 
   end_off = hbin->ps.data_offset;
 
@@ -1210,6 +1213,7 @@ static bool hbin_prs_key( REGF_FILE *file, REGF_HBIN *hbin, REGF_NK_REC *nk )
   REGF_HBIN *sub_hbin;
   
   depth++;
+  nk->hbin = hbin;
 
   /* get the initial nk record */
   if (!prs_nk_rec("nk_rec", &hbin->ps, depth, nk))
@@ -1329,6 +1333,8 @@ static bool next_record( REGF_HBIN *hbin, const char *hdr, bool *eob )
       found = true;
       curr_off += sizeof(uint32);
     }
+    else if ( record_size == 0 )
+      break;
   } 
 
   /* mark prs_struct as done ( at end ) if no more SK records */
@@ -1361,17 +1367,39 @@ static bool next_nk_record(REGF_FILE *file, REGF_HBIN *hbin,
 
 
 /*******************************************************************
- Open the registry file and then read in the REGF block to get the 
- first hbin offset.
+ Load a hive whose source is already set up, read in the REGF block 
+ and index its hbin blocks.  Frees the hive on failure.
 *******************************************************************/
-REGF_FILE* regfi_open( const char *filename )
+static REGF_FILE* regfi_open_raw( REGF_FILE *rb )
+{
+  /* the REGF block and an hbin header have to be there */
+
+  if ( rb->raw.size < REGF_BLOCKSIZE + HBIN_HEADER_REC_SIZE 
+       || !regfi_load_data( rb ) ) {
+    regfi_close( rb );
+    return NULL;
+  }
+
+  /* read in an existing file */
+	
+  if ( !read_regf_block( rb ) || !regfi_load_hbins( rb ) ) {
+    /* DEBUG(0,("regfi_open: Failed to read initial REGF block\n"));*/
+    regfi_close( rb );
+    return NULL;
+  }
+	
+  /* success */
+	
+  return rb;
+}
+
+
+/*******************************************************************
+ Allocate an empty hive structure.
+*******************************************************************/
+static REGF_FILE* regfi_alloc()
 {
   REGF_FILE *rb;
-  int flags = O_RDONLY;
-  
-#ifdef _WIN32
-  flags |= O_BINARY;
-#endif
 
   if ( !(rb = (REGF_FILE*)malloc(sizeof(REGF_FILE))) ) {
     /* DEBUG(0,("ERROR allocating memory\n")); */
@@ -1386,6 +1414,27 @@ REGF_FILE* regfi_open( const char *filename )
     return NULL;
     }
   */
+
+  return rb;
+}
+
+
+/*******************************************************************
+ Open the registry file and then read in the REGF block to get the 
+ first hbin offset.
+*******************************************************************/
+REGF_FILE* regfi_open( const char *filename )
+{
+  REGF_FILE *rb;
+  SMB_STRUCT_STAT sbuf;
+  int flags = O_RDONLY;
+  
+#ifdef _WIN32
+  flags |= O_BINARY;
+#endif
+
+  if ( !(rb = regfi_alloc()) )
+    return NULL;
   rb->open_flags = flags;
 	
   /* open and existing file */
@@ -1395,18 +1444,64 @@ REGF_FILE* regfi_open( const char *filename )
     regfi_close( rb );
     return NULL;
   }
-	
-  /* read in an existing file */
-	
-  if ( !read_regf_block( rb ) ) {
-    /* DEBUG(0,("regfi_open: Failed to read initial REGF block\n"));*/
+
+  /* offsets in the hive are 32 bits, so are the sizes of real hives */
+
+  if ( fstat( rb->fd, &sbuf ) || (sbuf.st_size != (uint32)sbuf.st_size) ) {
     regfi_close( rb );
     return NULL;
   }
+
+  rb->raw.read = regfi_fd_read;
+  rb->raw.size = (uint32)sbuf.st_size;
+  rb->raw.state = rb;
 	
-  /* success */
-	
-  return rb;
+  return regfi_open_raw( rb );
+}
+
+
+/*******************************************************************
+ Open a hive that is already in memory.  The buffer is not copied 
+ and has to stay valid until the hive is closed.
+*******************************************************************/
+REGF_FILE* regfi_open_buffer( const void *buf, uint32 len )
+{
+  REGF_FILE *rb;
+
+  if ( !buf || !(rb = regfi_alloc()) )
+    return NULL;
+
+  rb->raw.read = regfi_buffer_read;
+  rb->raw.size = len;
+  rb->raw.state = (void*)buf;
+
+  return regfi_open_raw( rb );
+}
+
+
+/*******************************************************************
+ Open a hive that is read through the callbacks in raw, which are 
+ copied.  raw->close is called when the hive is closed, also when 
+ opening it fails.
+*******************************************************************/
+REGF_FILE* regfi_open_cb( const REGFI_RAW_FILE *raw )
+{
+  REGF_FILE *rb;
+
+  if ( !raw || !raw->read )
+    return NULL;
+
+  if ( !(rb = regfi_alloc()) ) {
+    if ( raw->close ) {
+      REGFI_RAW_FILE tmp = *raw;
+      tmp.close( &tmp );
+    }
+    return NULL;
+  }
+
+  rb->raw = *raw;
+
+  return regfi_open_raw( rb );
 }
 
 
@@ -1433,13 +1528,25 @@ int regfi_close( REGF_FILE *file )
 
   /* nothing to do if there is no open file */
 
-  if ( !file || (file->fd == -1) )
+  if ( !file )
     return 0;
+
+  SAFE_FREE( file->hbins );
+#ifndef _WIN32
+  if ( file->data_mapped )
+    munmap( (void*)file->data, file->raw.size );
+#endif
+  SAFE_FREE( file->data_buf );
+
+  if ( file->raw.close )
+    file->raw.close( &file->raw );
 		
   fd = file->fd;
   file->fd = -1;
   SAFE_FREE( file );
 
+  if ( fd == -1 )
+    return 0;
   return close( fd );
 }
 
@@ -1452,7 +1559,7 @@ REGF_NK_REC* regfi_rootkey( REGF_FILE *file )
 {
   REGF_NK_REC *nk;
   REGF_HBIN   *hbin;
-  uint32      offset = REGF_BLOCKSIZE;
+  uint32      i;
   bool        found = false;
   bool        eob;
 	
@@ -1463,43 +1570,43 @@ REGF_NK_REC* regfi_rootkey( REGF_FILE *file )
     /*DEBUG(0,("regfi_rootkey: zalloc() failed!\n"));*/
     return NULL;
   }
+
+  /* the REGF block points at the root key */
+
+  hbin = lookup_hbin_block( file, file->data_offset );
+  if ( hbin 
+       && prs_set_offset( &hbin->ps, HBIN_HDR_SIZE + file->data_offset 
+			  - hbin->first_hbin_off )
+       && hbin_prs_key( file, hbin, nk ) 
+       && nk->key_type == NK_TYPE_ROOTKEY )
+    return nk;
 	
-  /* scan through the file on HBIN block at a time looking 
-     for an NK record with a type == 0x002c.
-     Normally this is the first nk record in the first hbin 
-     block (but I'm not assuming that for now) */
+  /* otherwise scan through the file on HBIN block at a time looking 
+     for an NK record with a type == 0x002c. */
 	
-  while ( (hbin = read_hbin_block( file, offset )) ) {
+  for ( i=0; i < file->num_hbins && !found; i++ ) {
+    hbin = &file->hbins[i];
+    prs_set_offset( &hbin->ps, HBIN_HEADER_REC_SIZE );
     eob = false;
 
-    while ( !eob) {
+    while ( !eob ) {
       if ( next_nk_record( file, hbin, nk, &eob ) ) {
 	if ( nk->key_type == NK_TYPE_ROOTKEY ) {
 	  found = true;
 	  break;
 	}
       }
-      if(hbin->ps.is_dynamic)
-	SAFE_FREE(hbin->ps.data_p);
-      hbin->ps.is_dynamic = false;
-      hbin->ps.buffer_size = 0;
-      hbin->ps.data_offset = 0;
+      else if ( !eob )
+	break;
     }
-		
-    if ( found ) 
-      break;
-
-    offset += hbin->block_size;
   }
 	
   if ( !found ) {
     /*DEBUG(0,("regfi_rootkey: corrupt registry file ?  No root key record located\n"));*/
+    free( nk );
     return NULL;
   }
 
-  /* XXX: this kind of caching needs to be re-evaluated */
-  DLIST_ADD( file->block_list, hbin );
-
   return nk;
 }
 
@@ -1522,6 +1629,8 @@ void regfi_key_free(REGF_NK_REC* nk)
     free(nk->values);
   }
 
+  if(nk->subkeys.hashes != NULL)
+    free(nk->subkeys.hashes);
   if(nk->keyname != NULL)
     free(nk->keyname);
   if(nk->classname != NULL)
@@ -1533,6 +1642,42 @@ void regfi_key_free(REGF_NK_REC* nk)
 }
 
 
+/******************************************************************************
+ * Parses the key whose NK record is at nk_off, an offset from the first 
+ * hbin block like the ones in subkey lists.  The key has to be freed 
+ * with regfi_key_free().
+ *****************************************************************************/
+REGF_NK_REC* regfi_load_key(REGF_FILE* file, uint32 nk_off)
+{
+  REGF_NK_REC* nk;
+  REGF_HBIN* hbin;
+
+  /* find the HBIN block which should contain the nk record */
+  hbin = lookup_hbin_block(file, nk_off);
+  if(!hbin)
+  {
+    /* XXX: should print out some kind of error message every time here */
+    /*DEBUG(0,("hbin_prs_key: Failed to find HBIN block containing offset [0x%x]\n", 
+      nk_off));*/
+    return NULL;
+  }
+  
+  if(!prs_set_offset(&hbin->ps, HBIN_HDR_SIZE + nk_off - hbin->first_hbin_off))
+    return NULL;
+		
+  if(!(nk = (REGF_NK_REC*)zalloc(sizeof(REGF_NK_REC))))
+    return NULL;
+
+  if(!hbin_prs_key(file, hbin, nk))
+  {
+    regfi_key_free(nk);
+    return NULL;
+  }
+
+  return nk;
+}
+
+
 /******************************************************************************
  *****************************************************************************/
 REGFI_ITERATOR* regfi_iterator_new(REGF_FILE* fh)
@@ -1580,6 +1725,7 @@ void regfi_iterator_free(REGFI_ITERATOR* i)
     regfi_key_free(cur->nk);
     free(cur);
   }
+  void_stack_free(i->key_positions);
   
   free(i);
 }
@@ -1653,39 +1799,141 @@ bool regfi_iterator_to_root(REGFI_ITERATOR* i)
 }
 
 
-/******************************************************************************
- *****************************************************************************/
-bool regfi_iterator_find_subkey(REGFI_ITERATOR* i, const char* subkey_name)
+/*******************************************************************
+ ASCII upper case, as used by the hashes of lh subkey lists
+ *******************************************************************/
+static uint8 regfi_ascii_upper( uint8 c )
 {
-  REGF_NK_REC* subkey;
-  bool found = false;
-  uint32 old_subkey = i->cur_subkey;
-  
-  if(subkey_name == NULL)
+  if ( c >= 'a' && c <= 'z' )
+    return c - 'a' + 'A';
+  return c;
+}
+
+
+/*******************************************************************
+ Compute the hash an lh subkey list stores for a key name.  Windows 
+ hashes the Unicode upper case of the name, so this only returns 
+ true for plain ASCII names.
+ *******************************************************************/
+static bool regfi_lh_hash( const char *name, uint32 *hash )
+{
+  uint32 h = 0;
+
+  for ( ; *name; name++ ) {
+    if ( (uint8)*name & 0x80 )
+      return false;
+    h = h*37 + regfi_ascii_upper( (uint8)*name );
+  }
+
+  *hash = h;
+  return true;
+}
+
+
+/*******************************************************************
+ Check the name hint of an lf subkey list entry, the first four 
+ characters of the name, zero padded.  Returns false only if the 
+ entry cannot be that key.
+ *******************************************************************/
+static bool lf_hint_may_match( const REGF_HASH_REC *hash, 
+			       const char *name, uint32 name_len )
+{
+  uint32 k;
+
+  for ( k=0; k < sizeof(hash->keycheck) && k < name_len; k++ ) {
+    if ( hash->keycheck[k] != 0 
+	 && regfi_ascii_upper( hash->keycheck[k] ) 
+	 != regfi_ascii_upper( (uint8)name[k] ) )
+      return false;
+  }
+
+  return true;
+}
+
+
+/*******************************************************************
+ Compare the name of the nk record at offset with name, straight from 
+ the hive and without parsing the record.
+ *******************************************************************/
+static bool nk_name_matches( REGF_FILE *file, uint32 nk_off, 
+			     const char *name, uint32 name_len )
+{
+  REGF_HBIN *hbin;
+  const char *nk;
+  uint32 pos, len;
+
+  if ( !(hbin = lookup_hbin_block( file, nk_off )) )
+    return false;
+
+  pos = HBIN_HDR_SIZE + nk_off - hbin->first_hbin_off;
+  if ( hbin->ps.buffer_size < NK_NAME_OFF 
+       || pos > hbin->ps.buffer_size - NK_NAME_OFF )
+    return false;
+
+  nk = hbin->ps.data_p + pos;
+  if ( memcmp( nk, "nk", REC_HDR_SIZE ) != 0 )
+    return false;
+
+  len = SVAL( nk, NK_NAME_LEN_OFF );
+  if ( len == 0 || len > hbin->ps.buffer_size - NK_NAME_OFF - pos )
+    return false;
+
+  /* keynames are compared up to the first nul, like strcasecmp() would */
+
+  nk += NK_NAME_OFF;
+  if ( len > name_len && nk[name_len] != '\0' )
     return false;
+  if ( len < name_len || memchr( nk, '\0', name_len ) )
+    return false;
+
+  return strncasecmp( nk, name, name_len ) == 0;
+}
+
+
+/******************************************************************************
+ * Uses the hints and hashes of lf and lh subkey lists to skip subkeys 
+ * that cannot match, and compares the names of the others in place, so 
+ * no subkey is parsed.
+ *****************************************************************************/
+bool regfi_iterator_find_subkey(REGFI_ITERATOR* i, const char* subkey_name)
+{
+  const REGF_LF_REC* lf;
+  const REGF_HASH_REC* hash;
+  uint32 x, num, name_len, name_hash = 0;
+  bool use_hash, use_hint;
+  
+  if(subkey_name == NULL || i->cur_key == NULL
+     || i->cur_key->subkeys_off == REGF_OFFSET_NONE)
+    return false;
+
+  lf = &i->cur_key->subkeys;
+  num = i->cur_key->num_subkeys;
+  if(lf->hashes == NULL)
+    return false;
+  if(num > lf->num_keys)
+    num = lf->num_keys;
 
-  /* XXX: this alloc/free of each sub key might be a bit excessive */
-  subkey = (REGF_NK_REC*)regfi_iterator_first_subkey(i);
-  while((subkey != NULL) && (found == false))
+  /* other list types are searched by name alone */
+  name_len = strlen(subkey_name);
+  use_hash = (memcmp(lf->header, "lh", REC_HDR_SIZE) == 0)
+    && regfi_lh_hash(subkey_name, &name_hash);
+  use_hint = (memcmp(lf->header, "lf", REC_HDR_SIZE) == 0);
+
+  for(x=0, hash=lf->hashes; x < num; x++, hash++)
   {
-    if(subkey->keyname != NULL 
-       && strcasecmp(subkey->keyname, subkey_name) == 0)
-      found = true;
-    else
+    if(use_hash && IVAL(hash->keycheck, 0) != name_hash)
+      continue;
+    if(use_hint && !lf_hint_may_match(hash, subkey_name, name_len))
+      continue;
+
+    if(nk_name_matches(i->f, hash->nk_off, subkey_name, name_len))
     {
-      regfi_key_free(subkey);
-      subkey = (REGF_NK_REC*)regfi_iterator_next_subkey(i);
+      i->cur_subkey = x;
+      return true;
     }
   }
 
-  if(found == false)
-  {
-    i->cur_subkey = old_subkey;
-    return false;
-  }
-
-  regfi_key_free(subkey);
-  return true;
+  return false;
 }
 
 
@@ -1735,41 +1983,13 @@ const REGF_NK_REC* regfi_iterator_first_subkey(REGFI_ITERATOR* i)
  *****************************************************************************/
 const REGF_NK_REC* regfi_iterator_cur_subkey(REGFI_ITERATOR* i)
 {
-  REGF_NK_REC* subkey;
-  REGF_HBIN* hbin;
-  uint32 nk_offset;
-
   /* see if there is anything left to report */
   if (!(i->cur_key) || (i->cur_key->subkeys_off==REGF_OFFSET_NONE)
       || (i->cur_subkey >= i->cur_key->num_subkeys))
     return NULL;
 
-  nk_offset = i->cur_key->subkeys.hashes[i->cur_subkey].nk_off;
-
-  /* find the HBIN block which should contain the nk record */
-  hbin = lookup_hbin_block(i->f, nk_offset);
-  if(!hbin)
-  {
-    /* XXX: should print out some kind of error message every time here */
-    /*DEBUG(0,("hbin_prs_key: Failed to find HBIN block containing offset [0x%x]\n", 
-      i->cur_key->subkeys.hashes[i->cur_subkey].nk_off));*/
-    return NULL;
-  }
-  
-  if(!prs_set_offset(&hbin->ps, 
-		     HBIN_HDR_SIZE + nk_offset - hbin->first_hbin_off))
-    return NULL;
-		
-  if(!(subkey = (REGF_NK_REC*)zalloc(sizeof(REGF_NK_REC))))
-    return NULL;
-
-  if(!hbin_prs_key(i->f, hbin, subkey))
-  {
-    regfi_key_free(subkey);
-    return NULL;
-  }
-
-  return subkey;
+  return regfi_load_key(i->f, 
+			i->cur_key->subkeys.hashes[i->cur_subkey].nk_off);
 }
 
 
@@ -1853,3 +2073,546 @@ const REGF_VK_REC* regfi_iterator_next_value(REGFI_ITERATOR* i)
 
   return ret_val;
 }
+
+
+/******************************************************************************
+ * Hive indexes
+ *****************************************************************************/
+
+/* index header fields after the ones copied from the hive */
+#define INDEX_HASH_OFF		0x20
+#define INDEX_NUM_KEYS_OFF	0x28
+#define INDEX_NAMES_SIZE_OFF	0x2c
+
+/* FNV-1a, with the 64 bit constants built from halves for C89 */
+#define HIVE_HASH_BASIS		((uint64_t)0xcbf29ce4 << 32 | 0x84222325)
+#define HIVE_HASH_PRIME		((uint64_t)0x00000100 << 32 | 0x000001b3)
+
+/* a key of an index that is being built */
+typedef struct {
+  uint32 nk_off;
+  uint32 parent;
+  uint32 first_subkey;
+  uint32 num_subkeys;
+  uint32 values_off;
+  uint32 num_values;
+  NTTIME mtime;
+  uint32 name_off;
+} INDEX_ENTRY;
+
+/* where a key ends up in the index */
+typedef struct {
+  const char* name;
+  uint32 num;
+} INDEX_ORDER;
+
+
+/******************************************************************************
+ * Hashes all of the hive into hash (REGFI_HASH_SIZE bytes).  This reads 
+ * the whole hive, unlike the checks of regfi_index_current() without 
+ * check_hash.
+ *****************************************************************************/
+bool regfi_hive_hash(REGF_FILE* file, uint8* hash)
+{
+  uint64_t h = HIVE_HASH_BASIS;
+  const uint8* p;
+  uint32 x;
+
+  if(file == NULL || file->data == NULL || hash == NULL)
+    return false;
+
+  p = (const uint8*)file->data;
+  for(x=0; x < file->raw.size; x++)
+    h = (h ^ p[x]) * HIVE_HASH_PRIME;
+
+  for(x=0; x < REGFI_HASH_SIZE; x++)
+    hash[x] = (uint8)(h >> 8*x);
+
+  return true;
+}
+
+
+/******************************************************************************
+ * Writes the part of an index header that identifies the hive: its 
+ * size, the sequence numbers and last write time from the REGF block, 
+ * which Windows updates on every write, and the root key offset.
+ *****************************************************************************/
+static void index_stamp(REGF_FILE* file, char* hdr)
+{
+  memcpy(hdr, REGFI_INDEX_MAGIC, 8);
+  SIVAL(hdr, 0x08, file->raw.size);
+  memcpy(hdr+0x0c, file->data+REGF_SEQ1_OFF, sizeof(uint32));
+  memcpy(hdr+0x10, file->data+REGF_SEQ2_OFF, sizeof(uint32));
+  memcpy(hdr+0x14, file->data+REGF_MTIME_OFF, sizeof(NTTIME));
+  SIVAL(hdr, 0x1c, file->data_offset);
+}
+
+
+/******************************************************************************
+ * Checks the header of the index file in data and returns an index 
+ * using it, or NULL.  The keys are checked when they are read.
+ *****************************************************************************/
+static REGFI_INDEX* index_init(const char* data, uint32 size, bool mapped)
+{
+  REGFI_INDEX* idx;
+  uint32 num_keys, names_size;
+
+  if(size < REGFI_INDEX_HDR_SIZE 
+     || memcmp(data, REGFI_INDEX_MAGIC, 8) != 0)
+    return NULL;
+
+  num_keys = IVAL(data, INDEX_NUM_KEYS_OFF);
+  names_size = IVAL(data, INDEX_NAMES_SIZE_OFF);
+  if(num_keys == 0 
+     || num_keys > (size - REGFI_INDEX_HDR_SIZE)/REGFI_INDEX_KEY_SIZE)
+    return NULL;
+
+  /* names_size > 0 and the names have to end in a nul */
+  if(names_size != size - REGFI_INDEX_HDR_SIZE 
+                   - num_keys*REGFI_INDEX_KEY_SIZE
+     || names_size == 0 || data[size-1] != '\0')
+    return NULL;
+
+  if(!(idx = (REGFI_INDEX*)zalloc(sizeof(REGFI_INDEX))))
+    return NULL;
+
+  idx->data = data;
+  idx->size = size;
+  idx->mapped = mapped;
+  idx->num_keys = num_keys;
+  idx->names = data + size - names_size;
+  idx->names_size = names_size;
+
+  return idx;
+}
+
+
+/******************************************************************************
+ *****************************************************************************/
+static bool index_add_key(INDEX_ENTRY** keys, uint32* num, uint32* alloc,
+			  uint32 nk_off, uint32 parent)
+{
+  INDEX_ENTRY* tmp;
+
+  if(*num == *alloc)
+  {
+    *alloc = *alloc ? *alloc*2 : 1024;
+    if(!(tmp = (INDEX_ENTRY*)realloc(*keys, *alloc*sizeof(INDEX_ENTRY))))
+      return false;
+    *keys = tmp;
+  }
+
+  memset(&(*keys)[*num], 0, sizeof(INDEX_ENTRY));
+  (*keys)[*num].nk_off = nk_off;
+  (*keys)[*num].parent = parent;
+  (*num)++;
+
+  return true;
+}
+
+
+/******************************************************************************
+ *****************************************************************************/
+static bool index_add_name(char** names, uint32* size, uint32* alloc,
+			   const char* name, uint32* off)
+{
+  uint32 len = strlen(name) + 1;
+  char* tmp;
+
+  if(*alloc - *size < len)
+  {
+    *alloc = *alloc ? *alloc*2 : 0x10000;
+    if(*alloc - *size < len)
+      *alloc = *size + len;
+    if(!(tmp = (char*)realloc(*names, *alloc)))
+      return false;
+    *names = tmp;
+  }
+
+  memcpy(*names + *size, name, len);
+  *off = *size;
+  *size += len;
+
+  return true;
+}
+
+
+/******************************************************************************
+ *****************************************************************************/
+static int index_order_cmp(const void* a, const void* b)
+{
+  return strcasecmp(((const INDEX_ORDER*)a)->name, 
+		    ((const INDEX_ORDER*)b)->name);
+}
+
+
+/******************************************************************************
+ * Builds an index of all of the keys of the hive, which can be saved 
+ * with regfi_index_write() to be opened with regfi_index_open() by 
+ * later runs.  Every key is parsed once.  Returns NULL if a key can't 
+ * be parsed, the iterators are the way to get at what is left of a 
+ * corrupt hive.
+ *****************************************************************************/
+REGFI_INDEX* regfi_index_build(REGF_FILE* file)
+{
+  INDEX_ENTRY* keys = NULL;
+  INDEX_ENTRY* k;
+  INDEX_ORDER* order = NULL;
+  uint32* new_num = NULL;
+  char* names = NULL;
+  char* data = NULL;
+  char* p;
+  REGF_NK_REC* root;
+  REGF_NK_REC* nk;
+  REGFI_INDEX* idx = NULL;
+  uint32 num = 0, alloc = 0, names_size = 0, names_alloc = 0;
+  uint32 max_keys, size, x, y, n;
+
+  if(file == NULL || (nk = root = regfi_rootkey(file)) == NULL)
+    return NULL;
+
+  /* Every key has an NK record of its own.  This bounds the keys of a 
+   * corrupt hive whose subkey lists loop. 
+   */
+  max_keys = file->raw.size / NK_NAME_OFF;
+
+  if(!index_add_key(&keys, &num, &alloc, root->hbin->first_hbin_off 
+		    + root->hbin_off - HBIN_HDR_SIZE, REGF_OFFSET_NONE))
+    goto error;
+
+  /* breadth first, so the subkeys of a key end up next to each other */
+  for(x=0; x < num; x++)
+  {
+    if(x > 0 && (nk = regfi_load_key(file, keys[x].nk_off)) == NULL)
+      goto error;
+
+    k = &keys[x];
+    k->mtime = nk->mtime;
+    k->values_off = REGF_OFFSET_NONE;
+    if(nk->num_values && nk->values_off != REGF_OFFSET_NONE)
+    {
+      k->values_off = nk->values_off;
+      k->num_values = nk->num_values;
+    }
+    if(!index_add_name(&names, &names_size, &names_alloc,
+		       nk->keyname ? nk->keyname : "", &k->name_off))
+      goto error;
+
+    n = 0;
+    if(nk->subkeys_off != REGF_OFFSET_NONE && nk->subkeys.hashes != NULL)
+      n = MIN(nk->num_subkeys, nk->subkeys.num_keys);
+    if(n > max_keys - num)
+      goto error;
+    k->first_subkey = num;
+    k->num_subkeys = n;
+
+    for(y=0; y < n; y++)
+    {
+      if(!index_add_key(&keys, &num, &alloc, 
+			nk->subkeys.hashes[y].nk_off, x))
+	goto error;
+    }
+
+    regfi_key_free(nk);
+    nk = NULL;
+  }
+
+  /* sort the subkeys of every key by name */
+  order = (INDEX_ORDER*)malloc(num*sizeof(INDEX_ORDER));
+  new_num = (uint32*)malloc(num*sizeof(uint32));
+  if(order == NULL || new_num == NULL)
+    goto error;
+
+  for(x=0; x < num; x++)
+  {
+    order[x].name = names + keys[x].name_off;
+    order[x].num = x;
+  }
+  for(x=0; x < num; x++)
+  {
+    if(keys[x].num_subkeys > 1)
+      qsort(order + keys[x].first_subkey, keys[x].num_subkeys, 
+	    sizeof(INDEX_ORDER), index_order_cmp);
+  }
+  for(x=0; x < num; x++)
+    new_num[order[x].num] = x;
+
+  size = REGFI_INDEX_HDR_SIZE + num*REGFI_INDEX_KEY_SIZE + names_size;
+  if(!(data = (char*)zalloc(size)))
+    goto error;
+
+  index_stamp(file, data);
+  regfi_hive_hash(file, (uint8*)data + INDEX_HASH_OFF);
+  SIVAL(data, INDEX_NUM_KEYS_OFF, num);
+  SIVAL(data, INDEX_NAMES_SIZE_OFF, names_size);
+
+  for(x=0; x < num; x++)
+  {
+    k = &keys[order[x].num];
+    p = data + REGFI_INDEX_HDR_SIZE + x*REGFI_INDEX_KEY_SIZE;
+    SIVAL(p, 0x00, k->nk_off);
+    SIVAL(p, 0x04, (k->parent == REGF_OFFSET_NONE) 
+	  ? REGF_OFFSET_NONE : new_num[k->parent]);
+    SIVAL(p, 0x08, k->first_subkey);
+    SIVAL(p, 0x0c, k->num_subkeys);
+    SIVAL(p, 0x10, k->values_off);
+    SIVAL(p, 0x14, k->num_values);
+    SIVAL(p, 0x18, k->mtime.low);
+    SIVAL(p, 0x1c, k->mtime.high);
+    SIVAL(p, 0x20, k->name_off);
+  }
+  memcpy(data + size - names_size, names, names_size);
+
+  if(!(idx = index_init(data, size, false)))
+    free(data);
+
+ error:
+  if(nk != NULL)
+    regfi_key_free(nk);
+  SAFE_FREE(keys);
+  SAFE_FREE(order);
+  SAFE_FREE(new_num);
+  SAFE_FREE(names);
+
+  return idx;
+}
+
+
+/******************************************************************************
+ * Saves an index.  It is written to another file first and renamed, so 
+ * runs that have the old index open keep reading the old one.
+ *****************************************************************************/
+bool regfi_index_write(const REGFI_INDEX* idx, const char* filename)
+{
+  char* tmp;
+  FILE* fp;
+  bool ret;
+
+  if(idx == NULL || filename == NULL)
+    return false;
+
+  if(!(tmp = (char*)malloc(strlen(filename) + 5)))
+    return false;
+  sprintf(tmp, "%s.tmp", filename);
+
+  if(!(fp = fopen(tmp, "wb")))
+  {
+    free(tmp);
+    return false;
+  }
+
+  ret = (fwrite(idx->data, 1, idx->size, fp) == idx->size);
+  ret = (fclose(fp) == 0) && ret;
+
+#ifdef _WIN32
+  /* rename() does not replace files */
+  if(ret)
+    unlink(filename);
+#endif
+  ret = ret && (rename(tmp, filename) == 0);
+
+  if(!ret)
+    unlink(tmp);
+  free(tmp);
+
+  return ret;
+}
+
+
+/******************************************************************************
+ * Opens an index saved by regfi_index_write() for file.  The index file 
+ * is mapped if possible.  Returns NULL if there is no index file, it is 
+ * damaged, or it is not current for the hive (see regfi_index_current()).
+ *****************************************************************************/
+REGFI_INDEX* regfi_index_open(REGF_FILE* file, const char* filename,
+			      bool check_hash)
+{
+  REGFI_INDEX* idx;
+  SMB_STRUCT_STAT sbuf;
+  char* data = NULL;
+  bool mapped = false;
+  uint32 size, done;
+  ssize_t got;
+  int flags = O_RDONLY;
+  int fd;
+
+#ifdef _WIN32
+  flags |= O_BINARY;
+#endif
+
+  if(file == NULL || filename == NULL || (fd = open(filename, flags)) == -1)
+    return NULL;
+
+  if(fstat(fd, &sbuf) || sbuf.st_size < REGFI_INDEX_HDR_SIZE 
+     || sbuf.st_size != (uint32)sbuf.st_size)
+  {
+    close(fd);
+    return NULL;
+  }
+  size = (uint32)sbuf.st_size;
+
+#ifndef _WIN32
+  data = (char*)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if(data != (char*)MAP_FAILED)
+    mapped = true;
+  else
+    data = NULL;
+#endif
+
+  if(!mapped && (data = (char*)malloc(size)) != NULL)
+  {
+    for(done=0; done < size; done += got)
+    {
+      if((got = read(fd, data + done, size - done)) <= 0)
+      {
+	SAFE_FREE(data);
+	break;
+      }
+    }
+  }
+  close(fd);
+
+  if(data == NULL)
+    return NULL;
+
+  if(!(idx = index_init(data, size, mapped)))
+  {
+#ifndef _WIN32
+    if(mapped)
+      munmap(data, size);
+    else
+#endif
+      free(data);
+    return NULL;
+  }
+
+  if(!regfi_index_current(idx, file, check_hash))
+  {
+    regfi_index_free(idx);
+    return NULL;
+  }
+
+  return idx;
+}
+
+
+/******************************************************************************
+ * Checks that idx was built from the hive as it is now, by comparing 
+ * the sequence numbers and such from the REGF block.  With check_hash 
+ * all of the hive is hashed and compared as well, for hives that may 
+ * have been changed by other means than Windows.
+ *****************************************************************************/
+bool regfi_index_current(const REGFI_INDEX* idx, REGF_FILE* file,
+			 bool check_hash)
+{
+  char stamp[INDEX_HASH_OFF];
+  uint8 hash[REGFI_HASH_SIZE];
+
+  if(idx == NULL || file == NULL || file->data == NULL)
+    return false;
+
+  index_stamp(file, stamp);
+  if(memcmp(stamp, idx->data, INDEX_HASH_OFF) != 0)
+    return false;
+
+  if(check_hash 
+     && (!regfi_hive_hash(file, hash) 
+	 || memcmp(hash, idx->data + INDEX_HASH_OFF, REGFI_HASH_SIZE) != 0))
+    return false;
+
+  return true;
+}
+
+
+/******************************************************************************
+ *****************************************************************************/
+void regfi_index_free(REGFI_INDEX* idx)
+{
+  if(idx == NULL)
+    return;
+
+#ifndef _WIN32
+  if(idx->mapped)
+    munmap((void*)idx->data, idx->size);
+  else
+#endif
+    free((void*)idx->data);
+
+  free(idx);
+}
+
+
+/******************************************************************************
+ * Reads key number num of the index.  Key 0 is the root.
+ *****************************************************************************/
+bool regfi_index_get_key(const REGFI_INDEX* idx, uint32 num,
+			 REGFI_INDEX_KEY* key)
+{
+  const char* p;
+  uint32 name_off;
+
+  if(idx == NULL || key == NULL || num >= idx->num_keys)
+    return false;
+
+  p = idx->data + REGFI_INDEX_HDR_SIZE + num*REGFI_INDEX_KEY_SIZE;
+  name_off = IVAL(p, 0x20);
+  if(name_off >= idx->names_size)
+    return false;
+
+  key->nk_off = IVAL(p, 0x00);
+  key->parent = IVAL(p, 0x04);
+  key->first_subkey = IVAL(p, 0x08);
+  key->num_subkeys = IVAL(p, 0x0c);
+  key->values_off = IVAL(p, 0x10);
+  key->num_values = IVAL(p, 0x14);
+  key->mtime.low = IVAL(p, 0x18);
+  key->mtime.high = IVAL(p, 0x1c);
+  key->keyname = idx->names + name_off;
+
+  return true;
+}
+
+
+/******************************************************************************
+ * Finds the key at path, a NULL terminated list of key names below the 
+ * root like for regfi_iterator_walk_path(), by a binary search of the 
+ * subkeys at every level.  key is only valid if true is returned.
+ *****************************************************************************/
+bool regfi_index_find_key(const REGFI_INDEX* idx, const char** path,
+			  REGFI_INDEX_KEY* key)
+{
+  REGFI_INDEX_KEY sub;
+  uint32 lo, hi, mid;
+  int cmp;
+
+  if(path == NULL || !regfi_index_get_key(idx, 0, key))
+    return false;
+
+  for(; *path != NULL; path++)
+  {
+    lo = key->first_subkey;
+    hi = lo + key->num_subkeys;
+    if(hi < lo || hi > idx->num_keys)
+      return false;
+
+    cmp = -1;
+    while(lo < hi)
+    {
+      mid = lo + (hi - lo)/2;
+      if(!regfi_index_get_key(idx, mid, &sub))
+	return false;
+      if((cmp = strcasecmp(*path, sub.keyname)) == 0)
+	break;
+      if(cmp < 0)
+	hi = mid;
+      else
+	lo = mid + 1;
+    }
+    if(cmp != 0)
+      return false;
+
+    *key = sub;
+  }
+
+  return true;
+}
@@ -11,16 +11,13 @@
 #include "iconv.h"
 #include "../include/regfi.h"
 #include "../include/void_stack.h"
+#include "../include/reglookuplib.h"
 
-/* Globals, influenced by command line parameters */
-bool print_verbose = false;
-bool print_security = false;
-bool print_header = true;
-bool path_filter_enabled = false;
-bool type_filter_enabled = false;
-bool print_one_key_val = false;
-char* path_filter = NULL;
-int type_filter;
+/* Options of the reglookup command line, fixed in the library.  The
+ * library keeps no other state, so that hives can be queried from many
+ * threads at once. */
+static const bool print_verbose = false;
+static const bool print_security = false;
 
 /* Other globals */
 const char* key_special_chars = ",\"\\/";
@@ -28,19 +25,6 @@ const char* subfield_special_chars = ",\"\\|";
 const char* common_special_chars = ",\"\\";
 
 #define NUM_DEFAULT_VALUES 256
-//TODO: Fix these properly
-iconv_t conv_desc;
-
-#define EX_OSERR -1
-#define EX_DATAERR -2
-#define EX_NOINPUT -3
-
-void bailOut(int code, char* message)
-{
-  fprintf(stderr, "%d: %s\n", code, message);
-  //exit(code);
-}
-
 
 /* Returns a newly malloc()ed string which contains original buffer,
  * except for non-printable or special characters are quoted in hex
@@ -136,10 +120,13 @@ static int uni_to_ascii(unsigned char* uni, char* ascii,
   char* outbuf = ascii;
   size_t in_len = (size_t)uni_max;
   size_t out_len = (size_t)(ascii_max-1);
+  iconv_t conv_desc;
   int ret;
 
   /* Set up conversion descriptor. */
   conv_desc = iconv_open("US-ASCII", "UTF-16LE");
+  if(conv_desc == (iconv_t)-1)
+    return -errno;
 
   ret = iconv(conv_desc, &inbuf, &in_len, &outbuf, &out_len);
   if(ret == -1)
@@ -367,6 +354,8 @@ static char* data_to_ascii(unsigned char *datap, uint32 len, uint32 type,
 }
 
 
+void freePath(char** path);
+
 /* XXX: Each chunk must be unquoted after it is split out. 
  *      Quoting syntax may need to be standardized and pushed into the API 
  *      to deal with this issue and others.
@@ -392,17 +381,24 @@ char** splitPath(const char* s)
   {
     if ((next-cur) > 0)
     {
+      if(ret_cur >= REGF_MAX_DEPTH+1)
+      {
+	/* Registry maximum depth exceeded */
+	freePath(ret_val);
+	return NULL;
+      }
+
       copy = (char*)malloc((next-cur+1)*sizeof(char));
       if(copy == NULL)
-	bailOut(EX_OSERR, "ERROR: Memory allocation problem.\n");
+      {
+	freePath(ret_val);
+	return NULL;
+      }
 	  
       memcpy(copy, cur, next-cur);
       copy[next-cur] = '\0';
       ret_val[ret_cur++] = copy;
-      if(ret_cur < (REGF_MAX_DEPTH+1+1))
-	ret_val[ret_cur] = NULL;
-      else
-	bailOut(EX_DATAERR, "ERROR: Registry maximum depth exceeded.\n");
+      ret_val[ret_cur] = NULL;
     }
     cur = next+1;
   }
@@ -410,12 +406,13 @@ char** splitPath(const char* s)
   /* Grab last element, if path doesn't end in '/'. */
   if(strlen(cur) > 0)
   {
-    copy = strdup(cur);
+    if((ret_cur >= REGF_MAX_DEPTH+1) || ((copy = strdup(cur)) == NULL))
+    {
+      freePath(ret_val);
+      return NULL;
+    }
     ret_val[ret_cur++] = copy;
-    if(ret_cur < (REGF_MAX_DEPTH+1+1))
-      ret_val[ret_cur] = NULL;
-    else
-      bailOut(EX_DATAERR, "ERROR: Registry maximum depth exceeded.\n");
+    ret_val[ret_cur] = NULL;
   }
 
   return ret_val;
@@ -469,6 +466,7 @@ char* iter2Path(REGFI_ITERATOR* i)
   /* skip root element */
   if(void_stack_size(i->key_positions) < 1)
   {
+    void_stack_iterator_free(iter);
     buf[0] = '/';
     buf[1] = '\0';
     return buf;
@@ -486,6 +484,12 @@ char* iter2Path(REGFI_ITERATOR* i)
     buf[buf_len-buf_left-1] = '/';
     buf_left -= 1;
     name = quote_string(cur_name, key_special_chars);
+    if(name == NULL)
+    {
+      free(buf);
+      void_stack_iterator_free(iter);
+      return NULL;
+    }
     name_len = strlen(name);
     if(name_len+1 > buf_left)
     {
@@ -494,7 +498,8 @@ char* iter2Path(REGFI_ITERATOR* i)
       if((new_buf = realloc(buf, buf_len)) == NULL)
       {
 	free(buf);
-	free(iter);
+	free(name);
+	void_stack_iterator_free(iter);
 	return NULL;
       }
       buf = new_buf;
@@ -506,6 +511,7 @@ char* iter2Path(REGFI_ITERATOR* i)
     free(name);
   } while(cur != NULL);
 
+  void_stack_iterator_free(iter);
   return buf;
 }
 
@@ -567,7 +573,11 @@ char *getValue(const REGF_VK_REC* vk, char* prefix)
   {
     quoted_name = malloc(1*sizeof(char));
     if(quoted_name == NULL)
-      bailOut(EX_OSERR, "ERROR: Could not allocate sufficient memory.\n");
+    {
+      free(quoted_value);
+      free(conv_error);
+      return NULL;
+    }
     quoted_name[0] = '\0';
   }
 
@@ -594,15 +604,16 @@ char *getValue(const REGF_VK_REC* vk, char* prefix)
           sprintf(type, "0x%.8X", vk->type);
           str_type = type;
       }
-      len = strlen(prefix) + strlen(quoted_name) + strlen(quoted_value)
-          + strlen(str_type);
+      len = strlen(prefix) + strlen(quoted_name)
+          + (quoted_value ? strlen(quoted_value) : 0) + strlen(str_type);
       len += 6; //for / and , etc
 
       value = malloc(sizeof(*value) * len);
       //printf("%s/%s,%s,%s,\n", prefix, quoted_name,
          //str_type, quoted_value);
-      snprintf(value, len-1, "%s/%s,%s,%s,", prefix, quoted_name,
-            str_type, quoted_value);
+      if(value != NULL)
+        snprintf(value, len-1, "%s/%s,%s,%s,", prefix, quoted_name,
+                 str_type, quoted_value ? quoted_value : "");
   }
 
   if(quoted_value != NULL)
@@ -616,27 +627,33 @@ char *getValue(const REGF_VK_REC* vk, char* prefix)
 }
 
 
-char ** getValueList(REGFI_ITERATOR* i, char* prefix)
+/* Returns the formatted values of type of the current key of i, NULL
+ * terminated, or NULL on error. */
+char ** getValueList(REGFI_ITERATOR* i, char* prefix, int type)
 {
   const REGF_VK_REC* value;
-  char **values = NULL;
-  int j = 0;
+  char **values = NULL, **tmp;
+  int j = 0, num_values = NUM_DEFAULT_VALUES;
 
-  values = calloc(sizeof(*values), NUM_DEFAULT_VALUES);
+  values = calloc(sizeof(*values), num_values);
+  if(values == NULL)
+    return NULL;
 
   value = regfi_iterator_first_value(i);
   while(value != NULL)
   {
-    if(!type_filter_enabled || (value->type == type_filter))
+    if(value->type == type)
     {
-        //printf("%d : ", j);
-        if(j >= NUM_DEFAULT_VALUES -1)
+        if(j >= num_values - 1)
         {
-            values = realloc(values, sizeof(*values) * (j+NUM_DEFAULT_VALUES));
-            //printf("realloc values: %p \n", values);
+            tmp = realloc(values, sizeof(*values) * (num_values + NUM_DEFAULT_VALUES));
+            if(tmp == NULL)
+                break;
+            values = tmp;
+            num_values += NUM_DEFAULT_VALUES;
         }
-        values[j] = getValue(value, prefix);
-        j++;
+        if((values[j] = getValue(value, prefix)) != NULL)
+            j++;
         values[j] = NULL;
     }
     value = regfi_iterator_next_value(i);
@@ -692,50 +709,42 @@ void printKey(const REGF_NK_REC* k, char* full_path)
 }
 
 
-char ** getSingleKey(REGFI_ITERATOR* iter)
+char ** getSingleKey(REGFI_ITERATOR* iter, int type)
 {
-  const REGF_NK_REC* root = NULL;
-  const REGF_NK_REC* cur = NULL;
-  const REGF_NK_REC* sub = NULL;
   char* path = NULL;
-  int key_type = regfi_type_str2val("KEY");
   char **values = NULL;
 
-  root = cur = regfi_iterator_cur_key(iter);
-  sub = regfi_iterator_first_subkey(iter);
-  
-  if(root == NULL)
-    bailOut(EX_DATAERR, "ERROR: root cannot be NULL.\n");
+  if(regfi_iterator_cur_key(iter) == NULL)
+    return NULL;
   
   path = iter2Path(iter);
   if(path == NULL)
-      bailOut(EX_OSERR, "ERROR: Could not construct iterator's path.\n");
+    return NULL;
   
-  //if(!type_filter_enabled || (key_type == type_filter))
-  //    printKey(cur, path);
-  if(!type_filter_enabled || (key_type != type_filter))
-      values = getValueList(iter, path);
+  values = getValueList(iter, path, type);
   
   free(path);
   return values;
 }
 
-char ** getKeyTree(REGFI_ITERATOR* iter)
+/* Returns the formatted values of type of the current key of iter and
+ * all keys below it, NULL terminated, or NULL if there are none or on
+ * error. */
+char ** getKeyTree(REGFI_ITERATOR* iter, int type)
 {
   const REGF_NK_REC* root = NULL;
   const REGF_NK_REC* cur = NULL;
   const REGF_NK_REC* sub = NULL;
   char* path = NULL;
-  int key_type = regfi_type_str2val("KEY");
   bool print_this = true;
-  char **values = NULL, **dummy = NULL;
+  char **values = NULL, **dummy = NULL, **tmp;
   int idx = 0, num_values = NUM_DEFAULT_VALUES, i =0;
 
   root = cur = regfi_iterator_cur_key(iter);
   sub = regfi_iterator_first_subkey(iter);
   
   if(root == NULL)
-    bailOut(EX_DATAERR, "ERROR: root cannot be NULL.\n");
+    return NULL;
   
   do
   {
@@ -743,36 +752,35 @@ char ** getKeyTree(REGFI_ITERATOR* iter)
     {
       path = iter2Path(iter);
       if(path == NULL)
-	bailOut(EX_OSERR, "ERROR: Could not construct iterator's path.\n");
+	goto error;
       
-      //if(!type_filter_enabled || (key_type == type_filter))
-	//printKey(cur, path);
-      if(!type_filter_enabled || (key_type != type_filter))
-          dummy = getValueList(iter, path);
-      if(dummy)
+      dummy = getValueList(iter, path, type);
+      free(path);
+      if(dummy == NULL)
+	goto error;
+
+      if(values == NULL && dummy[0] != NULL)
       {
-          if(values == NULL)
-          {
-                values = malloc(sizeof(*values) * num_values);
-          }
-          for(i=0; dummy[i]; i++)
+          if((values = malloc(sizeof(*values) * num_values)) == NULL)
+              goto error;
+      }
+      for(i=0; dummy[i]; i++)
+      {
+          if(idx+i >= num_values-1)
           {
-              //printf("%d = %d/%d, ", num_values, i, idx);
-              if(idx+i >= num_values-1)
-              {
-                  values = realloc(values, sizeof(*values) * (num_values + NUM_DEFAULT_VALUES));
-                  num_values += NUM_DEFAULT_VALUES;
-                  //printf("Realloc val : %p (%d/%d)\n", values, idx, num_values);
-              }
-              values[idx+i] = dummy[i];
-              values[idx+i+1] = NULL;
+              tmp = realloc(values, sizeof(*values) * (num_values + NUM_DEFAULT_VALUES));
+              if(tmp == NULL)
+                  goto error;
+              values = tmp;
+              num_values += NUM_DEFAULT_VALUES;
           }
-          //printf("\n");
-          idx += i;
-          free(dummy);
+          values[idx+i] = dummy[i];
+          dummy[i] = NULL;
+          values[idx+i+1] = NULL;
       }
+      idx += i;
+      free(dummy);
       dummy = NULL;
-      free(path);
     }
     
     if(sub == NULL)
@@ -781,11 +789,11 @@ char ** getKeyTree(REGFI_ITERATOR* iter)
       {
 	/* We're done with this sub-tree, going up and hitting other branches. */
 	if(!regfi_iterator_up(iter))
-	  bailOut(EX_DATAERR, "ERROR: could not traverse iterator upward.\n");
+	  goto error;
 	
 	cur = regfi_iterator_cur_key(iter);
 	if(cur == NULL)
-	  bailOut(EX_DATAERR, "ERROR: unexpected NULL for key.\n");
+	  goto error;
 	
 	sub = regfi_iterator_next_subkey(iter);
       }
@@ -796,7 +804,7 @@ char ** getKeyTree(REGFI_ITERATOR* iter)
        * Let's move down and print this first sub-tree out. 
        */
       if(!regfi_iterator_down(iter))
-	bailOut(EX_DATAERR, "ERROR: could not traverse iterator downward.\n");
+	goto error;
 
       cur = sub;
       sub = regfi_iterator_first_subkey(iter);
@@ -804,10 +812,12 @@ char ** getKeyTree(REGFI_ITERATOR* iter)
     }
   } while(!((cur == root) && (sub == NULL)));
 
-  if(print_verbose)
-    fprintf(stderr, "VERBOSE: Finished printing key tree.\n");
-
   return values;
+
+ error:
+  freePath(dummy);
+  freePath(values);
+  return NULL;
 }
 
 
@@ -819,8 +829,6 @@ char ** getKeyTree(REGFI_ITERATOR* iter)
  */
 int retrievePath(REGFI_ITERATOR* iter, char** path)
 {
-  const REGF_VK_REC* value;
-  char* tmp_path_joined;
   const char** tmp_path;
   uint32 i;
   
@@ -841,15 +849,12 @@ int retrievePath(REGFI_ITERATOR* iter, char** path)
 
   tmp_path[i] = NULL;
 
-  if(print_verbose)
-    fprintf(stderr, "VERBOSE: Attempting to retrieve specified path: %s\n",
-	    path_filter);
-
   /* Special check for '/' path filter */
   if(path[0] == NULL)
   {
     if(print_verbose)
       fprintf(stderr, "VERBOSE: Found final path element as root key.\n");
+    free((void *)tmp_path);
     return 2;
   }
 
@@ -859,21 +864,12 @@ int retrievePath(REGFI_ITERATOR* iter, char** path)
     return 0;
   }
 
+  free((void *)tmp_path);
+
   if(regfi_iterator_find_value(iter, path[i]))
   {
     if(print_verbose)
       fprintf(stderr, "VERBOSE: Found final path element as value.\n");
-
-    value = regfi_iterator_cur_value(iter);
-    tmp_path_joined = iter2Path(iter);
-
-    if((value == NULL) || (tmp_path_joined == NULL))
-      bailOut(EX_OSERR, "ERROR: Unexpected error before printValue.\n");
-
-    //printValue(value, tmp_path_joined);
-
-    free((void *)tmp_path);
-    free(tmp_path_joined);
     return 1;
   }
   else if(regfi_iterator_find_subkey(iter, path[i]))
@@ -882,7 +878,7 @@ int retrievePath(REGFI_ITERATOR* iter, char** path)
       fprintf(stderr, "VERBOSE: Found final path element as key.\n");
 
     if(!regfi_iterator_down(iter))
-      bailOut(EX_DATAERR, "ERROR: Unexpected error on traversing path filter key.\n");
+      return -3;
 
     return 2;
   }
@@ -900,16 +896,78 @@ DLL_EXPORT void *rll_open_file(char *regfile)
     
     f = regfi_open(regfile);
     if(f == NULL)
-    {
         fprintf(stderr, "ERROR: Couldn't open registry file: %s\n", regfile);
-        bailOut(EX_NOINPUT, "");
-    }
 
     //printf("Reg oped : %p \n", f);
     return (void *)f;
 }
 
-DLL_EXPORT char **rll_get_value_strings(void *p, char *key, int subtree)
+/* Open a hive that is already in memory, such as a file read from a disk
+ * image.  The buffer is not copied and has to stay valid until the hive
+ * is closed. */
+DLL_EXPORT void *rll_open_buffer(const char *buf, unsigned int len)
+{
+    REGF_FILE* f;
+
+    f = regfi_open_buffer(buf, len);
+    if(f == NULL)
+        fprintf(stderr, "ERROR: Couldn't open registry buffer\n");
+
+    return (void *)f;
+}
+
+/* Callback and state of a hive opened with rll_open_cb() */
+typedef struct {
+    RLL_READ_CB read;
+    void *state;
+} RLL_CB_STATE;
+
+static ssize_t rll_cb_read(REGFI_RAW_FILE *raw, uint32 offset, void *buf,
+                           size_t count)
+{
+    RLL_CB_STATE *cb = (RLL_CB_STATE *)raw->state;
+
+    return cb->read(cb->state, offset, (char *)buf, (unsigned int)count);
+}
+
+static void rll_cb_close(REGFI_RAW_FILE *raw)
+{
+    free(raw->state);
+    raw->state = NULL;
+}
+
+/* Open a hive that is read through a callback, so that it can be parsed
+ * in place from wherever it is stored (a file in a disk image, say)
+ * without being extracted first. */
+DLL_EXPORT void *rll_open_cb(RLL_READ_CB read, unsigned int size,
+                             void *state)
+{
+    REGFI_RAW_FILE raw;
+    RLL_CB_STATE *cb;
+    REGF_FILE* f;
+
+    if((read == NULL) || ((cb = malloc(sizeof(RLL_CB_STATE))) == NULL))
+        return NULL;
+    cb->read = read;
+    cb->state = state;
+
+    memset(&raw, 0, sizeof(raw));
+    raw.read = rll_cb_read;
+    raw.close = rll_cb_close;
+    raw.size = size;
+    raw.state = cb;
+
+    f = regfi_open_cb(&raw);
+    if(f == NULL)
+        fprintf(stderr, "ERROR: Couldn't open registry hive\n");
+
+    return (void *)f;
+}
+
+/* Values of type of the key at key (and all keys below it with subtree)
+ * formatted like reglookup output, NULL terminated, or NULL if there are
+ * none or on error. */
+static char **rll_get_values(void *p, char *key, int subtree, int type)
 {
     REGF_FILE* f = (REGF_FILE *)p;
     REGFI_ITERATOR* iter;
@@ -917,12 +975,15 @@ DLL_EXPORT char **rll_get_value_strings(void *p, char *key, int subtree)
     int retr_path_ret = 0;
     char **values = NULL;
 
-    //printf("Looking for: %s , %d\n", key, subtree);
+    if(f == NULL)
+        return NULL;
 
-    //printf("Reg : %p \n", p);
     iter = regfi_iterator_new(f);
     if(iter == NULL)
-        bailOut(EX_OSERR, "ERROR: Couldn't create registry iterator.\n");
+    {
+        fprintf(stderr, "ERROR: Couldn't create registry iterator.\n");
+        return NULL;
+    }
 
     path = splitPath(key);
     if(path != NULL)
@@ -935,136 +996,572 @@ DLL_EXPORT char **rll_get_value_strings(void *p, char *key, int subtree)
     {
         if(print_verbose)
             fprintf(stderr, "WARNING: specified path not found.\n");
-        return NULL;
     }
     else if (retr_path_ret != 2)
     {
         if(print_verbose)
             fprintf(stderr, "WARNING: specified path %s not valid.\n", key);
-        return NULL;
     }
-
-    type_filter_enabled = true;
-    print_one_key_val = !subtree;
-    print_header = false;
-    print_security = false;
-    type_filter = regfi_type_str2val("SZ");
-
-    if(subtree)
-        values = getKeyTree(iter);
+    else if(subtree)
+        values = getKeyTree(iter, type);
     else
-        values = getSingleKey(iter);
-
+        values = getSingleKey(iter, type);
 
     regfi_iterator_free(iter);
-    if(values)
-        return values;
+    return values;
+}
 
-    return NULL;
+DLL_EXPORT char **rll_get_value_strings(void *p, char *key, int subtree)
+{
+    return rll_get_values(p, key, subtree, REG_SZ);
 }
 
 DLL_EXPORT char **rll_get_value_dwords(void *p, char *key, int subtree)
 {
-    REGF_FILE* f = (REGF_FILE *)p;
-    REGFI_ITERATOR* iter;
-    char **path = NULL;
-    int retr_path_ret = 0;
-    char **values = NULL;
+    return rll_get_values(p, key, subtree, REG_DWORD);
+}
 
-    //printf("Looking for: %s , %d\n", key, subtree);
-    iter = regfi_iterator_new(f);
-    if(iter == NULL)
-        bailOut(EX_OSERR, "ERROR: Couldn't create registry iterator.\n");
+DLL_EXPORT char **rll_get_subtree_value_strings(void *p, char *key)
+{
+    return rll_get_values(p, key, 1, REG_SZ);
+}
 
-    path = splitPath(key);
-    if(path != NULL)
+DLL_EXPORT void rll_close(void *f)
+{
+    regfi_close((REGF_FILE *) f);
+    return;
+}
+
+
+/* Structured queries */
+
+/* Record of a query batch while it is built, with offsets into the heap
+ * of the context instead of pointers */
+typedef struct {
+    unsigned int query;
+    unsigned int type;
+    size_t key;
+    size_t name;
+    size_t data;
+    unsigned int data_len;
+    size_t str;                 /* (size_t)-1 if there is no string */
+    uint64_t num;
+} RLL_BUILD_REC;
+
+struct _RLL_CTX {
+    REGF_FILE *f;
+    REGFI_ITERATOR *iter;
+    char *heap;                 /* strings and data of the batch */
+    size_t heap_len;
+    size_t heap_size;
+    RLL_BUILD_REC *recs;
+    size_t num_recs;
+    size_t recs_size;
+    char *key;                  /* path of the current key */
+    size_t key_len;
+    size_t key_size;
+    size_t key_off;             /* key in the heap, (size_t)-1 if not yet */
+};
+
+#define RLL_NO_OFF ((size_t)-1)
+
+/* Create a query context for a hive opened with one of the rll_open
+ * functions.  The hive stays owned by the caller and must not be used
+ * by another thread while the context is in use. */
+DLL_EXPORT RLL_CTX *rll_ctx_new(void *hive)
+{
+    RLL_CTX *ctx;
+
+    if((hive == NULL) || ((ctx = calloc(1, sizeof(RLL_CTX))) == NULL))
+        return NULL;
+
+    ctx->f = (REGF_FILE *)hive;
+    if((ctx->iter = regfi_iterator_new(ctx->f)) == NULL)
     {
-        retr_path_ret = retrievePath(iter, path);
-        freePath(path);
+        free(ctx);
+        return NULL;
     }
+    return ctx;
+}
 
-    if(retr_path_ret == 0)
+DLL_EXPORT void rll_ctx_free(RLL_CTX *ctx)
+{
+    if(ctx == NULL)
+        return;
+    regfi_iterator_free(ctx->iter);
+    free(ctx->heap);
+    free(ctx->recs);
+    free(ctx->key);
+    free(ctx);
+}
+
+/* Make room for len more bytes in the heap.  Returns NULL on error. */
+static char *rll_heap_reserve(RLL_CTX *ctx, size_t len)
+{
+    char *tmp;
+    size_t size;
+
+    if(ctx->heap_size - ctx->heap_len < len)
     {
-        if(print_verbose)
-              fprintf(stderr, "WARNING: specified path not found.\n");
-        return NULL;
+        size = ctx->heap_size ? ctx->heap_size : 4096;
+        while(size - ctx->heap_len < len)
+            size *= 2;
+        if((tmp = realloc(ctx->heap, size)) == NULL)
+            return NULL;
+        ctx->heap = tmp;
+        ctx->heap_size = size;
     }
-    else if (retr_path_ret != 2)
+    return ctx->heap + ctx->heap_len;
+}
+
+/* Copy len bytes to the heap, with a nul after them.  Returns the offset
+ * of the copy or RLL_NO_OFF on error. */
+static size_t rll_heap_add(RLL_CTX *ctx, const void *buf, size_t len)
+{
+    char *dst;
+    size_t off = ctx->heap_len;
+
+    if((dst = rll_heap_reserve(ctx, len + 1)) == NULL)
+        return RLL_NO_OFF;
+    if(len)
+        memcpy(dst, buf, len);
+    dst[len] = '\0';
+    ctx->heap_len += len + 1;
+    return off;
+}
+
+/* Append name to the path of the current key */
+static int rll_key_push(RLL_CTX *ctx, const char *name)
+{
+    size_t len = name ? strlen(name) : 0;
+    size_t size;
+    char *tmp;
+
+    if(ctx->key_size - ctx->key_len < len + 2)
     {
-        if(print_verbose)
-            fprintf(stderr, "WARNING: specified path %s not valid.\n", key);
-        return NULL;
+        size = ctx->key_size ? ctx->key_size : 256;
+        while(size - ctx->key_len < len + 2)
+            size *= 2;
+        if((tmp = realloc(ctx->key, size)) == NULL)
+            return -1;
+        ctx->key = tmp;
+        ctx->key_size = size;
+    }
+    ctx->key[ctx->key_len++] = '/';
+    memcpy(ctx->key + ctx->key_len, name, len);
+    ctx->key_len += len;
+    ctx->key[ctx->key_len] = '\0';
+    ctx->key_off = RLL_NO_OFF;
+    return 0;
+}
+
+/* Set the path of the current key from the position of the iterator */
+static int rll_key_set(RLL_CTX *ctx)
+{
+    void_stack_iterator *it;
+    const REGFI_ITER_POSITION *pos;
+    int ret = 0;
+
+    ctx->key_len = 0;
+    ctx->key_off = RLL_NO_OFF;
+    if(void_stack_size(ctx->iter->key_positions) == 0)
+        return 0;
+
+    if((it = void_stack_iterator_new(ctx->iter->key_positions)) == NULL)
+        return -1;
+
+    /* the oldest position is the root key, which has no name in paths */
+    void_stack_iterator_next(it);
+    while((ret == 0) && ((pos = void_stack_iterator_next(it)) != NULL))
+        ret = rll_key_push(ctx, pos->nk->keyname);
+    void_stack_iterator_free(it);
+
+    if(ret == 0)
+        ret = rll_key_push(ctx, ctx->iter->cur_key->keyname);
+    return ret;
+}
+
+/* Decode the UTF-16LE string at data to UTF-8 in the heap, up to its nul
+ * or len bytes.  Returns a pointer past the nul (or the end of data) and
+ * stores the end of the UTF-8 string in *out. */
+static const unsigned char *rll_utf16_decode(const unsigned char *data,
+    const unsigned char *end, char **out)
+{
+    char *o = *out;
+    unsigned int c, c2;
+
+    while(end - data >= 2)
+    {
+        c = data[0] | (data[1] << 8);
+        data += 2;
+        if(c == 0)
+            break;
+
+        if((c >= 0xD800) && (c < 0xDC00) && (end - data >= 2))
+        {
+            c2 = data[0] | (data[1] << 8);
+            if((c2 >= 0xDC00) && (c2 < 0xE000))
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+                data += 2;
+            }
+        }
+        if((c >= 0xD800) && (c < 0xE000))
+            c = 0xFFFD;         /* unpaired surrogate */
+
+        if(c < 0x80)
+            *o++ = (char)c;
+        else if(c < 0x800)
+        {
+            *o++ = (char)(0xC0 | (c >> 6));
+            *o++ = (char)(0x80 | (c & 0x3F));
+        }
+        else if(c < 0x10000)
+        {
+            *o++ = (char)(0xE0 | (c >> 12));
+            *o++ = (char)(0x80 | ((c >> 6) & 0x3F));
+            *o++ = (char)(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            *o++ = (char)(0xF0 | (c >> 18));
+            *o++ = (char)(0x80 | ((c >> 12) & 0x3F));
+            *o++ = (char)(0x80 | ((c >> 6) & 0x3F));
+            *o++ = (char)(0x80 | (c & 0x3F));
+        }
     }
+    *out = o;
+    return data;
+}
 
-    type_filter_enabled = true;
-    print_one_key_val = !subtree;
-    print_header = false;
-    print_security = false;
-    type_filter = regfi_type_str2val("DWORD");
+/* Decode string data to the heap.  A MULTI_SZ value is decoded string by
+ * string, each followed by a nul, up to the first empty string.  Returns
+ * the offset of the string or RLL_NO_OFF on error. */
+static size_t rll_heap_add_str(RLL_CTX *ctx, const unsigned char *data,
+    unsigned int len, int multi)
+{
+    const unsigned char *end = data + len;
+    char *start, *o;
+    size_t off = ctx->heap_len;
+
+    /* a UTF-16 unit takes at most 3 bytes in UTF-8, a pair 4 */
+    if((start = rll_heap_reserve(ctx, (size_t)len / 2 * 3 + 2)) == NULL)
+        return RLL_NO_OFF;
+
+    o = start;
+    do
+    {
+        char *s = o;
+
+        data = rll_utf16_decode(data, end, &o);
+        if(multi && (o == s))
+            break;
+        *o++ = '\0';
+    } while(multi && (end - data >= 2));
+    if(multi)
+        *o++ = '\0';
+
+    ctx->heap_len += o - start;
+    return off;
+}
+
+/* Add a record for value vk of the current key */
+static int rll_add_value(RLL_CTX *ctx, unsigned int query,
+    const REGF_VK_REC *vk)
+{
+    RLL_BUILD_REC *rec;
+    unsigned char inline_data[4];
+    const unsigned char *data;
+    uint32 len;
+
+    if(ctx->num_recs == ctx->recs_size)
+    {
+        RLL_BUILD_REC *tmp;
+        size_t size = ctx->recs_size ? ctx->recs_size * 2 : 64;
 
-    if(subtree)
-        values = getKeyTree(iter);
+        if((tmp = realloc(ctx->recs, size * sizeof(RLL_BUILD_REC))) == NULL)
+            return -1;
+        ctx->recs = tmp;
+        ctx->recs_size = size;
+    }
+    rec = &ctx->recs[ctx->num_recs];
+    memset(rec, 0, sizeof(RLL_BUILD_REC));
+    rec->query = query;
+    rec->type = vk->type;
+    rec->str = RLL_NO_OFF;
+
+    /* the path of a key is added once for all of its values */
+    if(ctx->key_off == RLL_NO_OFF)
+    {
+        if(ctx->key_len)
+            ctx->key_off = rll_heap_add(ctx, ctx->key, ctx->key_len);
+        else
+            ctx->key_off = rll_heap_add(ctx, "/", 1);
+        if(ctx->key_off == RLL_NO_OFF)
+            return -1;
+    }
+    rec->key = ctx->key_off;
+
+    if(vk->valuename)
+        rec->name = rll_heap_add(ctx, vk->valuename, strlen(vk->valuename));
     else
-        values = getSingleKey(iter);
+        rec->name = rll_heap_add(ctx, "", 0);
+    if(rec->name == RLL_NO_OFF)
+        return -1;
 
-    regfi_iterator_free(iter);
-    if(values)
-        return values;
+    /* data of up to 4 bytes is stored in place of its offset */
+    len = vk->data_size & ~VK_DATA_IN_OFFSET;
+    if(vk->data_size & VK_DATA_IN_OFFSET)
+    {
+        if(len > 4)
+            len = 4;
+        inline_data[0] = (unsigned char)(vk->data_off & 0xFF);
+        inline_data[1] = (unsigned char)((vk->data_off >> 8) & 0xFF);
+        inline_data[2] = (unsigned char)((vk->data_off >> 16) & 0xFF);
+        inline_data[3] = (unsigned char)((vk->data_off >> 24) & 0xFF);
+        data = inline_data;
+    }
+    else if((data = vk->data) == NULL)
+        len = 0;
 
-    return NULL;
+    rec->data_len = len;
+    if((rec->data = rll_heap_add(ctx, data, len)) == RLL_NO_OFF)
+        return -1;
+
+    switch(vk->type)
+    {
+    case REG_SZ:
+    case REG_EXPAND_SZ:
+    case REG_LINK:
+    case REG_MULTI_SZ:
+        rec->str = rll_heap_add_str(ctx, data, len, vk->type == REG_MULTI_SZ);
+        if(rec->str == RLL_NO_OFF)
+            return -1;
+        break;
+    case REG_DWORD:
+        if(len >= 4)
+            rec->num = (uint64_t)IVAL(data, 0);
+        break;
+    case REG_DWORD_BE:
+        if(len >= 4)
+            rec->num = ((uint64_t)data[0] << 24) | (data[1] << 16)
+                | (data[2] << 8) | data[3];
+        break;
+    case REG_QWORD:
+        if(len >= 8)
+            rec->num = (uint64_t)IVAL(data, 0)
+                | ((uint64_t)IVAL(data, 4) << 32);
+        break;
+    }
+
+    ctx->num_recs++;
+    return 0;
 }
 
-DLL_EXPORT char **rll_get_subtree_value_strings(void *p, char *key)
+/* Add the values of the current key that match q */
+static int rll_add_values(RLL_CTX *ctx, unsigned int query,
+    const RLL_QUERY *q)
 {
-    REGF_FILE* f = (REGF_FILE *)p;
-    REGFI_ITERATOR* iter;
-    char **path = NULL;
-    int retr_path_ret = 0;
-    char **values = NULL;
+    const REGF_VK_REC *vk;
 
-    //printf("Reg : %p \n", p);
-    iter = regfi_iterator_new(f);
-    if(iter == NULL)
-        bailOut(EX_OSERR, "ERROR: Couldn't create registry iterator.\n");
+    for(vk = regfi_iterator_first_value(ctx->iter); vk != NULL;
+        vk = regfi_iterator_next_value(ctx->iter))
+    {
+        if((q->type != RLL_TYPE_ANY) && (vk->type != (uint32)q->type))
+            continue;
+        if(q->value_name && strcasecmp(q->value_name,
+                vk->valuename ? vk->valuename : "") != 0)
+            continue;
+        if(rll_add_value(ctx, query, vk))
+            return -1;
+    }
+    return 0;
+}
 
-    path = splitPath(key);
-    if(path != NULL)
+/* Move the iterator to the key at path.  Returns an RLL_QUERY_ status. */
+static int rll_walk(RLL_CTX *ctx, const char *path)
+{
+    const char *names[REGF_MAX_DEPTH + 1];
+    char *copy, *cur, *next;
+    int n = 0, ret = RLL_QUERY_OK;
+
+    regfi_iterator_to_root(ctx->iter);
+    if((copy = strdup(path ? path : "")) == NULL)
+        return RLL_QUERY_ERROR;
+
+    for(cur = copy; cur != NULL; cur = next)
     {
-        retr_path_ret = retrievePath(iter, path);
-        freePath(path);
+        if((next = strchr(cur, '/')) != NULL)
+            *next++ = '\0';
+        if(*cur == '\0')
+            continue;
+        if(n == REGF_MAX_DEPTH)
+        {
+            ret = RLL_QUERY_NOT_FOUND;
+            break;
+        }
+        names[n++] = cur;
     }
+    names[n] = NULL;
 
-    if(retr_path_ret == 0)
+    if((ret == RLL_QUERY_OK) && !regfi_iterator_walk_path(ctx->iter, names))
+        ret = RLL_QUERY_NOT_FOUND;
+    free(copy);
+
+    if((ret == RLL_QUERY_OK) && rll_key_set(ctx))
+        ret = RLL_QUERY_ERROR;
+    return ret;
+}
+
+/* The iterator returns a parsed copy of the subkey it moves to, which
+ * regfi_iterator_down() parses again.  Frees it and returns whether there
+ * was one. */
+static bool rll_has_subkey(const REGF_NK_REC *sub)
+{
+    if(sub == NULL)
+        return false;
+    regfi_key_free((REGF_NK_REC *)sub);
+    return true;
+}
+
+/* Add the values of the current key and all keys below it that match q.
+ * Returns an RLL_QUERY_ status. */
+static int rll_add_tree(RLL_CTX *ctx, unsigned int query,
+    const RLL_QUERY *q)
+{
+    const REGF_NK_REC *root, *cur;
+    size_t lens[REGF_MAX_DEPTH + 1];
+    int depth = 0;
+    bool visit = true, sub;
+
+    root = cur = regfi_iterator_cur_key(ctx->iter);
+    if(root == NULL)
+        return RLL_QUERY_ERROR;
+    sub = rll_has_subkey(regfi_iterator_first_subkey(ctx->iter));
+
+    do
     {
-        if(print_verbose)
-            fprintf(stderr, "WARNING: specified path not found.\n");
+        if(visit && rll_add_values(ctx, query, q))
+            return RLL_QUERY_ERROR;
+
+        if(!sub)
+        {
+            if(cur != root)
+            {
+                if(!regfi_iterator_up(ctx->iter))
+                    return RLL_QUERY_ERROR;
+                ctx->key_len = lens[--depth];
+                ctx->key[ctx->key_len] = '\0';
+                ctx->key_off = RLL_NO_OFF;
+
+                if((cur = regfi_iterator_cur_key(ctx->iter)) == NULL)
+                    return RLL_QUERY_ERROR;
+                sub = rll_has_subkey(
+                    regfi_iterator_next_subkey(ctx->iter));
+            }
+            visit = false;
+        }
+        else
+        {
+            if((depth == REGF_MAX_DEPTH) || !regfi_iterator_down(ctx->iter))
+                return RLL_QUERY_ERROR;
+            lens[depth++] = ctx->key_len;
+            cur = regfi_iterator_cur_key(ctx->iter);
+            if(rll_key_push(ctx, cur->keyname))
+                return RLL_QUERY_ERROR;
+            sub = rll_has_subkey(
+                regfi_iterator_first_subkey(ctx->iter));
+            visit = true;
+        }
+    } while(!((cur == root) && !sub));
+
+    return RLL_QUERY_OK;
+}
+
+/* Run num_queries queries on the hive of ctx.  Returns the records of all
+ * of them in one allocation to be freed with rll_result_free(), or NULL
+ * if memory runs out.  Queries whose key is missing or cannot be parsed
+ * only fail by themselves, see the status of the result. */
+DLL_EXPORT RLL_RESULT *rll_query(RLL_CTX *ctx, const RLL_QUERY *queries,
+    unsigned int num_queries)
+{
+    RLL_RESULT *res;
+    RLL_RECORD *rec;
+    char *heap;
+    size_t recs_off, heap_off, r;
+    unsigned int q;
+    int *status;
+
+    if((ctx == NULL) || ((queries == NULL) && num_queries))
         return NULL;
+
+    if((status = calloc(num_queries ? num_queries : 1, sizeof(int))) == NULL)
+        return NULL;
+
+    ctx->heap_len = 0;
+    ctx->num_recs = 0;
+    for(q = 0; q < num_queries; q++)
+    {
+        size_t num_recs = ctx->num_recs, heap_len = ctx->heap_len;
+
+        status[q] = rll_walk(ctx, queries[q].path);
+        if(status[q] == RLL_QUERY_OK)
+        {
+            if(queries[q].recursive)
+                status[q] = rll_add_tree(ctx, q, &queries[q]);
+            else if(rll_add_values(ctx, q, &queries[q]))
+                status[q] = RLL_QUERY_ERROR;
+        }
+
+        /* a query returns all of its records or none */
+        if(status[q] != RLL_QUERY_OK)
+        {
+            ctx->num_recs = num_recs;
+            ctx->heap_len = heap_len;
+        }
     }
-    else if (retr_path_ret != 2)
+
+    /* result, status, records and heap, each aligned for its contents */
+    recs_off = (sizeof(RLL_RESULT) + num_queries * sizeof(int)
+        + sizeof(RLL_RECORD) - 1) / sizeof(RLL_RECORD) * sizeof(RLL_RECORD);
+    heap_off = recs_off + ctx->num_recs * sizeof(RLL_RECORD);
+    if((res = malloc(heap_off + ctx->heap_len)) == NULL)
     {
-        if(print_verbose)
-            fprintf(stderr, "WARNING: specified path %s not valid.\n", key);
+        free(status);
         return NULL;
     }
 
-    type_filter_enabled = true;
-    print_one_key_val = false;
-    print_header = false;
-    print_security = false;
-    type_filter = regfi_type_str2val("SZ");
-
-    values = getKeyTree(iter);
-
-    regfi_iterator_free(iter);
-    if(values)
-        return values;
+    res->num_queries = num_queries;
+    res->status = (int *)(res + 1);
+    memcpy(res->status, status, num_queries * sizeof(int));
+    free(status);
+    res->num_records = (unsigned int)ctx->num_recs;
+    res->records = (RLL_RECORD *)((char *)res + recs_off);
+    heap = (char *)res + heap_off;
+    if(ctx->heap_len)
+        memcpy(heap, ctx->heap, ctx->heap_len);
+
+    for(r = 0; r < ctx->num_recs; r++)
+    {
+        const RLL_BUILD_REC *b = &ctx->recs[r];
+
+        rec = &res->records[r];
+        rec->query = b->query;
+        rec->key = heap + b->key;
+        rec->name = heap + b->name;
+        rec->type = b->type;
+        rec->data = (const unsigned char *)heap + b->data;
+        rec->data_len = b->data_len;
+        rec->str = (b->str == RLL_NO_OFF) ? NULL : heap + b->str;
+        rec->num = b->num;
+    }
 
-    return NULL;
+    return res;
 }
-DLL_EXPORT void rll_close(void *f)
+
+DLL_EXPORT void rll_result_free(RLL_RESULT *res)
 {
-    regfi_close((REGF_FILE *) f);
-    return;
+    free(res);
 }
 
 /*
@@ -17,6 +17,7 @@
  */
 
 #include "tsk3/tsk_tools_i.h"
+#include "tsk3/fs/tsk_fs_i.h"
 
 static char *s_root;
 
@@ -182,6 +183,90 @@ test_walk_apis(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr)
     return retval;
 }
 
+/* inode walk callback that does nothing */
+static TSK_WALK_RET_ENUM
+inode_walk_nop_cb(TSK_FS_FILE * a_fs_file, void *a_ptr)
+{
+    return TSK_WALK_CONT;
+}
+
+
+/* Test function that looks up each allocated name of dir_open_meta
+ * through the directory index (fs->dir_lookup) and compares the results.
+ * @param a_addr Address of directory to analyze
+ * @returns 1 if a test failed.
+ */
+static int
+test_dir_lookup_apis(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr)
+{
+    TSK_FS_DIR *fs_dir;
+    TSK_FS_NAME *fs_name_idx;
+    int retval = 0;
+
+    if (a_fs->dir_lookup == NULL)
+        return 0;
+
+    fs_dir = tsk_fs_dir_open_meta(a_fs, a_addr);
+    if (!fs_dir) {
+        fprintf(stderr, "Error opening dir %" PRIuINUM " via meta\n",
+            a_addr);
+        tsk_error_print(stderr);
+        return 1;
+    }
+
+    if ((fs_name_idx = tsk_fs_name_alloc(1024, 0)) == NULL) {
+        tsk_error_print(stderr);
+        tsk_fs_dir_close(fs_dir);
+        return 1;
+    }
+
+    for (size_t i = 0; i < tsk_fs_dir_getsize(fs_dir); i++) {
+        const TSK_FS_NAME *fs_name;
+        TSK_RETVAL_ENUM ret;
+
+        if ((fs_name = tsk_fs_dir_get_name(fs_dir, i)) == NULL) {
+            fprintf(stderr,
+                "Error getting entry %" PRIuSIZE " from directory %"
+                PRIuINUM "\n", i, a_addr);
+            tsk_error_print(stderr);
+            retval = 1;
+            goto lookup_cleanup;
+        }
+
+        /* the index only knows about allocated names, and not about the
+         * names that dir_open_meta adds itself */
+        if (((fs_name->flags & TSK_FS_NAME_FLAG_ALLOC) == 0)
+            || (fs_name->meta_addr == TSK_FS_ORPHANDIR_INUM(a_fs))
+            || (TSK_FS_ISDOT(fs_name->name)))
+            continue;
+
+        ret = a_fs->dir_lookup(a_fs, a_addr, fs_name->name, fs_name_idx);
+        if (ret != TSK_OK) {
+            fprintf(stderr,
+                "entry %" PRIuSIZE " in dir %" PRIuINUM
+                " not found via dir_lookup: %s (%d)\n", i, a_addr,
+                fs_name->name, ret);
+            tsk_error_print(stderr);
+            retval = 1;
+            goto lookup_cleanup;
+        }
+        if (compare_names(fs_name_idx, fs_name, 1)) {
+            fprintf(stderr,
+                "entry %" PRIuSIZE " in dir %" PRIuINUM
+                " is different via dir_lookup: %s\n", i, a_addr,
+                fs_name->name);
+            retval = 1;
+            goto lookup_cleanup;
+        }
+    }
+
+  lookup_cleanup:
+    tsk_fs_name_free(fs_name_idx);
+    tsk_fs_dir_close(fs_dir);
+    return retval;
+}
+
+
 /* Compare the differences between dir_open_meta and dir_open 
  * @param a_path Path of directory to open
  * @param a_addr The metadata address of the same directory as the path
@@ -423,6 +508,28 @@ test_ntfs_fe()
         return 1;
     }
 
+    if ((test_dir_lookup_apis(fs, fs->root_inum))
+        || (test_dir_lookup_apis(fs, 30))) {
+        fprintf(stderr, "%s failure\n", tname);
+        return 1;
+    }
+
+    /* lookups must not change once an inode walk has read (and
+     * marked in its skip map) the whole MFT */
+    if (tsk_fs_meta_walk(fs, fs->first_inum, fs->last_inum,
+            (TSK_FS_META_FLAG_ENUM) (TSK_FS_META_FLAG_ALLOC |
+                TSK_FS_META_FLAG_UNALLOC), inode_walk_nop_cb, NULL)) {
+        fprintf(stderr, "Error walking %s image\n", tname);
+        tsk_error_print(stderr);
+        return 1;
+    }
+
+    if ((test_dir_lookup_apis(fs, fs->root_inum))
+        || (test_dir_lookup_apis(fs, 30))) {
+        fprintf(stderr, "%s failure after inode walk\n", tname);
+        return 1;
+    }
+
     tsk_fs_close(fs);
     tsk_img_close(img);
     return 0;
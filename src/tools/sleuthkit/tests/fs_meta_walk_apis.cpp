@@ -0,0 +1,274 @@
+/*
+* The Sleuth Kit
+*
+*
+* This software is distributed under the Common Public License 1.0
+*
+*/
+
+/* Test and compare the serial and parallel metadata walk apis */
+
+#include "tsk3/tsk_tools_i.h"
+
+static char *s_root;
+
+
+/* Entries that a walk returned, as one line of text each */
+typedef struct {
+    char **lines;
+    size_t cnt;
+    size_t alloc;
+} WALK_LIST;
+
+
+static void
+walk_list_free(WALK_LIST * a_list)
+{
+    for (size_t i = 0; i < a_list->cnt; i++)
+        free(a_list->lines[i]);
+    free(a_list->lines);
+    memset(a_list, 0, sizeof(WALK_LIST));
+}
+
+
+/* meta walk callback that describes each entry (its metadata,
+ * attributes and names) and adds it to the WALK_LIST given as the
+ * arg pointer */
+static TSK_WALK_RET_ENUM
+meta_walk_list_cb(TSK_FS_FILE * a_fs_file, void *a_ptr)
+{
+    WALK_LIST *list = (WALK_LIST *) a_ptr;
+    TSK_FS_META *fs_meta = a_fs_file->meta;
+    TSK_FS_META_NAME_LIST *name2;
+    char buf[8192];
+    size_t len;
+    int cnt;
+
+    cnt = tsk_fs_file_attr_getsize(a_fs_file);
+    len = snprintf(buf, sizeof(buf),
+        "%" PRIuINUM " flags: %x type: %d size: %" PRIuOFF " seq: %"
+        PRIu32 " mtime: %lld attrs: %d", fs_meta->addr, fs_meta->flags,
+        fs_meta->type, fs_meta->size, fs_meta->seq,
+        (long long) fs_meta->mtime, cnt);
+
+    for (int i = 0; (i < cnt) && (len < sizeof(buf)); i++) {
+        const TSK_FS_ATTR *fs_attr = tsk_fs_file_attr_get_idx(a_fs_file, i);
+
+        if (fs_attr == NULL)
+            return TSK_WALK_ERROR;
+        len += snprintf(&buf[len], sizeof(buf) - len,
+            " [%d-%d %s %x %" PRIuOFF, fs_attr->type, fs_attr->id,
+            fs_attr->name ? fs_attr->name : "", fs_attr->flags,
+            fs_attr->size);
+        if (fs_attr->flags & TSK_FS_ATTR_NONRES) {
+            TSK_FS_ATTR_RUN *run;
+
+            for (run = fs_attr->nrd.run; (run) && (len < sizeof(buf));
+                run = run->next)
+                len += snprintf(&buf[len], sizeof(buf) - len,
+                    " %" PRIuDADDR "+%" PRIuDADDR, run->addr, run->len);
+        }
+        if (len < sizeof(buf))
+            len += snprintf(&buf[len], sizeof(buf) - len, "]");
+    }
+
+    for (name2 = fs_meta->name2; (name2) && (len < sizeof(buf));
+        name2 = name2->next)
+        len += snprintf(&buf[len], sizeof(buf) - len,
+            " <%s %" PRIuINUM ">", name2->name, name2->par_inode);
+
+    if (list->cnt == list->alloc) {
+        size_t alloc = list->alloc ? list->alloc * 2 : 1024;
+        char **tmp;
+
+        if ((tmp = (char **) realloc(list->lines,
+                    alloc * sizeof(char *))) == NULL)
+            return TSK_WALK_ERROR;
+        list->lines = tmp;
+        list->alloc = alloc;
+    }
+    if ((list->lines[list->cnt] = strdup(buf)) == NULL)
+        return TSK_WALK_ERROR;
+    list->cnt++;
+
+    return TSK_WALK_CONT;
+}
+
+
+/* Compare two walk results entry by entry.
+ * @returns 1 if they are different
+ */
+static int
+compare_walks(WALK_LIST * a_list1, WALK_LIST * a_list2)
+{
+    if (a_list1->cnt != a_list2->cnt) {
+        fprintf(stderr,
+            "number of entries mismatch: %" PRIuSIZE " %" PRIuSIZE "\n",
+            a_list1->cnt, a_list2->cnt);
+        return 1;
+    }
+    for (size_t i = 0; i < a_list1->cnt; i++) {
+        if (strcmp(a_list1->lines[i], a_list2->lines[i])) {
+            fprintf(stderr, "entry %" PRIuSIZE " mismatch:\n%s\n%s\n", i,
+                a_list1->lines[i], a_list2->lines[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/* Test function that compares the entries (and their order) that
+ * tsk_fs_meta_walk_parallel returns with those of tsk_fs_meta_walk.
+ * The parallel walks are done on a second file system handle, once
+ * before and once after it has been walked.
+ * @param a_path Path of image to open
+ * @param a_offset Byte offset of the file system in the image
+ * @param a_flags Flags of the walks
+ * @param a_threads Number of threads of the parallel walks
+ * @returns 1 if a test failed
+ */
+static int
+test_meta_walk_parallel(const char *a_path, TSK_OFF_T a_offset,
+    TSK_FS_META_FLAG_ENUM a_flags, int a_threads)
+{
+    TSK_IMG_INFO *img;
+    TSK_FS_INFO *fs, *fs2;
+    WALK_LIST serial, par;
+    int retval = 0;
+
+    memset(&serial, 0, sizeof(serial));
+    memset(&par, 0, sizeof(par));
+
+    if ((img = tsk_img_open_sing(a_path, (TSK_IMG_TYPE_ENUM) 0, 0)) == NULL) {
+        fprintf(stderr, "Error opening %s image\n", a_path);
+        tsk_error_print(stderr);
+        return 1;
+    }
+
+    if ((fs = tsk_fs_open_img(img, a_offset, (TSK_FS_TYPE_ENUM) 0)) == NULL) {
+        fprintf(stderr, "Error opening %s image\n", a_path);
+        tsk_error_print(stderr);
+        tsk_img_close(img);
+        return 1;
+    }
+
+    if ((fs2 = tsk_fs_open_img(img, a_offset, (TSK_FS_TYPE_ENUM) 0)) == NULL) {
+        fprintf(stderr, "Error opening %s image\n", a_path);
+        tsk_error_print(stderr);
+        tsk_fs_close(fs);
+        tsk_img_close(img);
+        return 1;
+    }
+
+    if (tsk_fs_meta_walk(fs, fs->first_inum, fs->last_inum, a_flags,
+            meta_walk_list_cb, &serial)) {
+        fprintf(stderr, "Error doing meta walk (flags: %x)\n", a_flags);
+        tsk_error_print(stderr);
+        retval = 1;
+        goto walk_cleanup;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        if (tsk_fs_meta_walk_parallel(fs2, fs2->first_inum,
+                fs2->last_inum, a_flags, a_threads,
+                TSK_FS_META_PWALK_FLAG_NONE, meta_walk_list_cb, &par)) {
+            fprintf(stderr,
+                "Error doing parallel meta walk (flags: %x threads: %d)\n",
+                a_flags, a_threads);
+            tsk_error_print(stderr);
+            retval = 1;
+            goto walk_cleanup;
+        }
+
+        if (compare_walks(&serial, &par)) {
+            fprintf(stderr,
+                "parallel meta walk differs from serial (flags: %x threads: %d pass: %d)\n",
+                a_flags, a_threads, pass);
+            retval = 1;
+            goto walk_cleanup;
+        }
+        walk_list_free(&par);
+    }
+
+  walk_cleanup:
+    walk_list_free(&serial);
+    walk_list_free(&par);
+    tsk_fs_close(fs2);
+    tsk_fs_close(fs);
+    tsk_img_close(img);
+    return retval;
+}
+
+
+/* Run test_meta_walk_parallel with several flags and thread counts
+ * @returns 1 if a test failed
+ */
+static int
+test_meta_walk_apis(const char *a_path, TSK_OFF_T a_offset)
+{
+    static const int flags[] = {
+        TSK_FS_META_FLAG_ALLOC | TSK_FS_META_FLAG_UNALLOC,
+        TSK_FS_META_FLAG_ALLOC,
+        TSK_FS_META_FLAG_UNALLOC,
+        TSK_FS_META_FLAG_ORPHAN
+    };
+    static const int threads[] = { 1, 2, 4 };
+
+    for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++) {
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            if (test_meta_walk_parallel(a_path, a_offset,
+                    (TSK_FS_META_FLAG_ENUM) flags[f], threads[t]))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+
+int
+test_fat12()
+{
+    const char *tname = "fat12.dd";
+    char fname[512];
+
+    snprintf(fname, 512, "%s/fat12.dd", s_root);
+    if (test_meta_walk_apis(fname, 0)) {
+        fprintf(stderr, "%s failure\n", tname);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+test_ntfs_fe()
+{
+    const char *tname = "fe_test_1-NTFS";
+    char fname[512];
+
+    snprintf(fname, 512, "%s/fe_test_1.img", s_root);
+    if (test_meta_walk_apis(fname, 32256)) {
+        fprintf(stderr, "%s failure\n", tname);
+        return 1;
+    }
+    return 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "missing image root directory\n");
+        return 1;
+    }
+    s_root = argv[1];
+
+    if (test_fat12())
+        return 1;
+    if (test_ntfs_fe())
+        return 1;
+
+    printf("Tests Passed\n");
+    return 0;
+}
@@ -228,7 +228,7 @@ extern "C" {
     /** \name Error Handling */
 //@{
 
-    extern uint32_t tsk_errno;
+    extern TSK_THREAD_LOCAL uint32_t tsk_errno;
     extern const char *tsk_error_get();
     extern void tsk_error_print(FILE *);
     extern void tsk_error_reset();
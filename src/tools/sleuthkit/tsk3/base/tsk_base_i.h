@@ -56,9 +56,23 @@ extern "C" {
 #define TSK_ERRSTR_L	512
 #define TSK_ERRSTR_PR_L	((TSK_ERRSTR_L << 2) + 64)
 
-    extern char tsk_errstr[TSK_ERRSTR_L];
-    extern char tsk_errstr2[TSK_ERRSTR_L];
-    extern char tsk_errstr_print[TSK_ERRSTR_PR_L];
+    extern TSK_THREAD_LOCAL char tsk_errstr[TSK_ERRSTR_L];
+    extern TSK_THREAD_LOCAL char tsk_errstr2[TSK_ERRSTR_L];
+    extern TSK_THREAD_LOCAL char tsk_errstr_print[TSK_ERRSTR_PR_L];
+
+
+/* Locks (see tsk_lock.c) */
+#ifdef TSK_WIN32
+    typedef CRITICAL_SECTION tsk_lock_t;
+#else
+    typedef pthread_mutex_t tsk_lock_t;
+#endif
+
+    extern void tsk_init_lock(tsk_lock_t *);
+    extern void tsk_deinit_lock(tsk_lock_t *);
+    extern void tsk_take_lock(tsk_lock_t *);
+    extern uint8_t tsk_try_lock(tsk_lock_t *);
+    extern void tsk_release_lock(tsk_lock_t *);
 
 
 
@@ -20,16 +20,17 @@ int tsk_verbose = 0;
 
 /** 
  * \ingroup baselib
- * Set when an error occurs and contains the error code.
+ * Set when an error occurs and contains the error code.  Every thread
+ * has its own copy.
  */
-uint32_t tsk_errno = 0;
+TSK_THREAD_LOCAL uint32_t tsk_errno = 0;
 
 
 /* \internal
  * Contains an error-specific string and is valid only 
  * when tsk_errno is set. This should be set when errno is set,
  * if it is not needed, then set tsk_errstr[0] to '\0'. */
-char tsk_errstr[TSK_ERRSTR_L];
+TSK_THREAD_LOCAL char tsk_errstr[TSK_ERRSTR_L];
 
 /* \internal 
 * Contains a caller-specific string and is valid only when tsk_errno is set 
@@ -43,12 +44,12 @@ char tsk_errstr[TSK_ERRSTR_L];
 * more context about why X_read() was 
 * called in the first place
 */
-char tsk_errstr2[TSK_ERRSTR_L];
+TSK_THREAD_LOCAL char tsk_errstr2[TSK_ERRSTR_L];
 
 
 /* \internal
  * Buffer used to store the printed message formed by tsk_errstr and tsk_errstr2 */
-char tsk_errstr_print[TSK_ERRSTR_PR_L];
+TSK_THREAD_LOCAL char tsk_errstr_print[TSK_ERRSTR_PR_L];
 
 
 /* Error messages */
@@ -0,0 +1,78 @@
+/*
+ * The Sleuth Kit
+ *
+ * This software is distributed under the Common Public License 1.0
+ */
+
+/** \file tsk_lock.c
+ * Contains the mutex wrappers used by the structures that can be shared
+ * between threads.
+ */
+
+#include "tsk_base_i.h"
+
+/* \internal
+ * Initialize a lock.  Must be called before any other lock function.
+ */
+void
+tsk_init_lock(tsk_lock_t * a_lock)
+{
+#ifdef TSK_WIN32
+    InitializeCriticalSection(a_lock);
+#else
+    pthread_mutex_init(a_lock, NULL);
+#endif
+}
+
+/* \internal
+ * Free the resources of a lock.  It must not be held.
+ */
+void
+tsk_deinit_lock(tsk_lock_t * a_lock)
+{
+#ifdef TSK_WIN32
+    DeleteCriticalSection(a_lock);
+#else
+    pthread_mutex_destroy(a_lock);
+#endif
+}
+
+/* \internal
+ * Take a lock, waiting until it is released by the thread holding it.
+ */
+void
+tsk_take_lock(tsk_lock_t * a_lock)
+{
+#ifdef TSK_WIN32
+    EnterCriticalSection(a_lock);
+#else
+    pthread_mutex_lock(a_lock);
+#endif
+}
+
+/* \internal
+ * Take a lock only if no other thread holds it.
+ * @returns 1 if the lock was taken and 0 if not
+ */
+uint8_t
+tsk_try_lock(tsk_lock_t * a_lock)
+{
+#ifdef TSK_WIN32
+    return TryEnterCriticalSection(a_lock) ? 1 : 0;
+#else
+    return pthread_mutex_trylock(a_lock) == 0 ? 1 : 0;
+#endif
+}
+
+/* \internal
+ * Release a lock taken with tsk_take_lock() or tsk_try_lock().
+ */
+void
+tsk_release_lock(tsk_lock_t * a_lock)
+{
+#ifdef TSK_WIN32
+    LeaveCriticalSection(a_lock);
+#else
+    pthread_mutex_unlock(a_lock);
+#endif
+}
@@ -190,4 +190,14 @@ typedef char TSK_TCHAR;         ///< Character data type that is UTF-16 (wchar_t
 
 #endif
 
+
+/* Locks and per-thread storage, used to let several threads read from
+ * one open image (see tsk_img_set_concurrent()) */
+#ifdef TSK_WIN32
+#define TSK_THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#define TSK_THREAD_LOCAL __thread
+#endif
+
 #endif
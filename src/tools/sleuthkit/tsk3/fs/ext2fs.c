@@ -14,7 +14,7 @@
 
 /**
  *\file ext2fs.c
- * Contains the internal TSK ext2/ext3 file system functions.
+ * Contains the internal TSK ext2/ext3/ext4 file system functions.
  */
 
 /* TCT 
@@ -31,17 +31,56 @@
 #include "tsk_ext2fs.h"
 
 
-/* ext2fs_group_load - load block group descriptor into cache 
- *
- * return 1 on error and 0 on success
+/* ext2fs_gd_block_bitmap, ext2fs_gd_inode_bitmap, ext2fs_gd_inode_table -
+ * return the block addresses stored in a group descriptor.  The upper
+ * 32-bits are only used with the 64-bit descriptors of ext4. 
+ */
+static TSK_DADDR_T
+ext2fs_gd_block_bitmap(EXT2FS_INFO * ext2fs, ext2fs_gd * gd)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ext2fs;
+    TSK_DADDR_T addr = tsk_getu32(fs->endian, gd->bg_block_bitmap);
+
+    if (ext2fs->gd_size >= EXT4FS_GD_64_SIZE)
+        addr |= (TSK_DADDR_T) tsk_getu32(fs->endian,
+            ((ext4fs_gd *) gd)->bg_block_bitmap_hi) << 32;
+    return addr;
+}
+
+static TSK_DADDR_T
+ext2fs_gd_inode_bitmap(EXT2FS_INFO * ext2fs, ext2fs_gd * gd)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ext2fs;
+    TSK_DADDR_T addr = tsk_getu32(fs->endian, gd->bg_inode_bitmap);
+
+    if (ext2fs->gd_size >= EXT4FS_GD_64_SIZE)
+        addr |= (TSK_DADDR_T) tsk_getu32(fs->endian,
+            ((ext4fs_gd *) gd)->bg_inode_bitmap_hi) << 32;
+    return addr;
+}
+
+static TSK_DADDR_T
+ext2fs_gd_inode_table(EXT2FS_INFO * ext2fs, ext2fs_gd * gd)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ext2fs;
+    TSK_DADDR_T addr = tsk_getu32(fs->endian, gd->bg_inode_table);
+
+    if (ext2fs->gd_size >= EXT4FS_GD_64_SIZE)
+        addr |= (TSK_DADDR_T) tsk_getu32(fs->endian,
+            ((ext4fs_gd *) gd)->bg_inode_table_hi) << 32;
+    return addr;
+}
+
+
+/* ext2fs_gd_get - return the descriptor of a group.  The whole group
+ * descriptor table is read into the cache on first use, so that walks
+ * across groups do not re-read it.
  *
+ * return NULL on error
  * */
-static uint8_t
-ext2fs_group_load(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num)
+static ext2fs_gd *
+ext2fs_gd_get(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num)
 {
-    ext2fs_gd *gd;
-    TSK_OFF_T offs;
-    ssize_t cnt;
     TSK_FS_INFO *fs = (TSK_FS_INFO *) ext2fs;
 
     /*
@@ -51,63 +90,82 @@ ext2fs_group_load(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num)
         tsk_error_reset();
         tsk_errno = TSK_ERR_FS_ARG;
         snprintf(tsk_errstr, TSK_ERRSTR_L,
-            "ext2fs_group_load: invalid cylinder group number: %"
+            "ext2fs_gd_get: invalid cylinder group number: %"
             PRI_EXT2GRP "", grp_num);
-        return 1;
+        return NULL;
     }
 
+    if (ext2fs->gd_buf == NULL) {
+        size_t len = (size_t) ext2fs->groups_count * ext2fs->gd_size;
+        ssize_t cnt;
 
-    if (ext2fs->grp_buf == NULL) {
-        if ((ext2fs->grp_buf =
-                (ext2fs_gd *) tsk_malloc(sizeof(ext2fs_gd))) == NULL) {
-            return 1;
-        }
-    }
-    else if (ext2fs->grp_num == grp_num) {
-        return 0;
-    }
+        if ((ext2fs->gd_buf = (uint8_t *) tsk_malloc(len)) == NULL)
+            return NULL;
 
-    gd = ext2fs->grp_buf;
+        /* A truncated image may hold only part of the table.  Keep the
+         * descriptors that were read and fail on the others. */
+        cnt = tsk_fs_read(fs, ext2fs->groups_offset,
+            (char *) ext2fs->gd_buf, len);
+        ext2fs->gd_count = (cnt > 0) ?
+            (EXT2_GRPNUM_T) (cnt / ext2fs->gd_size) : 0;
 
-    /*
-     * We're not reading group descriptors often, so it is OK to do small
-     * reads instead of cacheing group descriptors in a large buffer.
-     */
-    offs = ext2fs->groups_offset + grp_num * sizeof(ext2fs_gd);
-    cnt = tsk_fs_read(&ext2fs->fs_info, offs, (char *) gd,
-        sizeof(ext2fs_gd));
-    if (cnt != sizeof(ext2fs_gd)) {
-        if (cnt >= 0) {
-            tsk_error_reset();
-            tsk_errno = TSK_ERR_FS_READ;
-        }
+        if (tsk_verbose)
+            tsk_fprintf(stderr,
+                "ext2fs_gd_get: loaded %" PRI_EXT2GRP " of %"
+                PRI_EXT2GRP " group descriptors\n", ext2fs->gd_count,
+                ext2fs->groups_count);
+    }
+
+    if (grp_num >= ext2fs->gd_count) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_FS_READ;
         snprintf(tsk_errstr2, TSK_ERRSTR_L,
-            "ext2fs_group_load: Group descriptor %" PRI_EXT2GRP " at %"
-            PRIuOFF, grp_num, offs);
-        return 1;
+            "ext2fs_gd_get: Group descriptor %" PRI_EXT2GRP " at %"
+            PRIuOFF, grp_num,
+            ext2fs->groups_offset + (TSK_OFF_T) grp_num * ext2fs->gd_size);
+        return NULL;
     }
 
+    return (ext2fs_gd *) & ext2fs->gd_buf[(size_t) grp_num *
+        ext2fs->gd_size];
+}
+
+
+/* ext2fs_group_load - make a group descriptor the current one 
+ *
+ * return 1 on error and 0 on success
+ *
+ * */
+static uint8_t
+ext2fs_group_load(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num)
+{
+    ext2fs_gd *gd;
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ext2fs;
+
+    if ((ext2fs->grp_buf != NULL) && (ext2fs->grp_num == grp_num))
+        return 0;
+
+    if ((gd = ext2fs_gd_get(ext2fs, grp_num)) == NULL)
+        return 1;
 
     /* Perform a sanity check on the data to make sure offsets are in range */
-    if ((tsk_getu32(fs->endian,
-                gd->bg_block_bitmap) > fs->last_block) ||
-        (tsk_getu32(fs->endian,
-                gd->bg_inode_bitmap) > fs->last_block) ||
-        (tsk_getu32(fs->endian, gd->bg_inode_table) > fs->last_block)) {
+    if ((ext2fs_gd_block_bitmap(ext2fs, gd) > fs->last_block) ||
+        (ext2fs_gd_inode_bitmap(ext2fs, gd) > fs->last_block) ||
+        (ext2fs_gd_inode_table(ext2fs, gd) > fs->last_block)) {
         tsk_error_reset();
         tsk_errno = TSK_ERR_FS_CORRUPT;
         snprintf(tsk_errstr, TSK_ERRSTR_L,
             "extXfs_group_load: Group %" PRI_EXT2GRP
             " descriptor block locations too large at byte offset %"
-            PRIuDADDR, grp_num, offs);
+            PRIuDADDR, grp_num,
+            ext2fs->groups_offset + (TSK_OFF_T) grp_num * ext2fs->gd_size);
         return 1;
     }
 
-
+    ext2fs->grp_buf = gd;
     ext2fs->grp_num = grp_num;
 
     if (tsk_verbose) {
-        TSK_FS_INFO *fs = (TSK_FS_INFO *) & ext2fs->fs_info;
         tsk_fprintf(stderr,
             "\tgroup %" PRI_EXT2GRP ": %" PRIu16 "/%" PRIu16
             " free blocks/inodes\n", grp_num, tsk_getu16(fs->endian,
@@ -134,6 +192,48 @@ ext2fs_print_map(uint8_t * map, int len)
 }
 
 
+/* ext2fs_map_cache_slot - find the slot of a group's bitmap in a cache.
+ * If it is not there, the least recently used slot is given to the group
+ * and a_hit is set to 0 so that the caller reads the bitmap into it.
+ *
+ * return -1 on error and the slot index on success
+ * */
+static int
+ext2fs_map_cache_slot(TSK_FS_INFO * fs, EXT2FS_MAP_CACHE * cache,
+    EXT2_GRPNUM_T grp_num, uint8_t * a_hit)
+{
+    int i, slot = 0;
+
+    cache->clock++;
+    *a_hit = 0;
+
+    for (i = 0; i < EXT2FS_MAP_CACHE_LEN; i++) {
+        /* slots are filled in order, so the rest are free */
+        if (cache->buf[i] == NULL) {
+            slot = i;
+            break;
+        }
+        if (cache->grp_num[i] == grp_num) {
+            cache->used[i] = cache->clock;
+            *a_hit = 1;
+            return i;
+        }
+        if (cache->used[i] < cache->used[slot])
+            slot = i;
+    }
+
+    if (cache->buf[slot] == NULL) {
+        if ((cache->buf[slot] =
+                (uint8_t *) tsk_malloc(fs->block_size)) == NULL) {
+            return -1;
+        }
+    }
+    cache->grp_num[slot] = grp_num;
+    cache->used[slot] = cache->clock;
+    return slot;
+}
+
+
 /* ext2fs_bmap_load - look up block bitmap & load into cache 
  *
  * return 1 on error and 0 on success
@@ -142,60 +242,64 @@ static uint8_t
 ext2fs_bmap_load(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num)
 {
     TSK_FS_INFO *fs = (TSK_FS_INFO *) & ext2fs->fs_info;
+    EXT2FS_MAP_CACHE *cache = &ext2fs->bmap_cache;
     ssize_t cnt;
+    uint8_t hit;
+    int slot;
 
     /*
      * Look up the group descriptor info.  The load will do the sanity check.
      */
-    if ((ext2fs->grp_buf == NULL) || (ext2fs->grp_num != grp_num)) {
-        if (ext2fs_group_load(ext2fs, grp_num)) {
-            return 1;
-        }
+    if (ext2fs_group_load(ext2fs, grp_num)) {
+        return 1;
     }
 
-    if (ext2fs->bmap_buf == NULL) {
-        if ((ext2fs->bmap_buf =
-                (uint8_t *) tsk_malloc(fs->block_size)) == NULL) {
-            return 1;
-        }
-    }
-    else if (ext2fs->bmap_grp_num == grp_num)
+    if ((ext2fs->bmap_buf != NULL) && (ext2fs->bmap_grp_num == grp_num))
         return 0;
 
-    /*
-     * Look up the block allocation bitmap.
-     */
-    if (tsk_getu32(fs->endian,
-            ext2fs->grp_buf->bg_block_bitmap) > fs->last_block) {
-        tsk_error_reset();
-        tsk_errno = TSK_ERR_FS_BLK_NUM;
-        snprintf(tsk_errstr, TSK_ERRSTR_L,
-            "ext2fs_bmap_load: Block too large for image: %" PRIu32
-            "", tsk_getu32(fs->endian, ext2fs->grp_buf->bg_block_bitmap));
+    if ((slot = ext2fs_map_cache_slot(fs, cache, grp_num, &hit)) == -1)
         return 1;
-    }
-
-    cnt = tsk_fs_read(fs, (TSK_DADDR_T) tsk_getu32(fs->endian,
-            ext2fs->grp_buf->bg_block_bitmap) * fs->block_size,
-        (char *) ext2fs->bmap_buf, ext2fs->fs_info.block_size);
 
-    if (cnt != ext2fs->fs_info.block_size) {
-        if (cnt >= 0) {
+    if (hit == 0) {
+        /*
+         * Look up the block allocation bitmap.
+         */
+        if (ext2fs_gd_block_bitmap(ext2fs, ext2fs->grp_buf) >
+            fs->last_block) {
+            cache->grp_num[slot] = 0xffffffff;
             tsk_error_reset();
-            tsk_errno = TSK_ERR_FS_READ;
+            tsk_errno = TSK_ERR_FS_BLK_NUM;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "ext2fs_bmap_load: Block too large for image: %" PRIuDADDR
+                "", ext2fs_gd_block_bitmap(ext2fs, ext2fs->grp_buf));
+            return 1;
         }
-        snprintf(tsk_errstr2, TSK_ERRSTR_L,
-            "ext2fs_bmap_load: Bitmap group %" PRI_EXT2GRP " at %"
-            PRIu32, grp_num, tsk_getu32(fs->endian,
-                ext2fs->grp_buf->bg_block_bitmap));
+
+        cnt = tsk_fs_read(fs, (TSK_OFF_T) ext2fs_gd_block_bitmap(ext2fs,
+                ext2fs->grp_buf) * fs->block_size,
+            (char *) cache->buf[slot], ext2fs->fs_info.block_size);
+
+        if (cnt != ext2fs->fs_info.block_size) {
+            cache->grp_num[slot] = 0xffffffff;
+            if (cnt >= 0) {
+                tsk_error_reset();
+                tsk_errno = TSK_ERR_FS_READ;
+            }
+            snprintf(tsk_errstr2, TSK_ERRSTR_L,
+                "ext2fs_bmap_load: Bitmap group %" PRI_EXT2GRP " at %"
+                PRIuDADDR, grp_num, ext2fs_gd_block_bitmap(ext2fs,
+                    ext2fs->grp_buf));
+            return 1;
+        }
+
+        if (tsk_verbose > 1)
+            ext2fs_print_map(cache->buf[slot],
+                tsk_getu32(fs->endian, ext2fs->fs->s_blocks_per_group));
     }
 
+    ext2fs->bmap_buf = cache->buf[slot];
     ext2fs->bmap_grp_num = grp_num;
 
-    if (tsk_verbose > 1)
-        ext2fs_print_map(ext2fs->bmap_buf,
-            tsk_getu32(fs->endian, ext2fs->fs->s_blocks_per_group));
-
     return 0;
 }
 
@@ -208,64 +312,157 @@ static uint8_t
 ext2fs_imap_load(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num)
 {
     TSK_FS_INFO *fs = (TSK_FS_INFO *) & ext2fs->fs_info;
+    EXT2FS_MAP_CACHE *cache = &ext2fs->imap_cache;
     ssize_t cnt;
+    uint8_t hit;
+    int slot;
 
     /*
      * Look up the group descriptor info.
      */
-    if ((ext2fs->grp_buf == NULL) || (ext2fs->grp_num != grp_num)) {
-        if (ext2fs_group_load(ext2fs, grp_num)) {
+    if (ext2fs_group_load(ext2fs, grp_num)) {
+        return 1;
+    }
+
+    /* Exit if map is already loaded */
+    if ((ext2fs->imap_buf != NULL) && (ext2fs->imap_grp_num == grp_num)) {
+        return 0;
+    }
+
+    if ((slot = ext2fs_map_cache_slot(fs, cache, grp_num, &hit)) == -1)
+        return 1;
+
+    if (hit == 0) {
+        /*
+         * Look up the inode allocation bitmap.
+         */
+        if (ext2fs_gd_inode_bitmap(ext2fs, ext2fs->grp_buf) >
+            fs->last_block) {
+            cache->grp_num[slot] = 0xffffffff;
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_FS_BLK_NUM;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "ext2fs_imap_load: Block too large for image: %" PRIuDADDR
+                "", ext2fs_gd_inode_bitmap(ext2fs, ext2fs->grp_buf));
             return 1;
         }
-    }
 
-    /* Allocate the cache buffer and exit if map is already loaded */
-    if (ext2fs->imap_buf == NULL) {
-        if ((ext2fs->imap_buf =
-                (uint8_t *) tsk_malloc(fs->block_size)) == NULL) {
+        cnt = tsk_fs_read(fs,
+            (TSK_OFF_T) ext2fs_gd_inode_bitmap(ext2fs,
+                ext2fs->grp_buf) * fs->block_size,
+            (char *) cache->buf[slot], ext2fs->fs_info.block_size);
+
+        if (cnt != ext2fs->fs_info.block_size) {
+            cache->grp_num[slot] = 0xffffffff;
+            if (cnt >= 0) {
+                tsk_error_reset();
+                tsk_errno = TSK_ERR_FS_READ;
+            }
+            snprintf(tsk_errstr2, TSK_ERRSTR_L,
+                "ext2fs_imap_load: Inode bitmap %" PRI_EXT2GRP " at %"
+                PRIuDADDR, grp_num, ext2fs_gd_inode_bitmap(ext2fs,
+                    ext2fs->grp_buf));
             return 1;
         }
+
+        if (tsk_verbose > 1)
+            ext2fs_print_map(cache->buf[slot],
+                tsk_getu32(fs->endian, ext2fs->fs->s_inodes_per_group));
     }
-    else if (ext2fs->imap_grp_num == grp_num) {
-        return 0;
+
+    ext2fs->imap_buf = cache->buf[slot];
+    ext2fs->imap_grp_num = grp_num;
+
+    return 0;
+}
+
+/* ext2fs_itbl_load - read a run of up to a_count inode table entries,
+ * starting at inode a_inum, into the cache.  The run stops at the end
+ * of the group and at EXT2FS_ITBL_BATCH_MAX bytes, and may be shorter
+ * if the image is truncated.
+ *
+ * return 1 on error and 0 on success
+ * */
+static uint8_t
+ext2fs_itbl_load(EXT2FS_INFO * ext2fs, TSK_INUM_T a_inum,
+    TSK_INUM_T a_count)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & ext2fs->fs_info;
+    uint32_t ipg = tsk_getu32(fs->endian, ext2fs->fs->s_inodes_per_group);
+    EXT2_GRPNUM_T grp_num;
+    TSK_INUM_T rel_inum;
+    TSK_OFF_T addr;
+    size_t len;
+    ssize_t cnt;
+
+    /*
+     * Look up the group descriptor for this inode. 
+     */
+    grp_num = (EXT2_GRPNUM_T) ((a_inum - fs->first_inum) / ipg);
+    if (ext2fs_group_load(ext2fs, grp_num)) {
+        return 1;
     }
 
+    rel_inum = (a_inum - 1) - (TSK_INUM_T) ipg * grp_num;
+    if (a_count > ipg - rel_inum)
+        a_count = ipg - rel_inum;
+    if (a_count > EXT2FS_ITBL_BATCH_MAX / ext2fs->inode_size)
+        a_count = EXT2FS_ITBL_BATCH_MAX / ext2fs->inode_size;
+    if (a_count == 0)
+        a_count = 1;
+    len = (size_t) a_count * ext2fs->inode_size;
+
     /*
-     * Look up the inode allocation bitmap.
+     * Look up the inode table block for this inode.
      */
-    if (tsk_getu32(fs->endian,
-            ext2fs->grp_buf->bg_inode_bitmap) > fs->last_block) {
-        tsk_error_reset();
-        tsk_errno = TSK_ERR_FS_BLK_NUM;
-        snprintf(tsk_errstr, TSK_ERRSTR_L,
-            "ext2fs_imap_load: Block too large for image: %" PRIu32
-            "", tsk_getu32(fs->endian, ext2fs->grp_buf->bg_inode_bitmap));
+    addr =
+        (TSK_OFF_T) ext2fs_gd_inode_table(ext2fs,
+        ext2fs->grp_buf) * (TSK_OFF_T) fs->block_size +
+        rel_inum * (TSK_OFF_T) ext2fs->inode_size;
+
+    /* Use the entries in place if the image is mapped */
+    if ((ext2fs->itbl =
+            (const uint8_t *) tsk_fs_borrow(fs, addr, len)) != NULL) {
+        ext2fs->itbl_inum = a_inum;
+        ext2fs->itbl_count = a_count;
+        return 0;
     }
 
-    cnt = tsk_fs_read(fs,
-        (TSK_DADDR_T) tsk_getu32(fs->endian,
-            ext2fs->grp_buf->bg_inode_bitmap) * fs->block_size,
-        (char *) ext2fs->imap_buf, ext2fs->fs_info.block_size);
+    if (ext2fs->itbl_len < len) {
+        if ((ext2fs->itbl_buf =
+                (uint8_t *) tsk_realloc((char *) ext2fs->itbl_buf,
+                    len)) == NULL) {
+            ext2fs->itbl_len = 0;
+            ext2fs->itbl_count = 0;
+            return 1;
+        }
+        ext2fs->itbl_len = len;
+    }
 
-    if (cnt != ext2fs->fs_info.block_size) {
+    cnt = tsk_fs_read(fs, addr, (char *) ext2fs->itbl_buf, len);
+    if (cnt < ext2fs->inode_size) {
+        ext2fs->itbl_count = 0;
         if (cnt >= 0) {
             tsk_error_reset();
             tsk_errno = TSK_ERR_FS_READ;
         }
         snprintf(tsk_errstr2, TSK_ERRSTR_L,
-            "ext2fs_imap_load: Inode bitmap %" PRI_EXT2GRP " at %"
-            PRIu32, grp_num, tsk_getu32(fs->endian,
-                ext2fs->grp_buf->bg_inode_bitmap));
+            "ext2fs_itbl_load: Inode %" PRIuINUM
+            " from %" PRIuOFF, a_inum, addr);
+        return 1;
     }
 
-    ext2fs->imap_grp_num = grp_num;
-    if (tsk_verbose > 1)
-        ext2fs_print_map(ext2fs->imap_buf,
-            tsk_getu32(fs->endian, ext2fs->fs->s_inodes_per_group));
-
+    ext2fs->itbl = ext2fs->itbl_buf;
+    ext2fs->itbl_inum = a_inum;
+    ext2fs->itbl_count = (TSK_INUM_T) cnt / ext2fs->inode_size;
     return 0;
 }
 
+/* ext2fs_itbl_cached - returns 1 if an inode is in the inode table cache */
+#define ext2fs_itbl_cached(ext2fs, inum) \
+    (((inum) >= (ext2fs)->itbl_inum) && \
+     ((inum) < (ext2fs)->itbl_inum + (ext2fs)->itbl_count))
+
 /* ext2fs_dinode_load - look up disk inode & load into cache 
  *
  * return 1 on error and 0 on success
@@ -275,10 +472,6 @@ static uint8_t
 ext2fs_dinode_load(EXT2FS_INFO * ext2fs, TSK_INUM_T inum)
 {
     ext2fs_inode *dino;
-    EXT2_GRPNUM_T grp_num;
-    TSK_OFF_T addr;
-    ssize_t cnt;
-    TSK_INUM_T rel_inum;
     TSK_FS_INFO *fs = (TSK_FS_INFO *) & ext2fs->fs_info;
 
     /*
@@ -307,40 +500,28 @@ ext2fs_dinode_load(EXT2FS_INFO * ext2fs, TSK_INUM_T inum)
     dino = ext2fs->dino_buf;
 
     /*
-     * Look up the group descriptor for this inode. 
+     * Read the inode table block that holds this inode, unless an
+     * earlier batch read already has it.  Neighbouring inodes are
+     * often looked up together.
      */
-    grp_num = (EXT2_GRPNUM_T) ((inum - fs->first_inum) /
-        tsk_getu32(fs->endian, ext2fs->fs->s_inodes_per_group));
+    if (!ext2fs_itbl_cached(ext2fs, inum)) {
+        TSK_INUM_T ipb = fs->block_size / ext2fs->inode_size;
+        TSK_INUM_T first = inum - ((inum - fs->first_inum) % ipb);
 
-    if ((ext2fs->grp_buf == NULL) || (ext2fs->grp_num != grp_num)) {
-        if (ext2fs_group_load(ext2fs, grp_num)) {
+        if (ext2fs_itbl_load(ext2fs, first, ipb))
             return 1;
-        }
-    }
-
-    /*
-     * Look up the inode table block for this inode.
-     */
-    rel_inum =
-        (inum - 1) - tsk_getu32(fs->endian,
-        ext2fs->fs->s_inodes_per_group) * grp_num;
-    addr =
-        (TSK_OFF_T) tsk_getu32(fs->endian,
-        ext2fs->grp_buf->bg_inode_table) * (TSK_OFF_T) fs->block_size +
-        rel_inum * (TSK_OFF_T) ext2fs->inode_size;
-
-    cnt = tsk_fs_read(fs, addr, (char *) dino, ext2fs->inode_size);
-    if (cnt != ext2fs->inode_size) {
-        if (cnt >= 0) {
+        if (!ext2fs_itbl_cached(ext2fs, inum)) {
             tsk_error_reset();
             tsk_errno = TSK_ERR_FS_READ;
+            snprintf(tsk_errstr2, TSK_ERRSTR_L,
+                "ext2fs_dinode_load: Inode %" PRIuINUM, inum);
+            return 1;
         }
-        snprintf(tsk_errstr2, TSK_ERRSTR_L,
-            "ext2fs_dinode_load: Inode %" PRIuINUM
-            " from %" PRIuOFF, inum, addr);
-        return 1;
     }
 
+    memcpy(dino, &ext2fs->itbl[(size_t) (inum - ext2fs->itbl_inum) *
+            ext2fs->inode_size], ext2fs->inode_size);
+
     ext2fs->dino_inum = inum;
     if (tsk_verbose)
         tsk_fprintf(stderr,
@@ -362,6 +543,45 @@ ext2fs_dinode_load(EXT2FS_INFO * ext2fs, TSK_INUM_T inum)
     return 0;
 }
 
+/* ext4fs_extent_root_map - map a logical block of a file using only the
+ * extent tree root that is stored in the inode.  This is used for symbolic
+ * links, which are too small to need more than one tree level.
+ *
+ * returns the block address or 0 if it is not described in the root node
+ * */
+static TSK_DADDR_T
+ext4fs_extent_root_map(TSK_FS_INFO * fs, uint8_t * a_root,
+    TSK_DADDR_T a_lblk)
+{
+    ext4fs_extent_header *hdr = (ext4fs_extent_header *) a_root;
+    ext4fs_extent *ext = (ext4fs_extent *) & hdr[1];
+    uint16_t entries;
+    uint16_t i;
+
+    if ((tsk_getu16(fs->endian, hdr->eh_magic) != EXT4FS_EXT_MAGIC)
+        || (tsk_getu16(fs->endian, hdr->eh_depth) != 0))
+        return 0;
+
+    entries = tsk_getu16(fs->endian, hdr->eh_entries);
+    if (sizeof(*hdr) + entries * sizeof(*ext) >
+        4 * (EXT2FS_NDADDR + EXT2FS_NIADDR))
+        return 0;
+
+    for (i = 0; i < entries; i++) {
+        TSK_DADDR_T lblk = tsk_getu32(fs->endian, ext[i].ee_block);
+        uint16_t len = tsk_getu16(fs->endian, ext[i].ee_len);
+
+        if (len > EXT4FS_EXT_INIT_MAX_LEN)
+            len -= EXT4FS_EXT_INIT_MAX_LEN;
+
+        if ((a_lblk >= lblk) && (a_lblk < lblk + len))
+            return ((TSK_DADDR_T) tsk_getu16(fs->endian,
+                    ext[i].ee_start_hi) << 32 | tsk_getu32(fs->endian,
+                    ext[i].ee_start_lo)) + (a_lblk - lblk);
+    }
+    return 0;
+}
+
 /* ext2fs_dinode_copy - copy cached disk inode into generic inode 
  *
  * returns 1 on error and 0 on success
@@ -497,9 +717,20 @@ ext2fs_dinode_copy(EXT2FS_INFO * ext2fs, TSK_FS_META * fs_meta)
         }
     }
 
-    addr_ptr = (TSK_DADDR_T *) fs_meta->content_ptr;
-    for (i = 0; i < EXT2FS_NDADDR + EXT2FS_NIADDR; i++)
-        addr_ptr[i] = tsk_gets32(fs->endian, in->i_block[i]);
+    /* Ext4 inodes with the extents flag store the root node of an
+     * extent tree in i_block instead of block pointers.  Keep a raw
+     * copy of it for ext2fs_load_attrs() */
+    if (tsk_getu32(fs->endian, in->i_flags) & EXT2_IN_EXTENTS) {
+        fs_meta->content_type = TSK_FS_META_CONTENT_TYPE_EXT4_EXTENTS;
+        memset(fs_meta->content_ptr, 0, fs_meta->content_len);
+        memcpy(fs_meta->content_ptr, in->i_block, sizeof(in->i_block));
+    }
+    else {
+        fs_meta->content_type = TSK_FS_META_CONTENT_TYPE_DEFAULT;
+        addr_ptr = (TSK_DADDR_T *) fs_meta->content_ptr;
+        for (i = 0; i < EXT2FS_NDADDR + EXT2FS_NIADDR; i++)
+            addr_ptr[i] = tsk_gets32(fs->endian, in->i_block[i]);
+    }
 
     /* set the link string 
      * the size check prevents us from trying to allocate a huge amount of
@@ -545,14 +776,34 @@ ext2fs_dinode_copy(EXT2FS_INFO * ext2fs, TSK_FS_META * fs_meta)
              * on path length */
             for (i = 0; i < EXT2FS_NDADDR && count < fs_meta->size; i++) {
                 ssize_t cnt;
+                TSK_DADDR_T blk_addr;
 
                 int read_count =
                     (fs_meta->size - count <
                     fs->block_size) ? (int) (fs_meta->size -
                     count) : (int) (fs->block_size);
 
+                if (fs_meta->content_type ==
+                    TSK_FS_META_CONTENT_TYPE_EXT4_EXTENTS) {
+                    blk_addr =
+                        ext4fs_extent_root_map(fs,
+                        (uint8_t *) fs_meta->content_ptr, i);
+                    if (blk_addr == 0) {
+                        tsk_error_reset();
+                        tsk_errno = TSK_ERR_FS_INODE_COR;
+                        snprintf(tsk_errstr, TSK_ERRSTR_L,
+                            "ext2fs_dinode_copy: symlink destination block %d not in extent tree root",
+                            i);
+                        free(data_buf);
+                        return 1;
+                    }
+                }
+                else {
+                    blk_addr = addr_ptr[i];
+                }
+
                 cnt = tsk_fs_read_block(fs,
-                    addr_ptr[i], data_buf, fs->block_size);
+                    blk_addr, data_buf, fs->block_size);
 
                 if (cnt != fs->block_size) {
                     if (cnt >= 0) {
@@ -561,7 +812,7 @@ ext2fs_dinode_copy(EXT2FS_INFO * ext2fs, TSK_FS_META * fs_meta)
                     }
                     snprintf(tsk_errstr2, TSK_ERRSTR_L,
                         "ext2fs_dinode_copy: symlink destination from %"
-                        PRIuDADDR, addr_ptr[i]);
+                        PRIuDADDR, blk_addr);
                     free(data_buf);
                     return 1;
                 }
@@ -665,6 +916,320 @@ ext2fs_inode_lookup(TSK_FS_INFO * fs, TSK_FS_FILE * a_fs_file,
 
 
 
+/** \internal
+ * Add a run to the end of an extent-based data attribute.  Runs that
+ * continue the previous one (contiguous on disk, or both sparse) are
+ * merged into it so that a large file becomes a few long runs.
+ *
+ * @param fs File system the file is in
+ * @param fs_attr Data attribute to add the run to
+ * @param a_last Pointer to the last run that was added (updated)
+ * @param addr Starting block of the run (ignored for sparse runs)
+ * @param len Number of blocks in the run
+ * @param flags Flags for the run
+ *
+ * @returns 1 on error and 0 on success
+ */
+static uint8_t
+ext4fs_extent_add_run(TSK_FS_INFO * fs, TSK_FS_ATTR * fs_attr,
+    TSK_FS_ATTR_RUN ** a_last, TSK_DADDR_T addr, TSK_DADDR_T len,
+    TSK_FS_ATTR_RUN_FLAG_ENUM flags)
+{
+    TSK_FS_ATTR_RUN *data_run = *a_last;
+
+    if (flags & TSK_FS_ATTR_RUN_FLAG_SPARSE)
+        addr = 0;
+
+    if ((data_run) && (data_run->flags == flags)
+        && ((flags & TSK_FS_ATTR_RUN_FLAG_SPARSE)
+            || (data_run->addr + data_run->len == addr))) {
+        data_run->len += len;
+        return 0;
+    }
+
+    if ((data_run = tsk_fs_attr_run_alloc()) == NULL)
+        return 1;
+
+    data_run->addr = addr;
+    data_run->len = len;
+    data_run->flags = flags;
+    tsk_fs_attr_append_run(fs, fs_attr, data_run);
+    *a_last = data_run;
+
+    return 0;
+}
+
+
+/** \internal
+ * Process one node of an ext4 extent tree.  Leaf extents are added to
+ * the data attribute as runs (holes between them become sparse runs) and
+ * index entries are followed down to the next level.  The blocks that
+ * hold the lower levels of the tree are added to the indirect attribute.
+ *
+ * @param fs File system the file is in
+ * @param fs_attr Data attribute to add runs to
+ * @param fs_attr_tree Attribute to add the tree node blocks to
+ * @param a_last Last run that was added to fs_attr (updated)
+ * @param buf Node to process (header followed by entries)
+ * @param buf_len Size of buf in bytes
+ * @param depth Depth that the node header must have
+ * @param blk_cnt Number of blocks in the file; runs after it are ignored
+ * @param next_blk Next logical block that has not been mapped (updated)
+ *
+ * @returns 1 on error and 0 on success
+ */
+static uint8_t
+ext4fs_extent_tree_load(TSK_FS_INFO * fs, TSK_FS_ATTR * fs_attr,
+    TSK_FS_ATTR * fs_attr_tree, TSK_FS_ATTR_RUN ** a_last, uint8_t * buf,
+    size_t buf_len, int depth, TSK_DADDR_T blk_cnt, TSK_DADDR_T * next_blk)
+{
+    ext4fs_extent_header *hdr = (ext4fs_extent_header *) buf;
+    uint16_t entries;
+    uint16_t i;
+
+    entries = tsk_getu16(fs->endian, hdr->eh_entries);
+    if ((tsk_getu16(fs->endian, hdr->eh_magic) != EXT4FS_EXT_MAGIC)
+        || (tsk_getu16(fs->endian, hdr->eh_depth) != depth)
+        || (sizeof(*hdr) + entries * sizeof(ext4fs_extent) > buf_len)) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_FS_INODE_COR;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "ext4fs_extent_tree_load: Invalid extent node header (depth %d)",
+            depth);
+        return 1;
+    }
+
+    if (depth == 0) {
+        ext4fs_extent *ext = (ext4fs_extent *) & hdr[1];
+
+        for (i = 0; i < entries; i++) {
+            TSK_DADDR_T lblk = tsk_getu32(fs->endian, ext[i].ee_block);
+            TSK_DADDR_T len = tsk_getu16(fs->endian, ext[i].ee_len);
+            TSK_DADDR_T addr;
+            TSK_FS_ATTR_RUN_FLAG_ENUM flags = 0;
+
+            /* Uninitialized extents are allocated, but read as 0s */
+            if (len > EXT4FS_EXT_INIT_MAX_LEN) {
+                len -= EXT4FS_EXT_INIT_MAX_LEN;
+                flags = TSK_FS_ATTR_RUN_FLAG_SPARSE;
+            }
+            addr = (TSK_DADDR_T) tsk_getu16(fs->endian,
+                ext[i].ee_start_hi) << 32 | tsk_getu32(fs->endian,
+                ext[i].ee_start_lo);
+
+            if (lblk < *next_blk) {
+                tsk_error_reset();
+                tsk_errno = TSK_ERR_FS_INODE_COR;
+                snprintf(tsk_errstr, TSK_ERRSTR_L,
+                    "ext4fs_extent_tree_load: Extent for block %"
+                    PRIuDADDR " overlaps previous extent", lblk);
+                return 1;
+            }
+            if ((len == 0) || (addr + len - 1 > fs->last_block)) {
+                tsk_error_reset();
+                tsk_errno = TSK_ERR_FS_INODE_COR;
+                snprintf(tsk_errstr, TSK_ERRSTR_L,
+                    "ext4fs_extent_tree_load: Invalid extent address: %"
+                    PRIuDADDR " (len: %" PRIuDADDR ")", addr, len);
+                return 1;
+            }
+
+            /* blocks that were allocated past the end of the file */
+            if (lblk >= blk_cnt)
+                break;
+            if (lblk + len > blk_cnt)
+                len = blk_cnt - lblk;
+
+            if ((lblk > *next_blk)
+                && (ext4fs_extent_add_run(fs, fs_attr, a_last, 0,
+                        lblk - *next_blk, TSK_FS_ATTR_RUN_FLAG_SPARSE)))
+                return 1;
+
+            if (ext4fs_extent_add_run(fs, fs_attr, a_last, addr, len,
+                    flags))
+                return 1;
+            *next_blk = lblk + len;
+        }
+    }
+    else {
+        ext4fs_extent_idx *idx = (ext4fs_extent_idx *) & hdr[1];
+        uint8_t *node_buf;
+
+        if (depth > EXT4FS_EXT_MAX_DEPTH) {
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_FS_INODE_COR;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "ext4fs_extent_tree_load: Extent tree too deep: %d",
+                depth);
+            return 1;
+        }
+
+        if ((node_buf = (uint8_t *) tsk_malloc(fs->block_size)) == NULL)
+            return 1;
+
+        for (i = 0; i < entries; i++) {
+            TSK_FS_ATTR_RUN *data_run;
+            TSK_DADDR_T addr;
+            ssize_t cnt;
+
+            if (tsk_getu32(fs->endian, idx[i].ei_block) >= blk_cnt)
+                break;
+
+            addr = (TSK_DADDR_T) tsk_getu16(fs->endian,
+                idx[i].ei_leaf_hi) << 32 | tsk_getu32(fs->endian,
+                idx[i].ei_leaf_lo);
+            if (addr > fs->last_block) {
+                tsk_error_reset();
+                tsk_errno = TSK_ERR_FS_INODE_COR;
+                snprintf(tsk_errstr, TSK_ERRSTR_L,
+                    "ext4fs_extent_tree_load: Extent node address too large: %"
+                    PRIuDADDR "", addr);
+                free(node_buf);
+                return 1;
+            }
+
+            cnt = tsk_fs_read_block(fs, addr, (char *) node_buf,
+                fs->block_size);
+            if (cnt != fs->block_size) {
+                if (cnt >= 0) {
+                    tsk_error_reset();
+                    tsk_errno = TSK_ERR_FS_READ;
+                }
+                snprintf(tsk_errstr2, TSK_ERRSTR_L,
+                    "ext4fs_extent_tree_load: Block %" PRIuDADDR, addr);
+                free(node_buf);
+                return 1;
+            }
+
+            if ((data_run = tsk_fs_attr_run_alloc()) == NULL) {
+                free(node_buf);
+                return 1;
+            }
+            data_run->addr = addr;
+            data_run->len = 1;
+            tsk_fs_attr_append_run(fs, fs_attr_tree, data_run);
+            fs_attr_tree->size += fs->block_size;
+
+            if (ext4fs_extent_tree_load(fs, fs_attr, fs_attr_tree, a_last,
+                    node_buf, fs->block_size, depth - 1, blk_cnt,
+                    next_blk)) {
+                free(node_buf);
+                return 1;
+            }
+        }
+        free(node_buf);
+    }
+
+    return 0;
+}
+
+
+/** \internal
+ * Load the data runs of a file.  Files that use an ext4 extent tree are
+ * mapped here, the others are handed to the UFS/ExtX block pointer code.
+ *
+ * @returns 1 on error and 0 on success
+ */
+static uint8_t
+ext2fs_load_attrs(TSK_FS_FILE * fs_file)
+{
+    TSK_FS_META *fs_meta = fs_file->meta;
+    TSK_FS_INFO *fs = fs_file->fs_info;
+    TSK_FS_ATTR *fs_attr;
+    TSK_FS_ATTR *fs_attr_tree = NULL;
+    TSK_FS_ATTR_RUN *run_last = NULL;
+    TSK_DADDR_T blk_cnt;
+    TSK_DADDR_T next_blk = 0;
+    ext4fs_extent_header *hdr;
+
+    if (fs_meta->content_type != TSK_FS_META_CONTENT_TYPE_EXT4_EXTENTS)
+        return tsk_fs_unix_make_data_run(fs_file);
+
+    // clean up any error messages that are lying around
+    tsk_error_reset();
+
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "ext2fs_load_attrs: Processing extents of file %" PRIuINUM
+            "\n", fs_meta->addr);
+
+    // see if we have already loaded the runs
+    if ((fs_meta->attr != NULL)
+        && (fs_meta->attr_state == TSK_FS_META_ATTR_STUDIED)) {
+        return 0;
+    }
+    else if (fs_meta->attr_state == TSK_FS_META_ATTR_ERROR) {
+        return 1;
+    }
+    else if (fs_meta->attr != NULL) {
+        tsk_fs_attrlist_markunused(fs_meta->attr);
+    }
+    else if (fs_meta->attr == NULL) {
+        if ((fs_meta->attr = tsk_fs_attrlist_alloc()) == NULL)
+            return 1;
+    }
+
+    blk_cnt = (fs_meta->size + fs->block_size - 1) / fs->block_size;
+    hdr = (ext4fs_extent_header *) fs_meta->content_ptr;
+
+    if ((fs_attr =
+            tsk_fs_attrlist_getnew(fs_meta->attr,
+                TSK_FS_ATTR_NONRES)) == NULL) {
+        return 1;
+    }
+
+    if (tsk_fs_attr_set_run(fs_file, fs_attr, NULL, NULL,
+            TSK_FS_ATTR_TYPE_DEFAULT, TSK_FS_ATTR_ID_DEFAULT,
+            fs_meta->size, fs_meta->size, roundup(fs_meta->size,
+                fs->block_size), 0, 0)) {
+        return 1;
+    }
+
+    /* The blocks of the lower tree levels are the extent equivalent of
+     * indirect blocks, so they are kept in the same attribute type */
+    if (tsk_getu16(fs->endian, hdr->eh_depth) > 0) {
+        if ((fs_attr_tree =
+                tsk_fs_attrlist_getnew(fs_meta->attr,
+                    TSK_FS_ATTR_NONRES)) == NULL) {
+            return 1;
+        }
+        if (tsk_fs_attr_set_run(fs_file, fs_attr_tree, NULL, NULL,
+                TSK_FS_ATTR_TYPE_UNIX_INDIR, TSK_FS_ATTR_ID_DEFAULT,
+                0, 0, 0, 0, 0)) {
+            return 1;
+        }
+    }
+
+    if (ext4fs_extent_tree_load(fs, fs_attr, fs_attr_tree, &run_last,
+            (uint8_t *) fs_meta->content_ptr,
+            4 * (EXT2FS_NDADDR + EXT2FS_NIADDR),
+            tsk_getu16(fs->endian, hdr->eh_depth), blk_cnt, &next_blk)) {
+        fs_meta->attr_state = TSK_FS_META_ATTR_ERROR;
+        if (fs_meta->flags & TSK_FS_META_FLAG_UNALLOC)
+            tsk_errno = TSK_ERR_FS_RECOVER;
+        return 1;
+    }
+
+    /* a hole at the end of the file has no extent */
+    if ((next_blk < blk_cnt)
+        && (ext4fs_extent_add_run(fs, fs_attr, &run_last, 0,
+                blk_cnt - next_blk, TSK_FS_ATTR_RUN_FLAG_SPARSE))) {
+        fs_meta->attr_state = TSK_FS_META_ATTR_ERROR;
+        return 1;
+    }
+
+    if (fs_attr_tree) {
+        fs_attr_tree->nrd.initsize = fs_attr_tree->size;
+        fs_attr_tree->nrd.allocsize = fs_attr_tree->size;
+    }
+
+    fs_meta->attr_state = TSK_FS_META_ATTR_STUDIED;
+
+    return 0;
+}
+
+
+
 /* ext2fs_inode_walk - inode iterator 
  *
  * flags used: TSK_FS_META_FLAG_USED, TSK_FS_META_FLAG_UNUSED,
@@ -801,6 +1366,15 @@ ext2fs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
         if ((flags & myflags) != myflags)
             continue;
 
+        /* Read the inode table in large batches so that the walk is
+         * mostly sequential.  A batch ends at the end of the group. */
+        if (!ext2fs_itbl_cached(ext2fs, inum)) {
+            if (ext2fs_itbl_load(ext2fs, inum, end_inum_tmp - inum + 1)) {
+                tsk_fs_file_close(fs_file);
+                return 1;
+            }
+        }
+
         if (ext2fs_dinode_load(ext2fs, inum)) {
             tsk_fs_file_close(fs_file);
             return 1;
@@ -877,6 +1451,87 @@ ext2fs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
 
 
 
+/* ext2fs_bg_has_super - returns 1 if the group has a copy of the super
+ * block and group descriptor table and 0 if not.  With sparse super
+ * blocks, only groups 0, 1 and powers of 3, 5, and 7 have one.
+ */
+static int
+ext2fs_bg_has_super(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ext2fs;
+    uint64_t bases[3] = { 3, 5, 7 };
+    int i;
+
+    if ((grp_num <= 1) ||
+        ((tsk_getu32(fs->endian, ext2fs->fs->s_feature_ro_compat) &
+                EXT2FS_FEATURE_RO_COMPAT_SPARSE_SUPER) == 0))
+        return 1;
+
+    for (i = 0; i < 3; i++) {
+        uint64_t n = bases[i];
+        while (n < grp_num)
+            n *= bases[i];
+        if (n == grp_num)
+            return 1;
+    }
+    return 0;
+}
+
+/* ext2fs_bg_super_len - returns the number of blocks at the start of a
+ * group that hold the super block, the group descriptor table, and the
+ * blocks reserved for growing the table (0 if the group has no copy).
+ */
+static TSK_DADDR_T
+ext2fs_bg_super_len(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ext2fs;
+
+    if (ext2fs_bg_has_super(ext2fs, grp_num) == 0)
+        return 0;
+
+    return 1 + ((TSK_DADDR_T) ext2fs->groups_count * ext2fs->gd_size +
+        fs->block_size - 1) / fs->block_size +
+        tsk_getu16(fs->endian, ext2fs->fs->s_reserved_gdt_blocks);
+}
+
+/* ext2fs_flex_is_meta - returns 1 if a block holds a bitmap or inode
+ * table of a group in the same flex_bg group as grp_num, 0 if not, and -1
+ * on error.
+ */
+static int
+ext2fs_flex_is_meta(EXT2FS_INFO * ext2fs, EXT2_GRPNUM_T grp_num,
+    TSK_DADDR_T a_addr)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ext2fs;
+    EXT2_GRPNUM_T first = grp_num - grp_num % ext2fs->flex_size;
+    EXT2_GRPNUM_T i, cnt;
+    TSK_DADDR_T itbl_len;
+
+    itbl_len = ((TSK_DADDR_T) tsk_getu32(fs->endian,
+            ext2fs->fs->s_inodes_per_group) * ext2fs->inode_size +
+        fs->block_size - 1) / fs->block_size;
+
+    cnt = ext2fs->groups_count - first;
+    if (cnt > ext2fs->flex_size)
+        cnt = ext2fs->flex_size;
+
+    for (i = 0; i < cnt; i++) {
+        ext2fs_gd *gd;
+        TSK_DADDR_T itbl;
+
+        if ((gd = ext2fs_gd_get(ext2fs, first + i)) == NULL)
+            return -1;
+        itbl = ext2fs_gd_inode_table(ext2fs, gd);
+
+        if ((a_addr == ext2fs_gd_block_bitmap(ext2fs, gd))
+            || (a_addr == ext2fs_gd_inode_bitmap(ext2fs, gd))
+            || ((a_addr >= itbl) && (a_addr < itbl + itbl_len)))
+            return 1;
+    }
+    return 0;
+}
+
+
 TSK_FS_BLOCK_FLAG_ENUM
 ext2fs_block_getflags(TSK_FS_INFO * a_fs, TSK_DADDR_T a_addr)
 {
@@ -909,14 +1564,16 @@ ext2fs_block_getflags(TSK_FS_INFO * a_fs, TSK_DADDR_T a_addr)
                 " dbase %" PRIuDADDR " bmap +%" PRIuDADDR
                 " imap +%" PRIuDADDR " inos +%" PRIuDADDR "..%"
                 PRIuDADDR "\n", grp_num, dbase,
-                (TSK_DADDR_T) tsk_getu32(a_fs->endian,
-                    ext2fs->grp_buf->bg_block_bitmap)
-                - dbase, (TSK_DADDR_T) tsk_getu32(a_fs->endian,
-                    ext2fs->grp_buf->bg_inode_bitmap) - dbase,
-                (TSK_DADDR_T) tsk_getu32(a_fs->endian,
-                    ext2fs->grp_buf->bg_inode_table) - dbase,
+                ext2fs_gd_block_bitmap(ext2fs, ext2fs->grp_buf) - dbase,
+                ext2fs_gd_inode_bitmap(ext2fs, ext2fs->grp_buf) - dbase,
+                ext2fs_gd_inode_table(ext2fs, ext2fs->grp_buf) - dbase,
                 dmin - 1 - dbase);
     }
+    /* An inode lookup may have changed the current descriptor since
+     * the bitmap was loaded */
+    else if (ext2fs_group_load(ext2fs, grp_num)) {
+        return 0;
+    }
 
     /*
      * Be sure to use the right group descriptor information. XXX There
@@ -932,8 +1589,8 @@ ext2fs_block_getflags(TSK_FS_INFO * a_fs, TSK_DADDR_T a_addr)
 
     dbase = ext2_cgbase_lcl(a_fs, ext2fs->fs, grp_num);
     dmin =
-        tsk_getu32(a_fs->endian,
-        ext2fs->grp_buf->bg_inode_table) + INODE_TABLE_SIZE(ext2fs);
+        ext2fs_gd_inode_table(ext2fs,
+        ext2fs->grp_buf) + INODE_TABLE_SIZE(ext2fs);
 
     /*
      *  Identify meta blocks
@@ -955,15 +1612,25 @@ ext2fs_block_getflags(TSK_FS_INFO * a_fs, TSK_DADDR_T a_addr)
     flags = (isset(ext2fs->bmap_buf, a_addr - dbase) ?
         TSK_FS_BLOCK_FLAG_ALLOC : TSK_FS_BLOCK_FLAG_UNALLOC);
 
-    if ((a_addr >= dbase
-            && a_addr < tsk_getu32(a_fs->endian,
-                ext2fs->grp_buf->bg_block_bitmap))
-        || (a_addr == tsk_getu32(a_fs->endian,
-                ext2fs->grp_buf->bg_block_bitmap))
-        || (a_addr == tsk_getu32(a_fs->endian,
-                ext2fs->grp_buf->bg_inode_bitmap))
-        || (a_addr >= tsk_getu32(a_fs->endian,
-                ext2fs->grp_buf->bg_inode_table)
+    /* With flex_bg, the bitmaps and inode tables are not in their own
+     * group, so check the groups that share the flex group. */
+    if (ext2fs->flex_size) {
+        int is_meta;
+
+        if (a_addr < dbase + ext2fs_bg_super_len(ext2fs, grp_num))
+            is_meta = 1;
+        else if ((is_meta =
+                ext2fs_flex_is_meta(ext2fs, grp_num, a_addr)) == -1)
+            return 0;
+
+        flags |= (is_meta ? TSK_FS_BLOCK_FLAG_META :
+            TSK_FS_BLOCK_FLAG_CONT);
+    }
+    else if ((a_addr >= dbase
+            && a_addr < ext2fs_gd_block_bitmap(ext2fs, ext2fs->grp_buf))
+        || (a_addr == ext2fs_gd_block_bitmap(ext2fs, ext2fs->grp_buf))
+        || (a_addr == ext2fs_gd_inode_bitmap(ext2fs, ext2fs->grp_buf))
+        || (a_addr >= ext2fs_gd_inode_table(ext2fs, ext2fs->grp_buf)
             && a_addr < dmin))
         flags |= TSK_FS_BLOCK_FLAG_META;
     else
@@ -1116,8 +1783,12 @@ ext2fs_fsstat(TSK_FS_INFO * fs, FILE * hFile)
     tsk_fprintf(hFile, "FILE SYSTEM INFORMATION\n");
     tsk_fprintf(hFile, "--------------------------------------------\n");
 
-    tsk_fprintf(hFile, "File System Type: %s\n",
-        (fs->ftype == TSK_FS_TYPE_EXT3) ? "Ext3" : "Ext2");
+    if (tsk_getu32(fs->endian, sb->s_feature_incompat) &
+        EXT2FS_FEATURE_INCOMPAT_EXTENTS)
+        tsk_fprintf(hFile, "File System Type: Ext4\n");
+    else
+        tsk_fprintf(hFile, "File System Type: %s\n",
+            (fs->ftype == TSK_FS_TYPE_EXT3) ? "Ext3" : "Ext2");
     tsk_fprintf(hFile, "Volume Name: %s\n", sb->s_volume_name);
     tsk_fprintf(hFile, "Volume ID: %" PRIx64 "%" PRIx64 "\n",
         tsk_getu64(fs->endian, &sb->s_uuid[8]), tsk_getu64(fs->endian,
@@ -1212,7 +1883,19 @@ ext2fs_fsstat(TSK_FS_INFO * fs, FILE * hFile)
             tsk_fprintf(hFile, "Needs Recovery, ");
         if (tsk_getu32(fs->endian, sb->s_feature_incompat) &
             EXT2FS_FEATURE_INCOMPAT_JOURNAL_DEV)
-            tsk_fprintf(hFile, "Journal Dev");
+            tsk_fprintf(hFile, "Journal Dev, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_incompat) &
+            EXT2FS_FEATURE_INCOMPAT_META_BG)
+            tsk_fprintf(hFile, "Meta Block Groups, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_incompat) &
+            EXT2FS_FEATURE_INCOMPAT_EXTENTS)
+            tsk_fprintf(hFile, "Extents, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_incompat) &
+            EXT2FS_FEATURE_INCOMPAT_64BIT)
+            tsk_fprintf(hFile, "64bit, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_incompat) &
+            EXT2FS_FEATURE_INCOMPAT_FLEX_BG)
+            tsk_fprintf(hFile, "Flexible Block Groups");
 
         tsk_fprintf(hFile, "\n");
     }
@@ -1228,7 +1911,22 @@ ext2fs_fsstat(TSK_FS_INFO * fs, FILE * hFile)
             tsk_fprintf(hFile, "Has Large Files, ");
         if (tsk_getu32(fs->endian, sb->s_feature_ro_compat) &
             EXT2FS_FEATURE_RO_COMPAT_BTREE_DIR)
-            tsk_fprintf(hFile, "Btree Dir");
+            tsk_fprintf(hFile, "Btree Dir, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_ro_compat) &
+            EXT2FS_FEATURE_RO_COMPAT_HUGE_FILE)
+            tsk_fprintf(hFile, "Huge Files, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_ro_compat) &
+            EXT2FS_FEATURE_RO_COMPAT_GDT_CSUM)
+            tsk_fprintf(hFile, "Group Desc Checksums, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_ro_compat) &
+            EXT2FS_FEATURE_RO_COMPAT_DIR_NLINK)
+            tsk_fprintf(hFile, "Dir Nlink, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_ro_compat) &
+            EXT2FS_FEATURE_RO_COMPAT_EXTRA_ISIZE)
+            tsk_fprintf(hFile, "Extra Inode Size, ");
+        if (tsk_getu32(fs->endian, sb->s_feature_ro_compat) &
+            EXT2FS_FEATURE_RO_COMPAT_METADATA_CSUM)
+            tsk_fprintf(hFile, "Metadata Checksums");
 
         tsk_fprintf(hFile, "\n");
     }
@@ -1313,8 +2011,15 @@ ext2fs_fsstat(TSK_FS_INFO * fs, FILE * hFile)
             "Reserved Blocks Before Block Groups: %" PRIu32 "\n",
             tsk_getu32(fs->endian, sb->s_first_data_block));
 
-    tsk_fprintf(hFile, "Free Blocks: %" PRIu32 "\n",
-        tsk_getu32(fs->endian, sb->s_free_blocks_count));
+    if (tsk_getu32(fs->endian, sb->s_feature_incompat) &
+        EXT2FS_FEATURE_INCOMPAT_64BIT)
+        tsk_fprintf(hFile, "Free Blocks: %" PRIu64 "\n",
+            (uint64_t) tsk_getu32(fs->endian,
+                sb->s_free_blocks_count_hi) << 32 | tsk_getu32(fs->endian,
+                sb->s_free_blocks_count));
+    else
+        tsk_fprintf(hFile, "Free Blocks: %" PRIu32 "\n",
+            tsk_getu32(fs->endian, sb->s_free_blocks_count));
 
     tsk_fprintf(hFile, "\nBLOCK GROUP INFORMATION\n");
     tsk_fprintf(hFile, "--------------------------------------------\n");
@@ -1326,6 +2031,9 @@ ext2fs_fsstat(TSK_FS_INFO * fs, FILE * hFile)
         tsk_getu32(fs->endian, sb->s_inodes_per_group));
     tsk_fprintf(hFile, "Blocks per group: %" PRIu32 "\n",
         tsk_getu32(fs->endian, sb->s_blocks_per_group));
+    if (ext2fs->flex_size)
+        tsk_fprintf(hFile, "Groups per flex group: %" PRI_EXT2GRP "\n",
+            ext2fs->flex_size);
 
 
     /* number of blocks the inodes consume */
@@ -1371,13 +2079,7 @@ ext2fs_fsstat(TSK_FS_INFO * fs, FILE * hFile)
         /* only print the super block data if we are not in a sparse
          * group 
          */
-        if (((tsk_getu32(fs->endian, ext2fs->fs->s_feature_ro_compat) &
-                    EXT2FS_FEATURE_RO_COMPAT_SPARSE_SUPER) &&
-                (cg_base != tsk_getu32(fs->endian,
-                        ext2fs->grp_buf->bg_block_bitmap)))
-            || ((tsk_getu32(fs->endian,
-                        ext2fs->fs->s_feature_ro_compat) &
-                    EXT2FS_FEATURE_RO_COMPAT_SPARSE_SUPER) == 0)) {
+        if (ext2fs_bg_has_super(ext2fs, i)) {
 
             TSK_OFF_T boff;
 
@@ -1396,7 +2098,7 @@ ext2fs_fsstat(TSK_FS_INFO * fs, FILE * hFile)
                 "    Group Descriptor Table: %" PRIuDADDR " - ",
                 (cg_base + (boff + fs->block_size - 1) / fs->block_size));
 
-            boff += (ext2fs->groups_count * sizeof(ext2fs_gd));
+            boff += (ext2fs->groups_count * ext2fs->gd_size);
             tsk_fprintf(hFile, "%" PRIuDADDR "\n",
                 ((cg_base +
                         (boff + fs->block_size - 1) / fs->block_size) -
@@ -1405,49 +2107,85 @@ ext2fs_fsstat(TSK_FS_INFO * fs, FILE * hFile)
 
 
         /* The block bitmap is a full block */
-        tsk_fprintf(hFile, "    Data bitmap: %" PRIu32 " - %" PRIu32 "\n",
-            tsk_getu32(fs->endian, ext2fs->grp_buf->bg_block_bitmap),
-            tsk_getu32(fs->endian, ext2fs->grp_buf->bg_block_bitmap));
+        tsk_fprintf(hFile,
+            "    Data bitmap: %" PRIuDADDR " - %" PRIuDADDR "\n",
+            ext2fs_gd_block_bitmap(ext2fs, ext2fs->grp_buf),
+            ext2fs_gd_block_bitmap(ext2fs, ext2fs->grp_buf));
 
 
         /* The inode bitmap is a full block */
-        tsk_fprintf(hFile, "    Inode bitmap: %" PRIu32 " - %" PRIu32 "\n",
-            tsk_getu32(fs->endian, ext2fs->grp_buf->bg_inode_bitmap),
-            tsk_getu32(fs->endian, ext2fs->grp_buf->bg_inode_bitmap));
+        tsk_fprintf(hFile,
+            "    Inode bitmap: %" PRIuDADDR " - %" PRIuDADDR "\n",
+            ext2fs_gd_inode_bitmap(ext2fs, ext2fs->grp_buf),
+            ext2fs_gd_inode_bitmap(ext2fs, ext2fs->grp_buf));
 
 
-        tsk_fprintf(hFile, "    Inode Table: %" PRIu32 " - %" PRIu32 "\n",
-            tsk_getu32(fs->endian, ext2fs->grp_buf->bg_inode_table),
-            tsk_getu32(fs->endian,
-                ext2fs->grp_buf->bg_inode_table) + ibpg - 1);
+        tsk_fprintf(hFile,
+            "    Inode Table: %" PRIuDADDR " - %" PRIuDADDR "\n",
+            ext2fs_gd_inode_table(ext2fs, ext2fs->grp_buf),
+            ext2fs_gd_inode_table(ext2fs, ext2fs->grp_buf) + ibpg - 1);
 
 
         tsk_fprintf(hFile, "    Data Blocks: ");
 
-        /* If we are in a sparse group, display the other addresses */
-        if ((tsk_getu32(fs->endian, ext2fs->fs->s_feature_ro_compat) &
-                EXT2FS_FEATURE_RO_COMPAT_SPARSE_SUPER) &&
-            (cg_base == tsk_getu32(fs->endian,
-                    ext2fs->grp_buf->bg_block_bitmap))) {
-
-            /* it goes from the end of the inode bitmap to before the
-             * table
-             *
-             * This hard coded aspect does not scale ...
-             */
-            tsk_fprintf(hFile, "%" PRIu32 " - %" PRIu32 ", ",
-                tsk_getu32(fs->endian,
-                    ext2fs->grp_buf->bg_inode_bitmap) + 1,
-                tsk_getu32(fs->endian,
-                    ext2fs->grp_buf->bg_inode_table) - 1);
-        }
+        /* With flex_bg, the group may hold the bitmaps and inode tables
+         * of the other groups in its flex group (or none at all).  The
+         * data starts after the last one of them. */
+        if (ext2fs->flex_size) {
+            TSK_DADDR_T cg_last, dstart;
+            EXT2_GRPNUM_T first, g;
 
-        tsk_fprintf(hFile, "%" PRIuDADDR " - %" PRIuDADDR "\n",
-            (uint64_t) tsk_getu32(fs->endian,
-                ext2fs->grp_buf->bg_inode_table) + ibpg,
-            ((ext2_cgbase_lcl(fs, sb, i + 1) - 1) <
+            cg_last = ((ext2_cgbase_lcl(fs, sb, i + 1) - 1) <
                 fs->last_block) ? (ext2_cgbase_lcl(fs, sb,
-                    i + 1) - 1) : fs->last_block);
+                    i + 1) - 1) : fs->last_block;
+            dstart = cg_base + ext2fs_bg_super_len(ext2fs, i);
+
+            first = (i / ext2fs->flex_size) * ext2fs->flex_size;
+
+            for (g = 0; g < ext2fs->flex_size
+                && first + g < ext2fs->groups_count; g++) {
+                ext2fs_gd *gd;
+                TSK_DADDR_T meta_end[3];
+                int m;
+
+                if ((gd = ext2fs_gd_get(ext2fs, first + g)) == NULL)
+                    return 1;
+
+                meta_end[0] = ext2fs_gd_block_bitmap(ext2fs, gd);
+                meta_end[1] = ext2fs_gd_inode_bitmap(ext2fs, gd);
+                meta_end[2] = ext2fs_gd_inode_table(ext2fs, gd) + ibpg - 1;
+                for (m = 0; m < 3; m++) {
+                    if ((meta_end[m] >= dstart) && (meta_end[m] <= cg_last))
+                        dstart = meta_end[m] + 1;
+                }
+            }
+
+            tsk_fprintf(hFile, "%" PRIuDADDR " - %" PRIuDADDR "\n",
+                dstart, cg_last);
+        }
+        else {
+            /* If we are in a sparse group, display the other addresses */
+            if ((tsk_getu32(fs->endian, ext2fs->fs->s_feature_ro_compat) &
+                    EXT2FS_FEATURE_RO_COMPAT_SPARSE_SUPER) &&
+                (cg_base == ext2fs_gd_block_bitmap(ext2fs,
+                        ext2fs->grp_buf))) {
+
+                /* it goes from the end of the inode bitmap to before the
+                 * table
+                 *
+                 * This hard coded aspect does not scale ...
+                 */
+                tsk_fprintf(hFile, "%" PRIuDADDR " - %" PRIuDADDR ", ",
+                    ext2fs_gd_inode_bitmap(ext2fs, ext2fs->grp_buf) + 1,
+                    ext2fs_gd_inode_table(ext2fs, ext2fs->grp_buf) - 1);
+            }
+
+            tsk_fprintf(hFile, "%" PRIuDADDR " - %" PRIuDADDR "\n",
+                ext2fs_gd_inode_table(ext2fs, ext2fs->grp_buf) + ibpg,
+                ((ext2_cgbase_lcl(fs, sb, i + 1) - 1) <
+                    fs->last_block) ? (ext2_cgbase_lcl(fs, sb,
+                        i + 1) - 1) : fs->last_block);
+        }
 
 
         /* Print the free info */
@@ -1671,6 +2409,18 @@ ext2fs_istat(TSK_FS_INFO * fs, FILE * hFile, TSK_INUM_T inum,
                     ext2fs->dino_buf->i_flags) & EXT2_IN_NOA)
                 tsk_fprintf(hFile, "No A-Time, ");
 
+            if (tsk_getu32(fs->endian,
+                    ext2fs->dino_buf->i_flags) & EXT2_IN_INDEX)
+                tsk_fprintf(hFile, "Hashed Index, ");
+
+            if (tsk_getu32(fs->endian,
+                    ext2fs->dino_buf->i_flags) & EXT2_IN_HUGE_FILE)
+                tsk_fprintf(hFile, "Huge File, ");
+
+            if (tsk_getu32(fs->endian,
+                    ext2fs->dino_buf->i_flags) & EXT2_IN_EXTENTS)
+                tsk_fprintf(hFile, "Extents, ");
+
             tsk_fprintf(hFile, "\n");
         }
     }
@@ -1962,7 +2712,10 @@ ext2fs_istat(TSK_FS_INFO * fs, FILE * hFile, TSK_INUM_T inum,
     fs_attr_indir = tsk_fs_file_attr_get_type(fs_file,
         TSK_FS_ATTR_TYPE_UNIX_INDIR, 0, 0);
     if (fs_attr_indir) {
-        tsk_fprintf(hFile, "\nIndirect Blocks:\n");
+        if (fs_meta->content_type == TSK_FS_META_CONTENT_TYPE_EXT4_EXTENTS)
+            tsk_fprintf(hFile, "\nExtent Tree Blocks:\n");
+        else
+            tsk_fprintf(hFile, "\nIndirect Blocks:\n");
 
         print.idx = 0;
 
@@ -1988,20 +2741,25 @@ static void
 ext2fs_close(TSK_FS_INFO * fs)
 {
     EXT2FS_INFO *ext2fs = (EXT2FS_INFO *) fs;
+    int i;
 
     fs->tag = 0;
     free((char *) ext2fs->fs);
     if (ext2fs->dino_buf != NULL)
         free((char *) ext2fs->dino_buf);
 
-    if (ext2fs->grp_buf != NULL)
-        free((char *) ext2fs->grp_buf);
+    if (ext2fs->itbl_buf != NULL)
+        free((char *) ext2fs->itbl_buf);
 
-    if (ext2fs->bmap_buf != NULL)
-        free((char *) ext2fs->bmap_buf);
+    if (ext2fs->gd_buf != NULL)
+        free((char *) ext2fs->gd_buf);
 
-    if (ext2fs->imap_buf != NULL)
-        free((char *) ext2fs->imap_buf);
+    for (i = 0; i < EXT2FS_MAP_CACHE_LEN; i++) {
+        if (ext2fs->bmap_cache.buf[i] != NULL)
+            free((char *) ext2fs->bmap_cache.buf[i]);
+        if (ext2fs->imap_cache.buf[i] != NULL)
+            free((char *) ext2fs->imap_cache.buf[i]);
+    }
 
     if (fs->list_inum_named) {
         tsk_list_free(fs->list_inum_named);
@@ -2153,6 +2911,10 @@ ext2fs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
      */
     fs->dev_bsize = img_info->sector_size;
     fs->block_count = tsk_getu32(fs->endian, ext2fs->fs->s_blocks_count);
+    if (tsk_getu32(fs->endian, ext2fs->fs->s_feature_incompat) &
+        EXT2FS_FEATURE_INCOMPAT_64BIT)
+        fs->block_count |= (TSK_DADDR_T) tsk_getu32(fs->endian,
+            ext2fs->fs->s_blocks_count_hi) << 32;
     fs->first_block = 0;
     fs->last_block_act = fs->last_block = fs->block_count - 1;
     ext2fs->first_data_block =
@@ -2187,12 +2949,31 @@ ext2fs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
         roundup((EXT2FS_SBOFF + sizeof(ext2fs_sb)), fs->block_size);
 
     ext2fs->groups_count =
-        (EXT2_GRPNUM_T) ((tsk_getu32(fs->endian,
-                ext2fs->fs->s_blocks_count) - ext2fs->first_data_block +
+        (EXT2_GRPNUM_T) ((fs->block_count - ext2fs->first_data_block +
             tsk_getu32(fs->endian,
                 ext2fs->fs->s_blocks_per_group) -
             1) / tsk_getu32(fs->endian, ext2fs->fs->s_blocks_per_group));
 
+    /* Ext4 file systems with the 64bit feature can have bigger group
+     * descriptors that hold the upper halves of the block addresses */
+    ext2fs->gd_size = sizeof(ext2fs_gd);
+    if ((tsk_getu32(fs->endian, ext2fs->fs->s_feature_incompat) &
+            EXT2FS_FEATURE_INCOMPAT_64BIT)
+        && (tsk_getu16(fs->endian,
+                ext2fs->fs->s_desc_size) >= EXT4FS_GD_64_SIZE))
+        ext2fs->gd_size = tsk_getu16(fs->endian, ext2fs->fs->s_desc_size);
+
+    /* With flex_bg, the bitmaps and inode tables of several groups are
+     * packed together */
+    ext2fs->flex_size = 0;
+    if (tsk_getu32(fs->endian, ext2fs->fs->s_feature_incompat) &
+        EXT2FS_FEATURE_INCOMPAT_FLEX_BG) {
+        if (ext2fs->fs->s_log_groups_per_flex < 31)
+            ext2fs->flex_size = 1 << ext2fs->fs->s_log_groups_per_flex;
+        else
+            ext2fs->flex_size = 1 << 30;
+    }
+
 
     /* Volume ID */
     for (fs->fs_id_used = 0; fs->fs_id_used < 16; fs->fs_id_used++) {
@@ -2205,10 +2986,11 @@ ext2fs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
     fs->block_getflags = ext2fs_block_getflags;
 
     fs->get_default_attr_type = tsk_fs_unix_get_default_attr_type;
-    fs->load_attrs = tsk_fs_unix_make_data_run;
+    fs->load_attrs = ext2fs_load_attrs;
 
     fs->file_add_meta = ext2fs_inode_lookup;
     fs->dir_open_meta = ext2fs_dir_open_meta;
+    fs->dir_lookup = ext2fs_dir_lookup;
     fs->fsstat = ext2fs_fsstat;
     fs->fscheck = ext2fs_fscheck;
     fs->istat = ext2fs_istat;
@@ -2226,16 +3008,27 @@ ext2fs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
     /* inode map */
     ext2fs->imap_buf = NULL;
     ext2fs->imap_grp_num = 0xffffffff;
+    memset(&ext2fs->imap_cache, 0, sizeof(EXT2FS_MAP_CACHE));
 
     /* block map */
     ext2fs->bmap_buf = NULL;
     ext2fs->bmap_grp_num = 0xffffffff;
+    memset(&ext2fs->bmap_cache, 0, sizeof(EXT2FS_MAP_CACHE));
 
     /* dinode */
     ext2fs->dino_buf = NULL;
     ext2fs->dino_inum = 0xffffffff;
 
-    /* group descriptor */
+    /* inode table */
+    ext2fs->itbl = NULL;
+    ext2fs->itbl_buf = NULL;
+    ext2fs->itbl_len = 0;
+    ext2fs->itbl_inum = 0;
+    ext2fs->itbl_count = 0;
+
+    /* group descriptor table */
+    ext2fs->gd_buf = NULL;
+    ext2fs->gd_count = 0;
     ext2fs->grp_buf = NULL;
     ext2fs->grp_num = 0xffffffff;
 
@@ -376,3 +376,387 @@ ext2fs_dir_open_meta(TSK_FS_INFO * a_fs, TSK_FS_DIR ** a_fs_dir,
 
     return retval_final;
 }
+
+
+
+/*
+ * Name hashes of the hashed (htree) directories, as computed by the
+ * Linux ext3 driver.
+ */
+
+#define EXT2FS_DX_ROL32(x, s) (((x) << (s)) | ((x) >> (32 - (s))))
+
+#define EXT2FS_DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define EXT2FS_DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT2FS_DX_H(x, y, z) ((x) ^ (y) ^ (z))
+#define EXT2FS_DX_ROUND(f, a, b, c, d, x, s) \
+    (a += f(b, c, d) + (x), a = EXT2FS_DX_ROL32(a, s))
+#define EXT2FS_DX_K2 013240474631UL
+#define EXT2FS_DX_K3 015666365641UL
+
+static void
+ext2fs_dx_half_md4(uint32_t buf[4], const uint32_t in[8])
+{
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    EXT2FS_DX_ROUND(EXT2FS_DX_F, a, b, c, d, in[0], 3);
+    EXT2FS_DX_ROUND(EXT2FS_DX_F, d, a, b, c, in[1], 7);
+    EXT2FS_DX_ROUND(EXT2FS_DX_F, c, d, a, b, in[2], 11);
+    EXT2FS_DX_ROUND(EXT2FS_DX_F, b, c, d, a, in[3], 19);
+    EXT2FS_DX_ROUND(EXT2FS_DX_F, a, b, c, d, in[4], 3);
+    EXT2FS_DX_ROUND(EXT2FS_DX_F, d, a, b, c, in[5], 7);
+    EXT2FS_DX_ROUND(EXT2FS_DX_F, c, d, a, b, in[6], 11);
+    EXT2FS_DX_ROUND(EXT2FS_DX_F, b, c, d, a, in[7], 19);
+
+    EXT2FS_DX_ROUND(EXT2FS_DX_G, a, b, c, d, in[1] + EXT2FS_DX_K2, 3);
+    EXT2FS_DX_ROUND(EXT2FS_DX_G, d, a, b, c, in[3] + EXT2FS_DX_K2, 5);
+    EXT2FS_DX_ROUND(EXT2FS_DX_G, c, d, a, b, in[5] + EXT2FS_DX_K2, 9);
+    EXT2FS_DX_ROUND(EXT2FS_DX_G, b, c, d, a, in[7] + EXT2FS_DX_K2, 13);
+    EXT2FS_DX_ROUND(EXT2FS_DX_G, a, b, c, d, in[0] + EXT2FS_DX_K2, 3);
+    EXT2FS_DX_ROUND(EXT2FS_DX_G, d, a, b, c, in[2] + EXT2FS_DX_K2, 5);
+    EXT2FS_DX_ROUND(EXT2FS_DX_G, c, d, a, b, in[4] + EXT2FS_DX_K2, 9);
+    EXT2FS_DX_ROUND(EXT2FS_DX_G, b, c, d, a, in[6] + EXT2FS_DX_K2, 13);
+
+    EXT2FS_DX_ROUND(EXT2FS_DX_H, a, b, c, d, in[3] + EXT2FS_DX_K3, 3);
+    EXT2FS_DX_ROUND(EXT2FS_DX_H, d, a, b, c, in[7] + EXT2FS_DX_K3, 9);
+    EXT2FS_DX_ROUND(EXT2FS_DX_H, c, d, a, b, in[2] + EXT2FS_DX_K3, 11);
+    EXT2FS_DX_ROUND(EXT2FS_DX_H, b, c, d, a, in[6] + EXT2FS_DX_K3, 15);
+    EXT2FS_DX_ROUND(EXT2FS_DX_H, a, b, c, d, in[1] + EXT2FS_DX_K3, 3);
+    EXT2FS_DX_ROUND(EXT2FS_DX_H, d, a, b, c, in[5] + EXT2FS_DX_K3, 9);
+    EXT2FS_DX_ROUND(EXT2FS_DX_H, c, d, a, b, in[0] + EXT2FS_DX_K3, 11);
+    EXT2FS_DX_ROUND(EXT2FS_DX_H, b, c, d, a, in[4] + EXT2FS_DX_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+static void
+ext2fs_dx_tea(uint32_t buf[4], const uint32_t in[4])
+{
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+    int n;
+
+    for (n = 0; n < 16; n++) {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+static uint32_t
+ext2fs_dx_legacy(const char *name, int len, uint8_t is_unsigned)
+{
+    uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        int c = is_unsigned ? (int) (unsigned char) name[i] :
+            (int) (signed char) name[i];
+        hash = hash1 + (hash0 ^ (uint32_t) (c * 7152373));
+        if (hash & 0x80000000)
+            hash -= 0x7fffffff;
+        hash1 = hash0;
+        hash0 = hash;
+    }
+    return hash0 << 1;
+}
+
+static void
+ext2fs_dx_str2hashbuf(const char *msg, int len, uint32_t * buf, int num,
+    uint8_t is_unsigned)
+{
+    uint32_t pad, val;
+    int i;
+
+    pad = (uint32_t) len | ((uint32_t) len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if (len > num * 4)
+        len = num * 4;
+    for (i = 0; i < len; i++) {
+        int c = is_unsigned ? (int) (unsigned char) msg[i] :
+            (int) (signed char) msg[i];
+        val = (uint32_t) c + (val << 8);
+        if ((i % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            num--;
+        }
+    }
+    if (--num >= 0)
+        *buf++ = val;
+    while (--num >= 0)
+        *buf++ = pad;
+}
+
+/* Returns the (major) hash of a name, with the low bit cleared */
+static uint32_t
+ext2fs_dx_hash(EXT2FS_INFO * ext2fs, int a_version, const char *a_name,
+    int a_len)
+{
+    uint32_t buf[4], in[8], hash;
+    uint8_t is_unsigned = (a_version >= EXT2FS_DX_HASH_LEGACY_UNSIGNED);
+    int i;
+
+    buf[0] = 0x67452301;
+    buf[1] = 0xefcdab89;
+    buf[2] = 0x98badcfe;
+    buf[3] = 0x10325476;
+    for (i = 0; i < 4; i++) {
+        if (tsk_getu32(TSK_LIT_ENDIAN, &ext2fs->fs->s_hash_seed[i * 4])) {
+            for (i = 0; i < 4; i++)
+                buf[i] =
+                    tsk_getu32(TSK_LIT_ENDIAN,
+                    &ext2fs->fs->s_hash_seed[i * 4]);
+            break;
+        }
+    }
+
+    switch (a_version) {
+    case EXT2FS_DX_HASH_HALF_MD4:
+    case EXT2FS_DX_HASH_HALF_MD4_UNSIGNED:
+        for (i = 0; i < a_len; i += 32) {
+            ext2fs_dx_str2hashbuf(&a_name[i], a_len - i, in, 8,
+                is_unsigned);
+            ext2fs_dx_half_md4(buf, in);
+        }
+        hash = buf[1];
+        break;
+    case EXT2FS_DX_HASH_TEA:
+    case EXT2FS_DX_HASH_TEA_UNSIGNED:
+        for (i = 0; i < a_len; i += 16) {
+            ext2fs_dx_str2hashbuf(&a_name[i], a_len - i, in, 4,
+                is_unsigned);
+            ext2fs_dx_tea(buf, in);
+        }
+        hash = buf[0];
+        break;
+    default:
+        hash = ext2fs_dx_legacy(a_name, a_len, is_unsigned);
+        break;
+    }
+
+    /* the end of the hash space is reserved */
+    hash &= ~1;
+    if (hash == 0xfffffffe)
+        hash = 0xfffffffc;
+    return hash;
+}
+
+/* Read one block of a directory.  Returns 1 on error */
+static uint8_t
+ext2fs_dx_read_block(TSK_FS_FILE * fs_file, uint32_t a_block, char *a_buf)
+{
+    TSK_FS_INFO *fs = fs_file->fs_info;
+    TSK_OFF_T off = (TSK_OFF_T) a_block * fs->block_size;
+
+    if (off + fs->block_size > fs_file->meta->size)
+        return 1;
+    if (tsk_fs_file_read(fs_file, off, a_buf, fs->block_size,
+            (TSK_FS_FILE_READ_FLAG_ENUM) 0) != (ssize_t) fs->block_size) {
+        tsk_error_reset();
+        return 1;
+    }
+    return 0;
+}
+
+/* Look for an allocated entry in a leaf block.  Returns 1 if found. */
+static uint8_t
+ext2fs_dx_find_leaf(EXT2FS_INFO * ext2fs, char *a_buf, const char *a_name,
+    unsigned int a_len, TSK_FS_NAME * a_fs_name)
+{
+    TSK_FS_INFO *fs = &(ext2fs->fs_info);
+    unsigned int idx = 0;
+
+    while (idx + EXT2FS_DIRSIZ_lcl(1) <= fs->block_size) {
+        char *dirPtr = &a_buf[idx];
+        unsigned int namelen, reclen;
+        uint32_t inode;
+        char *name;
+
+        if (ext2fs->deentry_type == EXT2_DE_V1) {
+            ext2fs_dentry1 *dir = (ext2fs_dentry1 *) dirPtr;
+            inode = tsk_getu32(fs->endian, dir->inode);
+            namelen = tsk_getu16(fs->endian, dir->name_len);
+            reclen = tsk_getu16(fs->endian, dir->rec_len);
+            name = dir->name;
+        }
+        else {
+            ext2fs_dentry2 *dir = (ext2fs_dentry2 *) dirPtr;
+            inode = tsk_getu32(fs->endian, dir->inode);
+            namelen = dir->name_len;
+            reclen = tsk_getu16(fs->endian, dir->rec_len);
+            name = dir->name;
+        }
+
+        if ((reclen < EXT2FS_DIRSIZ_lcl(namelen)) || (reclen % 4)
+            || (idx + reclen > fs->block_size))
+            return 0;
+
+        if ((inode != 0) && (inode <= fs->last_inum)
+            && (namelen == a_len) && (memcmp(name, a_name, a_len) == 0)) {
+            if (ext2fs_dent_copy(ext2fs, dirPtr, a_fs_name)) {
+                tsk_error_reset();
+                return 0;
+            }
+            return 1;
+        }
+        idx += reclen;
+    }
+    return 0;
+}
+
+
+/** \internal
+ * Find one name in a hashed (htree) directory by hashing the name and
+ * following the index blocks to the one leaf block that can hold it,
+ * instead of reading the whole directory.  Directories without an index
+ * are left to the caller.
+ *
+ * @param a_fs File system to analyze
+ * @param a_addr Address of the directory
+ * @param a_name Name to find
+ * @param a_fs_name [out] Name that was found
+ * @returns TSK_OK if found, TSK_COR if not found (or the directory is not
+ * hashed) and TSK_ERR on error
+ */
+TSK_RETVAL_ENUM
+ext2fs_dir_lookup(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr,
+    const char *a_name, TSK_FS_NAME * a_fs_name)
+{
+    EXT2FS_INFO *ext2fs = (EXT2FS_INFO *) a_fs;
+    TSK_FS_FILE *fs_file;
+    char *idxbuf = NULL, *leafbuf;
+    ext2fs_dx_root_info *info;
+    ext2fs_dx_entry *entries;
+    unsigned int off, levels, count, limit, at;
+    uint32_t hash;
+    int version;
+    size_t len = strlen(a_name);
+    TSK_RETVAL_ENUM retval = TSK_COR;
+
+    if (((tsk_getu32(a_fs->endian,
+                    ext2fs->fs->s_feature_compat) &
+                EXT2FS_FEATURE_COMPAT_DIR_INDEX) == 0)
+        || (a_addr < a_fs->first_inum) || (a_addr > a_fs->last_inum)
+        || (a_addr == TSK_FS_ORPHANDIR_INUM(a_fs))
+        || (len == 0) || (len > EXT2FS_MAXNAMLEN))
+        return TSK_COR;
+
+    if ((fs_file = tsk_fs_file_open_meta(a_fs, NULL, a_addr)) == NULL) {
+        tsk_error_reset();
+        return TSK_COR;
+    }
+
+    // the entries of a deleted directory are all reported as deleted
+    if ((fs_file->meta->flags & TSK_FS_META_FLAG_UNALLOC)
+        || (fs_file->meta->type != TSK_FS_META_TYPE_DIR)
+        || (fs_file->meta->size < 2 * a_fs->block_size))
+        goto done;
+
+    if ((idxbuf = (char *) tsk_malloc(2 * a_fs->block_size)) == NULL) {
+        retval = TSK_ERR;
+        goto done;
+    }
+    leafbuf = &idxbuf[a_fs->block_size];
+
+    /* The root is only there if "." and ".." cover the first block and
+     * the info that follows them is sane */
+    if (ext2fs_dx_read_block(fs_file, 0, idxbuf))
+        goto done;
+    info = (ext2fs_dx_root_info *) & idxbuf[EXT2FS_DX_ROOT_INFO_OFF];
+    if ((tsk_getu16(a_fs->endian, &idxbuf[4]) != 12)
+        || (tsk_getu16(a_fs->endian, &idxbuf[16]) != a_fs->block_size - 12)
+        || (tsk_getu32(a_fs->endian, info->reserved_zero) != 0)
+        || (info->info_length != 8)
+        || (info->hash_version > EXT2FS_DX_HASH_TEA)
+        || (info->indirect_levels > 2))
+        goto done;
+
+    version = info->hash_version;
+    if (tsk_getu32(a_fs->endian, ext2fs->fs->s_flags) &
+        EXT2FS_FLAGS_UNSIGNED_HASH)
+        version += EXT2FS_DX_HASH_LEGACY_UNSIGNED;
+    hash = ext2fs_dx_hash(ext2fs, version, a_name, (int) len);
+
+    off = EXT2FS_DX_ROOT_INFO_OFF + info->info_length;
+    levels = info->indirect_levels;
+    while (1) {
+        ext2fs_dx_countlimit *cl = (ext2fs_dx_countlimit *) & idxbuf[off];
+        unsigned int lo, hi;
+
+        count = tsk_getu16(a_fs->endian, cl->count);
+        limit = tsk_getu16(a_fs->endian, cl->limit);
+        if ((count == 0) || (count > limit)
+            || (off + limit * sizeof(ext2fs_dx_entry) > a_fs->block_size))
+            goto bad;
+        entries = (ext2fs_dx_entry *) & idxbuf[off];
+
+        /* The first entry covers the hashes below the second one, find
+         * the last entry whose hash is not above ours */
+        lo = 1;
+        hi = count - 1;
+        while (lo <= hi) {
+            unsigned int mid = lo + (hi - lo) / 2;
+            if (tsk_getu32(a_fs->endian, entries[mid].hash) > hash)
+                hi = mid - 1;
+            else
+                lo = mid + 1;
+        }
+        at = lo - 1;
+
+        if (levels == 0)
+            break;
+        levels--;
+
+        if (ext2fs_dx_read_block(fs_file,
+                tsk_getu32(a_fs->endian, entries[at].block) & 0x0fffffff,
+                idxbuf))
+            goto bad;
+        if ((tsk_getu32(a_fs->endian, &idxbuf[0]) != 0)
+            || (tsk_getu16(a_fs->endian, &idxbuf[4]) != a_fs->block_size))
+            goto bad;
+        off = EXT2FS_DX_NODE_OFF;
+    }
+
+    /* Search the leaf.  Names with the same hash can continue in the
+     * next leaf, which its index entry marks with the low bit */
+    while (1) {
+        uint32_t next_hash;
+
+        if (ext2fs_dx_read_block(fs_file,
+                tsk_getu32(a_fs->endian, entries[at].block) & 0x0fffffff,
+                leafbuf))
+            goto bad;
+        if (ext2fs_dx_find_leaf(ext2fs, leafbuf, a_name,
+                (unsigned int) len, a_fs_name)) {
+            a_fs_name->flags = TSK_FS_NAME_FLAG_ALLOC;
+            retval = TSK_OK;
+            goto done;
+        }
+
+        if (++at >= count)
+            goto done;
+        next_hash = tsk_getu32(a_fs->endian, entries[at].hash);
+        if (((next_hash & 1) == 0) || ((next_hash & ~1) != hash))
+            goto done;
+    }
+
+  bad:
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "ext2fs_dir_lookup: Bad hash tree in directory %" PRIuINUM
+            " (name: %s hash version: %d hash: 0x%" PRIx32 ")\n", a_addr,
+            a_name, version, hash);
+
+  done:
+    free(idxbuf);
+    tsk_fs_file_close(fs_file);
+    return retval;
+}
@@ -130,6 +130,183 @@ getFATCacheIdx(FATFS_INFO * fatfs, TSK_DADDR_T sect)
 }
 
 
+/* Number of FAT entries that the scan kernels check in one step */
+#define FATFS_SCAN_W	16
+
+/*
+ * Read the first FAT into fatfs->fat_table as an array of decoded
+ * entries, one per cluster, so that cluster chains and allocation status
+ * can be looked up without going through the sector cache.  FATs larger
+ * than FATFS_FAT_TABLE_MAX and FATs that cannot be read are left to the
+ * cache, so errors here are not fatal.
+ */
+static void
+fatfs_fat_table_load(FATFS_INFO * fatfs)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & fatfs->fs_info;
+    size_t nent, rlen, i;
+    uint8_t *raw;
+    uint32_t *tbl;
+    ssize_t cnt;
+
+    if (fatfs->lastclust >= FATFS_FAT_TABLE_MAX / sizeof(uint32_t))
+        return;
+    nent = (size_t) fatfs->lastclust + 1;
+
+    /* number of bytes in the FAT that hold the entries */
+    if (fs->ftype == TSK_FS_TYPE_FAT12)
+        rlen = nent + (nent >> 1) + 1;
+    else if (fs->ftype == TSK_FS_TYPE_FAT16)
+        rlen = nent * 2;
+    else
+        rlen = nent * 4;
+    rlen = roundup(rlen, fatfs->ssize);
+
+    /* FAT32 entries are decoded in place */
+    if ((tbl = (uint32_t *) tsk_malloc(fs->ftype == TSK_FS_TYPE_FAT32 ?
+                rlen : nent * sizeof(uint32_t))) == NULL) {
+        tsk_error_reset();
+        return;
+    }
+    if (fs->ftype == TSK_FS_TYPE_FAT32)
+        raw = (uint8_t *) tbl;
+    else if ((raw = (uint8_t *) tsk_malloc(rlen)) == NULL) {
+        free(tbl);
+        tsk_error_reset();
+        return;
+    }
+
+    cnt = tsk_fs_read(fs, fatfs->firstfatsect * fs->block_size,
+        (char *) raw, rlen);
+    if (cnt != (ssize_t) rlen) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr,
+                "fatfs_fat_table_load: error reading FAT, using the cache\n");
+        if (raw != (uint8_t *) tbl)
+            free(raw);
+        free(tbl);
+        tsk_error_reset();
+        return;
+    }
+
+    for (i = 0; i < nent; i++) {
+        uint32_t val;
+
+        if (fs->ftype == TSK_FS_TYPE_FAT12) {
+            val = tsk_getu16(fs->endian, raw + i + (i >> 1));
+            if (i & 1)
+                val >>= 4;
+        }
+        else if (fs->ftype == TSK_FS_TYPE_FAT16)
+            val = tsk_getu16(fs->endian, raw + i * 2);
+        else
+            val = tsk_getu32(fs->endian, raw + i * 4);
+        val &= fatfs->mask;
+
+        /* same sanity check as fatfs_getFAT() */
+        if ((val > fatfs->lastclust) && (val < (0x0ffffff7 & fatfs->mask)))
+            val = 0;
+        tbl[i] = val;
+    }
+
+    if (raw != (uint8_t *) tbl)
+        free(raw);
+    fatfs->fat_table = tbl;
+
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "fatfs_fat_table_load: loaded %" PRIuSIZE " FAT entries\n",
+            nent);
+}
+
+
+/**
+ * \internal
+ * Scan the in-memory FAT for the first cluster in a range that is
+ * unallocated (or allocated).  The entries are checked in blocks of
+ * FATFS_SCAN_W with a branch-free inner loop that the compiler can
+ * vectorize.  fatfs->fat_table must be loaded.
+ *
+ * @param fatfs File system to scan
+ * @param a_start First cluster to check
+ * @param a_end Cluster after the last one to check (at most lastclust + 1)
+ * @param a_free 1 to look for an unallocated cluster, 0 for an allocated one
+ * @returns the cluster found or a_end if there is none
+ */
+TSK_DADDR_T
+fatfs_fat_scan(FATFS_INFO * fatfs, TSK_DADDR_T a_start,
+    TSK_DADDR_T a_end, uint8_t a_free)
+{
+    const uint32_t *tbl = fatfs->fat_table;
+    TSK_DADDR_T c = a_start;
+    int k;
+
+    while (c + FATFS_SCAN_W <= a_end) {
+        uint32_t hit = 0;
+
+        if (a_free) {
+            for (k = 0; k < FATFS_SCAN_W; k++)
+                hit |= (tbl[c + k] == FATFS_UNALLOC);
+        }
+        else {
+            for (k = 0; k < FATFS_SCAN_W; k++)
+                hit |= tbl[c + k];
+        }
+        if (hit)
+            break;
+        c += FATFS_SCAN_W;
+    }
+
+    for (; c < a_end; c++) {
+        if ((tbl[c] == FATFS_UNALLOC) == (a_free != 0))
+            break;
+    }
+    return c;
+}
+
+
+/**
+ * \internal
+ * Count how many clusters after a_clust continue its chain contiguously
+ * (each entry points to the cluster that follows it), so that a chain
+ * can be turned into runs without following it one entry at a time.
+ * fatfs->fat_table must be loaded.
+ *
+ * @param fatfs File system to scan
+ * @param a_clust Cluster to start from
+ * @param a_max Maximum number of clusters to count
+ * @returns the number of clusters that follow a_clust in sequence
+ */
+TSK_DADDR_T
+fatfs_fat_contig(FATFS_INFO * fatfs, TSK_DADDR_T a_clust,
+    TSK_DADDR_T a_max)
+{
+    const uint32_t *tbl = fatfs->fat_table;
+    TSK_DADDR_T c = a_clust;
+    TSK_DADDR_T end;
+    int k;
+
+    if (a_clust >= fatfs->lastclust)
+        return 0;
+    end = (a_max < fatfs->lastclust - a_clust) ?
+        a_clust + a_max : fatfs->lastclust;
+
+    while (c + FATFS_SCAN_W <= end) {
+        uint32_t diff = 0;
+
+        for (k = 0; k < FATFS_SCAN_W; k++)
+            diff |= tbl[c + k] ^ (uint32_t) (c + k + 1);
+        if (diff)
+            break;
+        c += FATFS_SCAN_W;
+    }
+
+    while ((c < end) && (tbl[c] == c + 1))
+        c++;
+    return c - a_clust;
+}
+
+
 /*
  * Set *value to the entry in the File Allocation Table (FAT) 
  * for the given cluster
@@ -171,6 +348,12 @@ fatfs_getFAT(FATFS_INFO * fatfs, TSK_DADDR_T clust, TSK_DADDR_T * value)
         return 1;
     }
 
+    /* The in-memory FAT has already been decoded and checked */
+    if (fatfs->fat_table != NULL) {
+        *value = fatfs->fat_table[clust];
+        return 0;
+    }
+
     switch (fatfs->fs_info.ftype) {
     case TSK_FS_TYPE_FAT12:
         if (clust & 0xf000) {
@@ -1275,6 +1458,9 @@ fatfs_close(TSK_FS_INFO * fs)
 
     free(fatfs->dinodes);
 
+    if (fatfs->fat_table)
+        free(fatfs->fat_table);
+
     if (fatfs->dir_buf)
         free(fatfs->dir_buf);
     if (fatfs->par_buf)
@@ -1696,5 +1882,9 @@ fatfs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
     // initialize the caches
     fs->list_inum_named = NULL;
 
+    /* load the FAT into memory if it is not too large */
+    fatfs->fat_table = NULL;
+    fatfs_fat_table_load(fatfs);
+
     return (fs);
 }
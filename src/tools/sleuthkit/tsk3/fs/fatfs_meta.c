@@ -1722,6 +1722,15 @@ fatfs_make_data_run(TSK_FS_FILE * a_fs_file)
                 break;
             }
 
+            /* With the FAT in memory, skip a whole range of allocated
+             * clusters at once */
+            if ((fatfs->fat_table != NULL) && (clust <= fatfs->lastclust)
+                && (fatfs->fat_table[clust] != FATFS_UNALLOC)) {
+                clust = fatfs_fat_scan(fatfs, clust,
+                    fatfs->lastclust + 1, 1);
+                continue;
+            }
+
             /* Skip allocated clusters */
             retval = fatfs_is_clustalloc(fatfs, clust);
             if (retval == -1) {
@@ -1763,6 +1772,23 @@ fatfs_make_data_run(TSK_FS_FILE * a_fs_file)
 
             size_remain -= (fatfs->csize << fatfs->ssize_sh);
             clust++;
+
+            /* Take the unallocated clusters that follow in the same run */
+            if ((fatfs->fat_table != NULL) && ((int64_t) size_remain > 0)
+                && (clust <= fatfs->lastclust)) {
+                TSK_OFF_T csize_b = fatfs->csize << fatfs->ssize_sh;
+                TSK_DADDR_T end, n;
+
+                end = clust + (size_remain + csize_b - 1) / csize_b;
+                if (end > fatfs->lastclust + 1)
+                    end = fatfs->lastclust + 1;
+                n = fatfs_fat_scan(fatfs, clust, end, 0) - clust;
+
+                data_run->len += n * fatfs->csize;
+                full_len_s += n * fatfs->csize;
+                size_remain -= n * csize_b;
+                clust += n;
+            }
         }
 
         // Get a FS_DATA structure and add the runlist to it
@@ -1819,6 +1845,7 @@ fatfs_make_data_run(TSK_FS_FILE * a_fs_file)
         TSK_FS_ATTR_RUN *data_run_head = NULL;
         TSK_OFF_T full_len_s = 0;
         TSK_DADDR_T sbase;
+        uint8_t loop_found = 0;
 
         if (tsk_verbose)
             tsk_fprintf(stderr,
@@ -1873,6 +1900,43 @@ fatfs_make_data_run(TSK_FS_FILE * a_fs_file)
             full_len_s += fatfs->csize;
             size_remain -= (fatfs->csize * fs->block_size);
 
+            /* With the FAT in memory, add the clusters that continue
+             * the chain contiguously to the run in one step */
+            if ((fatfs->fat_table != NULL) && ((int64_t) size_remain > 0)) {
+                TSK_OFF_T csize_b = fatfs->csize * fs->block_size;
+                TSK_DADDR_T n, i;
+
+                n = fatfs_fat_contig(fatfs, clust,
+                    (size_remain + csize_b - 1) / csize_b);
+
+                /* Make sure we do not get into an infinite loop */
+                for (i = 1; i <= n; i++) {
+                    if (tsk_list_find(list_seen, clust + i)) {
+                        loop_found = 1;
+                        break;
+                    }
+                    if (tsk_list_add(&list_seen, clust + i)) {
+                        fs_meta->attr_state = TSK_FS_META_ATTR_ERROR;
+                        tsk_fs_attr_run_free(data_run_head);
+                        tsk_list_free(list_seen);
+                        list_seen = NULL;
+                        return 1;
+                    }
+                }
+
+                data_run->len += (i - 1) * fatfs->csize;
+                full_len_s += (i - 1) * fatfs->csize;
+                size_remain -= (i - 1) * csize_b;
+                clust += i - 1;
+
+                if (loop_found) {
+                    if (tsk_verbose)
+                        tsk_fprintf(stderr,
+                            "Loop found while processing file\n");
+                    break;
+                }
+            }
+
             if ((int64_t) size_remain > 0) {
                 TSK_DADDR_T nxt;
                 if (fatfs_getFAT(fatfs, clust, &nxt)) {
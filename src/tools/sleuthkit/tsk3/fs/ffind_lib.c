@@ -95,7 +95,9 @@ tsk_fs_ffind(TSK_FS_INFO * fs, TSK_FS_FFIND_FLAG_ENUM lclflags,
             return 1;
     }
     else {
-        if (tsk_fs_dir_walk(fs, fs->root_inum, flags, find_file_act,
+        // only the names are compared
+        if (tsk_fs_dir_walk(fs, fs->root_inum,
+                flags | TSK_FS_DIR_WALK_FLAG_NAMEONLY, find_file_act,
                 &data))
             return 1;
     }
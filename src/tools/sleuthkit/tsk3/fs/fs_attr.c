@@ -725,6 +725,209 @@ tsk_fs_attr_walk_res(const TSK_FS_ATTR * fs_attr,
 }
 
 
+/* tsk_fs_attr_walk_nonres() keeps up to TSK_FS_ATTR_AIO_NUM reads of
+ * TSK_FS_ATTR_AIO_LEN bytes in flight ahead of the block it returns */
+#define TSK_FS_ATTR_AIO_NUM     8
+#define TSK_FS_ATTR_AIO_LEN     (128 * 1024)
+
+/* One read of the pipeline, a range of contiguous blocks */
+typedef struct {
+    char *buf;
+    TSK_DADDR_T addr;           // address of the first block
+    size_t num;                 // number of blocks
+    uint8_t busy;               // read still in flight
+    uint8_t failed;
+} FS_ATTR_AIO_SLOT;
+
+/* Blocks of an attribute read ahead by tsk_fs_attr_walk_nonres() */
+typedef struct {
+    FS_ATTR_AIO_SLOT slot[TSK_FS_ATTR_AIO_NUM];
+    size_t max;                 // number of blocks a slot can hold
+    int first;                  // slot with the next block
+    int count;                  // number of slots in use
+    int busy;                   // number of reads in flight
+    size_t pos;                 // next block in the first slot
+    TSK_FS_ATTR_RUN *run;       // where the next read starts
+    TSK_DADDR_T idx;
+    size_t left;                // blocks needed after the next read
+    uint8_t claimed;            // holds tsk_img_aio_claim()
+} FS_ATTR_AIO;
+
+/* Wait for one read to complete.  Returns 1 on error. */
+static uint8_t
+fs_attr_aio_wait(TSK_FS_INFO * fs, FS_ATTR_AIO * aio)
+{
+    TSK_IMG_AIO_EVENT ev[TSK_FS_ATTR_AIO_NUM];
+    int i, n;
+
+    // the reads that others started on the image stay queued for them
+    if ((n = tsk_img_aio_poll_range(fs->img_info, aio->slot,
+                &aio->slot[TSK_FS_ATTR_AIO_NUM], ev, TSK_FS_ATTR_AIO_NUM,
+                1)) <= 0)
+        return 1;
+
+    for (i = 0; i < n; i++) {
+        FS_ATTR_AIO_SLOT *slot = (FS_ATTR_AIO_SLOT *) ev[i].tag;
+
+        slot->busy = 0;
+        slot->failed = (ev[i].ret != (ssize_t) (slot->num * fs->block_size));
+        aio->busy--;
+    }
+    return 0;
+}
+
+/* Wait for the reads in flight and drop the read data */
+static void
+fs_attr_aio_drain(TSK_FS_INFO * fs, FS_ATTR_AIO * aio)
+{
+    while (aio->busy > 0) {
+        if (fs_attr_aio_wait(fs, aio)) {
+            tsk_error_reset();
+            break;
+        }
+    }
+    aio->count = 0;
+    aio->pos = 0;
+}
+
+static void
+fs_attr_aio_free(TSK_FS_INFO * fs, FS_ATTR_AIO * aio)
+{
+    int i;
+
+    // the buffers can only go once the image is done with them
+    fs_attr_aio_drain(fs, aio);
+    if (aio->busy > 0)
+        return;
+    for (i = 0; i < TSK_FS_ATTR_AIO_NUM; i++)
+        free(aio->slot[i].buf);
+    if (aio->claimed)
+        tsk_img_aio_release(fs->img_info);
+}
+
+/* Start reads until the pipeline is full or the attribute ends.  Reads
+ * stop at sparse and filler runs and at addresses outside of the image,
+ * which are left to the block by block code. */
+static void
+fs_attr_aio_fill(TSK_FS_INFO * fs, FS_ATTR_AIO * aio)
+{
+    while ((aio->count < TSK_FS_ATTR_AIO_NUM) && (aio->left > 0)
+        && (aio->run)) {
+        FS_ATTR_AIO_SLOT *slot;
+        TSK_IMG_READ_REQ req;
+        TSK_DADDR_T addr, len;
+
+        if (aio->idx >= aio->run->len) {
+            aio->run = aio->run->next;
+            aio->idx = 0;
+            continue;
+        }
+        if (aio->run->flags & (TSK_FS_ATTR_RUN_FLAG_SPARSE |
+                TSK_FS_ATTR_RUN_FLAG_FILLER)) {
+            aio->run = NULL;
+            break;
+        }
+
+        addr = aio->run->addr + aio->idx;
+        len = aio->run->len - aio->idx;
+        if (len > aio->max)
+            len = aio->max;
+        if (len > aio->left)
+            len = aio->left;
+        if (addr + len - 1 > fs->last_block_act) {
+            if (addr > fs->last_block_act) {
+                aio->run = NULL;
+                break;
+            }
+            len = fs->last_block_act - addr + 1;
+        }
+
+        slot = &aio->slot[(aio->first + aio->count) % TSK_FS_ATTR_AIO_NUM];
+        if ((slot->buf == NULL) && ((slot->buf =
+                    (char *) tsk_malloc(aio->max * fs->block_size)) ==
+                NULL)) {
+            tsk_error_reset();
+            aio->run = NULL;
+            break;
+        }
+        slot->addr = addr;
+        slot->num = (size_t) len;
+        slot->busy = 1;
+        slot->failed = 0;
+
+        req.off = fs->offset + (TSK_OFF_T) addr * fs->block_size;
+        req.buf = slot->buf;
+        req.len = (size_t) len * fs->block_size;
+        if (tsk_img_aio_submit(fs->img_info, &req, slot)) {
+            tsk_error_reset();
+            aio->run = NULL;
+            break;
+        }
+
+        aio->count++;
+        aio->busy++;
+        aio->idx += len;
+        aio->left -= (size_t) len;
+    }
+}
+
+/* Restart the pipeline at block a_idx of a_run, a_blks blocks are needed */
+static void
+fs_attr_aio_start(TSK_FS_INFO * fs, FS_ATTR_AIO * aio,
+    TSK_FS_ATTR_RUN * a_run, TSK_DADDR_T a_idx, size_t a_blks)
+{
+    fs_attr_aio_drain(fs, aio);
+    if (aio->busy > 0)
+        return;
+
+    // another thread reading the image has the asynchronous reads
+    if ((aio->claimed == 0)
+        && ((aio->claimed = tsk_img_aio_claim(fs->img_info)) == 0))
+        return;
+
+    aio->max = TSK_FS_ATTR_AIO_LEN / fs->block_size;
+    if (aio->max == 0)
+        aio->max = 1;
+    aio->run = a_run;
+    aio->idx = a_idx;
+    aio->left = a_blks;
+    fs_attr_aio_fill(fs, aio);
+}
+
+/* Return the data of block a_addr if it is the next block in the
+ * pipeline and was read without errors, NULL if not. */
+static char *
+fs_attr_aio_get(TSK_FS_INFO * fs, FS_ATTR_AIO * aio, TSK_DADDR_T a_addr)
+{
+    FS_ATTR_AIO_SLOT *slot;
+
+    // the first slot was used up by the previous call
+    if ((aio->count > 0) && (aio->pos >= aio->slot[aio->first].num)) {
+        aio->first = (aio->first + 1) % TSK_FS_ATTR_AIO_NUM;
+        aio->count--;
+        aio->pos = 0;
+        fs_attr_aio_fill(fs, aio);
+    }
+
+    if (aio->count == 0)
+        return NULL;
+
+    slot = &aio->slot[aio->first];
+    if (slot->addr + aio->pos != a_addr)
+        return NULL;
+
+    while (slot->busy) {
+        if (fs_attr_aio_wait(fs, aio)) {
+            tsk_error_reset();
+            return NULL;
+        }
+    }
+    if (slot->failed)
+        return NULL;
+
+    return &slot->buf[aio->pos++ * fs->block_size];
+}
+
 /** \internal
  * Processes a non-resident TSK_FS_ATTR structure and calls the callback with the associated
  * data. 
@@ -748,6 +951,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
     uint32_t skip_remain;
     TSK_FS_INFO *fs = fs_attr->fs_file->fs_info;
     uint8_t stop_loop = 0;
+    FS_ATTR_AIO aio;
 
     if ((fs_attr->flags & TSK_FS_ATTR_NONRES) == 0) {
         tsk_errno = TSK_ERR_FS_ARG;
@@ -763,6 +967,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
         tot_size = fs_attr->size;
 
     skip_remain = fs_attr->nrd.skiplen;
+    memset(&aio, 0, sizeof(aio));
 
     if ((a_flags & TSK_FS_FILE_WALK_FLAG_AONLY) == 0) {
         if ((buf = (char *) tsk_malloc(fs->block_size)) == NULL) {
@@ -783,6 +988,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
         for (len_idx = 0; len_idx < fs_attr_run->len; len_idx++) {
 
             TSK_FS_BLOCK_FLAG_ENUM myflags;
+            char *blk_buf = buf;
 
             /* If the address is too large then give an error */
             if (addr + len_idx > fs->last_block) {
@@ -794,6 +1000,8 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
                 snprintf(tsk_errstr, TSK_ERRSTR_L,
                     "Invalid address in run (too large): %"
                     PRIuDADDR "", addr + len_idx);
+                free(buf);
+                fs_attr_aio_free(fs, &aio);
                 return 1;
             }
 
@@ -822,10 +1030,39 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
                     memset(buf, 0, fs->block_size);
                 }
                 else {
-                    ssize_t cnt;
+                    ssize_t cnt = fs->block_size;
+
+                    /* The following blocks of the attribute are read
+                     * ahead with asynchronous reads.  If this block is
+                     * not the next one in the pipeline, restart it here. */
+                    if ((blk_buf =
+                            fs_attr_aio_get(fs, &aio,
+                                addr + len_idx)) == NULL) {
+                        TSK_OFF_T end = tot_size;
+                        size_t blks;
+
+                        if ((fs_attr->nrd.initsize < end)
+                            && ((a_flags & TSK_FS_FILE_READ_FLAG_SLACK) ==
+                                0))
+                            end = fs_attr->nrd.initsize;
+                        blks =
+                            (size_t) ((end - off + skip_remain +
+                                fs->block_size - 1) / fs->block_size);
+
+                        if (blks > 1) {
+                            fs_attr_aio_start(fs, &aio, fs_attr_run,
+                                len_idx, blks);
+                            blk_buf = fs_attr_aio_get(fs, &aio,
+                                addr + len_idx);
+                        }
+                    }
 
-                    cnt = tsk_fs_read_block
-                        (fs, addr + len_idx, buf, fs->block_size);
+                    // the block read reports errors
+                    if (blk_buf == NULL) {
+                        blk_buf = buf;
+                        cnt = tsk_fs_read_block
+                            (fs, addr + len_idx, buf, fs->block_size);
+                    }
                     if (cnt != fs->block_size) {
                         if (cnt >= 0) {
                             tsk_error_reset();
@@ -834,11 +1071,13 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
                         snprintf(tsk_errstr2, TSK_ERRSTR_L,
                             "tsk_fs_file_walk: Error reading block at %"
                             PRIuDADDR, addr + len_idx);
+                        free(buf);
+                        fs_attr_aio_free(fs, &aio);
                         return 1;
                     }
                     if ((off + fs->block_size > fs_attr->nrd.initsize)
                         && ((a_flags & TSK_FS_FILE_READ_FLAG_SLACK) == 0)) {
-                        memset(&buf[fs_attr->nrd.initsize - off], 0,
+                        memset(&blk_buf[fs_attr->nrd.initsize - off], 0,
                             fs->block_size -
                             (size_t) (fs_attr->nrd.initsize - off));
                     }
@@ -873,7 +1112,8 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
                     if ((a_flags & TSK_FS_FILE_WALK_FLAG_NOSPARSE) == 0) {
                         retval =
                             a_action(fs_attr->fs_file, off, 0,
-                            &buf[skip_remain], ret_len, myflags, a_ptr);
+                            &blk_buf[skip_remain], ret_len, myflags,
+                            a_ptr);
                     }
                 }
                 else {
@@ -882,7 +1122,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
 
                     retval =
                         a_action(fs_attr->fs_file, off, addr + len_idx,
-                        &buf[skip_remain], ret_len, myflags, a_ptr);
+                        &blk_buf[skip_remain], ret_len, myflags, a_ptr);
                 }
                 off += ret_len;
                 skip_remain = 0;
@@ -904,6 +1144,7 @@ tsk_fs_attr_walk_nonres(const TSK_FS_ATTR * fs_attr,
 
     if (buf)
         free(buf);
+    fs_attr_aio_free(fs, &aio);
 
     if (retval == TSK_WALK_ERROR)
         return 1;
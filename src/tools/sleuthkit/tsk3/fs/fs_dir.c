@@ -203,6 +203,525 @@ tsk_fs_dir_add(TSK_FS_DIR * a_fs_dir, const TSK_FS_NAME * a_fs_name)
 
 
 
+/* Directory cache
+ *
+ * tsk_fs_dir_open_meta() keeps a copy of the names of the directories
+ * that it parses and tsk_fs_path2inum() keeps the result of each name
+ * that it looks up, keyed by the directory address and the name as it
+ * was given.  Names that were not found are kept as well, so that
+ * repeated lookups of missing paths do not scan the directory again.
+ * Both tables are hash tables with chaining whose entries are replaced
+ * with the CLOCK algorithm, like the image read cache.  The memory
+ * budget counts the copied names: three quarters of it are used for
+ * directories and the rest for looked up names.  File systems are only
+ * read, so nothing needs to be invalidated.
+ *
+ * Directories are not cached while orphan files are hunted for, because
+ * some file systems fill in different parent addresses then, and the
+ * orphan directory is already kept in TSK_FS_INFO. */
+
+#define FS_DIR_CACHE_DIR_AVG    4096    // expected bytes per cached directory
+#define FS_DIR_CACHE_NAME_AVG   128     // expected bytes per cached name
+
+typedef struct {
+    uint8_t used;               // set if the entry holds a directory or name
+    uint8_t ref;                // CLOCK reference bit
+    int next;                   // next entry in the hash chain (-1 at end)
+    uint32_t hash;
+    TSK_INUM_T inum;            // address of the directory
+    char *key;                  // name that was looked up (name table only)
+    TSK_FS_DIR *fs_dir;         // names of the directory (directory table only)
+    TSK_FS_NAME *fs_name;       // name that was found (NULL if not found)
+    size_t len;                 // bytes counted against the budget
+} FS_DIR_CACHE_ENT;
+
+typedef struct {
+    size_t size;                // budget of the table in bytes
+    size_t used;
+    int ent_num;
+    int hand;                   // CLOCK hand
+    FS_DIR_CACHE_ENT *ent;
+    int *hash;                  // index of first entry in each chain (-1 if empty)
+    uint32_t hash_mask;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} FS_DIR_CACHE_TBL;
+
+struct TSK_FS_DIR_CACHE {
+    size_t size;                // memory budget in bytes
+    FS_DIR_CACHE_TBL dirs;      // parsed directories by address
+    FS_DIR_CACHE_TBL names;     // looked up names by directory and name
+    uint64_t name_neg_hits;     // name lookups answered with "not found"
+};
+
+static uint32_t
+fs_dir_cache_hash(TSK_INUM_T a_inum, const char *a_name)
+{
+    uint64_t h = (uint64_t) a_inum * 0x9E3779B97F4A7C15ULL;
+
+    // FNV-1a over the name
+    if (a_name) {
+        const unsigned char *c;
+        uint32_t f = 2166136261U;
+
+        for (c = (const unsigned char *) a_name; *c; c++)
+            f = (f ^ *c) * 16777619U;
+        h ^= f;
+    }
+    return (uint32_t) (h >> 32) ^ (uint32_t) h;
+}
+
+/* Free what an entry holds (the entry must not be in a hash chain) */
+static void
+fs_dir_cache_ent_clear(FS_DIR_CACHE_TBL * a_tbl, FS_DIR_CACHE_ENT * a_ent)
+{
+    if (a_ent->key)
+        free(a_ent->key);
+    if (a_ent->fs_dir)
+        tsk_fs_dir_close(a_ent->fs_dir);
+    if (a_ent->fs_name)
+        tsk_fs_name_free(a_ent->fs_name);
+    a_tbl->used -= a_ent->len;
+    memset(a_ent, 0, sizeof(FS_DIR_CACHE_ENT));
+    a_ent->next = -1;
+}
+
+static void
+fs_dir_cache_tbl_release(FS_DIR_CACHE_TBL * a_tbl)
+{
+    int i;
+
+    for (i = 0; i < a_tbl->ent_num; i++) {
+        if (a_tbl->ent[i].used)
+            fs_dir_cache_ent_clear(a_tbl, &a_tbl->ent[i]);
+    }
+    free(a_tbl->ent);
+    free(a_tbl->hash);
+}
+
+/* Set up a table for a_size bytes of entries that hold about a_avg bytes.
+ * Returns 1 on error. */
+static uint8_t
+fs_dir_cache_tbl_init(FS_DIR_CACHE_TBL * a_tbl, size_t a_size,
+    size_t a_avg)
+{
+    uint32_t hash_num = 1;
+    int i;
+
+    a_tbl->size = a_size;
+    a_tbl->ent_num = (int) (a_size / a_avg);
+    if ((a_size > 0) && (a_tbl->ent_num == 0))
+        a_tbl->ent_num = 1;
+    if (a_tbl->ent_num == 0)
+        return 0;
+
+    // keep the chains short: at least two buckets per entry
+    while (hash_num < (uint32_t) a_tbl->ent_num * 2)
+        hash_num <<= 1;
+    a_tbl->hash_mask = hash_num - 1;
+
+    if (((a_tbl->ent =
+                (FS_DIR_CACHE_ENT *) tsk_malloc(sizeof(FS_DIR_CACHE_ENT) *
+                    a_tbl->ent_num)) == NULL)
+        || ((a_tbl->hash =
+                (int *) tsk_malloc(sizeof(int) * hash_num)) == NULL)) {
+        free(a_tbl->ent);
+        a_tbl->ent = NULL;
+        a_tbl->ent_num = 0;
+        return 1;
+    }
+
+    for (i = 0; i < a_tbl->ent_num; i++)
+        a_tbl->ent[i].next = -1;
+    for (i = 0; i < (int) hash_num; i++)
+        a_tbl->hash[i] = -1;
+    return 0;
+}
+
+/* Remove an entry from its hash chain and free what it holds */
+static void
+fs_dir_cache_unlink(FS_DIR_CACHE_TBL * a_tbl, int a_idx)
+{
+    int *prev = &a_tbl->hash[a_tbl->ent[a_idx].hash & a_tbl->hash_mask];
+
+    while (*prev != -1) {
+        if (*prev == a_idx) {
+            *prev = a_tbl->ent[a_idx].next;
+            break;
+        }
+        prev = &a_tbl->ent[*prev].next;
+    }
+    fs_dir_cache_ent_clear(a_tbl, &a_tbl->ent[a_idx]);
+}
+
+/* Return the index of the entry for a_name (or the directory itself if
+ * a_name is NULL) in directory a_inum or -1 */
+static int
+fs_dir_cache_find(FS_DIR_CACHE_TBL * a_tbl, TSK_INUM_T a_inum,
+    const char *a_name, uint32_t a_hash)
+{
+    int idx;
+
+    if (a_tbl->ent_num == 0)
+        return -1;
+
+    for (idx = a_tbl->hash[a_hash & a_tbl->hash_mask]; idx != -1;
+        idx = a_tbl->ent[idx].next) {
+        FS_DIR_CACHE_ENT *ent = &a_tbl->ent[idx];
+
+        if ((ent->hash != a_hash) || (ent->inum != a_inum))
+            continue;
+        if ((a_name == NULL) || (strcmp(ent->key, a_name) == 0))
+            return idx;
+    }
+    return -1;
+}
+
+/* Make room for a_len bytes, take an entry and add it to the hash table.
+ * The caller fills in what it holds.  Returns NULL if the entry is too
+ * large to cache. */
+static FS_DIR_CACHE_ENT *
+fs_dir_cache_insert(FS_DIR_CACHE_TBL * a_tbl, TSK_INUM_T a_inum,
+    uint32_t a_hash, size_t a_len)
+{
+    FS_DIR_CACHE_ENT *ent;
+    int idx;
+
+    // a single entry may take half of the table
+    if ((a_tbl->ent_num == 0) || (a_len > a_tbl->size / 2))
+        return NULL;
+
+    while (1) {
+        idx = a_tbl->hand;
+        a_tbl->hand = (a_tbl->hand + 1) % a_tbl->ent_num;
+        ent = &a_tbl->ent[idx];
+
+        if (ent->used) {
+            if (ent->ref) {
+                ent->ref = 0;
+                continue;
+            }
+            fs_dir_cache_unlink(a_tbl, idx);
+            a_tbl->evictions++;
+        }
+        if (a_tbl->used + a_len <= a_tbl->size)
+            break;
+    }
+
+    ent->used = 1;
+    ent->ref = 1;
+    ent->inum = a_inum;
+    ent->hash = a_hash;
+    ent->len = a_len;
+    ent->next = a_tbl->hash[a_hash & a_tbl->hash_mask];
+    a_tbl->hash[a_hash & a_tbl->hash_mask] = idx;
+    a_tbl->used += a_len;
+    return ent;
+}
+
+/* Return the cache of a file system, creating it with the default
+ * budget if needed.  Returns NULL on error. */
+static TSK_FS_DIR_CACHE *
+fs_dir_cache_get(TSK_FS_INFO * a_fs)
+{
+    if ((a_fs->dir_cache == NULL)
+        && (tsk_fs_dir_cache_set_size(a_fs, TSK_FS_DIR_CACHE_DEFAULT_SIZE)))
+        return NULL;
+    return a_fs->dir_cache;
+}
+
+static size_t
+fs_dir_cache_name_len(const TSK_FS_NAME * a_fs_name)
+{
+    return sizeof(TSK_FS_NAME) + a_fs_name->name_size +
+        a_fs_name->shrt_name_size;
+}
+
+/* Open directory a_addr from the cache.
+ * @returns -1 on error, 0 if *a_fs_dir was opened from the cache and 1
+ * if the directory is not cached */
+static int8_t
+fs_dir_cache_dir_get(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr,
+    TSK_FS_DIR ** a_fs_dir)
+{
+    TSK_FS_DIR_CACHE *cache;
+    FS_DIR_CACHE_ENT *ent;
+    TSK_FS_DIR *fs_dir;
+    int idx;
+
+    if ((cache = fs_dir_cache_get(a_fs)) == NULL)
+        return -1;
+    if (cache->dirs.ent_num == 0)
+        return 1;
+
+    idx =
+        fs_dir_cache_find(&cache->dirs, a_addr, NULL,
+        fs_dir_cache_hash(a_addr, NULL));
+    if (idx == -1) {
+        cache->dirs.misses++;
+        return 1;
+    }
+    ent = &cache->dirs.ent[idx];
+    ent->ref = 1;
+    cache->dirs.hits++;
+
+    if ((fs_dir =
+            tsk_fs_dir_alloc(a_fs,
+                ent->fs_dir->names_used ? ent->fs_dir->names_used : 1)) ==
+        NULL)
+        return -1;
+
+    if ((tsk_fs_dir_copy(ent->fs_dir, fs_dir))
+        || ((fs_dir->fs_file =
+                tsk_fs_file_open_meta(a_fs, NULL, a_addr)) == NULL)) {
+        tsk_fs_dir_close(fs_dir);
+        return -1;
+    }
+
+    *a_fs_dir = fs_dir;
+    return 0;
+}
+
+/* Keep a copy of the names of a directory that was just parsed.  The
+ * directory is simply not cached if memory is short. */
+static void
+fs_dir_cache_dir_add(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr,
+    const TSK_FS_DIR * a_fs_dir)
+{
+    TSK_FS_DIR_CACHE *cache = a_fs->dir_cache;
+    FS_DIR_CACHE_ENT *ent;
+    TSK_FS_DIR *fs_dir;
+    size_t i, len;
+    uint32_t hash = fs_dir_cache_hash(a_addr, NULL);
+
+    if ((cache == NULL) || (cache->dirs.ent_num == 0)
+        || (fs_dir_cache_find(&cache->dirs, a_addr, NULL, hash) != -1))
+        return;
+
+    if ((fs_dir =
+            tsk_fs_dir_alloc(a_fs,
+                a_fs_dir->names_used ? a_fs_dir->names_used : 1)) == NULL) {
+        tsk_error_reset();
+        return;
+    }
+    if (tsk_fs_dir_copy(a_fs_dir, fs_dir)) {
+        tsk_fs_dir_close(fs_dir);
+        tsk_error_reset();
+        return;
+    }
+
+    len = sizeof(TSK_FS_DIR);
+    for (i = 0; i < fs_dir->names_alloc; i++)
+        len += fs_dir_cache_name_len(&fs_dir->names[i]);
+
+    if ((ent = fs_dir_cache_insert(&cache->dirs, a_addr, hash, len)) == NULL) {
+        tsk_fs_dir_close(fs_dir);
+        return;
+    }
+    ent->fs_dir = fs_dir;
+}
+
+/** \internal
+ * Look up a name in the results of earlier tsk_fs_path2inum() calls.
+ * @param a_fs File system to search
+ * @param a_dir Address of the directory the name is in
+ * @param a_name Name as it was looked up
+ * @param [out] a_fs_name Copy of the name that was found
+ * @returns -1 on error, 0 if the name was found, 1 if it is known not to
+ * exist and 2 if it is not cached
+ */
+int8_t
+tsk_fs_dir_cache_name_get(TSK_FS_INFO * a_fs, TSK_INUM_T a_dir,
+    const char *a_name, TSK_FS_NAME * a_fs_name)
+{
+    TSK_FS_DIR_CACHE *cache;
+    FS_DIR_CACHE_ENT *ent;
+    int idx;
+
+    if ((cache = fs_dir_cache_get(a_fs)) == NULL)
+        return -1;
+    if (cache->names.ent_num == 0)
+        return 2;
+
+    idx =
+        fs_dir_cache_find(&cache->names, a_dir, a_name,
+        fs_dir_cache_hash(a_dir, a_name));
+    if (idx == -1) {
+        cache->names.misses++;
+        return 2;
+    }
+    ent = &cache->names.ent[idx];
+    ent->ref = 1;
+
+    if (ent->fs_name == NULL) {
+        cache->name_neg_hits++;
+        return 1;
+    }
+    cache->names.hits++;
+    if (tsk_fs_name_copy(a_fs_name, ent->fs_name))
+        return -1;
+    return 0;
+}
+
+/** \internal
+ * Keep the result of looking up a name.  Nothing is kept if memory is
+ * short.
+ * @param a_fs File system that was searched
+ * @param a_dir Address of the directory the name is in
+ * @param a_name Name as it was looked up
+ * @param a_fs_name Name that was found (or NULL if it does not exist)
+ */
+void
+tsk_fs_dir_cache_name_add(TSK_FS_INFO * a_fs, TSK_INUM_T a_dir,
+    const char *a_name, const TSK_FS_NAME * a_fs_name)
+{
+    TSK_FS_DIR_CACHE *cache = a_fs->dir_cache;
+    FS_DIR_CACHE_ENT *ent;
+    TSK_FS_NAME *fs_name = NULL;
+    char *key;
+    size_t len;
+    uint32_t hash = fs_dir_cache_hash(a_dir, a_name);
+
+    if ((cache == NULL) || (cache->names.ent_num == 0)
+        || (fs_dir_cache_find(&cache->names, a_dir, a_name, hash) != -1))
+        return;
+
+    len = strlen(a_name) + 1;
+    if ((key = (char *) tsk_malloc(len)) == NULL) {
+        tsk_error_reset();
+        return;
+    }
+    strncpy(key, a_name, len);
+
+    if (a_fs_name) {
+        if (((fs_name = tsk_fs_name_alloc(0, 0)) == NULL)
+            || (tsk_fs_name_copy(fs_name, a_fs_name))) {
+            if (fs_name)
+                tsk_fs_name_free(fs_name);
+            free(key);
+            tsk_error_reset();
+            return;
+        }
+        len += fs_dir_cache_name_len(fs_name);
+    }
+
+    if ((ent = fs_dir_cache_insert(&cache->names, a_dir, hash, len)) == NULL) {
+        if (fs_name)
+            tsk_fs_name_free(fs_name);
+        free(key);
+        return;
+    }
+    ent->key = key;
+    ent->fs_name = fs_name;
+}
+
+/**
+ * \ingroup fslib
+ * Set the memory budget of the directory cache of an open file system.
+ * Any cached directories and names are dropped, the counters are kept.
+ * A size of 0 disables the cache.
+ * @param a_fs File system to change
+ * @param a_size Budget in bytes
+ * @returns 1 on error and 0 on success
+ */
+uint8_t
+tsk_fs_dir_cache_set_size(TSK_FS_INFO * a_fs, size_t a_size)
+{
+    TSK_FS_DIR_CACHE *cache;
+
+    if ((a_fs == NULL) || (a_fs->tag != TSK_FS_INFO_TAG)) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_FS_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_fs_dir_cache_set_size: called with NULL or unallocated structures");
+        return 1;
+    }
+
+    if ((cache =
+            (TSK_FS_DIR_CACHE *) tsk_malloc(sizeof(TSK_FS_DIR_CACHE))) ==
+        NULL)
+        return 1;
+    cache->size = a_size;
+
+    if ((fs_dir_cache_tbl_init(&cache->dirs, a_size - a_size / 4,
+                FS_DIR_CACHE_DIR_AVG))
+        || (fs_dir_cache_tbl_init(&cache->names, a_size / 4,
+                FS_DIR_CACHE_NAME_AVG))) {
+        fs_dir_cache_tbl_release(&cache->dirs);
+        free(cache);
+        return 1;
+    }
+
+    if (a_fs->dir_cache) {
+        TSK_FS_DIR_CACHE *old = a_fs->dir_cache;
+
+        cache->dirs.hits = old->dirs.hits;
+        cache->dirs.misses = old->dirs.misses;
+        cache->dirs.evictions = old->dirs.evictions;
+        cache->names.hits = old->names.hits;
+        cache->names.misses = old->names.misses;
+        cache->names.evictions = old->names.evictions;
+        cache->name_neg_hits = old->name_neg_hits;
+        tsk_fs_dir_cache_free(a_fs);
+    }
+    a_fs->dir_cache = cache;
+    return 0;
+}
+
+/**
+ * \ingroup fslib
+ * Get the directory cache counters of an open file system.
+ * @param a_fs File system to query
+ * @param a_stats Structure to fill in
+ */
+void
+tsk_fs_dir_cache_stats(TSK_FS_INFO * a_fs,
+    TSK_FS_DIR_CACHE_STATS * a_stats)
+{
+    TSK_FS_DIR_CACHE *cache = a_fs->dir_cache;
+
+    memset(a_stats, 0, sizeof(TSK_FS_DIR_CACHE_STATS));
+    if (cache == NULL) {
+        a_stats->size = TSK_FS_DIR_CACHE_DEFAULT_SIZE;
+        return;
+    }
+    a_stats->size = cache->size;
+    a_stats->used = cache->dirs.used + cache->names.used;
+    a_stats->dir_hits = cache->dirs.hits;
+    a_stats->dir_misses = cache->dirs.misses;
+    a_stats->name_hits = cache->names.hits;
+    a_stats->name_neg_hits = cache->name_neg_hits;
+    a_stats->name_misses = cache->names.misses;
+    a_stats->evictions = cache->dirs.evictions + cache->names.evictions;
+}
+
+/** \internal
+ * Free the directory cache.  Called by tsk_fs_close().
+ */
+void
+tsk_fs_dir_cache_free(TSK_FS_INFO * a_fs)
+{
+    TSK_FS_DIR_CACHE *cache = a_fs->dir_cache;
+
+    if (cache == NULL)
+        return;
+
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "tsk_fs_dir_cache_free: %" PRIu64 " dir hits, %" PRIu64
+            " dir misses, %" PRIu64 " name hits, %" PRIu64
+            " negative hits, %" PRIu64 " name misses\n", cache->dirs.hits,
+            cache->dirs.misses, cache->names.hits, cache->name_neg_hits,
+            cache->names.misses);
+
+    fs_dir_cache_tbl_release(&cache->dirs);
+    fs_dir_cache_tbl_release(&cache->names);
+    free(cache);
+    a_fs->dir_cache = NULL;
+}
+
+
 /** \ingroup fslib
 * Open a directory (using its metadata addr) so that each of the files in it can be accessed.
 * @param a_fs File system to analyze
@@ -214,6 +733,7 @@ tsk_fs_dir_open_meta(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr)
 {
     TSK_FS_DIR *fs_dir = NULL;
     TSK_RETVAL_ENUM retval;
+    uint8_t cache = 1;
 
     if ((a_fs == NULL) || (a_fs->tag != TSK_FS_INFO_TAG)
         || (a_fs->dir_open_meta == NULL)) {
@@ -223,10 +743,25 @@ tsk_fs_dir_open_meta(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr)
         return NULL;
     }
 
+    /* The orphan directory is kept in a_fs->orphan_dir once it is known */
+    if ((a_addr == TSK_FS_ORPHANDIR_INUM(a_fs)) || (a_fs->isOrphanHunting))
+        cache = 0;
+
+    if (cache) {
+        int8_t ret = fs_dir_cache_dir_get(a_fs, a_addr, &fs_dir);
+        if (ret == -1)
+            return NULL;
+        else if (ret == 0)
+            return fs_dir;
+    }
+
     retval = a_fs->dir_open_meta(a_fs, &fs_dir, a_addr);
     if (retval != TSK_OK)
         return NULL;
 
+    if (cache)
+        fs_dir_cache_dir_add(a_fs, a_addr, fs_dir);
+
     return fs_dir;
 }
 
@@ -388,6 +923,34 @@ tsk_fs_dir_get(const TSK_FS_DIR * a_fs_dir, size_t a_idx)
     return fs_file;
 }
 
+/** \ingroup fslib
+* Return the name of a file in a directory without loading its metadata.
+* This is cheaper than tsk_fs_dir_get() when only the names are needed.
+* The structure belongs to the directory and is valid until
+* tsk_fs_dir_close() is called.
+* @param a_fs_dir Directory to analyze
+* @param a_idx Index of file in directory to get name of
+* @returns NULL on error
+*/
+const TSK_FS_NAME *
+tsk_fs_dir_get_name(const TSK_FS_DIR * a_fs_dir, size_t a_idx)
+{
+    if ((a_fs_dir == NULL) || (a_fs_dir->tag != TSK_FS_DIR_TAG)) {
+        tsk_errno = TSK_ERR_FS_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_fs_dir_get_name: called with NULL or unallocated structures");
+        return NULL;
+    }
+    if (a_fs_dir->names_used <= a_idx) {
+        tsk_errno = TSK_ERR_FS_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_fs_dir_get_name: Index (%" PRIuSIZE ") too large (%"
+            PRIuSIZE ")", a_idx, a_fs_dir->names_used);
+        return NULL;
+    }
+    return &a_fs_dir->names[a_idx];
+}
+
 #define MAX_DEPTH   128
 #define DIR_STRSZ   4096
 
@@ -440,14 +1003,29 @@ tsk_fs_dir_walk_lcl(TSK_FS_INFO * a_fs, DENT_DINFO * a_dinfo,
 
     for (i = 0; i < fs_dir->names_used; i++) {
         int retval;
+        uint8_t load_meta;
 
         /* Point name to the buffer of names.  We need to be
          * careful about resetting this before we free fs_file */
         fs_file->name = (TSK_FS_NAME *) & fs_dir->names[i];
 
+        /* With the NAMEONLY flag, the metadata is only loaded for the
+         * names that we may recurse into and for the unallocated names
+         * that are saved for orphan finding.  The callback loads it for
+         * the others with tsk_fs_file_load_meta() if it needs it. */
+        load_meta = 1;
+        if ((a_flags & TSK_FS_DIR_WALK_FLAG_NAMEONLY)
+            && ((a_dinfo->save_inum_named == 0)
+                || (fs_file->name->flags & TSK_FS_NAME_FLAG_ALLOC))
+            && (((a_flags & TSK_FS_DIR_WALK_FLAG_RECURSE) == 0)
+                || ((fs_file->name->type != TSK_FS_NAME_TYPE_DIR)
+                    && (fs_file->name->type != TSK_FS_NAME_TYPE_UNDEF))
+                || (TSK_FS_ISDOT(fs_file->name->name))))
+            load_meta = 0;
+
         /* load the fs_meta structure if possible.
          * Must have non-zero inode addr or have allocated name (if inode is 0) */
-        if (((fs_file->name->meta_addr)
+        if ((load_meta) && ((fs_file->name->meta_addr)
                 || (fs_file->name->flags & TSK_FS_NAME_FLAG_ALLOC))) {
             if (a_fs->file_add_meta(a_fs, fs_file,
                     fs_file->name->meta_addr)) {
@@ -701,12 +1279,22 @@ tsk_fs_dir_make_orphan_dir_meta(TSK_FS_INFO * a_fs,
     a_fs_meta->mtime_nano = a_fs_meta->atime_nano = a_fs_meta->ctime_nano =
         a_fs_meta->crtime_nano = 0;
 
+    a_fs_meta->seq = 0;
+
     if (a_fs_meta->name2 == NULL) {
         if ((a_fs_meta->name2 = (TSK_FS_META_NAME_LIST *)
                 tsk_malloc(sizeof(TSK_FS_META_NAME_LIST))) == NULL)
             return 1;
         a_fs_meta->name2->next = NULL;
     }
+    // the structure may still have the names of the file it was used for
+    while (a_fs_meta->name2->next) {
+        TSK_FS_META_NAME_LIST *next = a_fs_meta->name2->next->next;
+        free(a_fs_meta->name2->next);
+        a_fs_meta->name2->next = next;
+    }
+    a_fs_meta->name2->par_inode = 0;
+    a_fs_meta->name2->par_seq = 0;
 
     a_fs_meta->attr_state = TSK_FS_META_ATTR_EMPTY;
     if (a_fs_meta->attr) {
@@ -134,6 +134,60 @@ tsk_fs_file_open_meta(TSK_FS_INFO * a_fs,
 }
 
 
+/**
+* \ingroup fslib
+* Load the metadata of a file that was returned without it, such as the
+* files passed to the callback of a tsk_fs_dir_walk() with the
+* TSK_FS_DIR_WALK_FLAG_NAMEONLY flag.  Nothing is done if the metadata is
+* already loaded.  The functions that read the attributes and content of
+* a file call this themselves.
+*
+* @param a_fs_file File to load the metadata of
+* @returns 1 on error (or if the name has no valid metadata address) and 0 on success
+*/
+uint8_t
+tsk_fs_file_load_meta(TSK_FS_FILE * a_fs_file)
+{
+    TSK_FS_INFO *fs;
+
+    if ((a_fs_file == NULL) || (a_fs_file->tag != TSK_FS_FILE_TAG)
+        || ((fs = a_fs_file->fs_info) == NULL)
+        || (fs->tag != TSK_FS_INFO_TAG)) {
+        tsk_errno = TSK_ERR_FS_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_fs_file_load_meta: called with NULL or unallocated structures");
+        return 1;
+    }
+
+    if (a_fs_file->meta)
+        return 0;
+
+    /* Must have non-zero inode addr or have allocated name (if inode is 0) */
+    if ((a_fs_file->name == NULL) || ((a_fs_file->name->meta_addr == 0)
+            && ((a_fs_file->name->flags & TSK_FS_NAME_FLAG_ALLOC) == 0))) {
+        tsk_errno = TSK_ERR_FS_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_fs_file_load_meta: name has no metadata address");
+        return 1;
+    }
+
+    return fs->file_add_meta(fs, a_fs_file, a_fs_file->name->meta_addr);
+}
+
+/* Load the metadata of a file that was returned without it, for the
+ * functions below.  Errors are reported by the caller, which finds the
+ * metadata missing. */
+static void
+tsk_fs_file_meta_lazy(TSK_FS_FILE * a_fs_file)
+{
+    if ((a_fs_file) && (a_fs_file->meta == NULL) && (a_fs_file->name)
+        && (a_fs_file->fs_info)) {
+        if (tsk_fs_file_load_meta(a_fs_file))
+            tsk_error_reset();
+    }
+}
+
+
 /** 
 * \ingroup fslib
 * Return the handle structure for a specific file, given its full path. Note that
@@ -204,6 +258,9 @@ static int
 tsk_fs_file_attr_check(TSK_FS_FILE * a_fs_file, char *a_func)
 {
     TSK_FS_INFO *fs;
+
+    tsk_fs_file_meta_lazy(a_fs_file);
+
     // check the FS_INFO, FS_FILE structures
     if ((a_fs_file == NULL) || (a_fs_file->meta == NULL)
         || (a_fs_file->fs_info == NULL)) {
@@ -338,6 +395,8 @@ tsk_fs_file_walk_type(TSK_FS_FILE * a_fs_file,
     // clean up any error messages that are lying around
     tsk_error_reset();
 
+    tsk_fs_file_meta_lazy(a_fs_file);
+
     // check the FS_INFO, FS_FILE structures
     if ((a_fs_file == NULL) || (a_fs_file->meta == NULL)
         || (a_fs_file->fs_info == NULL)) {
@@ -394,6 +453,8 @@ tsk_fs_file_walk(TSK_FS_FILE * a_fs_file,
     // clean up any error messages that are lying around
     tsk_error_reset();
 
+    tsk_fs_file_meta_lazy(a_fs_file);
+
     // check the FS_INFO, FS_FILE structures
     if ((a_fs_file == NULL) || (a_fs_file->meta == NULL)
         || (a_fs_file->fs_info == NULL)) {
@@ -449,6 +510,8 @@ tsk_fs_file_read_type(TSK_FS_FILE * a_fs_file,
     // clean up any error messages that are lying around
     tsk_error_reset();
 
+    tsk_fs_file_meta_lazy(a_fs_file);
+
     // check the FS_INFO, FS_FILE structures
     if ((a_fs_file == NULL) || (a_fs_file->meta == NULL)
         || (a_fs_file->fs_info == NULL)) {
@@ -519,6 +582,8 @@ tsk_fs_file_read(TSK_FS_FILE * a_fs_file,
 uint8_t
 tsk_fs_file_get_owner_sid(TSK_FS_FILE * a_fs_file, char **sid_str)
 {
+    tsk_fs_file_meta_lazy(a_fs_file);
+
     if ((a_fs_file == NULL) || (a_fs_file->fs_info == NULL)
         || (a_fs_file->meta == NULL) || (sid_str == NULL)) {
         tsk_errno = TSK_ERR_FS_ARG;
@@ -199,3 +199,41 @@ tsk_fs_meta_walk(TSK_FS_INFO * a_fs, TSK_INUM_T a_start,
 
     return a_fs->inode_walk(a_fs, a_start, a_end, a_flags, a_cb, a_ptr);
 }
+
+/**
+ * \ingroup fslib
+ * Walk a range of metadata structures like tsk_fs_meta_walk(), but
+ * read and parse them on several threads.  By default, the callback is
+ * called from the calling thread in address order, so it sees the same
+ * structures in the same order as with tsk_fs_meta_walk().  With
+ * TSK_FS_META_PWALK_FLAG_UNORDERED, it is called from the worker threads
+ * in no particular order and with several structures at the same time.
+ * The image is made concurrent (see tsk_img_set_concurrent()).  File
+ * systems that cannot be walked in parallel are walked by the calling
+ * thread alone.
+ *
+ * @param a_fs File system to process
+ * @param a_start Metadata address to start walking from
+ * @param a_end Metadata address to walk to
+ * @param a_flags Flags that specify the desired metadata features
+ * @param a_threads Number of worker threads to use
+ * @param a_pflags Flags that specify how the callback is called
+ * @param a_cb Callback function to call
+ * @param a_ptr Pointer to pass to the callback
+ * @returns 1 on error and 0 on success
+ */
+uint8_t
+tsk_fs_meta_walk_parallel(TSK_FS_INFO * a_fs, TSK_INUM_T a_start,
+    TSK_INUM_T a_end, TSK_FS_META_FLAG_ENUM a_flags, int a_threads,
+    TSK_FS_META_PWALK_FLAG_ENUM a_pflags, TSK_FS_META_WALK_CB a_cb,
+    void *a_ptr)
+{
+    if ((a_fs == NULL) || (a_fs->tag != TSK_FS_INFO_TAG))
+        return 1;
+
+    if ((a_threads < 2) || (a_fs->inode_walk_parallel == NULL))
+        return a_fs->inode_walk(a_fs, a_start, a_end, a_flags, a_cb,
+            a_ptr);
+    return a_fs->inode_walk_parallel(a_fs, a_start, a_end, a_flags,
+        a_threads, a_pflags, a_cb, a_ptr);
+}
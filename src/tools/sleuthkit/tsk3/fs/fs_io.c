@@ -64,6 +64,33 @@ tsk_fs_read(TSK_FS_INFO * a_fs, TSK_OFF_T a_off, char *a_buf, size_t a_len)
     return tsk_img_read(a_fs->img_info, off, a_buf, a_len);
 }
 
+/**
+ * \ingroup fslib
+ * Return a pointer to data inside of the file system when the image is
+ * memory mapped (see tsk_img_set_mmap()), so that it can be parsed
+ * without being copied.  The data must not be changed.  No error is set
+ * when NULL is returned; the caller then reads the data with
+ * tsk_fs_read().
+ * @param a_fs The file system handle.
+ * @param a_off The byte offset of the data (relative to start of file system)
+ * @param a_len The number of bytes needed
+ * @return Pointer to the data or NULL if it cannot be borrowed.
+ */
+const char *
+tsk_fs_borrow(TSK_FS_INFO * a_fs, TSK_OFF_T a_off, size_t a_len)
+{
+    if ((a_fs->img_info->borrow == NULL) || (a_off < 0))
+        return NULL;
+
+    // same bounds as tsk_fs_read(), but the whole range has to fit
+    if ((a_fs->last_block_act > 0)
+        && ((TSK_DADDR_T) a_off + a_len >
+            ((a_fs->last_block_act + 1) * a_fs->block_size)))
+        return NULL;
+
+    return tsk_img_borrow(a_fs->img_info, a_off + a_fs->offset, a_len);
+}
+
 
 
 /**
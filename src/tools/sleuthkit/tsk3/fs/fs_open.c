@@ -260,5 +260,6 @@ tsk_fs_close(TSK_FS_INFO * a_fs)
 {
     if ((a_fs == NULL) || (a_fs->tag != TSK_FS_INFO_TAG))
         return;
+    tsk_fs_dir_cache_free(a_fs);
     a_fs->close(a_fs);
 }
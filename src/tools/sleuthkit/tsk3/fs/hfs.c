@@ -614,6 +614,158 @@ hfs_cat_compare_keys(HFS_INFO * hfs, const hfs_btree_key_cat * key1,
 }
 
 
+/** \internal
+ * Return a node of the catalog B-tree.  Nodes are kept in a cache of
+ * HFS_CAT_CACHE_BUDGET bytes that is allocated on first use, so the upper
+ * levels of the tree and the leaves that are being listed are read from
+ * the image only once.  A node can only be stored in the
+ * HFS_CAT_CACHE_WAYS slots that its number maps to and replaces the least
+ * recently used of them.  The returned buffer is owned by the cache and can
+ * be replaced by the next call, so callers that call back into the catalog
+ * code while they use it must copy it first.
+ * @param hfs File system
+ * @param node_num Node to return
+ * @returns NULL on error
+ */
+static const char *
+hfs_cat_get_node(HFS_INFO * hfs, uint32_t node_num)
+{
+    TSK_FS_INFO *fs = &(hfs->fs_info);
+    uint16_t nodesize;
+    uint32_t i, first, slot;
+    TSK_OFF_T cur_off;
+    ssize_t cnt;
+    char *buf;
+
+    nodesize = tsk_getu16(fs->endian, hfs->catalog_header.nodesize);
+
+    if (hfs->cat_cache_buf == NULL) {
+        hfs->cat_cache_len = HFS_CAT_CACHE_BUDGET / nodesize;
+        hfs->cat_cache_len -= hfs->cat_cache_len % HFS_CAT_CACHE_WAYS;
+        if (hfs->cat_cache_len == 0)
+            hfs->cat_cache_len = HFS_CAT_CACHE_WAYS;
+        hfs->cat_cache_clock = 0;
+        if (((hfs->cat_cache_node =
+                    (uint32_t *) tsk_malloc(hfs->cat_cache_len *
+                        sizeof(uint32_t))) == NULL)
+            || ((hfs->cat_cache_used =
+                    (uint64_t *) tsk_malloc(hfs->cat_cache_len *
+                        sizeof(uint64_t))) == NULL)
+            || ((hfs->cat_cache_buf =
+                    (char *) tsk_malloc((size_t) hfs->cat_cache_len *
+                        nodesize)) == NULL)) {
+            free(hfs->cat_cache_node);
+            hfs->cat_cache_node = NULL;
+            free(hfs->cat_cache_used);
+            hfs->cat_cache_used = NULL;
+            return NULL;
+        }
+    }
+
+    // look for the node, remembering the least recently used slot
+    first = (node_num % (hfs->cat_cache_len / HFS_CAT_CACHE_WAYS)) *
+        HFS_CAT_CACHE_WAYS;
+    slot = first;
+    for (i = first; i < first + HFS_CAT_CACHE_WAYS; i++) {
+        if ((hfs->cat_cache_used[i]) && (hfs->cat_cache_node[i] == node_num)) {
+            hfs->cat_cache_used[i] = ++hfs->cat_cache_clock;
+            return &hfs->cat_cache_buf[(size_t) i * nodesize];
+        }
+        if (hfs->cat_cache_used[i] < hfs->cat_cache_used[slot])
+            slot = i;
+    }
+
+    buf = &hfs->cat_cache_buf[(size_t) slot * nodesize];
+    cur_off = (TSK_OFF_T) node_num * nodesize;
+    cnt = tsk_fs_attr_read(hfs->catalog_attr, cur_off, buf, nodesize, 0);
+    if (cnt != nodesize) {
+        hfs->cat_cache_used[slot] = 0;
+        if (cnt >= 0) {
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_FS_READ;
+        }
+        snprintf(tsk_errstr2, TSK_ERRSTR_L,
+            "hfs_cat_get_node: Error reading node %" PRIu32
+            " at offset %" PRIuOFF, node_num, cur_off);
+        return NULL;
+    }
+    hfs->cat_cache_node[slot] = node_num;
+    hfs->cat_cache_used[slot] = ++hfs->cat_cache_clock;
+    return buf;
+}
+
+
+/** \internal
+ * Read data from the catalog file through the node cache.
+ * @param hfs File system
+ * @param off Byte offset in catalog file to read from
+ * @param buf [out] Buffer to read data into
+ * @param len Number of bytes to read
+ * @returns Number of bytes read or -1 on error (as tsk_fs_attr_read())
+ */
+static ssize_t
+hfs_cat_read(HFS_INFO * hfs, TSK_OFF_T off, char *buf, size_t len)
+{
+    TSK_FS_INFO *fs = &(hfs->fs_info);
+    uint16_t nodesize;
+    size_t len_read = 0;
+
+    nodesize = tsk_getu16(fs->endian, hfs->catalog_header.nodesize);
+
+    while (len_read < len) {
+        const char *node;
+        size_t node_off, len_cpy;
+
+        if ((node = hfs_cat_get_node(hfs,
+                    (uint32_t) (off / nodesize))) == NULL) {
+            if (len_read == 0)
+                return -1;
+            break;
+        }
+        node_off = (size_t) (off % nodesize);
+        len_cpy = nodesize - node_off;
+        if (len_cpy > len - len_read)
+            len_cpy = len - len_read;
+        memcpy(&buf[len_read], &node[node_off], len_cpy);
+
+        len_read += len_cpy;
+        off += len_cpy;
+    }
+    return len_read;
+}
+
+
+/** \internal
+ * Return the key of a record in a catalog B-tree node after checking
+ * that the record offset is inside of the node.
+ * @param hfs File system
+ * @param node Node buffer
+ * @param cur_node Node number (for error messages)
+ * @param rec Record index in node
+ * @param rec_off [out] Byte offset of record in node
+ * @returns NULL on error
+ */
+static const hfs_btree_key_cat *
+hfs_cat_get_rec_key(HFS_INFO * hfs, const char *node, uint32_t cur_node,
+    int rec, size_t * rec_off)
+{
+    TSK_FS_INFO *fs = &(hfs->fs_info);
+    uint16_t nodesize;
+
+    nodesize = tsk_getu16(fs->endian, hfs->catalog_header.nodesize);
+    *rec_off = tsk_getu16(fs->endian, &node[nodesize - (rec + 1) * 2]);
+    if (*rec_off + 8 > nodesize) {
+        tsk_errno = TSK_ERR_FS_GENFS;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "hfs_cat_get_rec_key: offset of record %d in node %" PRIu32
+            " too large (%zu vs %" PRIu16 ")", rec, cur_node, *rec_off,
+            nodesize);
+        return NULL;
+    }
+    return (const hfs_btree_key_cat *) &node[*rec_off];
+}
+
+
 /** \internal
  * @param hfs File system
  * @param targ_data can be null
@@ -663,7 +815,7 @@ hfs_cat_traverse(HFS_INFO * hfs, const void *targ_data,
     while (is_done == 0) {
         TSK_OFF_T cur_off;      /* start address of cur_node */
         uint16_t num_rec;       /* number of records in this node */
-        ssize_t cnt;
+        const char *cache_node;
         hfs_btree_node *node_desc;
 
         // sanity check 
@@ -676,21 +828,14 @@ hfs_cat_traverse(HFS_INFO * hfs, const void *targ_data,
             return 1;
         }
 
-        // read the current node
-        cur_off = cur_node * nodesize;
-        cnt = tsk_fs_attr_read(hfs->catalog_attr, cur_off,
-            node, nodesize, 0);
-        if (cnt != nodesize) {
-            if (cnt >= 0) {
-                tsk_error_reset();
-                tsk_errno = TSK_ERR_FS_READ;
-            }
-            snprintf(tsk_errstr2, TSK_ERRSTR_L,
-                "hfs_cat_traverse: Error reading node %d at offset %"
-                PRIuOFF, cur_node, cur_off);
+        // read the current node.  The callbacks can look up other
+        // records, so work on a copy of the cached node.
+        cur_off = (TSK_OFF_T) cur_node * nodesize;
+        if ((cache_node = hfs_cat_get_node(hfs, cur_node)) == NULL) {
             free(node);
             return 1;
         }
+        memcpy(node, cache_node, nodesize);
 
         // process the header / descriptor
         node_desc = (hfs_btree_node *) node;
@@ -868,61 +1013,182 @@ hfs_cat_traverse(HFS_INFO * hfs, const void *targ_data,
 }
 
 
-static uint8_t
-hfs_cat_get_record_offset_cb(HFS_INFO * hfs, int8_t level_type,
-    const void *targ_data, const hfs_btree_key_cat * cur_key,
-    TSK_OFF_T key_off, void *ptr)
-{
-    const hfs_btree_key_cat *targ_key = (hfs_btree_key_cat *) targ_data;
-    if (tsk_verbose)
-        fprintf(stderr,
-            "hfs_cat_get_record_offset_cb: %s node want: %" PRIu32
-            " vs have: %" PRIu32 "\n",
-            (level_type == HFS_BT_NODE_TYPE_IDX) ? "Index" : "Leaf",
-            tsk_getu32(hfs->fs_info.endian, targ_key->parent_cnid),
-            tsk_getu32(hfs->fs_info.endian, cur_key->parent_cnid));
-
-    if (level_type == HFS_BT_NODE_TYPE_IDX) {
-        int diff = hfs_cat_compare_keys(hfs, cur_key, targ_key);
-        if (diff < 0)
-            return HFS_BTREE_CB_IDX_LT;
-        else
-            return HFS_BTREE_CB_IDX_EQGT;
-    }
-    else {
-        int diff = hfs_cat_compare_keys(hfs, cur_key, targ_key);
-
-        // see if this record is for our file or if we passed the interesting entries
-        if (diff < 0) {
-            return HFS_BTREE_CB_LEAF_GO;
-        }
-        else if (diff == 0) {
-            TSK_OFF_T *off = (TSK_OFF_T *) ptr;
-            *off =
-                key_off + 2 + tsk_getu16(hfs->fs_info.endian,
-                cur_key->key_len);
-        }
-        return HFS_BTREE_CB_LEAF_STOP;
-    }
-}
-
-
 /** \internal
  * Find the byte offset (from the start of the catalog file) to a record
- * in the catalog file.  
+ * in the catalog file.  This descends the B-tree directly instead of using
+ * hfs_cat_traverse(): the records in each node are sorted by
+ * hfs_cat_compare_keys(), so they are binary searched.
  * @param hfs File System being analyzed
  * @param needle Key to search for
+ * @param a_key [out] Copy of the key that was found (the name can differ
+ * in case from the needle).  Can be NULL.
  * @returns Byte offset or 0 on error. 0 is also returned if catalog
  * record was not found. Check tsk_errno to determine if error occured.
  */
-static TSK_OFF_T
-hfs_cat_get_record_offset(HFS_INFO * hfs, const hfs_btree_key_cat * needle)
+TSK_OFF_T
+hfs_cat_get_record_offset(HFS_INFO * hfs, const hfs_btree_key_cat * needle,
+    hfs_btree_key_cat * a_key)
 {
-    TSK_OFF_T off = 0;
-    if (hfs_cat_traverse(hfs, needle, hfs_cat_get_record_offset_cb, &off)) {
+    TSK_FS_INFO *fs = &(hfs->fs_info);
+    uint32_t cur_node;          /* node id of the current node */
+    uint32_t total_nodes;
+    uint32_t nodes_seen = 0;
+    uint16_t nodesize;
+
+    tsk_error_reset();
+
+    nodesize = tsk_getu16(fs->endian, hfs->catalog_header.nodesize);
+    total_nodes = tsk_getu32(fs->endian, hfs->catalog_header.totalNodes);
+
+    /* start at root node */
+    cur_node = tsk_getu32(fs->endian, hfs->catalog_header.rootNode);
+    if (cur_node == 0) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr, "hfs_cat_get_record_offset: "
+                "empty catalog btree\n");
         return 0;
     }
-    return off;
+
+    while (1) {
+        const char *node;
+        const hfs_btree_node *node_desc;
+        const hfs_btree_key_cat *key;
+        uint16_t num_rec;       /* number of records in this node */
+        size_t rec_off;
+        int lo, hi;
+
+        // sanity checks
+        if (cur_node > total_nodes) {
+            tsk_errno = TSK_ERR_FS_GENFS;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "hfs_cat_get_record_offset: Node %" PRIu32
+                " too large for file", cur_node);
+            return 0;
+        }
+        if (++nodes_seen > total_nodes) {
+            tsk_errno = TSK_ERR_FS_GENFS;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "hfs_cat_get_record_offset: Loop in btree at node %"
+                PRIu32, cur_node);
+            return 0;
+        }
+
+        if ((node = hfs_cat_get_node(hfs, cur_node)) == NULL)
+            return 0;
+
+        node_desc = (const hfs_btree_node *) node;
+        num_rec = tsk_getu16(fs->endian, node_desc->num_rec);
+
+        if (tsk_verbose)
+            tsk_fprintf(stderr, "hfs_cat_get_record_offset: node %" PRIu32
+                " has %" PRIu16 " records\n", cur_node, num_rec);
+
+        if ((num_rec == 0)
+            || (num_rec * 2 > nodesize - sizeof(hfs_btree_node))) {
+            tsk_errno = TSK_ERR_FS_GENFS;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "hfs_cat_get_record_offset: invalid number of records (%"
+                PRIu16 ") in node %" PRIu32, num_rec, cur_node);
+            return 0;
+        }
+
+        /* With an index node, find the record with the largest key that
+         * is smaller than or equal to the needle (or the first record) */
+        if (node_desc->type == HFS_BT_NODE_TYPE_IDX) {
+            const hfs_btree_index_record *idx_rec;
+            size_t keylen;
+
+            // records before lo are <= needle, records from hi on are >
+            lo = 0;
+            hi = num_rec;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if ((key = hfs_cat_get_rec_key(hfs, node, cur_node, mid,
+                            &rec_off)) == NULL)
+                    return 0;
+                if (hfs_cat_compare_keys(hfs, key, needle) <= 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            if ((key = hfs_cat_get_rec_key(hfs, node, cur_node,
+                        (lo > 0) ? lo - 1 : 0, &rec_off)) == NULL)
+                return 0;
+            keylen =
+                2 + hfs_get_idxkeylen(hfs, tsk_getu16(fs->endian,
+                    key->key_len), &(hfs->catalog_header));
+            if (rec_off + keylen + sizeof(hfs_btree_index_record) >
+                nodesize) {
+                tsk_errno = TSK_ERR_FS_GENFS;
+                snprintf(tsk_errstr, TSK_ERRSTR_L,
+                    "hfs_cat_get_record_offset: offset of record and keylength in index node %"
+                    PRIu32 " too large (%zu vs %" PRIu16 ")", cur_node,
+                    rec_off + keylen, nodesize);
+                return 0;
+            }
+            idx_rec =
+                (const hfs_btree_index_record *) &node[rec_off + keylen];
+            cur_node = tsk_getu32(fs->endian, idx_rec->childNode);
+            if (cur_node == 0) {
+                tsk_errno = TSK_ERR_FS_GENFS;
+                snprintf(tsk_errstr, TSK_ERRSTR_L,
+                    "hfs_cat_get_record_offset: invalid child node in index node");
+                return 0;
+            }
+        }
+
+        /* With a leaf, find the first record with a key that is greater
+         * than or equal to the needle */
+        else if (node_desc->type == HFS_BT_NODE_TYPE_LEAF) {
+            // records before lo are < needle, records from hi on are >=
+            lo = 0;
+            hi = num_rec;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if ((key = hfs_cat_get_rec_key(hfs, node, cur_node, mid,
+                            &rec_off)) == NULL)
+                    return 0;
+                if (hfs_cat_compare_keys(hfs, key, needle) < 0)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            // all of the keys are smaller, so move right to the next leaf
+            if (lo == num_rec) {
+                cur_node = tsk_getu32(fs->endian, node_desc->flink);
+                if (cur_node == 0)
+                    return 0;
+                continue;
+            }
+
+            if ((key = hfs_cat_get_rec_key(hfs, node, cur_node, lo,
+                        &rec_off)) == NULL)
+                return 0;
+            if (hfs_cat_compare_keys(hfs, key, needle) != 0)
+                return 0;
+            if (a_key) {
+                size_t keylen = 2 + tsk_getu16(fs->endian, key->key_len);
+                if (keylen > sizeof(hfs_btree_key_cat))
+                    keylen = sizeof(hfs_btree_key_cat);
+                if (keylen > nodesize - rec_off)
+                    keylen = nodesize - rec_off;
+                memset((char *) a_key, 0, sizeof(hfs_btree_key_cat));
+                memcpy((char *) a_key, (const char *) key, keylen);
+            }
+            return (TSK_OFF_T) cur_node * nodesize + rec_off + 2 +
+                tsk_getu16(fs->endian, key->key_len);
+        }
+        else {
+            tsk_errno = TSK_ERR_FS_GENFS;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "hfs_cat_get_record_offset: btree node %" PRIu32
+                " is neither index nor leaf (%" PRIu8 ")", cur_node,
+                node_desc->type);
+            return 0;
+        }
+    }
 }
 
 
@@ -944,7 +1210,7 @@ hfs_cat_read_thread_record(HFS_INFO * hfs, TSK_OFF_T off,
     size_t cnt;
 
     memset(thread, 0, sizeof(hfs_thread));
-    cnt = tsk_fs_attr_read(hfs->catalog_attr, off, (char *) thread, 10, 0);
+    cnt = hfs_cat_read(hfs, off, (char *) thread, 10);
     if (cnt != 10) {
         if (cnt >= 0) {
             tsk_error_reset();
@@ -976,8 +1242,8 @@ hfs_cat_read_thread_record(HFS_INFO * hfs, TSK_OFF_T off,
     }
 
     cnt =
-        tsk_fs_attr_read(hfs->catalog_attr, off + 10,
-        (char *) thread->name.unicode, uni_len * 2, 0);
+        hfs_cat_read(hfs, off + 10,
+        (char *) thread->name.unicode, uni_len * 2);
     if (cnt != uni_len * 2) {
         if (cnt >= 0) {
             tsk_error_reset();
@@ -1010,7 +1276,7 @@ hfs_cat_read_file_folder_record(HFS_INFO * hfs, TSK_OFF_T off,
 
     memset(record, 0, sizeof(hfs_file_folder));
 
-    cnt = tsk_fs_attr_read(hfs->catalog_attr, off, rec_type, 2, 0);
+    cnt = hfs_cat_read(hfs, off, rec_type, 2);
     if (cnt != 2) {
         if (cnt >= 0) {
             tsk_error_reset();
@@ -1024,8 +1290,8 @@ hfs_cat_read_file_folder_record(HFS_INFO * hfs, TSK_OFF_T off,
 
     if (tsk_getu16(fs->endian, rec_type) == HFS_FOLDER_RECORD) {
         cnt =
-            tsk_fs_attr_read(hfs->catalog_attr, off, (char *) record,
-            sizeof(hfs_folder), 0);
+            hfs_cat_read(hfs, off, (char *) record,
+            sizeof(hfs_folder));
         if (cnt != sizeof(hfs_folder)) {
             if (cnt >= 0) {
                 tsk_error_reset();
@@ -1039,8 +1305,8 @@ hfs_cat_read_file_folder_record(HFS_INFO * hfs, TSK_OFF_T off,
     }
     else if (tsk_getu16(fs->endian, rec_type) == HFS_FILE_RECORD) {
         cnt =
-            tsk_fs_attr_read(hfs->catalog_attr, off, (char *) record,
-            sizeof(hfs_file), 0);
+            hfs_cat_read(hfs, off, (char *) record,
+            sizeof(hfs_file));
         if (cnt != sizeof(hfs_file)) {
             if (cnt >= 0) {
                 tsk_error_reset();
@@ -1064,6 +1330,44 @@ hfs_cat_read_file_folder_record(HFS_INFO * hfs, TSK_OFF_T off,
 }
 
 
+/** \internal
+ * Remember a folder thread record so that later lookups of the folder do
+ * not need to search the catalog for it.  The cache is allocated on first
+ * use; if that fails, the record is simply not cached.
+ * @param hfs File system
+ * @param inum Address (cnid) of folder
+ * @param thread Thread record of folder
+ */
+static void
+hfs_cat_cache_thread(HFS_INFO * hfs, TSK_INUM_T inum,
+    const hfs_thread * thread)
+{
+    uint32_t slot;
+
+    if (hfs->thread_cache == NULL) {
+        if ((hfs->thread_cache_cnid =
+                (uint32_t *) tsk_malloc(HFS_THREAD_CACHE_LEN *
+                    sizeof(uint32_t))) == NULL) {
+            tsk_error_reset();
+            return;
+        }
+        if ((hfs->thread_cache =
+                (hfs_thread *) tsk_malloc(HFS_THREAD_CACHE_LEN *
+                    sizeof(hfs_thread))) == NULL) {
+            free(hfs->thread_cache_cnid);
+            hfs->thread_cache_cnid = NULL;
+            tsk_error_reset();
+            return;
+        }
+    }
+
+    slot = (uint32_t) (inum % HFS_THREAD_CACHE_LEN);
+    hfs->thread_cache_cnid[slot] = (uint32_t) inum;
+    memcpy((char *) &hfs->thread_cache[slot], (char *) thread,
+        sizeof(hfs_thread));
+}
+
+
 /** \internal
  * Lookup an entry in the catalog file and save it into the entry.  Do not
  * call this for the special files that do not have an entry in the catalog. 
@@ -1082,6 +1386,7 @@ hfs_cat_file_lookup(HFS_INFO * hfs, TSK_INUM_T inum, HFS_ENTRY * entry)
     hfs_thread thread;          /* thread record */
     hfs_file_folder record;     /* file/folder record */
     TSK_OFF_T off;
+    uint32_t slot;
 
     tsk_error_reset();
 
@@ -1102,40 +1407,56 @@ hfs_cat_file_lookup(HFS_INFO * hfs, TSK_INUM_T inum, HFS_ENTRY * entry)
         return 1;
     }
 
-    /* first look up the thread record for the item we're searching for */
-
-    /* set up the thread record key */
-    memset((char *) &key, 0, sizeof(hfs_btree_key_cat));
-    cnid_to_array((uint32_t) inum, key.parent_cnid);
-
-    if (tsk_verbose)
-        tsk_fprintf(stderr,
-            "hfs_cat_file_lookup: Looking up thread record (%" PRIuINUM
-            ")\n", inum);
+    /* first look up the thread record for the item we're searching for.
+     * Folder threads are looked up over and over when paths are resolved
+     * and directories are listed, so they are remembered. */
+    slot = (uint32_t) (inum % HFS_THREAD_CACHE_LEN);
+    if ((hfs->thread_cache) && (hfs->thread_cache_cnid[slot] != 0)
+        && (hfs->thread_cache_cnid[slot] == inum)) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr,
+                "hfs_cat_file_lookup: Using cached thread record (%"
+                PRIuINUM ")\n", inum);
+        memcpy((char *) &thread, (char *) &hfs->thread_cache[slot],
+            sizeof(hfs_thread));
+    }
+    else {
+        /* set up the thread record key */
+        memset((char *) &key, 0, sizeof(hfs_btree_key_cat));
+        cnid_to_array((uint32_t) inum, key.parent_cnid);
 
-    /* look up the thread record */
-    off = hfs_cat_get_record_offset(hfs, &key);
-    if (off == 0) {
-        // no parsing error, just not found
-        if (tsk_errno == 0) {
-            tsk_errno = TSK_ERR_FS_INODE_NUM;
-            snprintf(tsk_errstr, TSK_ERRSTR_L,
-                "hfs_cat_file_lookup: Error finding thread node for file (%"
-                PRIuINUM ")", inum);
+        if (tsk_verbose)
+            tsk_fprintf(stderr,
+                "hfs_cat_file_lookup: Looking up thread record (%" PRIuINUM
+                ")\n", inum);
+
+        /* look up the thread record */
+        off = hfs_cat_get_record_offset(hfs, &key, NULL);
+        if (off == 0) {
+            // no parsing error, just not found
+            if (tsk_errno == 0) {
+                tsk_errno = TSK_ERR_FS_INODE_NUM;
+                snprintf(tsk_errstr, TSK_ERRSTR_L,
+                    "hfs_cat_file_lookup: Error finding thread node for file (%"
+                    PRIuINUM ")", inum);
+            }
+            else {
+                snprintf(tsk_errstr2, TSK_ERRSTR_L,
+                    " hfs_cat_file_lookup: thread for file (%" PRIuINUM ")",
+                    inum);
+            }
+            return 1;
         }
-        else {
+
+        /* read the thread record */
+        if (hfs_cat_read_thread_record(hfs, off, &thread)) {
             snprintf(tsk_errstr2, TSK_ERRSTR_L,
-                " hfs_cat_file_lookup: thread for file (%" PRIuINUM ")",
-                inum);
+                " hfs_cat_file_lookup: file (%" PRIuINUM ")", inum);
+            return 1;
         }
-        return 1;
-    }
 
-    /* read the thread record */
-    if (hfs_cat_read_thread_record(hfs, off, &thread)) {
-        snprintf(tsk_errstr2, TSK_ERRSTR_L,
-            " hfs_cat_file_lookup: file (%" PRIuINUM ")", inum);
-        return 1;
+        if (tsk_getu16(fs->endian, thread.rec_type) == HFS_FOLDER_THREAD)
+            hfs_cat_cache_thread(hfs, inum, &thread);
     }
 
     /* now look up the actual file/folder record */
@@ -1152,7 +1473,7 @@ hfs_cat_file_lookup(HFS_INFO * hfs, TSK_INUM_T inum, HFS_ENTRY * entry)
             PRIuINUM ")\n", tsk_getu32(fs->endian, key.parent_cnid));
 
     /* look up the record */
-    off = hfs_cat_get_record_offset(hfs, &key);
+    off = hfs_cat_get_record_offset(hfs, &key, NULL);
     if (off == 0) {
         // no parsing error, just not found
         if (tsk_errno == 0) {
@@ -2903,6 +3224,12 @@ hfs_close(TSK_FS_INFO * fs)
         hfs->blockmap_attr = NULL;
     }
 
+    free(hfs->cat_cache_buf);
+    free(hfs->cat_cache_node);
+    free(hfs->cat_cache_used);
+    free(hfs->thread_cache);
+    free(hfs->thread_cache_cnid);
+
     free(hfs);
 }
 
@@ -3067,6 +3394,7 @@ hfs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
 
     fs->file_add_meta = hfs_inode_lookup;
     fs->dir_open_meta = hfs_dir_open_meta;
+    fs->dir_lookup = hfs_dir_lookup;
     fs->fsstat = hfs_fsstat;
     fs->fscheck = hfs_fscheck;
     fs->istat = hfs_istat;
@@ -3087,6 +3415,14 @@ hfs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
     hfs->extents_file = NULL;
     hfs->extents_attr = NULL;
 
+    // the catalog node and thread caches are allocated on first use
+    hfs->cat_cache_buf = NULL;
+    hfs->cat_cache_node = NULL;
+    hfs->cat_cache_used = NULL;
+    hfs->cat_cache_len = 0;
+    hfs->thread_cache = NULL;
+    hfs->thread_cache_cnid = NULL;
+
     /* Load the catalog file though */
     if ((hfs->catalog_file =
             tsk_fs_file_open_meta(fs, NULL,
@@ -3128,6 +3464,21 @@ hfs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
         return NULL;
     }
 
+    // the node cache and the record offset tables need a sane node size
+    if (tsk_getu16(fs->endian,
+            hfs->catalog_header.nodesize) < sizeof(hfs_btree_node) + 2) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_FS_MAGIC;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "hfs_open: invalid catalog node size (%" PRIu16 ")",
+            tsk_getu16(fs->endian, hfs->catalog_header.nodesize));
+        fs->tag = 0;
+        tsk_fs_file_close(hfs->catalog_file);
+        free(hfs->fs);
+        free(hfs);
+        return NULL;
+    }
+
     if (tsk_getu16(fs->endian, hfs->fs->version) == HFS_VH_VER_HFSPLUS)
         hfs->is_case_sensitive = 0;
     else if (tsk_getu16(fs->endian, hfs->fs->version) == HFS_VH_VER_HFSX) {
@@ -422,6 +422,92 @@ hfs_dir_open_meta(TSK_FS_INFO * fs, TSK_FS_DIR ** a_fs_dir,
     return TSK_OK;
 }
 
+/** \internal
+ * Find one name in a folder by searching the catalog B-tree for its
+ * (parent cnid, name) key, instead of reading all records of the folder.
+ * The special files that hfs_dir_open_meta adds to the root folder are
+ * not in the catalog and are left to the caller.
+ *
+ * @param fs File system to analyze
+ * @param a_addr Address of the folder
+ * @param a_name UTF-8 name to find
+ * @param a_fs_name [out] Name that was found
+ * @returns TSK_OK if found, TSK_COR if not found and TSK_ERR on error
+ */
+TSK_RETVAL_ENUM
+hfs_dir_lookup(TSK_FS_INFO * fs, TSK_INUM_T a_addr, const char *a_name,
+    TSK_FS_NAME * a_fs_name)
+{
+    HFS_INFO *hfs = (HFS_INFO *) fs;
+    hfs_btree_key_cat key, found_key;
+    hfs_file_folder record;
+    TSK_OFF_T off;
+    uint16_t rec_type;
+    UTF16 name16[255];
+    UTF16 *ptr16 = name16;
+    const UTF8 *ptr8 = (const UTF8 *) a_name;
+    uint16_t len, i;
+
+    if ((a_addr < fs->first_inum) || (a_addr > fs->last_inum))
+        return TSK_COR;
+
+    if (tsk_UTF8toUTF16(&ptr8, (const UTF8 *) (a_name + strlen(a_name)),
+            &ptr16, &name16[255], TSKstrictConversion) != TSKconversionOK)
+        return TSK_COR;
+    len = (uint16_t) (ptr16 - name16);
+
+    // an empty name would match the thread record of the directory
+    if (len == 0)
+        return TSK_COR;
+
+    /* build the (big endian) key and undo the ':' for '/' replacement
+     * of hfs_uni2ascii */
+    memset((char *) &key, 0, sizeof(hfs_btree_key_cat));
+    key.parent_cnid[0] = (a_addr >> 24) & 0xff;
+    key.parent_cnid[1] = (a_addr >> 16) & 0xff;
+    key.parent_cnid[2] = (a_addr >> 8) & 0xff;
+    key.parent_cnid[3] = a_addr & 0xff;
+    key.name.length[0] = (len >> 8) & 0xff;
+    key.name.length[1] = len & 0xff;
+    for (i = 0; i < len; i++) {
+        uint16_t uc = name16[i];
+        if (uc == UTF16_COLON)
+            uc = UTF16_SLASH;
+        key.name.unicode[2 * i] = (uc >> 8) & 0xff;
+        key.name.unicode[2 * i + 1] = uc & 0xff;
+    }
+
+    off = hfs_cat_get_record_offset(hfs, &key, &found_key);
+    if (off == 0)
+        return tsk_errno ? TSK_ERR : TSK_COR;
+    if (hfs_cat_read_file_folder_record(hfs, off, &record))
+        return TSK_ERR;
+
+    rec_type = tsk_getu16(fs->endian, record.file.std.rec_type);
+    if (rec_type == HFS_FOLDER_RECORD) {
+        a_fs_name->meta_addr =
+            tsk_getu32(fs->endian, record.folder.std.cnid);
+        a_fs_name->type = TSK_FS_NAME_TYPE_DIR;
+    }
+    else {
+        a_fs_name->meta_addr = tsk_getu32(fs->endian, record.file.std.cnid);
+        a_fs_name->type =
+            hfsmode2tsknametype(tsk_getu16(fs->endian,
+                record.file.std.perm.mode));
+    }
+
+    // the name on disk can differ in case from the one that we looked for
+    len = tsk_getu16(fs->endian, found_key.name.length);
+    if (len > 255)
+        return TSK_COR;
+    if (hfs_uni2ascii(fs, (uint8_t *) found_key.name.unicode, len,
+            a_fs_name->name, a_fs_name->name_size))
+        return TSK_ERR;
+    a_fs_name->meta_seq = 0;
+    a_fs_name->flags = TSK_FS_NAME_FLAG_ALLOC;
+    return TSK_OK;
+}
+
 int
 hfs_name_cmp(TSK_FS_INFO * a_fs_info, const char *s1, const char *s2)
 {
@@ -150,6 +150,9 @@ tsk_fs_ifind_par(TSK_FS_INFO * fs, TSK_FS_IFIND_FLAG_ENUM lclflags,
 
 
 
+/* room for the longest UTF-8 name that the dir_lookup functions return */
+#define PATH2INUM_NAMLEN 1024
+
 /**
  * \ingroup fslib
  * 
@@ -175,6 +178,7 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
     char *strtok_last;
     TSK_INUM_T next_meta;
     uint8_t is_done;
+    TSK_FS_NAME *fs_name_idx = NULL;    // result of the directory index lookups
     *a_result = 0;
 
     // copy path to a buffer that we can modify
@@ -224,25 +228,75 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
     is_done = 0;
     while (is_done == 0) {
         size_t i;
-        TSK_FS_FILE *fs_file_alloc = NULL;      // set to the allocated file that is our target
-        TSK_FS_FILE *fs_file_del = NULL;        // set to an unallocated file that matches our criteria
+        const TSK_FS_NAME *fs_name_alloc = NULL;        // set to the allocated name that is our target
+        const TSK_FS_NAME *fs_name_del = NULL;  // set to an unallocated name that matches our criteria
+        const TSK_FS_NAME *fs_name_hit = NULL;  // name of the entry that we are going to use
+        int8_t cached = 2;      // result of the directory cache lookup
 
         TSK_FS_DIR *fs_dir = NULL;
 
+        /* Look for the result of an earlier lookup of the same name in
+         * the directory cache.  The attribute of an NTFS name is always
+         * checked by the scan below. */
+        if (cur_attr == NULL) {
+            if ((fs_name_idx == NULL) &&
+                ((fs_name_idx =
+                        tsk_fs_name_alloc(PATH2INUM_NAMLEN, 0)) == NULL)) {
+                free(cpath);
+                return -1;
+            }
+
+            cached =
+                tsk_fs_dir_cache_name_get(a_fs, next_meta, cur_dir,
+                fs_name_idx);
+            if (cached == -1) {
+                tsk_fs_name_free(fs_name_idx);
+                free(cpath);
+                return -1;
+            }
+            else if (cached == 0) {
+                fs_name_hit = fs_name_idx;
+            }
+        }
+
+        /* Ask the directory index of the file system next.  It only
+         * knows about allocated names, so if it does not find the name
+         * we still scan the directory to find deleted entries. */
+        if ((cached == 2) && (a_fs->dir_lookup) && (cur_attr == NULL)) {
+            TSK_RETVAL_ENUM retval;
+
+            retval = a_fs->dir_lookup(a_fs, next_meta, cur_dir, fs_name_idx);
+            if (retval == TSK_ERR) {
+                tsk_fs_name_free(fs_name_idx);
+                free(cpath);
+                return -1;
+            }
+            else if (retval == TSK_OK) {
+                fs_name_hit = fs_name_idx;
+            }
+        }
+
         // open the next directory in the recursion
-        if ((fs_dir = tsk_fs_dir_open_meta(a_fs, next_meta)) == NULL) {
+        if ((fs_name_hit == NULL) && (cached == 2) &&
+            ((fs_dir = tsk_fs_dir_open_meta(a_fs, next_meta)) == NULL)) {
+            if (fs_name_idx)
+                tsk_fs_name_free(fs_name_idx);
             free(cpath);
             return -1;
         }
 
-        // cycle through each entry
-        for (i = 0; i < tsk_fs_dir_getsize(fs_dir); i++) {
+        /* Cycle through each name.  Only the names are compared, so the
+         * metadata of the files is not loaded (except to check the
+         * attribute of an NTFS name). */
+        for (i = 0; (fs_dir) && (i < tsk_fs_dir_getsize(fs_dir)); i++) {
 
-            TSK_FS_FILE *fs_file;
+            const TSK_FS_NAME *fs_name;
             uint8_t found_name = 0;
 
-            if ((fs_file = tsk_fs_dir_get(fs_dir, i)) == NULL) {
+            if ((fs_name = tsk_fs_dir_get_name(fs_dir, i)) == NULL) {
                 tsk_fs_dir_close(fs_dir);
+                if (fs_name_idx)
+                    tsk_fs_name_free(fs_name_idx);
                 free(cpath);
                 return -1;
             }
@@ -253,13 +307,13 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
              */
             /* FAT is a special case because we check the short name */
             if (TSK_FS_TYPE_ISFAT(a_fs->ftype)) {
-                if ((fs_file->name->name)
-                    && (a_fs->name_cmp(a_fs, fs_file->name->name,
+                if ((fs_name->name)
+                    && (a_fs->name_cmp(a_fs, fs_name->name,
                             cur_dir) == 0)) {
                     found_name = 1;
                 }
-                else if ((fs_file->name->shrt_name)
-                    && (a_fs->name_cmp(a_fs, fs_file->name->shrt_name,
+                else if ((fs_name->shrt_name)
+                    && (a_fs->name_cmp(a_fs, fs_name->shrt_name,
                             cur_dir) == 0)) {
                     found_name = 1;
                 }
@@ -267,14 +321,24 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
 
             /* NTFS gets a case insensitive comparison */
             else if (TSK_FS_TYPE_ISNTFS(a_fs->ftype)) {
-                if ((fs_file->name->name)
-                    && (a_fs->name_cmp(a_fs, fs_file->name->name,
+                if ((fs_name->name)
+                    && (a_fs->name_cmp(a_fs, fs_name->name,
                             cur_dir) == 0)) {
                     /*  ensure we have the right attribute name */
                     if (cur_attr == NULL) {
                         found_name = 1;
                     }
                     else {
+                        TSK_FS_FILE *fs_file;
+
+                        if ((fs_file = tsk_fs_dir_get(fs_dir, i)) == NULL) {
+                            tsk_fs_dir_close(fs_dir);
+                            if (fs_name_idx)
+                                tsk_fs_name_free(fs_name_idx);
+                            free(cpath);
+                            return -1;
+                        }
+
                         if (fs_file->meta) {
                             int cnt, i;
 
@@ -293,12 +357,13 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
                                 }
                             }
                         }
+                        tsk_fs_file_close(fs_file);
                     }
                 }
             }
             else {
-                if ((fs_file->name->name)
-                    && (a_fs->name_cmp(a_fs, fs_file->name->name,
+                if ((fs_name->name)
+                    && (a_fs->name_cmp(a_fs, fs_name->name,
                             cur_dir) == 0)) {
                     found_name = 1;
                 }
@@ -308,37 +373,31 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
                 /* If we found our file and it is allocated, then stop. If
                  * it is unallocated, keep on going to see if we can get
                  * an allocated hit */
-                if (fs_file->name->flags & TSK_FS_NAME_FLAG_ALLOC) {
-                    fs_file_alloc = fs_file;
+                if (fs_name->flags & TSK_FS_NAME_FLAG_ALLOC) {
+                    fs_name_alloc = fs_name;
                     break;
                 }
                 else {
-                    // if we already have an unalloc and its addr is 0, then use the new one
-                    if ((fs_file_del)
-                        && (fs_file_del->name->meta_addr == 0)) {
-                        tsk_fs_file_close(fs_file_del);
-                    }
-                    fs_file_del = fs_file;
+                    fs_name_del = fs_name;
                 }
             }
-            // close the file if we did not save it for future analysis.
-            else {
-                tsk_fs_file_close(fs_file);
-                fs_file = NULL;
-            }
         }
 
+        // choose the alloc one first (if they both exist)
+        if (fs_name_alloc)
+            fs_name_hit = fs_name_alloc;
+        else if (fs_name_del)
+            fs_name_hit = fs_name_del;
+
+        // remember the outcome for the next lookup of this name
+        if ((cached == 2) && (cur_attr == NULL))
+            tsk_fs_dir_cache_name_add(a_fs, next_meta, cur_dir,
+                fs_name_hit);
+
         // we found a directory, go into it 
-        if ((fs_file_alloc) || (fs_file_del)) {
+        if (fs_name_hit) {
 
             const char *pname;
-            TSK_FS_FILE *fs_file_tmp;
-
-            // choose the alloc one first (if they both exist)
-            if (fs_file_alloc)
-                fs_file_tmp = fs_file_alloc;
-            else
-                fs_file_tmp = fs_file_del;
 
             pname = cur_dir;    // save a copy of the current name pointer
 
@@ -352,14 +411,17 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
 
             /* That was the last name in the path -- we found the file! */
             if (cur_dir == NULL) {
-                *a_result = fs_file_tmp->name->meta_addr;
+                *a_result = fs_name_hit->meta_addr;
 
                 // make a copy if one was requested
                 if (a_fs_name) {
-                    tsk_fs_name_copy(a_fs_name, fs_file_tmp->name);
+                    tsk_fs_name_copy(a_fs_name, fs_name_hit);
                 }
 
-                tsk_fs_dir_close(fs_dir);
+                if (fs_dir)
+                    tsk_fs_dir_close(fs_dir);
+                if (fs_name_idx)
+                    tsk_fs_name_free(fs_name_idx);
                 free(cpath);
                 return 0;
             }
@@ -372,16 +434,7 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
             }
 
             // update the value for the next directory to open
-            next_meta = fs_file_tmp->name->meta_addr;
-
-            if (fs_file_alloc) {
-                tsk_fs_file_close(fs_file_alloc);
-                fs_file_alloc = NULL;
-            }
-            if (fs_file_del) {
-                tsk_fs_file_close(fs_file_del);
-                fs_file_del = NULL;
-            }
+            next_meta = fs_name_hit->meta_addr;
         }
 
         // no hit in directory
@@ -389,10 +442,14 @@ tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
             is_done = 1;
         }
 
-        tsk_fs_dir_close(fs_dir);
-        fs_dir = NULL;
+        if (fs_dir) {
+            tsk_fs_dir_close(fs_dir);
+            fs_dir = NULL;
+        }
     }
 
+    if (fs_name_idx)
+        tsk_fs_name_free(fs_name_idx);
     free(cpath);
     return 1;
 }
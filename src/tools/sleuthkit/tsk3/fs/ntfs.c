@@ -119,6 +119,98 @@ nt2nano(uint64_t ntdate)
 
 
 
+/**
+ * Check and remove the update sequence of an MFT entry that was read
+ * from disk.
+ *
+ * @param a_ntfs File system the entry is from
+ * @param a_mft Raw entry (mft_rsize_b bytes) to fix up in place
+ *
+ * @returns Error value
+ */
+static TSK_RETVAL_ENUM
+ntfs_mft_fixup(NTFS_INFO * a_ntfs, ntfs_mft * a_mft)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & a_ntfs->fs_info;
+    ntfs_upd *upd;
+    uint16_t sig_seq;
+    int i;
+
+    /* The MFT entries have error and integrity checks in them
+     * called update sequences.  They must be checked and removed
+     * so that later functions can process the data as normal. 
+     * They are located in the last 2 bytes of each 512-byte sector
+     *
+     * We first verify that the the 2-byte value is a give value and
+     * then replace it with what should be there
+     */
+    /* sanity check so we don't run over in the next loop */
+    if ((tsk_getu16(fs->endian, a_mft->upd_cnt) > 0) &&
+        (((uint32_t) (tsk_getu16(fs->endian,
+                        a_mft->upd_cnt) - 1) * a_ntfs->ssize_b) >
+            a_ntfs->mft_rsize_b)) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_FS_INODE_COR;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "dinode_lookup: More Update Sequence Entries than MFT size");
+        return TSK_COR;
+    }
+    if (tsk_getu16(fs->endian, a_mft->upd_off) > a_ntfs->mft_rsize_b) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_FS_INODE_COR;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "dinode_lookup: Update sequence offset larger than MFT size");
+        return TSK_COR;
+    }
+
+    /* Apply the update sequence structure template */
+    upd =
+        (ntfs_upd *) ((uintptr_t) a_mft + tsk_getu16(fs->endian,
+            a_mft->upd_off));
+    /* Get the sequence value that each 16-bit value should be */
+    sig_seq = tsk_getu16(fs->endian, upd->upd_val);
+    /* cycle through each sector */
+    for (i = 1; i < tsk_getu16(fs->endian, a_mft->upd_cnt); i++) {
+        uint8_t *new_val, *old_val;
+        /* The offset into the buffer of the value to analyze */
+        size_t offset = i * a_ntfs->ssize_b - 2;
+        /* get the current sequence value */
+        uint16_t cur_seq =
+            tsk_getu16(fs->endian, (uintptr_t) a_mft + offset);
+        if (cur_seq != sig_seq) {
+            /* get the replacement value */
+            uint16_t cur_repl =
+                tsk_getu16(fs->endian, &upd->upd_seq + (i - 1) * 2);
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_FS_GENFS;
+
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "Incorrect update sequence value in MFT entry\nSignature Value: 0x%"
+                PRIx16 " Actual Value: 0x%" PRIx16
+                " Replacement Value: 0x%" PRIx16
+                "\nThis is typically because of a corrupted entry",
+                sig_seq, cur_seq, cur_repl);
+            return TSK_COR;
+        }
+
+        new_val = &upd->upd_seq + (i - 1) * 2;
+        old_val = (uint8_t *) ((uintptr_t) a_mft + offset);
+        /*
+           if (tsk_verbose)
+           tsk_fprintf(stderr,
+           "ntfs_dinode_lookup: upd_seq %i   Replacing: %.4"
+           PRIx16 "   With: %.4" PRIx16 "\n", i,
+           tsk_getu16(fs->endian, old_val), tsk_getu16(fs->endian,
+           new_val));
+         */
+        *old_val++ = *new_val++;
+        *old_val = *new_val;
+    }
+
+    return TSK_OK;
+}
+
+
 /**
  * Read an MFT entry and save it in raw form in the given buffer.
  * NOTE: This will remove the update sequence integrity checks in the
@@ -136,11 +228,8 @@ ntfs_dinode_lookup(NTFS_INFO * a_ntfs, ntfs_mft * a_mft,
 {
     TSK_OFF_T mftaddr_b, mftaddr2_b, offset;
     size_t mftaddr_len = 0;
-    int i;
     TSK_FS_INFO *fs = (TSK_FS_INFO *) & a_ntfs->fs_info;
     TSK_FS_ATTR_RUN *data_run;
-    ntfs_upd *upd;
-    uint16_t sig_seq;
 
     /* sanity checks */
     if (!a_mft) {
@@ -177,6 +266,21 @@ ntfs_dinode_lookup(NTFS_INFO * a_ntfs, ntfs_mft * a_mft,
             "ntfs_dinode_lookup: Processing MFT %" PRIuINUM "\n",
             a_mftnum);
 
+    /* Use the copy that ntfs_mft_chunk_load read with its neighbors.
+     * Corrupt entries are read again below so that the error is set. */
+    if ((a_mftnum >= a_ntfs->mft_chunk_addr)
+        && (a_mftnum < a_ntfs->mft_chunk_addr + a_ntfs->mft_chunk_cnt)
+        && (a_ntfs->mft_chunk_cor[a_mftnum - a_ntfs->mft_chunk_addr] ==
+            0)) {
+        memcpy(a_mft,
+            &a_ntfs->mft_chunk[(a_mftnum -
+                    a_ntfs->mft_chunk_addr) * a_ntfs->mft_rsize_b],
+            a_ntfs->mft_rsize_b);
+        if ((uintptr_t) a_mft == (uintptr_t) a_ntfs->mft)
+            a_ntfs->mnum = a_mftnum;
+        return TSK_OK;
+    }
+
     /* If mft_data (the cached $Data attribute of $MFT) is not there yet, 
      * then we have not started to load $MFT yet.  In that case, we will
      * 'cheat' and calculate where it goes.  This should only be for
@@ -356,81 +460,209 @@ ntfs_dinode_lookup(NTFS_INFO * a_ntfs, ntfs_mft * a_mft,
         return 1;
     }
 #endif
-    /* The MFT entries have error and integrity checks in them
-     * called update sequences.  They must be checked and removed
-     * so that later functions can process the data as normal. 
-     * They are located in the last 2 bytes of each 512-byte sector
-     *
-     * We first verify that the the 2-byte value is a give value and
-     * then replace it with what should be there
-     */
-    /* sanity check so we don't run over in the next loop */
-    if ((tsk_getu16(fs->endian, a_mft->upd_cnt) > 0) &&
-        (((uint32_t) (tsk_getu16(fs->endian,
-                        a_mft->upd_cnt) - 1) * a_ntfs->ssize_b) >
-            a_ntfs->mft_rsize_b)) {
-        tsk_error_reset();
-        tsk_errno = TSK_ERR_FS_INODE_COR;
-        snprintf(tsk_errstr, TSK_ERRSTR_L,
-            "dinode_lookup: More Update Sequence Entries than MFT size");
-        return TSK_COR;
-    }
-    if (tsk_getu16(fs->endian, a_mft->upd_off) > a_ntfs->mft_rsize_b) {
-        tsk_error_reset();
-        tsk_errno = TSK_ERR_FS_INODE_COR;
-        snprintf(tsk_errstr, TSK_ERRSTR_L,
-            "dinode_lookup: Update sequence offset larger than MFT size");
-        return TSK_COR;
+    return ntfs_mft_fixup(a_ntfs, a_mft);
+}
+
+
+
+/**
+ * Free the MFT skip map and stop building it.
+ *
+ * @param a_ntfs File system to free the map of
+ */
+static void
+ntfs_mft_skip_free(NTFS_INFO * a_ntfs)
+{
+    NTFS_MFT_SKIP *skip = a_ntfs->mft_skip;
+
+    if (skip == NULL)
+        return;
+
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "ntfs_mft_skip_free: %" PRIuINUM " entries, %" PRIuSIZE
+            " bytes\n", skip->seen_cnt, skip->mem);
+
+    free(skip->flags);
+    free(skip);
+    a_ntfs->mft_skip = NULL;
+}
+
+/**
+ * Give up on the MFT skip map because it went over its budget or memory
+ * could not be allocated.  Walks then read every entry again.
+ *
+ * @param a_ntfs File system to drop the map of
+ */
+static void
+ntfs_mft_skip_drop(NTFS_INFO * a_ntfs)
+{
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "ntfs_mft_skip_drop: Not building the MFT skip map\n");
+    ntfs_mft_skip_free(a_ntfs);
+    a_ntfs->mft_skip_off = 1;
+    tsk_error_reset();
+}
+
+/**
+ * Add the flags of an MFT entry to the skip map.
+ *
+ * @param a_ntfs File system being walked
+ * @param a_mftnum Address of the entry
+ * @param a_mft Entry with its update sequence applied
+ * @param a_cor Set if the update sequence of the entry was corrupt
+ */
+static void
+ntfs_mft_skip_add(NTFS_INFO * a_ntfs, TSK_INUM_T a_mftnum,
+    ntfs_mft * a_mft, uint8_t a_cor)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & a_ntfs->fs_info;
+    NTFS_MFT_SKIP *skip = a_ntfs->mft_skip;
+    uint8_t *flags = &skip->flags[a_mftnum];
+    uint16_t mflags;
+
+    if (*flags & NTFS_MFT_SKIP_SEEN)
+        return;
+    *flags = NTFS_MFT_SKIP_SEEN;
+    skip->seen_cnt++;
+
+    if (a_cor) {
+        *flags |= NTFS_MFT_SKIP_COR;
+        return;
     }
 
-    /* Apply the update sequence structure template */
-    upd =
-        (ntfs_upd *) ((uintptr_t) a_mft + tsk_getu16(fs->endian,
-            a_mft->upd_off));
-    /* Get the sequence value that each 16-bit value should be */
-    sig_seq = tsk_getu16(fs->endian, upd->upd_val);
-    /* cycle through each sector */
-    for (i = 1; i < tsk_getu16(fs->endian, a_mft->upd_cnt); i++) {
-        uint8_t *new_val, *old_val;
-        /* The offset into the buffer of the value to analyze */
-        size_t offset = i * a_ntfs->ssize_b - 2;
-        /* get the current sequence value */
-        uint16_t cur_seq =
-            tsk_getu16(fs->endian, (uintptr_t) a_mft + offset);
-        if (cur_seq != sig_seq) {
-            /* get the replacement value */
-            uint16_t cur_repl =
-                tsk_getu16(fs->endian, &upd->upd_seq + (i - 1) * 2);
-            tsk_error_reset();
-            tsk_errno = TSK_ERR_FS_GENFS;
+    mflags = tsk_getu16(fs->endian, a_mft->flags);
+    if (tsk_getu48(fs->endian, a_mft->base_ref) == NTFS_MFT_BASE)
+        *flags |= NTFS_MFT_SKIP_BASE;
+    if (mflags & NTFS_MFT_INUSE)
+        *flags |= NTFS_MFT_SKIP_INUSE;
+}
 
-            snprintf(tsk_errstr, TSK_ERRSTR_L,
-                "Incorrect update sequence value in MFT entry\nSignature Value: 0x%"
-                PRIx16 " Actual Value: 0x%" PRIx16
-                " Replacement Value: 0x%" PRIx16
-                "\nThis is typically because of a corrupted entry",
-                sig_seq, cur_seq, cur_repl);
-            return TSK_COR;
-        }
+/**
+ * Read consecutive MFT entries with one read for each $MFT data run that
+ * they are in instead of one read per entry.  The update sequences are
+ * not applied.  This can be called from several threads at once if the
+ * image was made concurrent.
+ *
+ * @param a_ntfs File system to read from
+ * @param a_mftnum Address of the first entry to read
+ * @param a_cnt Number of entries to read
+ * @param a_buf Buffer to read into (a_cnt * mft_rsize_b bytes)
+ * @returns Number of entries that were read (less than a_cnt if the
+ * $MFT data runs end early or a read fails)
+ */
+static TSK_INUM_T
+ntfs_mft_read_bulk(NTFS_INFO * a_ntfs, TSK_INUM_T a_mftnum,
+    TSK_INUM_T a_cnt, char *a_buf)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & a_ntfs->fs_info;
+    TSK_FS_ATTR_RUN *data_run;
+    TSK_OFF_T offset, run_off;
+    size_t len, done;
+
+    len = (size_t) (a_cnt * a_ntfs->mft_rsize_b);
+    offset = a_mftnum * a_ntfs->mft_rsize_b;
+
+    /* NOTE: data_run values are in clusters */
+    done = 0;
+    run_off = 0;
+    for (data_run = a_ntfs->mft_data->nrd.run;
+        (data_run != NULL) && (done < len); data_run = data_run->next) {
+        TSK_OFF_T run_len = data_run->len * a_ntfs->csize_b;
+        TSK_OFF_T pos = offset + done - run_off;
+        size_t part;
+
+        run_off += run_len;
+        if (pos >= run_len)
+            continue;
 
-        new_val = &upd->upd_seq + (i - 1) * 2;
-        old_val = (uint8_t *) ((uintptr_t) a_mft + offset);
-        /*
-           if (tsk_verbose)
-           tsk_fprintf(stderr,
-           "ntfs_dinode_lookup: upd_seq %i   Replacing: %.4"
-           PRIx16 "   With: %.4" PRIx16 "\n", i,
-           tsk_getu16(fs->endian, old_val), tsk_getu16(fs->endian,
-           new_val));
-         */
-        *old_val++ = *new_val++;
-        *old_val = *new_val;
+        part = len - done;
+        if (part > run_len - pos)
+            part = (size_t) (run_len - pos);
+
+        if (data_run->flags & (TSK_FS_ATTR_RUN_FLAG_SPARSE |
+                TSK_FS_ATTR_RUN_FLAG_FILLER)) {
+            memset(&a_buf[done], 0, part);
+        }
+        else {
+            ssize_t ret = tsk_fs_read(fs,
+                data_run->addr * a_ntfs->csize_b + pos,
+                &a_buf[done], part);
+            if (ret != (ssize_t) part) {
+                if (ret > 0)
+                    done += ret;
+                tsk_error_reset();
+                break;
+            }
+        }
+        done += part;
     }
 
-    return TSK_OK;
+    return done / a_ntfs->mft_rsize_b;
 }
 
 
+/**
+ * Read MFT entries starting at a given address into ntfs->mft_chunk
+ * (see ntfs_mft_read_bulk()) and apply their update sequences.  If the
+ * MFT skip map is being built, the entries are added to it.  Entries that
+ * cannot be read are left out of the chunk so that ntfs_dinode_lookup
+ * reads them itself and reports the error.
+ *
+ * @param a_ntfs File system to read from
+ * @param a_mftnum Address of the first entry to read
+ * @param a_last Address of the last entry that will be needed
+ * @returns 1 on error
+ */
+static uint8_t
+ntfs_mft_chunk_load(NTFS_INFO * a_ntfs, TSK_INUM_T a_mftnum,
+    TSK_INUM_T a_last)
+{
+    TSK_INUM_T cnt, i;
+
+    if (a_ntfs->mft_data == NULL)
+        return 0;
+
+    if (a_ntfs->mft_chunk == NULL) {
+        if ((a_ntfs->mft_chunk =
+                (char *) tsk_malloc(NTFS_MFT_CHUNK_B)) == NULL)
+            return 1;
+        if ((a_ntfs->mft_chunk_cor =
+                (uint8_t *) tsk_malloc(NTFS_MFT_CHUNK_B /
+                    a_ntfs->mft_rsize_b)) == NULL)
+            return 1;
+    }
+
+    cnt = NTFS_MFT_CHUNK_B / a_ntfs->mft_rsize_b;
+    if (cnt > a_last - a_mftnum + 1)
+        cnt = a_last - a_mftnum + 1;
+
+    a_ntfs->mft_chunk_addr = a_mftnum;
+    a_ntfs->mft_chunk_cnt =
+        ntfs_mft_read_bulk(a_ntfs, a_mftnum, cnt, a_ntfs->mft_chunk);
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "ntfs_mft_chunk_load: Read %" PRIuINUM
+            " entries starting at %" PRIuINUM "\n", a_ntfs->mft_chunk_cnt,
+            a_mftnum);
+
+    for (i = 0; i < a_ntfs->mft_chunk_cnt; i++) {
+        ntfs_mft *mft =
+            (ntfs_mft *) & a_ntfs->mft_chunk[i * a_ntfs->mft_rsize_b];
+
+        a_ntfs->mft_chunk_cor[i] = 0;
+        if (ntfs_mft_fixup(a_ntfs, mft) != TSK_OK) {
+            a_ntfs->mft_chunk_cor[i] = 1;
+            tsk_error_reset();
+        }
+        if (a_ntfs->mft_skip)
+            ntfs_mft_skip_add(a_ntfs, a_mftnum + i, mft,
+                a_ntfs->mft_chunk_cor[i]);
+    }
+    return 0;
+}
+
 
 /*
  * given a cluster, return the allocation status or
@@ -544,13 +776,14 @@ is_clustalloc(NTFS_INFO * ntfs, TSK_DADDR_T addr)
  * @param runlist The raw runlist data from the MFT entry.
  * @param a_data_run_head [out] Pointer to pointer of run that is created. (NULL on error and for $BadClust - special case because it is a sparse file for the entire FS).
  * @param totlen [out] Pointer to location where total length of run (in bytes) can be returned (or NULL)
+ * @param a_mnum Address of the (base) MFT entry that the runlist is for
  *
  * @returns Return status of error, corrupt, or OK (note a_data_run can be NULL even when OK is returned if $BadClust is encountered)
  */
 static TSK_RETVAL_ENUM
 ntfs_make_data_run(NTFS_INFO * ntfs, TSK_OFF_T start_vcn,
     ntfs_runlist * runlist_head, TSK_FS_ATTR_RUN ** a_data_run_head,
-    TSK_OFF_T * totlen)
+    TSK_OFF_T * totlen, TSK_INUM_T a_mnum)
 {
     TSK_FS_INFO *fs = (TSK_FS_INFO *) ntfs;
     ntfs_runlist *run;
@@ -674,7 +907,7 @@ ntfs_make_data_run(NTFS_INFO * ntfs, TSK_OFF_T start_vcn,
          * For sparse files the next run will have its offset relative 
          * to the current "prev_addr" so skip that code
          */
-        else if ((addr_offset) || (ntfs->mnum == NTFS_MFT_BOOT)) {
+        else if ((addr_offset) || (a_mnum == NTFS_MFT_BOOT)) {
 
             data_run->addr = prev_addr + addr_offset;
             prev_addr = data_run->addr;
@@ -1765,7 +1998,8 @@ ntfs_proc_attrseq(NTFS_INFO * ntfs,
                 tsk_getu64(fs->endian, attr->c.nr.start_vcn),
                 (ntfs_runlist *) ((uintptr_t)
                     attr + tsk_getu16(fs->endian,
-                        attr->c.nr.run_off)), &fs_attr_run, NULL);
+                        attr->c.nr.run_off)), &fs_attr_run, NULL,
+                fs_file->meta->addr);
             if (retval != TSK_OK) {
                 strncat(tsk_errstr2, " - proc_attrseq",
                     TSK_ERRSTR_L - strlen(tsk_errstr2));
@@ -2339,17 +2573,23 @@ ntfs_proc_attrlist(NTFS_INFO * ntfs,
 
 
 /**
- * Copy the MFT entry saved in ntfs->mft into the generic structure.
+ * Copy an MFT entry (usually the one saved in ntfs->mft) into the
+ * generic structure.  Entries without an attribute list only use the
+ * buffer that is passed in, so this can be called from several threads
+ * at once for them.
  * 
  * @param ntfs File system structure that contains entry to copy
  * @param fs_file Structure to copy processed data to.
+ * @param a_mft Raw MFT entry with the update sequence applied
+ * @param a_mnum Address of the MFT entry
  * 
  * @returns error code
  */
 static TSK_RETVAL_ENUM
-ntfs_dinode_copy(NTFS_INFO * ntfs, TSK_FS_FILE * a_fs_file)
+ntfs_dinode_copy(NTFS_INFO * ntfs, TSK_FS_FILE * a_fs_file,
+    ntfs_mft * a_mft, TSK_INUM_T a_mnum)
 {
-    ntfs_mft *mft = ntfs->mft;
+    ntfs_mft *mft = a_mft;
     ntfs_attr *attr;
     TSK_FS_INFO *fs = (TSK_FS_INFO *) & ntfs->fs_info;
     TSK_RETVAL_ENUM retval;
@@ -2391,10 +2631,10 @@ ntfs_dinode_copy(NTFS_INFO * ntfs, TSK_FS_FILE * a_fs_file)
     /* Set the a_fs_file->meta values from mft */
     a_fs_file->meta->nlink = tsk_getu16(fs->endian, mft->link);
     a_fs_file->meta->seq = tsk_getu16(fs->endian, mft->seq);
-    a_fs_file->meta->addr = ntfs->mnum;
+    a_fs_file->meta->addr = a_mnum;
 
     /* Set the mode for file or directory */
-    if (tsk_getu16(fs->endian, ntfs->mft->flags) & NTFS_MFT_DIR)
+    if (tsk_getu16(fs->endian, mft->flags) & NTFS_MFT_DIR)
         a_fs_file->meta->type = TSK_FS_META_TYPE_DIR;
     else
         a_fs_file->meta->type = TSK_FS_META_TYPE_REG;
@@ -2417,7 +2657,7 @@ ntfs_dinode_copy(NTFS_INFO * ntfs, TSK_FS_FILE * a_fs_file)
 
     /* add the flags */
     a_fs_file->meta->flags =
-        ((tsk_getu16(fs->endian, ntfs->mft->flags) &
+        ((tsk_getu16(fs->endian, mft->flags) &
             NTFS_MFT_INUSE) ? TSK_FS_META_FLAG_ALLOC :
         TSK_FS_META_FLAG_UNALLOC);
 
@@ -2543,7 +2783,7 @@ ntfs_inode_lookup(TSK_FS_INFO * fs, TSK_FS_FILE * a_fs_file,
     }
 
     /* Copy the structure in ntfs to generic a_fs_file->meta */
-    if (ntfs_dinode_copy(ntfs, a_fs_file) != TSK_OK) {
+    if (ntfs_dinode_copy(ntfs, a_fs_file, ntfs->mft, ntfs->mnum) != TSK_OK) {
         return 1;
     }
 
@@ -2727,7 +2967,7 @@ ntfs_load_bmap(NTFS_INFO * ntfs)
                 (ntfs_runlist
                     *) ((uintptr_t) attr + tsk_getu16(fs->endian,
                         attr->c.nr.run_off)), &(ntfs->bmap),
-                NULL)) != TSK_OK) {
+                NULL, ntfs->mnum)) != TSK_OK) {
         return 1;
     }
 
@@ -3452,25 +3692,16 @@ ntfs_block_walk(TSK_FS_INFO * fs,
 
 
 /*
- * inode_walk
- *
- * Flags: TSK_FS_META_FLAG_ALLOC, TSK_FS_META_FLAG_UNALLOC, 
- * TSK_FS_META_FLAG_USED, TSK_FS_META_FLAG_UNUSED, TSK_FS_META_FLAG_ORPHAN
- *
- * Note that with ORPHAN, entries will be found that can also be
- * found by searching based on parent directories (if parent directory is
- * known)
+ * Check the range and flags of an inode walk and fill in the flags that
+ * are implied.  Loads the list of named entries for ORPHAN walks.
+ * @returns 1 on error
  */
-uint8_t
-ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
-    TSK_INUM_T end_inum, TSK_FS_META_FLAG_ENUM flags,
-    TSK_FS_META_WALK_CB a_action, void *ptr)
+static uint8_t
+ntfs_inode_walk_setup(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
+    TSK_INUM_T end_inum, TSK_FS_META_FLAG_ENUM * a_flags)
 {
     NTFS_INFO *ntfs = (NTFS_INFO *) fs;
-    int myflags;
-    TSK_INUM_T mftnum;
-    TSK_FS_FILE *fs_file;
-    TSK_INUM_T end_inum_tmp;
+    TSK_FS_META_FLAG_ENUM flags = *a_flags;
 
     /*
      * Sanity checks.
@@ -3530,6 +3761,7 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
             flags |= (TSK_FS_META_FLAG_USED | TSK_FS_META_FLAG_UNUSED);
         }
     }
+    *a_flags = flags;
 
 
     /* If we are looking for orphan files and have not yet filled
@@ -3546,94 +3778,698 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
         }
     }
 
-    if ((fs_file = tsk_fs_file_alloc(fs)) == NULL)
-        return 1;
+    /* Start the MFT skip map if this is the first walk.  The entries
+     * are added to it as they are read in chunks. */
+    if ((ntfs->mft_skip == NULL) && (ntfs->mft_skip_off == 0)) {
+        size_t len = (size_t) fs->last_inum;
 
-    if ((fs_file->meta = tsk_fs_meta_alloc(NTFS_FILE_CONTENT_LEN)) == NULL) {
-        // JRB: Coverity CID: 348 
-        if (fs_file)
-            tsk_fs_file_close(fs_file);
+        if ((len > NTFS_MFT_SKIP_MAX_B)
+            || ((ntfs->mft_skip =
+                    (NTFS_MFT_SKIP *) tsk_malloc(sizeof(NTFS_MFT_SKIP))) ==
+                NULL)
+            || ((ntfs->mft_skip->flags =
+                    (uint8_t *) tsk_malloc(len)) == NULL)) {
+            ntfs_mft_skip_drop(ntfs);
+        }
+        else {
+            ntfs->mft_skip->mem = sizeof(NTFS_MFT_SKIP) + len;
+            // entries that are already in the chunk are not in the map
+            ntfs->mft_chunk_cnt = 0;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Returns 1 if the MFT skip map shows that an entry does not need to be
+ * looked at by an inode walk with the given flags.
+ */
+static uint8_t
+ntfs_inode_walk_skip(NTFS_INFO * ntfs, TSK_INUM_T mftnum,
+    TSK_FS_META_FLAG_ENUM flags)
+{
+    uint8_t mflags;
+    int myflags;
+
+    if (ntfs->mft_skip == NULL)
+        return 0;
+
+    mflags = ntfs->mft_skip->flags[mftnum];
+    if ((mflags & (NTFS_MFT_SKIP_SEEN | NTFS_MFT_SKIP_COR)) !=
+        NTFS_MFT_SKIP_SEEN)
+        return 0;
+    if ((mflags & NTFS_MFT_SKIP_BASE) == 0)
         return 1;
+    myflags = (mflags & NTFS_MFT_SKIP_INUSE) ?
+        TSK_FS_META_FLAG_ALLOC : TSK_FS_META_FLAG_UNALLOC;
+    return ((flags & myflags) == 0) ? 1 : 0;
+}
+
+
+/*
+ * Load one MFT entry for an inode walk and call the callback if it
+ * matches the flags.  Corrupt entries are skipped.
+ * @returns TSK_WALK_STOP if the callback stopped the walk,
+ * TSK_WALK_ERROR on error and TSK_WALK_CONT otherwise
+ */
+static TSK_WALK_RET_ENUM
+ntfs_inode_walk_one(NTFS_INFO * ntfs, TSK_FS_FILE * fs_file,
+    TSK_INUM_T mftnum, TSK_FS_META_FLAG_ENUM flags,
+    TSK_FS_META_WALK_CB a_action, void *ptr)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ntfs;
+    int myflags;
+    int retval;
+    TSK_RETVAL_ENUM retval2;
+
+    /* read MFT entry in to NTFS_INFO */
+    if ((retval2 = ntfs_dinode_load(ntfs, mftnum)) != TSK_OK) {
+        // if the entry is corrupt, then skip to the next one
+        if (retval2 == TSK_COR) {
+            if (tsk_verbose)
+                tsk_error_print(stderr);
+            tsk_error_reset();
+            return TSK_WALK_CONT;
+        }
+        return TSK_WALK_ERROR;
     }
 
-    // we need to handle fs->last_inum specially because it is for the 
-    // virtual ORPHANS directory.  Handle it outside of the loop.
-    if (end_inum == TSK_FS_ORPHANDIR_INUM(fs))
-        end_inum_tmp = end_inum - 1;
-    else
-        end_inum_tmp = end_inum;
+    /* we only want to look at base file records
+     * (extended are because the base could not fit into one)
+     */
+    if (tsk_getu48(fs->endian, ntfs->mft->base_ref) != NTFS_MFT_BASE)
+        return TSK_WALK_CONT;
 
+    /* NOTE: We could add a sanity check here with the MFT bitmap
+     * to validate of the INUSE flag and bitmap are in agreement
+     */
+    /* check flags */
+    myflags =
+        ((tsk_getu16(fs->endian, ntfs->mft->flags) &
+            NTFS_MFT_INUSE) ? TSK_FS_META_FLAG_ALLOC :
+        TSK_FS_META_FLAG_UNALLOC);
 
-    for (mftnum = start_inum; mftnum <= end_inum_tmp; mftnum++) {
-        int retval;
-        TSK_RETVAL_ENUM retval2;
+    /* If we want only orphans, then check if this
+     * inode is in the seen list
+     * */
+    if ((myflags & TSK_FS_META_FLAG_UNALLOC) &&
+        (flags & TSK_FS_META_FLAG_ORPHAN) &&
+        (tsk_list_find(fs->list_inum_named, mftnum))) {
+        return TSK_WALK_CONT;
+    }
 
-        /* read MFT entry in to NTFS_INFO */
-        if ((retval2 = ntfs_dinode_load(ntfs, mftnum)) != TSK_OK) {
-            // if the entry is corrupt, then skip to the next one
-            if (retval2 == TSK_COR) {
-                if (tsk_verbose)
-                    tsk_error_print(stderr);
-                tsk_error_reset();
-                continue;
-            }
-            tsk_fs_file_close(fs_file);
-            return 1;
+    /* copy into generic format */
+    if ((retval =
+            ntfs_dinode_copy(ntfs, fs_file, ntfs->mft,
+                ntfs->mnum)) != TSK_OK) {
+        // continue on if there were only corruption problems
+        if (retval == TSK_COR) {
+            if (tsk_verbose)
+                tsk_error_print(stderr);
+            tsk_error_reset();
+            return TSK_WALK_CONT;
         }
+        return TSK_WALK_ERROR;
+    }
 
-        /* we only want to look at base file records 
-         * (extended are because the base could not fit into one)
-         */
-        if (tsk_getu48(fs->endian, ntfs->mft->base_ref) != NTFS_MFT_BASE)
+    myflags |=
+        (fs_file->meta->
+        flags & (TSK_FS_META_FLAG_USED | TSK_FS_META_FLAG_UNUSED));
+    if ((flags & myflags) != myflags)
+        return TSK_WALK_CONT;
+
+    /* call action */
+    retval = a_action(fs_file, ptr);
+    if (retval == TSK_WALK_STOP)
+        return TSK_WALK_STOP;
+    else if (retval == TSK_WALK_ERROR)
+        return TSK_WALK_ERROR;
+    return TSK_WALK_CONT;
+}
+
+
+/*
+ * Walk the MFT entries from start_inum to end_inum (which must not be
+ * the orphan directory) in this thread, reading the MFT in chunks.
+ * @returns TSK_WALK_STOP if the callback stopped the walk,
+ * TSK_WALK_ERROR on error and TSK_WALK_CONT otherwise
+ */
+static TSK_WALK_RET_ENUM
+ntfs_inode_walk_range(NTFS_INFO * ntfs, TSK_FS_FILE * fs_file,
+    TSK_INUM_T start_inum, TSK_INUM_T end_inum,
+    TSK_FS_META_FLAG_ENUM flags, TSK_FS_META_WALK_CB a_action, void *ptr)
+{
+    TSK_INUM_T mftnum;
+    TSK_WALK_RET_ENUM retval;
+
+    for (mftnum = start_inum; mftnum <= end_inum; mftnum++) {
+        /* skip the entries that the skip map shows are not wanted */
+        if (ntfs_inode_walk_skip(ntfs, mftnum, flags))
             continue;
 
-        /* NOTE: We could add a sanity check here with the MFT bitmap
-         * to validate of the INUSE flag and bitmap are in agreement
-         */
-        /* check flags */
+        /* read the MFT in chunks rather than one entry at a time */
+        if ((mftnum < ntfs->mft_chunk_addr)
+            || (mftnum >= ntfs->mft_chunk_addr + ntfs->mft_chunk_cnt)) {
+            if (ntfs_mft_chunk_load(ntfs, mftnum, end_inum))
+                return TSK_WALK_ERROR;
+        }
+
+        retval =
+            ntfs_inode_walk_one(ntfs, fs_file, mftnum, flags, a_action,
+            ptr);
+        if (retval != TSK_WALK_CONT)
+            return retval;
+    }
+    return TSK_WALK_CONT;
+}
+
+
+#ifndef TSK_WIN32
+
+/*
+ * Parallel inode walk.  The entries are processed in windows of
+ * NTFS_PWALK_SLICE entries per thread.  Each worker thread reads its
+ * slice of the window, applies the update sequences and parses the
+ * entries into its own TSK_FS_FILE structures.  Entries that need more
+ * than their own MFT entry (attribute lists), that could not be read or
+ * that failed to parse are left to the calling thread, which does them
+ * the same way as ntfs_inode_walk.  While the callback is called for
+ * one window, the workers are already parsing the next one.
+ *
+ * The workers do not use ntfs->mft, the MFT chunk or the MFT skip map;
+ * the calling thread adds the entries of a window to the map once
+ * the workers of the window are done.
+ */
+
+/* values for NTFS_PWALK_WIN.state */
+#define NTFS_PWALK_TODO     0   /* entry still has to be parsed */
+#define NTFS_PWALK_SKIP     1   /* entry is not wanted (or was returned) */
+#define NTFS_PWALK_DONE     2   /* entry was parsed into files[] */
+#define NTFS_PWALK_SERIAL   3   /* calling thread has to process the entry */
+
+/* values for NTFS_PWALK_WIN.cor */
+#define NTFS_PWALK_RAW_UNREAD   0       /* entry was not read (or fixed up) */
+#define NTFS_PWALK_RAW_OK       1       /* update sequence was applied */
+#define NTFS_PWALK_RAW_COR      2       /* update sequence was corrupt */
+
+typedef struct {
+    TSK_INUM_T addr;            // address of the first entry in the window
+    TSK_INUM_T cnt;             // number of entries in the window
+    char *buf;                  // raw entries
+    uint8_t *raw;               // NTFS_PWALK_RAW_* value of each entry
+    uint8_t *state;             // NTFS_PWALK_* value of each entry
+    TSK_FS_FILE **files;        // parsed entries (ordered walks only)
+} NTFS_PWALK_WIN;
+
+typedef struct NTFS_PWALK NTFS_PWALK;
+
+typedef struct {
+    NTFS_PWALK *pwalk;
+    NTFS_PWALK_WIN *win;        // window the thread is working on
+    TSK_INUM_T first;           // index in the window of the slice
+    TSK_FS_FILE *fs_file;       // file that unordered walks parse into
+    pthread_t thread;
+    uint8_t running;            // set if thread has to be joined
+} NTFS_PWALK_THR;
+
+struct NTFS_PWALK {
+    NTFS_INFO *ntfs;
+    TSK_FS_META_FLAG_ENUM flags;
+    TSK_FS_META_WALK_CB action; // called by the workers (unordered walks only)
+    void *ptr;
+    int thr_cnt;
+    NTFS_PWALK_THR *thr;
+    NTFS_PWALK_WIN win[2];
+
+    tsk_lock_t lock;            // protects the values below
+    uint8_t stop;               // set when the walk has to end early
+    uint8_t failed;             // set if a callback in a worker returned an error
+    uint32_t err_no;            // error of the callback that failed
+    char errstr[TSK_ERRSTR_L];
+    char errstr2[TSK_ERRSTR_L];
+};
+
+
+/*
+ * Returns 1 if an MFT entry has an $ATTRIBUTE_LIST attribute.
+ */
+static uint8_t
+ntfs_mft_has_attrlist(NTFS_INFO * ntfs, ntfs_mft * a_mft)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ntfs;
+    uintptr_t attr, end;
+
+    attr = (uintptr_t) a_mft + tsk_getu16(fs->endian, a_mft->attr_off);
+    end = (uintptr_t) a_mft + ntfs->mft_rsize_b;
+    while (attr + 8 <= end) {
+        ntfs_attr *a = (ntfs_attr *) attr;
+        uint32_t type = tsk_getu32(fs->endian, a->type);
+        uint32_t len = tsk_getu32(fs->endian, a->len);
+
+        if ((type == 0xffffffff) || (len == 0))
+            break;
+        if (type == NTFS_ATYPE_ATTRLIST)
+            return 1;
+        attr += len;
+    }
+    return 0;
+}
+
+
+/*
+ * Return 1 if the walk should stop.
+ */
+static uint8_t
+ntfs_pwalk_stopped(NTFS_PWALK * a_pw)
+{
+    uint8_t stop;
+
+    tsk_take_lock(&a_pw->lock);
+    stop = a_pw->stop;
+    tsk_release_lock(&a_pw->lock);
+    return stop;
+}
+
+
+/*
+ * Record that the walk has to stop, and why if a callback returned an
+ * error in the calling thread.
+ */
+static void
+ntfs_pwalk_set_stop(NTFS_PWALK * a_pw, TSK_WALK_RET_ENUM a_ret)
+{
+    tsk_take_lock(&a_pw->lock);
+    a_pw->stop = 1;
+    if ((a_ret == TSK_WALK_ERROR) && (a_pw->failed == 0)) {
+        a_pw->failed = 1;
+        a_pw->err_no = tsk_errno;
+        strncpy(a_pw->errstr, tsk_errstr, TSK_ERRSTR_L);
+        strncpy(a_pw->errstr2, tsk_errstr2, TSK_ERRSTR_L);
+    }
+    tsk_release_lock(&a_pw->lock);
+}
+
+
+/*
+ * Worker thread: read, fix up and parse one slice of a window.
+ */
+static void *
+ntfs_pwalk_worker(void *a_arg)
+{
+    NTFS_PWALK_THR *thr = (NTFS_PWALK_THR *) a_arg;
+    NTFS_PWALK *pw = thr->pwalk;
+    NTFS_PWALK_WIN *win = thr->win;
+    NTFS_INFO *ntfs = pw->ntfs;
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ntfs;
+    TSK_INUM_T cnt, got, i;
+
+    if (thr->first >= win->cnt)
+        return NULL;
+    cnt = win->cnt - thr->first;
+    if (cnt > NTFS_PWALK_SLICE)
+        cnt = NTFS_PWALK_SLICE;
+
+    got = ntfs_mft_read_bulk(ntfs, win->addr + thr->first, cnt,
+        &win->buf[thr->first * ntfs->mft_rsize_b]);
+
+    for (i = thr->first; i < thr->first + cnt; i++) {
+        ntfs_mft *mft = (ntfs_mft *) & win->buf[i * ntfs->mft_rsize_b];
+        TSK_INUM_T mftnum = win->addr + i;
+        TSK_FS_FILE *fs_file;
+        TSK_RETVAL_ENUM retval;
+        TSK_WALK_RET_ENUM ret;
+        int myflags;
+
+        if (win->state[i] == NTFS_PWALK_SKIP)
+            continue;
+
+        // let the calling thread read it again and report the error
+        if (i - thr->first >= got) {
+            win->state[i] = NTFS_PWALK_SERIAL;
+            continue;
+        }
+        if (ntfs_mft_fixup(ntfs, mft) != TSK_OK) {
+            tsk_error_reset();
+            win->raw[i] = NTFS_PWALK_RAW_COR;
+            win->state[i] = NTFS_PWALK_SERIAL;
+            continue;
+        }
+        win->raw[i] = NTFS_PWALK_RAW_OK;
+
+        /* the same checks as ntfs_inode_walk_one */
+        if (tsk_getu48(fs->endian, mft->base_ref) != NTFS_MFT_BASE) {
+            win->state[i] = NTFS_PWALK_SKIP;
+            continue;
+        }
         myflags =
-            ((tsk_getu16(fs->endian, ntfs->mft->flags) &
+            ((tsk_getu16(fs->endian, mft->flags) &
                 NTFS_MFT_INUSE) ? TSK_FS_META_FLAG_ALLOC :
             TSK_FS_META_FLAG_UNALLOC);
+        if (((pw->flags & myflags) == 0) ||
+            ((myflags & TSK_FS_META_FLAG_UNALLOC) &&
+                (pw->flags & TSK_FS_META_FLAG_ORPHAN) &&
+                (tsk_list_find(fs->list_inum_named, mftnum)))) {
+            win->state[i] = NTFS_PWALK_SKIP;
+            continue;
+        }
 
-        /* If we want only orphans, then check if this
-         * inode is in the seen list
-         * */
-        if ((myflags & TSK_FS_META_FLAG_UNALLOC) &&
-            (flags & TSK_FS_META_FLAG_ORPHAN) &&
-            (tsk_list_find(fs->list_inum_named, mftnum))) {
+        // attribute lists are in other entries
+        if (ntfs_mft_has_attrlist(ntfs, mft)) {
+            win->state[i] = NTFS_PWALK_SERIAL;
             continue;
         }
 
-        /* copy into generic format */
-        if ((retval = ntfs_dinode_copy(ntfs, fs_file)) != TSK_OK) {
-            // continue on if there were only corruption problems
+        if (pw->action)
+            fs_file = thr->fs_file;
+        else
+            fs_file = win->files[i];
+        if (fs_file == NULL) {
+            if (((fs_file = tsk_fs_file_alloc(fs)) == NULL)
+                || ((fs_file->meta =
+                        tsk_fs_meta_alloc(NTFS_FILE_CONTENT_LEN)) ==
+                    NULL)) {
+                tsk_fs_file_close(fs_file);
+                tsk_error_reset();
+                win->state[i] = NTFS_PWALK_SERIAL;
+                continue;
+            }
+            if (pw->action)
+                thr->fs_file = fs_file;
+            else
+                win->files[i] = fs_file;
+        }
+
+        if ((retval =
+                ntfs_dinode_copy(ntfs, fs_file, mft, mftnum)) != TSK_OK) {
             if (retval == TSK_COR) {
                 if (tsk_verbose)
                     tsk_error_print(stderr);
                 tsk_error_reset();
-                continue;
+                win->state[i] = NTFS_PWALK_SKIP;
             }
-            tsk_fs_file_close(fs_file);
-            return 1;
+            else {
+                tsk_error_reset();
+                win->state[i] = NTFS_PWALK_SERIAL;
+            }
+            continue;
         }
 
         myflags |=
             (fs_file->meta->
             flags & (TSK_FS_META_FLAG_USED | TSK_FS_META_FLAG_UNUSED));
-        if ((flags & myflags) != myflags)
+        if ((pw->flags & myflags) != myflags) {
+            win->state[i] = NTFS_PWALK_SKIP;
             continue;
+        }
 
-        /* call action */
-        retval = a_action(fs_file, ptr);
-        if (retval == TSK_WALK_STOP) {
-            tsk_fs_file_close(fs_file);
-            return 0;
+        if (pw->action == NULL) {
+            win->state[i] = NTFS_PWALK_DONE;
+            continue;
         }
-        else if (retval == TSK_WALK_ERROR) {
-            tsk_fs_file_close(fs_file);
-            return 1;
+
+        /* unordered walks return the entry right here */
+        win->state[i] = NTFS_PWALK_SKIP;
+        if (ntfs_pwalk_stopped(pw))
+            break;
+        ret = pw->action(fs_file, pw->ptr);
+        if ((ret == TSK_WALK_STOP) || (ret == TSK_WALK_ERROR)) {
+            ntfs_pwalk_set_stop(pw, ret);
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Set up a window for the entries starting at a_addr and start the
+ * workers on it.  Slices that a thread could not be started for are
+ * done by the calling thread before returning.
+ */
+static void
+ntfs_pwalk_start(NTFS_PWALK * a_pw, NTFS_PWALK_WIN * a_win,
+    TSK_INUM_T a_addr, TSK_INUM_T a_end)
+{
+    TSK_INUM_T i;
+    int t;
+
+    a_win->addr = a_addr;
+    a_win->cnt = (TSK_INUM_T) a_pw->thr_cnt * NTFS_PWALK_SLICE;
+    if (a_win->cnt > a_end - a_addr + 1)
+        a_win->cnt = a_end - a_addr + 1;
+
+    // skip what the MFT skip map already shows is not wanted
+    for (i = 0; i < a_win->cnt; i++) {
+        a_win->raw[i] = NTFS_PWALK_RAW_UNREAD;
+        a_win->state[i] =
+            ntfs_inode_walk_skip(a_pw->ntfs, a_addr + i,
+            a_pw->flags) ? NTFS_PWALK_SKIP : NTFS_PWALK_TODO;
+    }
+
+    for (t = 0; t < a_pw->thr_cnt; t++) {
+        NTFS_PWALK_THR *thr = &a_pw->thr[t];
+
+        thr->win = a_win;
+        thr->first = (TSK_INUM_T) t * NTFS_PWALK_SLICE;
+        thr->running = 0;
+        if (thr->first >= a_win->cnt)
+            continue;
+        if (pthread_create(&thr->thread, NULL, ntfs_pwalk_worker,
+                thr) == 0)
+            thr->running = 1;
+        else
+            ntfs_pwalk_worker(thr);
+    }
+}
+
+
+/*
+ * Wait for the workers of the current window.
+ */
+static void
+ntfs_pwalk_join(NTFS_PWALK * a_pw)
+{
+    int t;
+
+    for (t = 0; t < a_pw->thr_cnt; t++) {
+        if (a_pw->thr[t].running) {
+            pthread_join(a_pw->thr[t].thread, NULL);
+            a_pw->thr[t].running = 0;
+        }
+    }
+}
+
+
+/*
+ * Walk the MFT entries from start_inum to end_inum (which must not be
+ * the orphan directory) with a_threads worker threads.  If
+ * TSK_FS_META_PWALK_FLAG_UNORDERED is set, the workers call a_action
+ * themselves.  Otherwise it is called by this thread in address order.
+ * @returns TSK_WALK_STOP if the callback stopped the walk,
+ * TSK_WALK_ERROR on error and TSK_WALK_CONT otherwise
+ */
+static TSK_WALK_RET_ENUM
+ntfs_inode_walk_range_parallel(NTFS_INFO * ntfs, TSK_FS_FILE * fs_file,
+    TSK_INUM_T start_inum, TSK_INUM_T end_inum,
+    TSK_FS_META_FLAG_ENUM flags, int a_threads,
+    TSK_FS_META_PWALK_FLAG_ENUM a_pflags, TSK_FS_META_WALK_CB a_action,
+    void *ptr)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) ntfs;
+    NTFS_PWALK *pw;
+    NTFS_PWALK_WIN *win;
+    TSK_WALK_RET_ENUM retval = TSK_WALK_CONT;
+    size_t win_cnt;
+    int cur, t, w;
+
+    if (tsk_img_set_concurrent(fs->img_info))
+        return TSK_WALK_ERROR;
+
+    if ((pw = (NTFS_PWALK *) tsk_malloc(sizeof(NTFS_PWALK))) == NULL)
+        return TSK_WALK_ERROR;
+    pw->ntfs = ntfs;
+    pw->flags = flags;
+    pw->ptr = ptr;
+    if (a_pflags & TSK_FS_META_PWALK_FLAG_UNORDERED)
+        pw->action = a_action;
+    pw->thr_cnt = a_threads;
+    tsk_init_lock(&pw->lock);
+
+    win_cnt = (size_t) a_threads * NTFS_PWALK_SLICE;
+    if ((pw->thr =
+            (NTFS_PWALK_THR *) tsk_malloc(a_threads *
+                sizeof(NTFS_PWALK_THR))) == NULL) {
+        retval = TSK_WALK_ERROR;
+        goto done;
+    }
+    for (t = 0; t < a_threads; t++)
+        pw->thr[t].pwalk = pw;
+    for (w = 0; w < 2; w++) {
+        win = &pw->win[w];
+        if (((win->buf =
+                    (char *) tsk_malloc(win_cnt * ntfs->mft_rsize_b)) ==
+                NULL)
+            || ((win->raw = (uint8_t *) tsk_malloc(win_cnt)) == NULL)
+            || ((win->state = (uint8_t *) tsk_malloc(win_cnt)) == NULL)
+            || ((pw->action == NULL)
+                && ((win->files =
+                        (TSK_FS_FILE **) tsk_malloc(win_cnt *
+                            sizeof(TSK_FS_FILE *))) == NULL))) {
+            retval = TSK_WALK_ERROR;
+            goto done;
+        }
+    }
+
+    if (tsk_verbose)
+        tsk_fprintf(stderr,
+            "ntfs_inode_walk_parallel: Walking %" PRIuINUM " to %"
+            PRIuINUM " with %d threads\n", start_inum, end_inum,
+            a_threads);
+
+    cur = 0;
+    ntfs_pwalk_start(pw, &pw->win[cur], start_inum, end_inum);
+    while (1) {
+        TSK_INUM_T i, next;
+
+        win = &pw->win[cur];
+        ntfs_pwalk_join(pw);
+
+        if (pw->failed) {
+            tsk_error_reset();
+            tsk_errno = pw->err_no;
+            strncpy(tsk_errstr, pw->errstr, TSK_ERRSTR_L);
+            strncpy(tsk_errstr2, pw->errstr2, TSK_ERRSTR_L);
+            retval = TSK_WALK_ERROR;
+            break;
+        }
+        else if (pw->stop) {
+            retval = TSK_WALK_STOP;
+            break;
+        }
+
+        if (ntfs->mft_skip) {
+            for (i = 0; i < win->cnt; i++) {
+                if (win->raw[i] != NTFS_PWALK_RAW_UNREAD)
+                    ntfs_mft_skip_add(ntfs, win->addr + i,
+                        (ntfs_mft *) & win->buf[i * ntfs->mft_rsize_b],
+                        (win->raw[i] == NTFS_PWALK_RAW_COR) ? 1 : 0);
+            }
+        }
+
+        // have the workers parse the next window in the meantime
+        next = win->addr + win->cnt;
+        if (next <= end_inum)
+            ntfs_pwalk_start(pw, &pw->win[1 - cur], next, end_inum);
+
+        for (i = 0; i < win->cnt; i++) {
+            if (win->state[i] == NTFS_PWALK_DONE)
+                retval = a_action(win->files[i], ptr);
+            else if (win->state[i] == NTFS_PWALK_SERIAL)
+                retval = ntfs_inode_walk_one(ntfs, fs_file,
+                    win->addr + i, flags, a_action, ptr);
+            else
+                continue;
+
+            if ((retval == TSK_WALK_STOP) || (retval == TSK_WALK_ERROR))
+                break;
+            retval = TSK_WALK_CONT;
+        }
+
+        if (retval != TSK_WALK_CONT) {
+            // keep our error, the workers only see the stop
+            tsk_take_lock(&pw->lock);
+            pw->stop = 1;
+            tsk_release_lock(&pw->lock);
+            ntfs_pwalk_join(pw);
+            break;
         }
+        if (next > end_inum)
+            break;
+        cur = 1 - cur;
+    }
+
+  done:
+    if (pw->thr) {
+        for (t = 0; t < a_threads; t++)
+            tsk_fs_file_close(pw->thr[t].fs_file);
+        free(pw->thr);
+    }
+    for (w = 0; w < 2; w++) {
+        win = &pw->win[w];
+        if (win->files) {
+            size_t i;
+            for (i = 0; i < win_cnt; i++)
+                tsk_fs_file_close(win->files[i]);
+            free(win->files);
+        }
+        free(win->buf);
+        free(win->raw);
+        free(win->state);
+    }
+    tsk_deinit_lock(&pw->lock);
+    free(pw);
+    return retval;
+}
+
+#endif
+
+
+/*
+ * Shared by ntfs_inode_walk and ntfs_inode_walk_parallel.  Uses
+ * a_threads worker threads if it is more than 1.
+ */
+static uint8_t
+ntfs_inode_walk_int(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
+    TSK_INUM_T end_inum, TSK_FS_META_FLAG_ENUM flags, int a_threads,
+    TSK_FS_META_PWALK_FLAG_ENUM a_pflags, TSK_FS_META_WALK_CB a_action,
+    void *ptr)
+{
+    NTFS_INFO *ntfs = (NTFS_INFO *) fs;
+    TSK_FS_FILE *fs_file;
+    TSK_INUM_T end_inum_tmp;
+    TSK_WALK_RET_ENUM retval;
+
+    if (ntfs_inode_walk_setup(fs, start_inum, end_inum, &flags))
+        return 1;
+
+    if ((fs_file = tsk_fs_file_alloc(fs)) == NULL)
+        return 1;
+
+    if ((fs_file->meta = tsk_fs_meta_alloc(NTFS_FILE_CONTENT_LEN)) == NULL) {
+        // JRB: Coverity CID: 348
+        if (fs_file)
+            tsk_fs_file_close(fs_file);
+        return 1;
+    }
+
+    // we need to handle fs->last_inum specially because it is for the
+    // virtual ORPHANS directory.  Handle it outside of the loop.
+    if (end_inum == TSK_FS_ORPHANDIR_INUM(fs))
+        end_inum_tmp = end_inum - 1;
+    else
+        end_inum_tmp = end_inum;
+
+#ifndef TSK_WIN32
+    if ((a_threads > 1) && (ntfs->mft_data != NULL)
+        && (start_inum <= end_inum_tmp))
+        retval =
+            ntfs_inode_walk_range_parallel(ntfs, fs_file, start_inum,
+            end_inum_tmp, flags, a_threads, a_pflags, a_action, ptr);
+    else
+#endif
+        retval =
+            ntfs_inode_walk_range(ntfs, fs_file, start_inum, end_inum_tmp,
+            flags, a_action, ptr);
+
+    if (retval == TSK_WALK_STOP) {
+        tsk_fs_file_close(fs_file);
+        return 0;
+    }
+    else if (retval == TSK_WALK_ERROR) {
+        tsk_fs_file_close(fs_file);
+        return 1;
     }
 
     // handle the virtual orphans folder if they asked for it
@@ -3663,6 +4499,44 @@ ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
 }
 
 
+/*
+ * inode_walk
+ *
+ * Flags: TSK_FS_META_FLAG_ALLOC, TSK_FS_META_FLAG_UNALLOC,
+ * TSK_FS_META_FLAG_USED, TSK_FS_META_FLAG_UNUSED, TSK_FS_META_FLAG_ORPHAN
+ *
+ * Note that with ORPHAN, entries will be found that can also be
+ * found by searching based on parent directories (if parent directory is
+ * known)
+ */
+uint8_t
+ntfs_inode_walk(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
+    TSK_INUM_T end_inum, TSK_FS_META_FLAG_ENUM flags,
+    TSK_FS_META_WALK_CB a_action, void *ptr)
+{
+    return ntfs_inode_walk_int(fs, start_inum, end_inum, flags, 1, 0,
+        a_action, ptr);
+}
+
+
+/*
+ * inode_walk that parses the MFT entries on several threads (see
+ * tsk_fs_meta_walk_parallel()).  Entries with attribute lists are
+ * parsed by the calling thread.  Windows builds walk serially.
+ */
+static uint8_t
+ntfs_inode_walk_parallel(TSK_FS_INFO * fs, TSK_INUM_T start_inum,
+    TSK_INUM_T end_inum, TSK_FS_META_FLAG_ENUM flags, int a_threads,
+    TSK_FS_META_PWALK_FLAG_ENUM a_pflags, TSK_FS_META_WALK_CB a_action,
+    void *ptr)
+{
+    if (a_threads > NTFS_PWALK_THREADS_MAX)
+        a_threads = NTFS_PWALK_THREADS_MAX;
+    return ntfs_inode_walk_int(fs, start_inum, end_inum, flags,
+        a_threads, a_pflags, a_action, ptr);
+}
+
+
 
 static uint8_t
 ntfs_fscheck(TSK_FS_INFO * fs, FILE * hFile)
@@ -4400,6 +5274,10 @@ ntfs_close(TSK_FS_INFO * fs)
     free((char *) ntfs->fs);
     tsk_fs_attr_run_free(ntfs->bmap);
     free(ntfs->bmap_buf);
+    free(ntfs->upcase);
+    free(ntfs->mft_chunk);
+    free(ntfs->mft_chunk_cor);
+    ntfs_mft_skip_free(ntfs);
     tsk_fs_file_close(ntfs->mft_file);
 
     if (fs->list_inum_named) {
@@ -4609,6 +5487,7 @@ ntfs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
      * Set the function pointers (before we start calling internal functions)
      */
     fs->inode_walk = ntfs_inode_walk;
+    fs->inode_walk_parallel = ntfs_inode_walk_parallel;
     fs->block_walk = ntfs_block_walk;
     fs->block_getflags = ntfs_block_getflags;
 
@@ -4617,6 +5496,7 @@ ntfs_open(TSK_IMG_INFO * img_info, TSK_OFF_T offset,
 
     fs->file_add_meta = ntfs_inode_lookup;
     fs->dir_open_meta = ntfs_dir_open_meta;
+    fs->dir_lookup = ntfs_dir_lookup;
     fs->fsstat = ntfs_fsstat;
     fs->fscheck = ntfs_fscheck;
     fs->istat = ntfs_istat;
@@ -1142,6 +1142,260 @@ ntfs_dir_open_meta(TSK_FS_INFO * a_fs, TSK_FS_DIR ** a_fs_dir,
 
 
 
+/****************************************************************************
+ * NAME LOOKUP ROUTINES
+ *
+ */
+
+/* number of entries in the $UpCase table */
+#define NTFS_UPCASE_LEN 65536
+
+/* most index levels that we descend before giving up */
+#define NTFS_IDX_MAX_DEPTH 32
+
+/*
+ * Load the $UpCase table, which defines the order of the names in the
+ * $I30 indexes.  If it cannot be loaded only ASCII letters are folded,
+ * which can make a lookup miss (and the caller scan the directory).
+ */
+static void
+ntfs_load_upcase(NTFS_INFO * ntfs)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & ntfs->fs_info;
+    TSK_FS_FILE *fs_file;
+    ssize_t cnt;
+    int i;
+
+    if (ntfs->upcase_tried)
+        return;
+    ntfs->upcase_tried = 1;
+
+    if ((fs_file = tsk_fs_file_open_meta(fs, NULL, NTFS_MFT_UPCASE)) == NULL) {
+        tsk_error_reset();
+        return;
+    }
+
+    if ((ntfs->upcase =
+            (uint16_t *) tsk_malloc(NTFS_UPCASE_LEN * 2)) == NULL) {
+        tsk_fs_file_close(fs_file);
+        tsk_error_reset();
+        return;
+    }
+
+    cnt = tsk_fs_file_read(fs_file, 0, (char *) ntfs->upcase,
+        NTFS_UPCASE_LEN * 2, (TSK_FS_FILE_READ_FLAG_ENUM) 0);
+    tsk_fs_file_close(fs_file);
+    if (cnt != NTFS_UPCASE_LEN * 2) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr,
+                "ntfs_load_upcase: Error reading $UpCase, folding ASCII only\n");
+        free(ntfs->upcase);
+        ntfs->upcase = NULL;
+        tsk_error_reset();
+        return;
+    }
+
+    for (i = 0; i < NTFS_UPCASE_LEN; i++)
+        ntfs->upcase[i] = tsk_getu16(fs->endian, &ntfs->upcase[i]);
+}
+
+static uint16_t
+ntfs_upcase(NTFS_INFO * ntfs, uint16_t c)
+{
+    if (ntfs->upcase)
+        return ntfs->upcase[c];
+    if ((c >= 'a') && (c <= 'z'))
+        return c - 'a' + 'A';
+    return c;
+}
+
+/*
+ * Compare an upcased name with the name of an index entry, in the
+ * order of the $I30 index.
+ *
+ * @returns < 0, 0 or > 0 if a_name sorts before, equal to, or after
+ */
+static int
+ntfs_idx_name_cmp(NTFS_INFO * ntfs, const uint16_t * a_name, int a_len,
+    ntfs_attr_fname * fname)
+{
+    TSK_FS_INFO *fs = (TSK_FS_INFO *) & ntfs->fs_info;
+    uint8_t *name = (uint8_t *) & fname->name;
+    int i;
+
+    for (i = 0; (i < a_len) && (i < fname->nlen); i++) {
+        uint16_t c = ntfs_upcase(ntfs, tsk_getu16(fs->endian, name + i * 2));
+        if (a_name[i] != c)
+            return (a_name[i] < c) ? -1 : 1;
+    }
+    return a_len - fname->nlen;
+}
+
+
+/** \internal
+ * Find one name in a directory by descending its $I30 B+tree from
+ * $IDX_ROOT through the $IDX_ALLOC records, instead of reading the whole
+ * index as ntfs_dir_open_meta does.  Only allocated entries of the tree
+ * are seen; DOS (8.3) names are not matched, as in ntfs_dir_open_meta.
+ *
+ * @param a_fs File system to analyze
+ * @param a_addr Address of the directory
+ * @param a_name UTF-8 name to find
+ * @param a_fs_name [out] Name that was found
+ * @returns TSK_OK if found, TSK_COR if not found (or the index could not
+ * be used) and TSK_ERR on error
+ */
+TSK_RETVAL_ENUM
+ntfs_dir_lookup(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr, const char *a_name,
+    TSK_FS_NAME * a_fs_name)
+{
+    NTFS_INFO *ntfs = (NTFS_INFO *) a_fs;
+    TSK_FS_FILE *fs_file;
+    const TSK_FS_ATTR *fs_attr_root, *fs_attr_idx;
+    ntfs_idxroot *idxroot;
+    ntfs_idxelist *idxelist;
+    ntfs_idxrec *idxrec = NULL;
+    uintptr_t buf_end;
+    UTF16 name16[NTFS_MAXNAMLEN];
+    UTF16 *ptr16 = name16;
+    const UTF8 *ptr8 = (const UTF8 *) a_name;
+    uint32_t vcn_size;
+    int len, i, depth;
+    TSK_RETVAL_ENUM retval = TSK_COR;
+
+    if ((a_addr < a_fs->first_inum) || (a_addr > a_fs->last_inum)
+        || (a_addr == TSK_FS_ORPHANDIR_INUM(a_fs)))
+        return TSK_COR;
+
+    if (tsk_UTF8toUTF16(&ptr8, (const UTF8 *) (a_name + strlen(a_name)),
+            &ptr16, &name16[NTFS_MAXNAMLEN],
+            TSKstrictConversion) != TSKconversionOK)
+        return TSK_COR;
+    len = (int) (ptr16 - name16);
+
+    ntfs_load_upcase(ntfs);
+    for (i = 0; i < len; i++)
+        name16[i] = ntfs_upcase(ntfs, name16[i]);
+
+    if ((fs_file = tsk_fs_file_open_meta(a_fs, NULL, a_addr)) == NULL) {
+        tsk_error_reset();
+        return TSK_COR;
+    }
+
+    // the entries of a deleted directory are all reported as deleted
+    if ((fs_file->meta->flags & TSK_FS_META_FLAG_UNALLOC)
+        || (fs_file->meta->attr == NULL))
+        goto done;
+
+    fs_attr_root =
+        tsk_fs_attrlist_get(fs_file->meta->attr, NTFS_ATYPE_IDXROOT);
+    if ((fs_attr_root == NULL) || (fs_attr_root->flags & TSK_FS_ATTR_NONRES)) {
+        tsk_error_reset();
+        goto done;
+    }
+    idxroot = (ntfs_idxroot *) fs_attr_root->rd.buf;
+    if (tsk_getu32(a_fs->endian, idxroot->type) != NTFS_ATYPE_FNAME)
+        goto done;
+    idxelist = &idxroot->list;
+    buf_end = (uintptr_t) fs_attr_root->rd.buf + fs_attr_root->rd.buf_size;
+
+    fs_attr_idx =
+        tsk_fs_attrlist_get(fs_file->meta->attr, NTFS_ATYPE_IDXALLOC);
+    if (fs_attr_idx == NULL)
+        tsk_error_reset();
+
+    /* sub-nodes are addressed in clusters, or in 512-byte blocks if the
+     * index records are smaller than a cluster */
+    vcn_size = (ntfs->idx_rsize_b < ntfs->csize_b) ? 512 : ntfs->csize_b;
+
+    for (depth = 0; depth < NTFS_IDX_MAX_DEPTH; depth++) {
+        ntfs_idxentry *idxe;
+        uintptr_t seq_end;
+        uint64_t vcn;
+        ssize_t cnt;
+
+        idxe = (ntfs_idxentry *) ((uintptr_t) idxelist +
+            tsk_getu32(a_fs->endian, idxelist->begin_off));
+        seq_end = (uintptr_t) idxelist +
+            tsk_getu32(a_fs->endian, idxelist->seqend_off);
+        if (seq_end > buf_end)
+            goto done;
+
+        /* find the first entry that does not sort before the name */
+        while (1) {
+            uint16_t idxlen;
+
+            if ((uintptr_t) idxe + sizeof(ntfs_idxentry) > seq_end)
+                goto done;
+            idxlen = tsk_getu16(a_fs->endian, idxe->idxlen);
+            if ((idxlen < sizeof(ntfs_idxentry))
+                || ((uintptr_t) idxe + idxlen > seq_end))
+                goto done;
+
+            if ((idxe->flags & NTFS_IDX_LAST) == 0) {
+                ntfs_attr_fname *fname = (ntfs_attr_fname *) & idxe->stream;
+                int cmp;
+
+                if ((uintptr_t) & fname->name + fname->nlen * 2 >
+                    (uintptr_t) idxe + idxlen)
+                    goto done;
+
+                cmp = ntfs_idx_name_cmp(ntfs, name16, len, fname);
+                if (cmp == 0) {
+                    if ((fname->nspace == NTFS_FNAME_DOS)
+                        || (tsk_getu48(a_fs->endian,
+                                idxe->file_ref) > a_fs->last_inum)
+                        || (ntfs_dent_copy(ntfs, idxe, a_fs_name)))
+                        goto done;
+                    a_fs_name->flags = TSK_FS_NAME_FLAG_ALLOC;
+                    retval = TSK_OK;
+                    goto done;
+                }
+                else if (cmp > 0) {
+                    idxe = (ntfs_idxentry *) ((uintptr_t) idxe + idxlen);
+                    continue;
+                }
+            }
+
+            // the name can only be below this entry
+            if ((idxe->flags & NTFS_IDX_SUB) == 0)
+                goto done;
+            vcn = tsk_getu64(a_fs->endian, (uint8_t *) idxe + idxlen - 8);
+            break;
+        }
+
+        /* read the index record of the sub-node */
+        if ((fs_attr_idx == NULL) || (fs_attr_idx->flags & TSK_FS_ATTR_RES))
+            goto done;
+
+        if ((idxrec == NULL) &&
+            ((idxrec =
+                    (ntfs_idxrec *) tsk_malloc(ntfs->idx_rsize_b)) == NULL)) {
+            retval = TSK_ERR;
+            goto done;
+        }
+
+        cnt = tsk_fs_attr_read(fs_attr_idx, (TSK_OFF_T) (vcn * vcn_size),
+            (char *) idxrec, ntfs->idx_rsize_b, (TSK_FS_FILE_READ_FLAG_ENUM) 0);
+        if ((cnt != (ssize_t) ntfs->idx_rsize_b)
+            || (tsk_getu32(a_fs->endian,
+                    idxrec->magic) != NTFS_IDXREC_MAGIC)
+            || (ntfs_fix_idxrec(ntfs, idxrec, ntfs->idx_rsize_b))) {
+            tsk_error_reset();
+            goto done;
+        }
+        idxelist = &idxrec->list;
+        buf_end = (uintptr_t) idxrec + ntfs->idx_rsize_b;
+    }
+
+  done:
+    free(idxrec);
+    tsk_fs_file_close(fs_file);
+    return retval;
+}
+
+
+
 /****************************************************************************
  * FIND_FILE ROUTINES
  *
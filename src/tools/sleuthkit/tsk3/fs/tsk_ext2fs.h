@@ -80,14 +80,37 @@ extern "C" {
         uint8_t s_algorithm_usage_bitmap[4];    /* u32 */
         uint8_t s_prealloc_blocks;      /* u8 */
         uint8_t s_prealloc_dir_blocks;  /* u8 */
-        uint8_t s_padding1[2];  /* u16 */
+        uint8_t s_reserved_gdt_blocks[2];       /* u16 */
         uint8_t s_journal_uuid[16];     /* u8[16] */
         uint8_t s_journal_inum[4];      /* u32 */
         uint8_t s_journal_dev[4];       /* u32 */
         uint8_t s_last_orphan[4];       /* u32 */
-        uint8_t s_padding[788];
+        uint8_t s_hash_seed[16];        /* u32[4] *//* htree hash seed */
+        uint8_t s_def_hash_version;     /* u8 *//* default htree hash */
+        uint8_t s_jnl_backup_type;      /* u8 */
+        uint8_t s_desc_size[2]; /* u16 */
+        uint8_t s_default_mount_opts[4];        /* u32 */
+        uint8_t s_first_meta_bg[4];     /* u32 */
+        uint8_t s_mkfs_time[4]; /* u32 */
+        uint8_t s_jnl_blocks[17 * 4];   /* u32[17] */
+        uint8_t s_blocks_count_hi[4];   /* u32 */
+        uint8_t s_r_blocks_count_hi[4]; /* u32 */
+        uint8_t s_free_blocks_count_hi[4];      /* u32 */
+        uint8_t s_min_extra_isize[2];   /* u16 */
+        uint8_t s_want_extra_isize[2];  /* u16 */
+        uint8_t s_flags[4];     /* u32 */
+        uint8_t s_raid_stride[2];       /* u16 */
+        uint8_t s_mmp_interval[2];      /* u16 */
+        uint8_t s_mmp_block[8]; /* u64 */
+        uint8_t s_raid_stripe_width[4]; /* u32 */
+        uint8_t s_log_groups_per_flex;  /* u8 *//* flex_bg group size */
+        uint8_t s_padding[651];
     } ext2fs_sb;
 
+/* s_flags */
+#define EXT2FS_FLAGS_SIGNED_HASH	0x0001  /* htree hashes use signed chars */
+#define EXT2FS_FLAGS_UNSIGNED_HASH	0x0002  /* htree hashes use unsigned chars */
+
 /* File system State Values */
 #define EXT2FS_STATE_VALID	0x0001  /* unmounted correctly */
 #define EXT2FS_STATE_ERROR	0x0002  /* errors detected */
@@ -115,10 +138,19 @@ extern "C" {
 #define EXT2FS_FEATURE_INCOMPAT_FILETYPE	0x0002
 #define EXT2FS_FEATURE_INCOMPAT_RECOVER		0x0004
 #define EXT2FS_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008
+#define EXT2FS_FEATURE_INCOMPAT_META_BG		0x0010
+#define EXT2FS_FEATURE_INCOMPAT_EXTENTS		0x0040
+#define EXT2FS_FEATURE_INCOMPAT_64BIT		0x0080
+#define EXT2FS_FEATURE_INCOMPAT_FLEX_BG		0x0200
 
 #define EXT2FS_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT2FS_FEATURE_RO_COMPAT_LARGE_FILE		0x0002
 #define EXT2FS_FEATURE_RO_COMPAT_BTREE_DIR		0x0004
+#define EXT2FS_FEATURE_RO_COMPAT_HUGE_FILE		0x0008
+#define EXT2FS_FEATURE_RO_COMPAT_GDT_CSUM		0x0010
+#define EXT2FS_FEATURE_RO_COMPAT_DIR_NLINK		0x0020
+#define EXT2FS_FEATURE_RO_COMPAT_EXTRA_ISIZE	0x0040
+#define EXT2FS_FEATURE_RO_COMPAT_METADATA_CSUM	0x0400
 
 
 
@@ -135,6 +167,31 @@ extern "C" {
         uint8_t f1[14];
     } ext2fs_gd;
 
+/*
+ * Ext4 64-bit Group Descriptor (used if INCOMPAT_64BIT is set and
+ * s_desc_size is at least this big).  The first 32 bytes are the same
+ * as ext2fs_gd.
+ */
+    typedef struct {
+        uint8_t bg_block_bitmap_lo[4];  /* u32 */
+        uint8_t bg_inode_bitmap_lo[4];  /* u32 */
+        uint8_t bg_inode_table_lo[4];   /* u32 */
+        uint8_t bg_free_blocks_count_lo[2];     /* u16 */
+        uint8_t bg_free_inodes_count_lo[2];     /* u16 */
+        uint8_t bg_used_dirs_count_lo[2];       /* u16 */
+        uint8_t bg_flags[2];    /* u16 */
+        uint8_t f1[12];
+        uint8_t bg_block_bitmap_hi[4];  /* u32 */
+        uint8_t bg_inode_bitmap_hi[4];  /* u32 */
+        uint8_t bg_inode_table_hi[4];   /* u32 */
+        uint8_t bg_free_blocks_count_hi[2];     /* u16 */
+        uint8_t bg_free_inodes_count_hi[2];     /* u16 */
+        uint8_t bg_used_dirs_count_hi[2];       /* u16 */
+        uint8_t f2[14];
+    } ext4fs_gd;
+
+#define EXT4FS_GD_64_SIZE	64
+
 
 /* data address to group number */
 #define ext2_dtog_lcl(fsi, fs, d)	\
@@ -209,6 +266,41 @@ extern "C" {
 #define EXT2_IN_APPEND 		0x00000020      /* writes to file may only append */
 #define EXT2_IN_NODUMP 		0x00000040      /* do not dump file */
 #define EXT2_IN_NOA		 	0x00000080      /* do not update atime */
+#define EXT2_IN_INDEX		0x00001000      /* hash-indexed directory */
+#define EXT2_IN_HUGE_FILE	0x00040000      /* i_nblk is in fs blocks */
+#define EXT2_IN_EXTENTS		0x00080000      /* i_block holds an extent tree */
+
+
+/*
+ * Ext4 extent tree.  i_block of an inode with EXT2_IN_EXTENTS holds a
+ * header and up to four entries.  Entries in nodes with depth > 0 are
+ * index entries pointing at the next level; depth 0 nodes hold extents.
+ */
+    typedef struct {
+        uint8_t eh_magic[2];    /* u16 */
+        uint8_t eh_entries[2];  /* u16 *//* entries in use */
+        uint8_t eh_max[2];      /* u16 *//* capacity of the node */
+        uint8_t eh_depth[2];    /* u16 *//* 0 for leaf nodes */
+        uint8_t eh_generation[4];       /* u32 */
+    } ext4fs_extent_header;
+
+    typedef struct {
+        uint8_t ee_block[4];    /* u32 *//* first logical block */
+        uint8_t ee_len[2];      /* u16 *//* > EXT4FS_EXT_INIT_MAX_LEN if uninit */
+        uint8_t ee_start_hi[2]; /* u16 */
+        uint8_t ee_start_lo[4]; /* u32 */
+    } ext4fs_extent;
+
+    typedef struct {
+        uint8_t ei_block[4];    /* u32 *//* first logical block covered */
+        uint8_t ei_leaf_lo[4];  /* u32 *//* block of next level node */
+        uint8_t ei_leaf_hi[2];  /* u16 */
+        uint8_t ei_unused[2];
+    } ext4fs_extent_idx;
+
+#define EXT4FS_EXT_MAGIC	0xf30a
+#define EXT4FS_EXT_INIT_MAX_LEN	32768
+#define EXT4FS_EXT_MAX_DEPTH	5
 
 
 
@@ -235,6 +327,43 @@ extern "C" {
     ((len + 8 + 3) & ~(3))
 
 
+/*
+ * Hashed (htree) directories.  The first block of the directory holds
+ * the "." and ".." entries followed by the root of the index, the other
+ * index blocks start with an empty entry that covers the block.
+ */
+    typedef struct {
+        uint8_t reserved_zero[4];       /* u32 */
+        uint8_t hash_version;   /* u8 */
+        uint8_t info_length;    /* u8 *//* 8 */
+        uint8_t indirect_levels;        /* u8 */
+        uint8_t unused_flags;   /* u8 */
+    } ext2fs_dx_root_info;
+
+/* the first entry of an index block holds limit and count instead */
+    typedef struct {
+        uint8_t hash[4];        /* u32 */
+        uint8_t block[4];       /* u32 *//* logical block in the dir */
+    } ext2fs_dx_entry;
+
+    typedef struct {
+        uint8_t limit[2];       /* u16 */
+        uint8_t count[2];       /* u16 */
+    } ext2fs_dx_countlimit;
+
+/* offset of the root info and of the entries of the other index blocks */
+#define EXT2FS_DX_ROOT_INFO_OFF	24
+#define EXT2FS_DX_NODE_OFF	8
+
+/* hash versions */
+#define EXT2FS_DX_HASH_LEGACY	0
+#define EXT2FS_DX_HASH_HALF_MD4	1
+#define EXT2FS_DX_HASH_TEA	2
+#define EXT2FS_DX_HASH_LEGACY_UNSIGNED	3
+#define EXT2FS_DX_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2FS_DX_HASH_TEA_UNSIGNED	5
+
+
 /* Ext2 directory file types  */
 #define EXT2_DE_UNKNOWN         0
 #define EXT2_DE_REG        1
@@ -402,6 +531,22 @@ extern "C" {
 
 
 
+/* Number of bitmap blocks of each type that are cached */
+#define EXT2FS_MAP_CACHE_LEN    16
+
+/* Largest run of inode table entries that is read at once */
+#define EXT2FS_ITBL_BATCH_MAX   (4 * 1024 * 1024)
+
+    /*
+     * LRU cache of bitmap blocks (one per group).
+     */
+    typedef struct {
+        uint8_t *buf[EXT2FS_MAP_CACHE_LEN];     /* bitmap blocks (NULL if unused) */
+        EXT2_GRPNUM_T grp_num[EXT2FS_MAP_CACHE_LEN];    /* group of each bitmap */
+        uint32_t used[EXT2FS_MAP_CACHE_LEN];    /* time of last use */
+        uint32_t clock;         /* use counter */
+    } EXT2FS_MAP_CACHE;
+
     /*
      * Structure of an ext2fs file system handle.
      */
@@ -409,19 +554,33 @@ extern "C" {
         TSK_FS_INFO fs_info;    /* super class */
         ext2fs_sb *fs;          /* super block */
 
-        ext2fs_gd *grp_buf;     /* cached group descriptor */
-        EXT2_GRPNUM_T grp_num;  /* cached group number */
+        uint8_t *gd_buf;        /* cached group descriptor table */
+        EXT2_GRPNUM_T gd_count; /* nr of descriptors read into gd_buf */
 
-        uint8_t *bmap_buf;      /* cached block allocation bitmap */
-        EXT2_GRPNUM_T bmap_grp_num;     /* cached block bitmap nr */
+        ext2fs_gd *grp_buf;     /* current group descriptor (points into gd_buf) */
+        EXT2_GRPNUM_T grp_num;  /* current group number */
 
-        uint8_t *imap_buf;      /* cached inode allocation bitmap */
-        EXT2_GRPNUM_T imap_grp_num;     /* cached inode bitmap nr */
+        uint8_t *bmap_buf;      /* current block allocation bitmap (points into bmap_cache) */
+        EXT2_GRPNUM_T bmap_grp_num;     /* current block bitmap nr */
+        EXT2FS_MAP_CACHE bmap_cache;    /* recently used block bitmaps */
+
+        uint8_t *imap_buf;      /* current inode allocation bitmap (points into imap_cache) */
+        EXT2_GRPNUM_T imap_grp_num;     /* current inode bitmap nr */
+        EXT2FS_MAP_CACHE imap_cache;    /* recently used inode bitmaps */
 
         ext2fs_inode *dino_buf; /* cached disk inode */
         TSK_INUM_T dino_inum;   /* cached inode number */
 
+        const uint8_t *itbl;    /* cached run of inode table entries (itbl_buf or the image mapping) */
+        uint8_t *itbl_buf;      /* buffer for itbl when the image is not mapped */
+        size_t itbl_len;        /* allocated size of itbl_buf */
+        TSK_INUM_T itbl_inum;   /* first inode in itbl_buf */
+        TSK_INUM_T itbl_count;  /* nr of inodes in itbl_buf */
+
+        EXT2_GRPNUM_T flex_size;        /* groups per flex_bg group (0 if not used) */
+
         TSK_OFF_T groups_offset;        /* offset to first group desc */
+        uint16_t gd_size;       /* size of each group descriptor */
         EXT2_GRPNUM_T groups_count;     /* nr of descriptor group blocks */
         uint8_t deentry_type;   /* v1 or v2 of dentry */
         uint16_t inode_size;    /* size of each inode */
@@ -434,6 +593,9 @@ extern "C" {
     extern TSK_RETVAL_ENUM
         ext2fs_dir_open_meta(TSK_FS_INFO * a_fs, TSK_FS_DIR ** a_fs_dir,
         TSK_INUM_T a_addr);
+    extern TSK_RETVAL_ENUM
+        ext2fs_dir_lookup(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr,
+        const char *a_name, TSK_FS_NAME * a_fs_name);
     extern uint8_t ext2fs_jentry_walk(TSK_FS_INFO *, int,
         TSK_FS_JENTRY_WALK_CB, void *);
     extern uint8_t ext2fs_jblk_walk(TSK_FS_INFO *, TSK_DADDR_T,
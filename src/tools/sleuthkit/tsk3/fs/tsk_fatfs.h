@@ -58,6 +58,10 @@ extern "C" {
 #define FAT_CACHE_B		4096
 #define FAT_CACHE_S		8       // number of sectors in cache
 
+/* Largest FAT (in bytes of decoded entries) that is kept in memory as a
+ * whole.  Larger FATs are read through the cache above. */
+#define FATFS_FAT_TABLE_MAX	(64 * 1024 * 1024)
+
 /* MASK values for FAT entries */
 #define FATFS_12_MASK	0x00000fff
 #define FATFS_16_MASK	0x0000ffff
@@ -306,6 +310,9 @@ extern "C" {
         TSK_DADDR_T fatc_addr[FAT_CACHE_N];
         uint8_t fatc_ttl[FAT_CACHE_N];  // ttl of 0 means is not in use
 
+        /* whole FAT, decoded and indexed by cluster (NULL if not loaded) */
+        uint32_t *fat_table;
+
 
         char *dinodes;          /* cluster size buffer of inode list */
         fatfs_sb *sb;
@@ -372,6 +379,10 @@ extern "C" {
 
     extern uint8_t fatfs_getFAT(FATFS_INFO * fatfs, TSK_DADDR_T clust,
         TSK_DADDR_T * value);
+    extern TSK_DADDR_T fatfs_fat_scan(FATFS_INFO * fatfs,
+        TSK_DADDR_T a_start, TSK_DADDR_T a_end, uint8_t a_free);
+    extern TSK_DADDR_T fatfs_fat_contig(FATFS_INFO * fatfs,
+        TSK_DADDR_T a_clust, TSK_DADDR_T a_max);
 
     extern TSK_RETVAL_ENUM
         fatfs_dir_open_meta(TSK_FS_INFO * a_fs, TSK_FS_DIR ** a_fs_dir,
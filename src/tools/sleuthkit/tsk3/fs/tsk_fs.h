@@ -350,6 +350,15 @@ extern "C" {
     };
     typedef enum TSK_FS_META_ATTR_FLAG_ENUM TSK_FS_META_ATTR_FLAG_ENUM;
 
+    /**
+     * Describes how the file system specific data in TSK_FS_META::content_ptr is laid out
+     */
+    enum TSK_FS_META_CONTENT_TYPE_ENUM {
+        TSK_FS_META_CONTENT_TYPE_DEFAULT = 0x0, ///< Default layout for the file system (block pointers etc.)
+        TSK_FS_META_CONTENT_TYPE_EXT4_EXTENTS = 0x1,    ///< Raw Ext4 extent tree root copied from the inode
+    };
+    typedef enum TSK_FS_META_CONTENT_TYPE_ENUM TSK_FS_META_CONTENT_TYPE_ENUM;
+
 
     /**
      * Values for the mode field -- which identifies the file type 
@@ -443,6 +452,7 @@ extern "C" {
 
         void *content_ptr;      ///< Pointer to file system specific data that is used to store references to file content
         size_t content_len;     ///< size of content  buffer
+        TSK_FS_META_CONTENT_TYPE_ENUM content_type;     ///< Layout of the data in content_ptr
 
         uint32_t seq;           ///< Sequence number for file (NTFS only, is incremented when entry is reallocated) 
 
@@ -479,6 +489,20 @@ extern "C" {
         TSK_INUM_T a_end, TSK_FS_META_FLAG_ENUM a_flags,
         TSK_FS_META_WALK_CB a_cb, void *a_ptr);
 
+    /**
+     * Flags that are used with tsk_fs_meta_walk_parallel().
+     */
+    typedef enum {
+        TSK_FS_META_PWALK_FLAG_NONE = 0x00,     ///< Call the callback from the calling thread in address order
+        TSK_FS_META_PWALK_FLAG_UNORDERED = 0x01,        ///< Call the callback from the worker threads as soon as an entry is parsed, in no particular order (the callback must be thread-safe)
+    } TSK_FS_META_PWALK_FLAG_ENUM;
+
+    extern uint8_t tsk_fs_meta_walk_parallel(TSK_FS_INFO * a_fs,
+        TSK_INUM_T a_start, TSK_INUM_T a_end,
+        TSK_FS_META_FLAG_ENUM a_flags, int a_threads,
+        TSK_FS_META_PWALK_FLAG_ENUM a_pflags, TSK_FS_META_WALK_CB a_cb,
+        void *a_ptr);
+
     extern uint8_t tsk_fs_meta_make_ls(TSK_FS_META * a_fs_meta,
         char *a_buf, size_t a_len);
 
@@ -582,6 +606,7 @@ extern "C" {
         TSK_FS_DIR_WALK_FLAG_UNALLOC = 0x02,    ///< Return unallocated names in callback
         TSK_FS_DIR_WALK_FLAG_RECURSE = 0x04,    ///< Recurse into sub-directories 
         TSK_FS_DIR_WALK_FLAG_NOORPHAN = 0x08,   ///< Do not return (or recurse into) the special Orphan directory
+        TSK_FS_DIR_WALK_FLAG_NAMEONLY = 0x10,   ///< Do not load the metadata of files before the callback (it can call tsk_fs_file_load_meta())
     } TSK_FS_DIR_WALK_FLAG_ENUM;
 
 
@@ -594,11 +619,36 @@ extern "C" {
         void *a_ptr);
     extern size_t tsk_fs_dir_getsize(const TSK_FS_DIR *);
     extern TSK_FS_FILE *tsk_fs_dir_get(const TSK_FS_DIR *, size_t);
+    extern const TSK_FS_NAME *tsk_fs_dir_get_name(const TSK_FS_DIR *,
+        size_t);
     extern void tsk_fs_dir_close(TSK_FS_DIR *);
 
     extern int8_t tsk_fs_path2inum(TSK_FS_INFO * a_fs, const char *a_path,
         TSK_INUM_T * a_result, TSK_FS_NAME * a_fs_name);
 
+#define TSK_FS_DIR_CACHE_DEFAULT_SIZE  (4 * 1024 * 1024)       ///< Default directory cache budget in bytes
+
+    typedef struct TSK_FS_DIR_CACHE TSK_FS_DIR_CACHE;
+
+    /**
+     * Directory cache counters, filled in by tsk_fs_dir_cache_stats().
+     */
+    typedef struct {
+        size_t size;            ///< Memory budget of the cache in bytes (0 if disabled)
+        size_t used;            ///< Bytes currently used by cached directories and names
+        uint64_t dir_hits;      ///< Number of directories opened from the cache
+        uint64_t dir_misses;    ///< Number of directories parsed from the file system
+        uint64_t name_hits;     ///< Number of path lookups answered with a name from the cache
+        uint64_t name_neg_hits; ///< Number of path lookups answered with a cached "not found"
+        uint64_t name_misses;   ///< Number of path lookups that searched the directory
+        uint64_t evictions;     ///< Number of directories and names replaced to make room
+    } TSK_FS_DIR_CACHE_STATS;
+
+    extern uint8_t tsk_fs_dir_cache_set_size(TSK_FS_INFO * a_fs,
+        size_t a_size);
+    extern void tsk_fs_dir_cache_stats(TSK_FS_INFO * a_fs,
+        TSK_FS_DIR_CACHE_STATS * a_stats);
+
     //@}
 
     /********************* FILE Structure *************************/
@@ -618,7 +668,7 @@ extern "C" {
         int tag;                ///< \internal Will be set to TSK_FS_FILE_TAG if structure is allocated
 
         TSK_FS_NAME *name;      ///< Pointer to name of file (or NULL if file was opened using metadata address)
-        TSK_FS_META *meta;      ///< Pointer to metadata of file (or NULL if name has invalid metadata address)
+        TSK_FS_META *meta;      ///< Pointer to metadata of file (or NULL if name has invalid metadata address or it was not loaded yet, see tsk_fs_file_load_meta())
 
         TSK_FS_INFO *fs_info;   ///< Pointer to file system that the file is located in.
     };
@@ -635,6 +685,7 @@ extern "C" {
         TSK_FS_FILE * a_fs_file, const char *a_path);
     extern TSK_FS_FILE *tsk_fs_file_open_meta(TSK_FS_INFO * fs,
         TSK_FS_FILE * fs_file, TSK_INUM_T addr);
+    extern uint8_t tsk_fs_file_load_meta(TSK_FS_FILE * a_fs_file);
     extern ssize_t
         tsk_fs_file_read(TSK_FS_FILE *, TSK_OFF_T, char *, size_t,
         TSK_FS_FILE_READ_FLAG_ENUM);
@@ -833,12 +884,16 @@ extern "C" {
         TSK_FS_DIR *orphan_dir;         ///< Files and dirs in the top level of the $OrphanFiles directory.  NULL if orphans have not been hunted for yet. 
         uint8_t isOrphanHunting;        ///< Set to 1 if TSK is currently looking for Orphan files
 
+        TSK_FS_DIR_CACHE *dir_cache;    ///< \internal Parsed directories and path lookup results, created on the first tsk_fs_dir_open_meta()
+
          uint8_t(*block_walk) (TSK_FS_INFO * fs, TSK_DADDR_T start, TSK_DADDR_T end, TSK_FS_BLOCK_WALK_FLAG_ENUM flags, TSK_FS_BLOCK_WALK_CB cb, void *ptr);    ///< FS-specific function: Call tsk_fs_block_walk() instead. 
 
          TSK_FS_BLOCK_FLAG_ENUM(*block_getflags) (TSK_FS_INFO * a_fs, TSK_DADDR_T a_addr);      ///< \internal
 
          uint8_t(*inode_walk) (TSK_FS_INFO * fs, TSK_INUM_T start, TSK_INUM_T end, TSK_FS_META_FLAG_ENUM flags, TSK_FS_META_WALK_CB cb, void *ptr);     ///< FS-specific function: Call tsk_fs_meta_walk() instead. 
 
+         uint8_t(*inode_walk_parallel) (TSK_FS_INFO * fs, TSK_INUM_T start, TSK_INUM_T end, TSK_FS_META_FLAG_ENUM flags, int threads, TSK_FS_META_PWALK_FLAG_ENUM pflags, TSK_FS_META_WALK_CB cb, void *ptr);   ///< \internal Call tsk_fs_meta_walk_parallel() instead.  Can be NULL.
+
          uint8_t(*file_add_meta) (TSK_FS_INFO * fs, TSK_FS_FILE * fs_file, TSK_INUM_T addr);    ///< \internal
 
          TSK_FS_ATTR_TYPE_ENUM(*get_default_attr_type) (const TSK_FS_FILE *);   ///< \internal
@@ -860,7 +915,9 @@ extern "C" {
          uint8_t(*istat) (TSK_FS_INFO * fs, FILE * hFile, TSK_INUM_T inum,
             TSK_DADDR_T numblock, int32_t sec_skew);
 
-         TSK_RETVAL_ENUM(*dir_open_meta) (TSK_FS_INFO * fs, TSK_FS_DIR ** a_fs_dir, TSK_INUM_T inode);  ///< \internal Call tsk_fs_dir_open_meta() instead. 
+         TSK_RETVAL_ENUM(*dir_open_meta) (TSK_FS_INFO * fs, TSK_FS_DIR ** a_fs_dir, TSK_INUM_T inode);  ///< \internal Call tsk_fs_dir_open_meta() instead.
+
+         TSK_RETVAL_ENUM(*dir_lookup) (TSK_FS_INFO * fs, TSK_INUM_T a_dir, const char *a_name, TSK_FS_NAME * a_fs_name);        ///< \internal Find one allocated name through the directory index (TSK_OK if found, TSK_COR if the index cannot tell).  Can be NULL.
 
          uint8_t(*jopen) (TSK_FS_INFO *, TSK_INUM_T);   ///< \internal
 
@@ -896,6 +953,8 @@ extern "C" {
         char *a_buf, size_t a_len);
     extern ssize_t tsk_fs_read_block(TSK_FS_INFO * a_fs,
         TSK_DADDR_T a_addr, char *a_buf, size_t a_len);
+    extern const char *tsk_fs_borrow(TSK_FS_INFO * a_fs, TSK_OFF_T a_off,
+        size_t a_len);
 
     //@}
 
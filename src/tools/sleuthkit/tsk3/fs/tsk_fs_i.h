@@ -143,6 +143,14 @@ extern "C" {
         const TSK_FS_NAME * a_fs_dent);
     extern void tsk_fs_dir_reset(TSK_FS_DIR * a_fs_dir);
 
+    /* Directory cache */
+    extern int8_t tsk_fs_dir_cache_name_get(TSK_FS_INFO * a_fs,
+        TSK_INUM_T a_dir, const char *a_name, TSK_FS_NAME * a_fs_name);
+    extern void tsk_fs_dir_cache_name_add(TSK_FS_INFO * a_fs,
+        TSK_INUM_T a_dir, const char *a_name,
+        const TSK_FS_NAME * a_fs_name);
+    extern void tsk_fs_dir_cache_free(TSK_FS_INFO * a_fs);
+
     /* Orphan Directory Support */
     TSK_RETVAL_ENUM tsk_fs_dir_load_inum_named(TSK_FS_INFO * a_fs);
     extern uint8_t tsk_fs_dir_make_orphan_dir_meta(TSK_FS_INFO * a_fs,
@@ -503,6 +503,14 @@ typedef struct {
 } hfs_thread;
 
 
+// number of bytes of catalog B-tree nodes that are cached in HFS_INFO
+#define HFS_CAT_CACHE_BUDGET    (4 * 1024 * 1024)
+// number of slots that a node can be cached in (nodes are LRU within them)
+#define HFS_CAT_CACHE_WAYS      8
+
+// number of folder thread records that are cached in HFS_INFO
+#define HFS_THREAD_CACHE_LEN    256
+
 // internally used structure to pass around both files and folders
 typedef union {
     hfs_folder folder;
@@ -526,6 +534,15 @@ typedef struct {
     const TSK_FS_ATTR *catalog_attr;
     hfs_btree_header_record catalog_header;
 
+    char *cat_cache_buf;        ///< Cached catalog nodes (cat_cache_len nodes, loaded on first use)
+    uint32_t *cat_cache_node;   ///< Node number held in each slot of cat_cache_buf
+    uint64_t *cat_cache_used;   ///< Time of last use of each slot (0 if slot is empty)
+    uint32_t cat_cache_len;     ///< Number of slots in cat_cache_buf (a multiple of HFS_CAT_CACHE_WAYS)
+    uint64_t cat_cache_clock;   ///< Counter used to find the least recently used slot
+
+    hfs_thread *thread_cache;   ///< Folder thread records, indexed by cnid modulo HFS_THREAD_CACHE_LEN
+    uint32_t *thread_cache_cnid;        ///< Cnid of the record in each slot of thread_cache (0 if empty)
+
     TSK_FS_FILE *extents_file;
     const TSK_FS_ATTR *extents_attr;
     hfs_btree_header_record extents_header;
@@ -565,6 +582,8 @@ extern uint16_t hfs_get_idxkeylen(HFS_INFO * hfs, uint16_t keylen,
 
 extern TSK_RETVAL_ENUM hfs_dir_open_meta(TSK_FS_INFO *, TSK_FS_DIR **,
     TSK_INUM_T);
+extern TSK_RETVAL_ENUM hfs_dir_lookup(TSK_FS_INFO *, TSK_INUM_T,
+    const char *, TSK_FS_NAME *);
 extern int hfs_name_cmp(TSK_FS_INFO *, const char *, const char *);
 
 extern uint8_t hfs_jopen(TSK_FS_INFO *, TSK_INUM_T);
@@ -586,6 +605,12 @@ typedef uint8_t(*TSK_HFS_BTREE_CB) (HFS_INFO *, int8_t level_type,
 
 extern uint8_t hfs_cat_traverse(HFS_INFO * hfs, const void *targ_data,
     TSK_HFS_BTREE_CB a_cb, void *ptr);
+extern int hfs_cat_compare_keys(HFS_INFO * hfs,
+    const hfs_btree_key_cat * key1, const hfs_btree_key_cat * key2);
+extern TSK_OFF_T hfs_cat_get_record_offset(HFS_INFO * hfs,
+    const hfs_btree_key_cat * needle, hfs_btree_key_cat * a_key);
+extern uint8_t hfs_cat_read_file_folder_record(HFS_INFO * hfs,
+    TSK_OFF_T off, hfs_file_folder * record);
 
 
 #endif
@@ -612,6 +612,37 @@ extern "C" {
         TSK_INUM_T *addrs;      // array for address of unallocated files in this dir
     };
 
+/* Number of bytes of MFT entries that ntfs_inode_walk reads at once */
+#define NTFS_MFT_CHUNK_B    (1024 * 1024)
+
+/* Largest MFT skip map that ntfs_inode_walk builds (in bytes).  It
+ * has one byte per MFT entry, so this covers an MFT of 16M entries. */
+#define NTFS_MFT_SKIP_MAX_B (16 * 1024 * 1024)
+
+/* Number of MFT entries that each thread of ntfs_inode_walk_parallel
+ * reads and parses at a time */
+#define NTFS_PWALK_SLICE    256
+
+/* Most threads that ntfs_inode_walk_parallel starts */
+#define NTFS_PWALK_THREADS_MAX  64
+
+/* values for the bytes of NTFS_MFT_SKIP.flags */
+#define NTFS_MFT_SKIP_SEEN  0x01        /* entry has been read */
+#define NTFS_MFT_SKIP_COR   0x02        /* update sequence was corrupt */
+#define NTFS_MFT_SKIP_BASE  0x04        /* base file record */
+#define NTFS_MFT_SKIP_INUSE 0x08        /* NTFS_MFT_INUSE was set */
+
+    /* Flags of each MFT entry that are filled in as ntfs_inode_walk reads
+     * the MFT, so that later walks can skip extension records and the
+     * entries with an allocation state that they do not want without
+     * reading them again.  The entries that are not skipped are still
+     * read and parsed from disk. */
+    typedef struct {
+        uint8_t *flags;         // NTFS_MFT_SKIP_* flags of each MFT entry
+        TSK_INUM_T seen_cnt;    // number of entries read so far
+        size_t mem;             // bytes allocated for the map
+    } NTFS_MFT_SKIP;
+
 
 /************************************************************************
 */
@@ -637,6 +668,14 @@ extern "C" {
         ntfs_attrdef *attrdef;  // buffer of attrdef file contents
         size_t attrdef_len;     // length of addrdef buffer
         NTFS_PAR_MAP *orphan_map;       // map that lists par directory to its orphans.
+        uint16_t *upcase;       // $UpCase table in host order (loaded by ntfs_dir_lookup)
+        uint8_t upcase_tried;   // set to 1 once we tried to load upcase
+        char *mft_chunk;        // MFT entries read in bulk, with update sequences applied
+        uint8_t *mft_chunk_cor; // set for entries in mft_chunk whose update sequence failed
+        TSK_INUM_T mft_chunk_addr;      // address of first entry in mft_chunk
+        TSK_INUM_T mft_chunk_cnt;       // number of entries in mft_chunk
+        NTFS_MFT_SKIP *mft_skip;        // MFT skip map (NULL if not being built)
+        uint8_t mft_skip_off;   // set once the MFT skip map went over its budget
 
 #if TSK_USE_SID
         NTFS_SXX_BUFFER sii_data;
@@ -651,6 +690,9 @@ extern "C" {
     extern TSK_RETVAL_ENUM
         ntfs_dir_open_meta(TSK_FS_INFO * a_fs, TSK_FS_DIR ** a_fs_dir,
         TSK_INUM_T a_addr);
+    extern TSK_RETVAL_ENUM
+        ntfs_dir_lookup(TSK_FS_INFO * a_fs, TSK_INUM_T a_addr,
+        const char *a_name, TSK_FS_NAME * a_fs_name);
 
     extern void ntfs_orphan_map_free(NTFS_INFO * a_ntfs);
 
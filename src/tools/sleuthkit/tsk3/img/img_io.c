@@ -7,11 +7,933 @@
 
 /**
  * \file img_io.c
- * Contains the basic img reading API redirection functions.
+ * Contains the basic img reading API redirection functions and the
+ * image read cache.
  */
 
 #include "tsk_img_i.h"
 
+#ifndef TSK_WIN32
+#include <sys/mman.h>
+#endif
+
+/* The read cache holds TSK_IMG_CACHE_BLOCK_LEN sized blocks that start
+ * at multiples of the block length.  Blocks are found through a hash
+ * table with chaining and replaced with the CLOCK algorithm, which
+ * approximates LRU without touching a list on every hit.  Misses that
+ * continue a sequential stream read a growing window of blocks with one
+ * request to the image backend.
+ *
+ * Larger caches are split into shards by block number.  Every shard has
+ * its own entries, hash table, CLOCK hand and lock, so that threads that
+ * read through the same image (see tsk_img_set_concurrent()) only wait
+ * for each other when they hit the same shard at the same time.  Locks
+ * are only taken once the image was made concurrent.  The backend is
+ * read without holding any cache lock.
+ *
+ * The same structure keeps the state of asynchronous reads: completions
+ * that were not returned yet and, for backends that cannot read
+ * asynchronously, the requests that are read as one batch when the
+ * caller polls. */
+
+#define IMG_CACHE_SHARD_MAX     8       // most shards a cache is split into
+#define IMG_CACHE_SHARD_MIN     32      // fewest entries a shard is left with
+
+typedef struct {
+    TSK_OFF_T off;              // offset of the block in the image (-1 if unused)
+    size_t len;                 // number of valid bytes in data
+    int next;                   // next entry in the hash chain (-1 at end)
+    uint8_t ref;                // CLOCK reference bit
+    char *data;                 // block data (allocated on first use)
+} TSK_IMG_CACHE_ENT;
+
+typedef struct {
+    tsk_lock_t lock;
+    int ent_num;                // number of entries in the shard
+    int ent_used;               // number of entries handed out so far
+    int hand;                   // CLOCK hand
+    TSK_IMG_CACHE_ENT *ent;
+    int *hash;                  // index of first entry in each chain (-1 if empty)
+    uint32_t hash_mask;
+    size_t used;
+    uint64_t hits;
+    uint64_t evictions;
+    uint64_t readahead;
+} TSK_IMG_CACHE_SHARD;
+
+struct TSK_IMG_CACHE {
+    size_t size;                // memory budget in bytes
+    int ent_num;                // number of entries the budget allows
+    uint8_t concurrent;         // set by tsk_img_set_concurrent()
+    int shard_num;              // number of shards (a power of 2)
+    TSK_IMG_CACHE_SHARD *shard;
+
+    tsk_lock_t ra_lock;         // protects the miss counter and readahead state
+    uint64_t misses;
+    size_t ra_size;             // readahead limit in bytes (0 disables it)
+    int ra_win;                 // current readahead window in blocks
+    TSK_OFF_T ra_next;          // offset where the last read from the image ended
+    char *ra_buf;               // buffer for reads from the image (single thread only)
+    size_t ra_buf_len;
+
+    tsk_lock_t io_lock;         // serializes formats that cannot read concurrently
+
+    // asynchronous reads (see tsk_img_aio_submit())
+    tsk_lock_t aio_lock;        // held by the thread that uses them
+    uint8_t aio_claimed;        // aio_lock is held (see tsk_img_aio_claim())
+    TSK_IMG_READ_REQ *aio_req;  // requests queued for a batch read
+    void **aio_req_tag;
+    int aio_req_num;
+    TSK_IMG_AIO_EVENT *aio_ev;  // completions not returned yet
+    int aio_ev_num;
+    int aio_max;                // size of aio_req and aio_req_tag
+    int aio_ev_max;             // size of aio_ev
+};
+
+static void
+img_lock(TSK_IMG_CACHE * cache, tsk_lock_t * lock)
+{
+    if (cache->concurrent)
+        tsk_take_lock(lock);
+}
+
+static void
+img_unlock(TSK_IMG_CACHE * cache, tsk_lock_t * lock)
+{
+    if (cache->concurrent)
+        tsk_release_lock(lock);
+}
+
+/* Return the shard that holds the block at off */
+static TSK_IMG_CACHE_SHARD *
+img_cache_shard(TSK_IMG_CACHE * cache, TSK_OFF_T off)
+{
+    uint64_t blk = (uint64_t) off / TSK_IMG_CACHE_BLOCK_LEN;
+
+    return &cache->shard[blk & (cache->shard_num - 1)];
+}
+
+static uint32_t
+img_cache_hash(TSK_IMG_CACHE_SHARD * shard, TSK_OFF_T off)
+{
+    uint64_t blk = (uint64_t) off / TSK_IMG_CACHE_BLOCK_LEN;
+
+    return (uint32_t) ((blk * 0x9E3779B97F4A7C15ULL) >> 32) &
+        shard->hash_mask;
+}
+
+static void
+img_cache_release(TSK_IMG_CACHE * cache)
+{
+    int i, s;
+
+    for (s = 0; s < cache->shard_num; s++) {
+        TSK_IMG_CACHE_SHARD *shard = &cache->shard[s];
+
+        for (i = 0; i < shard->ent_used; i++)
+            free(shard->ent[i].data);
+        free(shard->ent);
+        free(shard->hash);
+        tsk_deinit_lock(&shard->lock);
+    }
+    tsk_deinit_lock(&cache->ra_lock);
+    tsk_deinit_lock(&cache->io_lock);
+    tsk_deinit_lock(&cache->aio_lock);
+
+    free(cache->ra_buf);
+    free(cache->aio_req);
+    free(cache->aio_req_tag);
+    free(cache->aio_ev);
+    free(cache->shard);
+    free(cache);
+}
+
+static TSK_IMG_CACHE *
+img_cache_alloc(size_t a_size)
+{
+    TSK_IMG_CACHE *cache;
+    int i, s;
+
+    if ((cache =
+            (TSK_IMG_CACHE *) tsk_malloc(sizeof(TSK_IMG_CACHE))) == NULL)
+        return NULL;
+
+    cache->size = a_size;
+    cache->ra_size = TSK_IMG_READAHEAD_DEFAULT_SIZE;
+    cache->ra_win = 1;
+    cache->ra_next = -1;
+    cache->ent_num = (int) (a_size / TSK_IMG_CACHE_BLOCK_LEN);
+    if ((a_size > 0) && (cache->ent_num == 0))
+        cache->ent_num = 1;
+
+    cache->shard_num = 1;
+    while ((cache->shard_num < IMG_CACHE_SHARD_MAX)
+        && (cache->ent_num / (cache->shard_num * 2) >= IMG_CACHE_SHARD_MIN))
+        cache->shard_num *= 2;
+
+    if ((cache->shard =
+            (TSK_IMG_CACHE_SHARD *) tsk_malloc(sizeof(TSK_IMG_CACHE_SHARD) *
+                cache->shard_num)) == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    tsk_init_lock(&cache->ra_lock);
+    tsk_init_lock(&cache->io_lock);
+    tsk_init_lock(&cache->aio_lock);
+    for (s = 0; s < cache->shard_num; s++)
+        tsk_init_lock(&cache->shard[s].lock);
+
+    for (s = 0; s < cache->shard_num; s++) {
+        TSK_IMG_CACHE_SHARD *shard = &cache->shard[s];
+        uint32_t hash_num = 1;
+
+        shard->ent_num = cache->ent_num / cache->shard_num;
+        if (shard->ent_num == 0)
+            continue;
+
+        // keep the chains short: at least two buckets per entry
+        while (hash_num < (uint32_t) shard->ent_num * 2)
+            hash_num <<= 1;
+        shard->hash_mask = hash_num - 1;
+
+        if (((shard->ent =
+                    (TSK_IMG_CACHE_ENT *)
+                    tsk_malloc(sizeof(TSK_IMG_CACHE_ENT) *
+                        shard->ent_num)) == NULL)
+            || ((shard->hash =
+                    (int *) tsk_malloc(sizeof(int) * hash_num)) == NULL)) {
+            shard->ent_num = 0;
+            img_cache_release(cache);
+            return NULL;
+        }
+
+        for (i = 0; i < shard->ent_num; i++) {
+            shard->ent[i].off = -1;
+            shard->ent[i].next = -1;
+        }
+        for (i = 0; i < (int) hash_num; i++)
+            shard->hash[i] = -1;
+    }
+
+    return cache;
+}
+
+/* Remove an entry from its hash chain */
+static void
+img_cache_unlink(TSK_IMG_CACHE_SHARD * shard, int idx)
+{
+    int *prev = &shard->hash[img_cache_hash(shard, shard->ent[idx].off)];
+
+    while (*prev != -1) {
+        if (*prev == idx) {
+            *prev = shard->ent[idx].next;
+            break;
+        }
+        prev = &shard->ent[*prev].next;
+    }
+    shard->ent[idx].off = -1;
+    shard->ent[idx].next = -1;
+}
+
+/* Pick the entry to load a new block into */
+static int
+img_cache_victim(TSK_IMG_CACHE_SHARD * shard)
+{
+    int idx;
+
+    if (shard->ent_used < shard->ent_num)
+        return shard->ent_used++;
+
+    while (1) {
+        idx = shard->hand;
+        shard->hand = (shard->hand + 1) % shard->ent_num;
+
+        if (shard->ent[idx].off == -1)
+            return idx;
+
+        if (shard->ent[idx].ref) {
+            shard->ent[idx].ref = 0;
+            continue;
+        }
+
+        img_cache_unlink(shard, idx);
+        shard->evictions++;
+        return idx;
+    }
+}
+
+/* Return the index of the entry holding the block at a_off or -1 */
+static int
+img_cache_find(TSK_IMG_CACHE_SHARD * shard, TSK_OFF_T a_off)
+{
+    int idx;
+
+    for (idx = shard->hash[img_cache_hash(shard, a_off)]; idx != -1;
+        idx = shard->ent[idx].next) {
+        if (shard->ent[idx].off == a_off)
+            return idx;
+    }
+    return -1;
+}
+
+/* Take an entry for the block at a_off and add it to the hash table.
+ * The caller fills in the data.  Returns NULL on error. */
+static TSK_IMG_CACHE_ENT *
+img_cache_insert(TSK_IMG_CACHE_SHARD * shard, TSK_OFF_T a_off)
+{
+    TSK_IMG_CACHE_ENT *ent;
+    uint32_t h = img_cache_hash(shard, a_off);
+    int idx;
+
+    idx = img_cache_victim(shard);
+    ent = &shard->ent[idx];
+
+    if (ent->data == NULL) {
+        if ((ent->data =
+                (char *) tsk_malloc(TSK_IMG_CACHE_BLOCK_LEN)) == NULL)
+            return NULL;
+        shard->used += TSK_IMG_CACHE_BLOCK_LEN;
+    }
+
+    ent->off = a_off;
+    ent->len = 0;
+    ent->ref = 1;
+    ent->next = shard->hash[h];
+    shard->hash[h] = idx;
+    return ent;
+}
+
+/* Return 1 if the block at a_off is cached */
+static uint8_t
+img_cache_has(TSK_IMG_CACHE * cache, TSK_OFF_T a_off)
+{
+    TSK_IMG_CACHE_SHARD *shard = img_cache_shard(cache, a_off);
+    int idx;
+
+    img_lock(cache, &shard->lock);
+    idx = img_cache_find(shard, a_off);
+    img_unlock(cache, &shard->lock);
+    return idx != -1;
+}
+
+/* Copy up to a_len bytes from a_skip into the cached block at a_blk_off.
+ * Returns the number of bytes copied (less than a_len at the end of a
+ * short block) or -1 if the block is not cached. */
+static ssize_t
+img_cache_lookup(TSK_IMG_CACHE * cache, TSK_OFF_T a_blk_off,
+    size_t a_skip, char *a_buf, size_t a_len)
+{
+    TSK_IMG_CACHE_SHARD *shard = img_cache_shard(cache, a_blk_off);
+    TSK_IMG_CACHE_ENT *ent;
+    ssize_t cnt = -1;
+    int idx;
+
+    if (shard->ent_num == 0)
+        return -1;
+
+    img_lock(cache, &shard->lock);
+    if ((idx = img_cache_find(shard, a_blk_off)) != -1) {
+        ent = &shard->ent[idx];
+        ent->ref = 1;
+        shard->hits++;
+
+        cnt = 0;
+        if (a_skip < ent->len) {
+            cnt = (ssize_t) (ent->len - a_skip);
+            if (cnt > (ssize_t) a_len)
+                cnt = (ssize_t) a_len;
+            memcpy(a_buf, &ent->data[a_skip], cnt);
+        }
+    }
+    img_unlock(cache, &shard->lock);
+    return cnt;
+}
+
+/* Add the a_win blocks read from the image at a_off into a_buf (a_cnt
+ * bytes) to the cache.  Blocks that another thread added in the
+ * meantime are kept. */
+static void
+img_cache_fill(TSK_IMG_CACHE * cache, TSK_OFF_T a_off, const char *a_buf,
+    size_t a_cnt, int a_win)
+{
+    int i;
+
+    for (i = 0; i < a_win; i++) {
+        size_t boff = (size_t) i * TSK_IMG_CACHE_BLOCK_LEN;
+        TSK_OFF_T off = a_off + (TSK_OFF_T) boff;
+        TSK_IMG_CACHE_SHARD *shard;
+        TSK_IMG_CACHE_ENT *ent;
+        size_t len;
+
+        if ((boff >= a_cnt) && (i > 0))
+            break;
+
+        shard = img_cache_shard(cache, off);
+        if (shard->ent_num == 0)
+            continue;
+
+        img_lock(cache, &shard->lock);
+        if ((img_cache_find(shard, off) == -1)
+            && ((ent = img_cache_insert(shard, off)) != NULL)) {
+            len = a_cnt > boff ? a_cnt - boff : 0;
+            if (len > TSK_IMG_CACHE_BLOCK_LEN)
+                len = TSK_IMG_CACHE_BLOCK_LEN;
+            memcpy(ent->data, &a_buf[boff], len);
+            ent->len = len;
+            if (i > 0)
+                shard->readahead++;
+        }
+        img_unlock(cache, &shard->lock);
+    }
+}
+
+/* Number of blocks to read for a miss at a_off.  A miss right where the
+ * last read ended continues a sequential stream and doubles the window
+ * (up to the readahead limit), any other miss resets it to one block.
+ * Called with ra_lock held. */
+static int
+img_cache_window(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off)
+{
+    TSK_IMG_CACHE *cache = a_img_info->cache;
+    int win, max, i;
+
+    max = (int) (cache->ra_size / TSK_IMG_CACHE_BLOCK_LEN);
+    // never read ahead so far that the window evicts itself
+    if (max > cache->ent_num / 2)
+        max = cache->ent_num / 2;
+
+    if ((a_off == cache->ra_next) && (max > 1)) {
+        win = cache->ra_win * 2;
+        if (win < 2)
+            win = 2;
+        if (win > max)
+            win = max;
+    }
+    else {
+        win = 1;
+    }
+    cache->ra_win = win;
+
+    // stop at the end of the image or at the first block we already have
+    for (i = 1; i < win; i++) {
+        TSK_OFF_T off = a_off + (TSK_OFF_T) i * TSK_IMG_CACHE_BLOCK_LEN;
+
+        if ((off >= a_img_info->size) || (img_cache_has(cache, off)))
+            break;
+    }
+    return i;
+}
+
+/* Read from the image format.  Formats that cannot be read from several
+ * threads at once are read one thread at a time. */
+static ssize_t
+img_backend_read(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off, char *a_buf,
+    size_t a_len)
+{
+    TSK_IMG_CACHE *cache = a_img_info->cache;
+    ssize_t cnt;
+
+    if ((cache == NULL) || (cache->concurrent == 0)
+        || (a_img_info->concurrent_read))
+        return a_img_info->read(a_img_info, a_off, a_buf, a_len);
+
+    tsk_take_lock(&cache->io_lock);
+    cnt = a_img_info->read(a_img_info, a_off, a_buf, a_len);
+    tsk_release_lock(&cache->io_lock);
+    return cnt;
+}
+
+/* Batch version of img_backend_read() */
+static ssize_t
+img_backend_read_batch(TSK_IMG_INFO * a_img_info, TSK_IMG_READ_REQ * a_reqs,
+    int a_count)
+{
+    TSK_IMG_CACHE *cache = a_img_info->cache;
+    ssize_t cnt;
+
+    if ((cache == NULL) || (cache->concurrent == 0)
+        || (a_img_info->concurrent_read))
+        return a_img_info->read_batch(a_img_info, a_reqs, a_count);
+
+    tsk_take_lock(&cache->io_lock);
+    cnt = a_img_info->read_batch(a_img_info, a_reqs, a_count);
+    tsk_release_lock(&cache->io_lock);
+    return cnt;
+}
+
+/* Read a_len bytes at a_off, which must not cross a block boundary,
+ * through the cache.  A miss reads the block (and any readahead blocks)
+ * from the image.  Returns the number of bytes copied (less than a_len
+ * at the end of a truncated image) or -1 on error. */
+static ssize_t
+img_cache_read_block(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off,
+    char *a_buf, size_t a_len)
+{
+    TSK_IMG_CACHE *cache = a_img_info->cache;
+    TSK_OFF_T blk_off = a_off - (a_off % TSK_IMG_CACHE_BLOCK_LEN);
+    size_t skip = (size_t) (a_off - blk_off);
+    char *buf = NULL;
+    size_t rlen;
+    ssize_t cnt;
+    int win;
+
+    if ((cnt = img_cache_lookup(cache, blk_off, skip, a_buf, a_len)) != -1)
+        return cnt;
+
+    img_lock(cache, &cache->ra_lock);
+    cache->misses++;
+    win = img_cache_window(a_img_info, blk_off);
+
+    rlen = (size_t) win * TSK_IMG_CACHE_BLOCK_LEN;
+    if (blk_off + rlen > a_img_info->size)
+        rlen = (size_t) (a_img_info->size - blk_off);
+
+    // a single thread reuses one buffer for all misses
+    if ((cache->concurrent == 0) && (cache->ra_buf_len < rlen)) {
+        free(cache->ra_buf);
+        cache->ra_buf_len = 0;
+        if ((cache->ra_buf = (char *) tsk_malloc(rlen)) != NULL)
+            cache->ra_buf_len = rlen;
+    }
+    if (cache->concurrent == 0)
+        buf = cache->ra_buf;
+    img_unlock(cache, &cache->ra_lock);
+
+    if ((buf == NULL) && ((cache->concurrent == 0)
+            || ((buf = (char *) tsk_malloc(rlen)) == NULL)))
+        return -1;
+
+    cnt = img_backend_read(a_img_info, blk_off, buf, rlen);
+
+    // only a successful read moves the stream on, so a range that failed
+    // is read again by the next miss rather than skipped
+    img_lock(cache, &cache->ra_lock);
+    if (cnt != -1)
+        cache->ra_next = blk_off + cnt;
+    else
+        cache->ra_win = 1;
+    img_unlock(cache, &cache->ra_lock);
+
+    if (cnt != -1) {
+        img_cache_fill(cache, blk_off, buf, (size_t) cnt, win);
+
+        if (skip >= (size_t) cnt) {
+            cnt = 0;
+        }
+        else {
+            cnt -= (ssize_t) skip;
+            if (cnt > (ssize_t) a_len)
+                cnt = (ssize_t) a_len;
+            memcpy(a_buf, &buf[skip], cnt);
+        }
+    }
+
+    if (cache->concurrent)
+        free(buf);
+    return cnt;
+}
+
+/* Copy a range from the cache if all of its blocks are cached.
+ * Returns 1 if the data was copied and 0 if not. */
+static uint8_t
+img_cache_copy(TSK_IMG_CACHE * cache, TSK_OFF_T a_off, char *a_buf,
+    size_t a_len)
+{
+    size_t copied;
+
+    if (cache->ent_num == 0)
+        return 0;
+
+    for (copied = 0; copied < a_len;) {
+        TSK_OFF_T off = a_off + copied;
+        TSK_OFF_T blk_off = off - (off % TSK_IMG_CACHE_BLOCK_LEN);
+        size_t cnt = TSK_IMG_CACHE_BLOCK_LEN - (size_t) (off - blk_off);
+
+        if (cnt > a_len - copied)
+            cnt = a_len - copied;
+        if (img_cache_lookup(cache, blk_off, (size_t) (off - blk_off),
+                &a_buf[copied], cnt) != (ssize_t) cnt)
+            return 0;
+        copied += cnt;
+    }
+    return 1;
+}
+
+/* Add up the counters of all shards */
+static void
+img_cache_counters(TSK_IMG_CACHE * cache, TSK_IMG_CACHE_STATS * a_stats)
+{
+    int s;
+
+    memset(a_stats, 0, sizeof(TSK_IMG_CACHE_STATS));
+    a_stats->size = cache->size;
+
+    for (s = 0; s < cache->shard_num; s++) {
+        TSK_IMG_CACHE_SHARD *shard = &cache->shard[s];
+
+        img_lock(cache, &shard->lock);
+        a_stats->used += shard->used;
+        a_stats->hits += shard->hits;
+        a_stats->evictions += shard->evictions;
+        a_stats->readahead += shard->readahead;
+        img_unlock(cache, &shard->lock);
+    }
+
+    img_lock(cache, &cache->ra_lock);
+    a_stats->misses = cache->misses;
+    img_unlock(cache, &cache->ra_lock);
+}
+
+/**
+ * \ingroup imglib
+ * Set the memory budget of the read cache of an open disk image.  Any
+ * cached data is dropped, the counters are kept.  A size of 0 disables
+ * the cache.  Must not be called while other threads read from the
+ * image.
+ * @param a_img_info Disk image to change
+ * @param a_size Budget in bytes (rounded down to TSK_IMG_CACHE_BLOCK_LEN)
+ * @returns 1 on error and 0 on success
+ */
+uint8_t
+tsk_img_cache_set_size(TSK_IMG_INFO * a_img_info, size_t a_size)
+{
+    TSK_IMG_CACHE *cache;
+
+    if (a_img_info == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_cache_set_size: pointer is NULL");
+        return 1;
+    }
+
+    if ((cache = img_cache_alloc(a_size)) == NULL)
+        return 1;
+
+    if (a_img_info->cache) {
+        TSK_IMG_CACHE_STATS stats;
+
+        // the counters of the old shards continue in the first new one
+        img_cache_counters(a_img_info->cache, &stats);
+        cache->shard[0].hits = stats.hits;
+        cache->shard[0].evictions = stats.evictions;
+        cache->shard[0].readahead = stats.readahead;
+        cache->misses = stats.misses;
+        cache->ra_size = a_img_info->cache->ra_size;
+        cache->concurrent = a_img_info->cache->concurrent;
+
+        // keep the reads that were started but not returned
+        cache->aio_req = a_img_info->cache->aio_req;
+        cache->aio_req_tag = a_img_info->cache->aio_req_tag;
+        cache->aio_req_num = a_img_info->cache->aio_req_num;
+        cache->aio_ev = a_img_info->cache->aio_ev;
+        cache->aio_ev_num = a_img_info->cache->aio_ev_num;
+        cache->aio_max = a_img_info->cache->aio_max;
+        cache->aio_ev_max = a_img_info->cache->aio_ev_max;
+        a_img_info->cache->aio_req = NULL;
+        a_img_info->cache->aio_req_tag = NULL;
+        a_img_info->cache->aio_ev = NULL;
+
+        // so does the claim of the thread that resizes it
+        if (a_img_info->cache->aio_claimed) {
+            tsk_release_lock(&a_img_info->cache->aio_lock);
+            tsk_take_lock(&cache->aio_lock);
+            cache->aio_claimed = 1;
+        }
+        img_cache_release(a_img_info->cache);
+    }
+    a_img_info->cache = cache;
+    return 0;
+}
+
+/**
+ * \ingroup imglib
+ * Set how far the read cache reads ahead of a sequential stream.  The
+ * window starts at one block and doubles with every sequential miss up
+ * to this limit (and to half of the cache).  A size of 0 disables
+ * readahead.
+ * @param a_img_info Disk image to change
+ * @param a_size Readahead limit in bytes
+ * @returns 1 on error and 0 on success
+ */
+uint8_t
+tsk_img_cache_set_readahead(TSK_IMG_INFO * a_img_info, size_t a_size)
+{
+    if (a_img_info == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_cache_set_readahead: pointer is NULL");
+        return 1;
+    }
+
+    if ((a_img_info->cache == NULL)
+        && (tsk_img_cache_set_size(a_img_info,
+                TSK_IMG_CACHE_DEFAULT_SIZE)))
+        return 1;
+
+    img_lock(a_img_info->cache, &a_img_info->cache->ra_lock);
+    a_img_info->cache->ra_size = a_size;
+    a_img_info->cache->ra_win = 1;
+    img_unlock(a_img_info->cache, &a_img_info->cache->ra_lock);
+    return 0;
+}
+
+/**
+ * \ingroup imglib
+ * Get the read cache counters of an open disk image.
+ * @param a_img_info Disk image to query
+ * @param a_stats Structure to fill in
+ */
+void
+tsk_img_cache_stats(TSK_IMG_INFO * a_img_info,
+    TSK_IMG_CACHE_STATS * a_stats)
+{
+    TSK_IMG_CACHE *cache = a_img_info->cache;
+
+    if (cache == NULL) {
+        memset(a_stats, 0, sizeof(TSK_IMG_CACHE_STATS));
+        a_stats->size = TSK_IMG_CACHE_DEFAULT_SIZE;
+        return;
+    }
+    img_cache_counters(cache, a_stats);
+}
+
+/* \internal
+ * Free the read cache.  Called by tsk_img_close().
+ */
+void
+tsk_img_cache_free(TSK_IMG_INFO * a_img_info)
+{
+    TSK_IMG_CACHE *cache = a_img_info->cache;
+
+    TSK_IMG_CACHE_STATS stats;
+
+    if (cache == NULL)
+        return;
+
+    if (tsk_verbose) {
+        img_cache_counters(cache, &stats);
+        tsk_fprintf(stderr,
+            "tsk_img_cache_free: %" PRIu64 " hits, %" PRIu64
+            " misses, %" PRIu64 " evictions, %" PRIu64
+            " readahead\n", stats.hits, stats.misses, stats.evictions,
+            stats.readahead);
+    }
+
+    img_cache_release(cache);
+    a_img_info->cache = NULL;
+}
+
+/**
+ * \ingroup imglib
+ * Allow several threads to read from an open disk image at the same
+ * time.  Afterwards tsk_img_read() and tsk_img_read_batch() can be called
+ * from any thread: the read cache takes the lock of the shard a block is
+ * in and image formats that cannot be read concurrently are read one
+ * thread at a time.  Asynchronous reads are used by one thread at a time
+ * (see tsk_img_aio_claim()).  The image must not be closed and its cache
+ * must not be resized while other threads use it.
+ *
+ * Only the image is shared.  File system handles keep state of their
+ * own, so every thread opens its own TSK_FS_INFO on the image (the
+ * workers of tsk_fs_meta_walk_parallel() are the exception).
+ * @param a_img_info Disk image to share
+ * @returns 1 on error and 0 on success
+ */
+uint8_t
+tsk_img_set_concurrent(TSK_IMG_INFO * a_img_info)
+{
+    if (a_img_info == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_set_concurrent: pointer is NULL");
+        return 1;
+    }
+
+    // the cache is created lazily, which is not safe with threads
+    if ((a_img_info->cache == NULL)
+        && (tsk_img_cache_set_size(a_img_info,
+                TSK_IMG_CACHE_DEFAULT_SIZE)))
+        return 1;
+
+    a_img_info->cache->concurrent = 1;
+    return 0;
+}
+
+/**
+ * \ingroup imglib
+ * Take the asynchronous reads of an image for the calling thread.  The
+ * completions of an image are kept in one queue, so on an image that is
+ * read from several threads (see tsk_img_set_concurrent()) only one of
+ * them can have reads in flight.  Other threads read synchronously.
+ * @param a_img_info Disk image to read from
+ * @returns 1 if the thread may use tsk_img_aio_submit() until it calls
+ * tsk_img_aio_release() and 0 if another thread uses them
+ */
+uint8_t
+tsk_img_aio_claim(TSK_IMG_INFO * a_img_info)
+{
+    if (a_img_info == NULL)
+        return 1;
+
+    // the lock is taken even if the image is not concurrent (yet), so
+    // that the release matches whatever happens in between
+    if ((a_img_info->cache == NULL)
+        && (tsk_img_cache_set_size(a_img_info,
+                TSK_IMG_CACHE_DEFAULT_SIZE))) {
+        tsk_error_reset();
+        return 0;
+    }
+    if (tsk_try_lock(&a_img_info->cache->aio_lock) == 0)
+        return 0;
+    a_img_info->cache->aio_claimed = 1;
+    return 1;
+}
+
+/**
+ * \ingroup imglib
+ * Give back the asynchronous reads taken with tsk_img_aio_claim().  All
+ * reads must have been returned by tsk_img_aio_poll().
+ * @param a_img_info Disk image to read from
+ */
+void
+tsk_img_aio_release(TSK_IMG_INFO * a_img_info)
+{
+    if ((a_img_info == NULL) || (a_img_info->cache == NULL)
+        || (a_img_info->cache->aio_claimed == 0))
+        return;
+    a_img_info->cache->aio_claimed = 0;
+    tsk_release_lock(&a_img_info->cache->aio_lock);
+}
+
+#ifndef TSK_WIN32
+/* \internal
+ * Pass an access hint for a mapped range to madvise().  Used by the
+ * formats that map images. */
+void
+tsk_img_madvise(char *a_addr, size_t a_len, TSK_IMG_ACCESS_ENUM a_access)
+{
+    int advice = MADV_NORMAL;
+
+    if (a_access == TSK_IMG_ACCESS_SEQUENTIAL)
+        advice = MADV_SEQUENTIAL;
+    else if (a_access == TSK_IMG_ACCESS_RANDOM)
+        advice = MADV_RANDOM;
+
+    if ((madvise(a_addr, a_len, advice) != 0) && (tsk_verbose))
+        tsk_fprintf(stderr, "tsk_img_madvise: %s\n", strerror(errno));
+}
+
+/* \internal
+ * Pass an access hint for a whole file to posix_fadvise(), where the
+ * system has it. */
+void
+tsk_img_fadvise(int a_fd, TSK_IMG_ACCESS_ENUM a_access)
+{
+#ifdef POSIX_FADV_NORMAL
+    int advice = POSIX_FADV_NORMAL;
+
+    if (a_access == TSK_IMG_ACCESS_SEQUENTIAL)
+        advice = POSIX_FADV_SEQUENTIAL;
+    else if (a_access == TSK_IMG_ACCESS_RANDOM)
+        advice = POSIX_FADV_RANDOM;
+
+    if ((posix_fadvise(a_fd, 0, 0, advice) != 0) && (tsk_verbose))
+        tsk_fprintf(stderr, "tsk_img_fadvise: failed\n");
+#endif
+}
+#endif
+
+/**
+ * \ingroup imglib
+ * Map a raw or split disk image into memory, or remove the mapping.
+ * While an image is mapped, tsk_img_read() copies straight from the
+ * mapping instead of reading into the read cache first, and
+ * tsk_img_borrow() returns pointers into it.  The image files must not
+ * be truncated while they are mapped.  Must not be called while other
+ * threads read from the image, and the mapping must not be removed while
+ * file systems opened on the image are in use, because they can hold
+ * borrowed pointers.
+ * @param a_img_info Disk image to change
+ * @param a_enable 1 to map the image and 0 to remove the mapping
+ * @returns 1 on error (including formats that cannot be mapped) and 0 on
+ * success
+ */
+uint8_t
+tsk_img_set_mmap(TSK_IMG_INFO * a_img_info, uint8_t a_enable)
+{
+    if (a_img_info == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_set_mmap: pointer is NULL");
+        return 1;
+    }
+
+    if (a_img_info->map == NULL) {
+        if (a_enable == 0)
+            return 0;
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_UNSUPTYPE;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_set_mmap: %s images cannot be mapped",
+            tsk_img_type_toname(a_img_info->itype));
+        return 1;
+    }
+    return a_img_info->map(a_img_info, a_enable);
+}
+
+/**
+ * \ingroup imglib
+ * Return a pointer to data in a memory mapped disk image (see
+ * tsk_img_set_mmap()), so that it can be parsed in place instead of
+ * being copied into a buffer first.  The data must not be changed and
+ * the pointer stays valid until the mapping is removed or the image is
+ * closed.  No error is set when NULL is returned; the caller reads the
+ * data with tsk_img_read() instead.
+ * @param a_img_info Disk image to read from
+ * @param a_off Byte offset of the data
+ * @param a_len Number of bytes needed
+ * @returns Pointer to the data or NULL if the image is not mapped or the
+ * range is not inside of one mapped file
+ */
+const char *
+tsk_img_borrow(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off, size_t a_len)
+{
+    if ((a_img_info == NULL) || (a_img_info->borrow == NULL))
+        return NULL;
+    return a_img_info->borrow(a_img_info, a_off, a_len);
+}
+
+/**
+ * \ingroup imglib
+ * Tell the operating system how an image is going to be read, so that it
+ * can read ahead further or not at all.  Raw and split images pass the
+ * hint to madvise() while they are mapped and to posix_fadvise()
+ * otherwise; other formats ignore it.
+ * @param a_img_info Disk image to read from
+ * @param a_access Expected access pattern
+ * @returns 1 on error and 0 on success
+ */
+uint8_t
+tsk_img_set_access(TSK_IMG_INFO * a_img_info, TSK_IMG_ACCESS_ENUM a_access)
+{
+    if (a_img_info == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_set_access: pointer is NULL");
+        return 1;
+    }
+
+    if (a_img_info->advise)
+        a_img_info->advise(a_img_info, a_access);
+    return 0;
+}
+
 /**
  * \ingroup imglib
  * Reads data from an open disk image
@@ -25,11 +947,7 @@ ssize_t
 tsk_img_read(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off,
     char *a_buf, size_t a_len)
 {
-#define CACHE_AGE   1000
-    ssize_t retval = 0;
-    int i;
-    int cache_next = 0;         // index to lowest age cache (to use next)
-    size_t len2;
+    size_t len2, copied = 0;
 
     if (a_img_info == NULL) {
         tsk_error_reset();
@@ -39,11 +957,37 @@ tsk_img_read(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off,
         return -1;
     }
 
-    // if they ask for more than the cache length, skip the cache
-    if (a_len > TSK_IMG_INFO_CACHE_LEN) {
+    // mapped images are copied from directly, the page cache has them
+    if ((a_img_info->borrow) && (a_off >= 0) && (a_off < a_img_info->size)) {
+        const char *ptr;
+
+        len2 = a_len;
+        if (a_off + len2 > a_img_info->size)
+            len2 = (size_t) (a_img_info->size - a_off);
+        if ((ptr = a_img_info->borrow(a_img_info, a_off, len2)) != NULL) {
+            memcpy(a_buf, ptr, len2);
+            return (ssize_t) len2;
+        }
+    }
+
+    // create the cache with the default budget on first use
+    if ((a_img_info->cache == NULL)
+        && (tsk_img_cache_set_size(a_img_info,
+                TSK_IMG_CACHE_DEFAULT_SIZE))) {
+        if (tsk_verbose)
+            tsk_fprintf(stderr,
+                "tsk_img_read: Error creating cache: %s\n",
+                tsk_error_get());
+        tsk_error_reset();
         return a_img_info->read(a_img_info, a_off, a_buf, a_len);
     }
 
+    // if they ask for more than the cache length, skip the cache
+    if ((a_len > TSK_IMG_CACHE_BLOCK_LEN)
+        || (a_img_info->cache->ent_num == 0)) {
+        return img_backend_read(a_img_info, a_off, a_buf, a_len);
+    }
+
     if (a_off >= a_img_info->size) {
         tsk_error_reset();
         tsk_errno = TSK_ERR_IMG_READ_OFF;
@@ -58,100 +1002,369 @@ tsk_img_read(TSK_IMG_INFO * a_img_info, TSK_OFF_T a_off,
     if (a_off + len2 > a_img_info->size)
         len2 = (size_t) (a_img_info->size - a_off);
 
-    // check if it is in the cache
-    for (i = 0; i < TSK_IMG_INFO_CACHE_NUM; i++) {
+    // a request can span two blocks
+    while (copied < len2) {
+        TSK_OFF_T off = a_off + copied;
+        size_t cnt = TSK_IMG_CACHE_BLOCK_LEN -
+            (size_t) (off % TSK_IMG_CACHE_BLOCK_LEN);
+        ssize_t ret;
 
-        // Look into the in-use cache entries
-        if (a_img_info->cache_len[i] > 0) {
+        if (cnt > len2 - copied)
+            cnt = len2 - copied;
 
-            // the retval check makes sure we don't go back in after data was read
-            if ((retval == 0) && (a_img_info->cache_off[i] <= a_off) &&
-                (a_img_info->cache_off[i] + a_img_info->cache_len[i] >=
-                    a_off + len2)) {
+        if ((ret = img_cache_read_block(a_img_info, off, &a_buf[copied],
+                    cnt)) == -1) {
+            if (copied == 0)
+                return -1;
+            break;
+        }
+        copied += (size_t) ret;
 
-                /*
-                   if (tsk_verbose)
-                   fprintf(stderr,
-                   "tsk_img_read: Read found in cache %d\n", i);
-                 */
+        // the block was short (end of a truncated image)
+        if ((size_t) ret < cnt)
+            break;
+    }
 
-                // We found it...
-                memcpy(a_buf,
-                    &a_img_info->cache[i][a_off -
-                        a_img_info->cache_off[i]], len2);
-                retval = (ssize_t) len2;
+    return (ssize_t) copied;
+}
 
-                // reset its "age" since it was useful
-                a_img_info->cache_age[i] = CACHE_AGE;
+/**
+ * \ingroup imglib
+ * Reads a batch of requests from an open disk image.  Requests that are
+ * in the read cache are copied from it, the others are passed to the
+ * image format in one call if it supports batches (it can then merge
+ * and reorder them) and are read one at a time if not.  Every request
+ * must be inside of the image.
+ * @param a_img_info Disk image to read from
+ * @param a_reqs Requests to read
+ * @param a_count Number of requests
+ * @returns 1 on error and 0 on success
+ */
+uint8_t
+tsk_img_read_batch(TSK_IMG_INFO * a_img_info, TSK_IMG_READ_REQ * a_reqs,
+    int a_count)
+{
+    TSK_IMG_READ_REQ *pend;
+    size_t pend_len = 0;
+    ssize_t cnt;
+    int i, pend_num = 0;
 
-                // we don't break out of the loop so that we update all ages
-            }
-            else {
-                /* decrease its "age" since it was not useful.
-                 * We don't let used ones go below 1 so that they are not
-                 * confused with entries that have never been used. */
-                a_img_info->cache_age[i]--;
-
-                // see if this is the most eligible replacement
-                if ((a_img_info->cache_len[cache_next] > 0)
-                    && (a_img_info->cache_age[i] <
-                        a_img_info->cache_age[cache_next]))
-                    cache_next = i;
+    if (a_img_info == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_read_batch: pointer is NULL");
+        return 1;
+    }
+
+    for (i = 0; i < a_count; i++) {
+        if ((a_reqs[i].off < 0) || (a_reqs[i].off + (TSK_OFF_T)
+                a_reqs[i].len > a_img_info->size)) {
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_IMG_READ_OFF;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "tsk_img_read_batch - %" PRIuOFF, a_reqs[i].off);
+            return 1;
+        }
+    }
+
+    if (a_img_info->read_batch == NULL) {
+        for (i = 0; i < a_count; i++) {
+            cnt = tsk_img_read(a_img_info, a_reqs[i].off, a_reqs[i].buf,
+                a_reqs[i].len);
+            if (cnt != (ssize_t) a_reqs[i].len) {
+                if (cnt >= 0) {
+                    tsk_error_reset();
+                    tsk_errno = TSK_ERR_IMG_READ;
+                    snprintf(tsk_errstr, TSK_ERRSTR_L,
+                        "tsk_img_read_batch - %" PRIuOFF, a_reqs[i].off);
+                }
+                return 1;
             }
         }
-        else {
-            cache_next = i;
+        return 0;
+    }
+
+    if ((pend = (TSK_IMG_READ_REQ *) tsk_malloc(sizeof(TSK_IMG_READ_REQ) *
+                a_count)) == NULL)
+        return 1;
+
+    for (i = 0; i < a_count; i++) {
+        if ((a_img_info->cache)
+            && (img_cache_copy(a_img_info->cache, a_reqs[i].off,
+                    a_reqs[i].buf, a_reqs[i].len)))
+            continue;
+        pend[pend_num++] = a_reqs[i];
+        pend_len += a_reqs[i].len;
+    }
+
+    if (pend_num > 0) {
+        cnt = img_backend_read_batch(a_img_info, pend, pend_num);
+        if (cnt != (ssize_t) pend_len) {
+            if (cnt >= 0) {
+                tsk_error_reset();
+                tsk_errno = TSK_ERR_IMG_READ;
+                snprintf(tsk_errstr, TSK_ERRSTR_L,
+                    "tsk_img_read_batch - %" PRIuOFF, pend[0].off);
+            }
+            free(pend);
+            return 1;
         }
     }
 
-    // if we didn't find it, then load it into the cache_next entry
-    if (retval == 0) {
-        size_t rlen;
+    free(pend);
+    return 0;
+}
+
+/* Make room for a_num more completions */
+static uint8_t
+img_aio_ev_reserve(TSK_IMG_CACHE * cache, int a_num)
+{
+    int max = cache->aio_ev_max ? cache->aio_ev_max : 16;
 
-        // round the offset down to a sector boundary
-        a_img_info->cache_off[cache_next] = (a_off / 512) * 512;
+    if (cache->aio_ev_num + a_num <= cache->aio_ev_max)
+        return 0;
 
-        /*
-           if (tsk_verbose)
-           fprintf(stderr,
-           "tsk_img_read: Loading data into cache %d (%" PRIuOFF
-           ")\n", cache_next, a_img_info->cache_off[cache_next]);
-         */
+    while (max < cache->aio_ev_num + a_num)
+        max *= 2;
+    if ((cache->aio_ev =
+            (TSK_IMG_AIO_EVENT *) tsk_realloc(cache->aio_ev,
+                max * sizeof(TSK_IMG_AIO_EVENT))) == NULL)
+        return 1;
+    cache->aio_ev_max = max;
+    return 0;
+}
 
-        // figure out the length to read into the cache
-        rlen = TSK_IMG_INFO_CACHE_LEN;
-        if (a_img_info->cache_off[cache_next] + rlen > a_img_info->size) {
-            rlen =
-                (size_t) (a_img_info->size -
-                a_img_info->cache_off[cache_next]);
-        }
+/* Make room for one more queued request and completion */
+static uint8_t
+img_aio_grow(TSK_IMG_CACHE * cache)
+{
+    int max;
+
+    if (img_aio_ev_reserve(cache, 1))
+        return 1;
+    if (cache->aio_req_num < cache->aio_max)
+        return 0;
+
+    max = cache->aio_max ? cache->aio_max * 2 : 16;
+    if (((cache->aio_req =
+                (TSK_IMG_READ_REQ *) tsk_realloc(cache->aio_req,
+                    max * sizeof(TSK_IMG_READ_REQ))) == NULL)
+        || ((cache->aio_req_tag =
+                (void **) tsk_realloc(cache->aio_req_tag,
+                    max * sizeof(void *))) == NULL))
+        return 1;
+    cache->aio_max = max;
+    return 0;
+}
 
-        retval =
-            a_img_info->read(a_img_info, a_img_info->cache_off[cache_next],
-            a_img_info->cache[cache_next], rlen);
+/**
+ * \ingroup imglib
+ * Starts an asynchronous read from an open disk image.  The completion is
+ * returned by tsk_img_aio_poll() with the tag; the buffer must stay valid
+ * until then.  Data in the read cache completes right away.  If the
+ * image format cannot read asynchronously, the request is queued and all
+ * queued requests are read as one batch (see tsk_img_read_batch()) by
+ * the next tsk_img_aio_poll().  On an image that is read from several
+ * threads, only the thread that holds tsk_img_aio_claim() may use it.
+ * @param a_img_info Disk image to read from
+ * @param a_req Request to read (must be inside of the image)
+ * @param a_tag Value returned with the completion
+ * @returns 1 on error and 0 on success
+ */
+uint8_t
+tsk_img_aio_submit(TSK_IMG_INFO * a_img_info, TSK_IMG_READ_REQ * a_req,
+    void *a_tag)
+{
+    TSK_IMG_CACHE *cache;
 
-        // if no error, then set the variables and copy the data
-        if (retval != -1) {
-            a_img_info->cache_age[cache_next] = CACHE_AGE;
-            a_img_info->cache_len[cache_next] = retval;
+    if (a_img_info == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_aio_submit: pointer is NULL");
+        return 1;
+    }
 
-            // update the length we can actually copy (in case we did not get to read all that we wanted)
-            if (a_off + len2 > a_img_info->cache_off[cache_next] + retval)
-                len2 =
-                    (size_t) (a_img_info->cache_off[cache_next] + retval -
-                    a_off);
+    if ((a_req->off < 0)
+        || (a_req->off + (TSK_OFF_T) a_req->len > a_img_info->size)) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_READ_OFF;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_aio_submit - %" PRIuOFF, a_req->off);
+        return 1;
+    }
 
-            memcpy(a_buf,
-                &a_img_info->cache[cache_next][a_off -
-                    a_img_info->cache_off[cache_next]], len2);
-            retval = (ssize_t) len2;
+    if ((a_img_info->cache == NULL)
+        && (tsk_img_cache_set_size(a_img_info,
+                TSK_IMG_CACHE_DEFAULT_SIZE)))
+        return 1;
+    cache = a_img_info->cache;
+
+    if (img_aio_grow(cache))
+        return 1;
+
+    if (img_cache_copy(cache, a_req->off, a_req->buf, a_req->len)) {
+        cache->aio_ev[cache->aio_ev_num].tag = a_tag;
+        cache->aio_ev[cache->aio_ev_num].ret = (ssize_t) a_req->len;
+        cache->aio_ev_num++;
+        return 0;
+    }
+
+    if ((a_img_info->aio_submit) && ((cache->concurrent == 0)
+            || (a_img_info->concurrent_read)))
+        return a_img_info->aio_submit(a_img_info, a_req, a_tag);
+
+    cache->aio_req[cache->aio_req_num] = *a_req;
+    cache->aio_req_tag[cache->aio_req_num] = a_tag;
+    cache->aio_req_num++;
+    return 0;
+}
+
+/* Read the queued requests and turn them into completions.  Returns 1
+ * if there is no memory for the completions. */
+static uint8_t
+img_aio_run_queue(TSK_IMG_INFO * a_img_info)
+{
+    TSK_IMG_CACHE *cache = a_img_info->cache;
+    int i;
+
+    if (img_aio_ev_reserve(cache, cache->aio_req_num))
+        return 1;
+
+    if (tsk_img_read_batch(a_img_info, cache->aio_req,
+            cache->aio_req_num) == 0) {
+        for (i = 0; i < cache->aio_req_num; i++) {
+            cache->aio_ev[cache->aio_ev_num].tag = cache->aio_req_tag[i];
+            cache->aio_ev[cache->aio_ev_num].ret =
+                (ssize_t) cache->aio_req[i].len;
+            cache->aio_ev_num++;
         }
-        else {
-            a_img_info->cache_len[cache_next] = 0;
-            a_img_info->cache_age[cache_next] = 0;
-            a_img_info->cache_off[cache_next] = 0;
+    }
+    else {
+        // find out which of them failed
+        tsk_error_reset();
+        for (i = 0; i < cache->aio_req_num; i++) {
+            cache->aio_ev[cache->aio_ev_num].tag = cache->aio_req_tag[i];
+            cache->aio_ev[cache->aio_ev_num].ret =
+                tsk_img_read(a_img_info, cache->aio_req[i].off,
+                cache->aio_req[i].buf, cache->aio_req[i].len);
+            if (cache->aio_ev[cache->aio_ev_num].ret !=
+                (ssize_t) cache->aio_req[i].len)
+                cache->aio_ev[cache->aio_ev_num].ret = -1;
+            cache->aio_ev_num++;
+        }
+    }
+    cache->aio_req_num = 0;
+    return 0;
+}
+
+/* Move the pending completions whose tag is in [a_lo, a_hi) to a_events.
+ * Returns the number moved. */
+static int
+img_aio_take(TSK_IMG_CACHE * cache, void *a_lo, void *a_hi,
+    TSK_IMG_AIO_EVENT * a_events, int a_max)
+{
+    int i, n = 0, kept = 0;
+
+    for (i = 0; i < cache->aio_ev_num; i++) {
+        char *tag = (char *) cache->aio_ev[i].tag;
+
+        if ((n < a_max) && (tag >= (char *) a_lo) && (tag < (char *) a_hi))
+            a_events[n++] = cache->aio_ev[i];
+        else
+            cache->aio_ev[kept++] = cache->aio_ev[i];
+    }
+    cache->aio_ev_num = kept;
+    return n;
+}
+
+/**
+ * \ingroup imglib
+ * Returns the completions of reads started with tsk_img_aio_submit()
+ * whose tag is in [a_lo, a_hi), such as the elements of an array of
+ * requests.  Completions of the reads of other callers on the image are
+ * kept for them.
+ * @param a_img_info Disk image the reads were started on
+ * @param a_lo Lowest tag to return
+ * @param a_hi Tag after the highest one to return
+ * @param a_events Array to store the completions in
+ * @param a_max Size of a_events
+ * @param a_wait 1 to block until at least one of the reads completed (if
+ * any are in flight) and 0 to only return what already completed
+ * @returns number of completions stored or -1 on error
+ */
+int
+tsk_img_aio_poll_range(TSK_IMG_INFO * a_img_info, void *a_lo, void *a_hi,
+    TSK_IMG_AIO_EVENT * a_events, int a_max, uint8_t a_wait)
+{
+    TSK_IMG_CACHE *cache;
+    TSK_IMG_AIO_EVENT ev[16];
+    int i, n, ret;
+
+    if (a_img_info == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_ARG;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "tsk_img_aio_poll: pointer is NULL");
+        return -1;
+    }
+
+    if ((cache = a_img_info->cache) == NULL)
+        return 0;
+
+    n = img_aio_take(cache, a_lo, a_hi, a_events, a_max);
+    if ((n == 0) && (cache->aio_req_num > 0)) {
+        if (img_aio_run_queue(a_img_info))
+            return -1;
+        n = img_aio_take(cache, a_lo, a_hi, a_events, a_max);
+    }
+
+    if ((a_img_info->aio_poll == NULL) || ((cache->concurrent)
+            && (a_img_info->concurrent_read == 0)))
+        return n;
+
+    // keep what the format completed for others until they poll
+    while (n < a_max) {
+        int max = a_max - n < 16 ? a_max - n : 16;
+
+        if ((ret = a_img_info->aio_poll(a_img_info, ev, max,
+                    (a_wait) && (n == 0))) < 0)
+            return -1;
+        if (ret == 0)
+            break;
+        if (img_aio_ev_reserve(cache, ret))
+            return -1;
+        for (i = 0; i < ret; i++) {
+            char *tag = (char *) ev[i].tag;
+
+            if ((tag >= (char *) a_lo) && (tag < (char *) a_hi))
+                a_events[n++] = ev[i];
+            else
+                cache->aio_ev[cache->aio_ev_num++] = ev[i];
         }
+        if ((ret < max) && ((n > 0) || (a_wait == 0)))
+            break;
     }
 
-    return retval;
+    return n;
+}
+
+/**
+ * \ingroup imglib
+ * Returns the completions of reads started with tsk_img_aio_submit(),
+ * whoever started them (see tsk_img_aio_poll_range()).
+ * @param a_img_info Disk image the reads were started on
+ * @param a_events Array to store the completions in
+ * @param a_max Size of a_events
+ * @param a_wait 1 to block until at least one read completed (if any
+ * are in flight) and 0 to only return what already completed
+ * @returns number of completions stored or -1 on error
+ */
+int
+tsk_img_aio_poll(TSK_IMG_INFO * a_img_info, TSK_IMG_AIO_EVENT * a_events,
+    int a_max, uint8_t a_wait)
+{
+    return tsk_img_aio_poll_range(a_img_info, NULL, (void *) ~(uintptr_t) 0,
+        a_events, a_max, a_wait);
 }
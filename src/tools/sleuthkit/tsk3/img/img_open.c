@@ -469,5 +469,6 @@ tsk_img_close(TSK_IMG_INFO * a_img_info)
     if (a_img_info == NULL) {
         return;
     }
+    tsk_img_cache_free(a_img_info);
     a_img_info->close(a_img_info);
 }
@@ -12,13 +12,26 @@
 #endif
 
 typedef void * (* qemu_img_open_t)(const char *filename);
+typedef void (* qemu_img_close_t)(void *);
 typedef int (* qemu_img_read_t)(void *, int64_t offset, uint8_t *buf, size_t len);
+typedef int64_t (* qemu_img_readv_t)(void *, QEMU_IMG_IOV *iov, int count);
+typedef int (* qemu_img_aio_submit_t)(void *, QEMU_IMG_IOV *iov, void *tag);
+typedef int (* qemu_img_aio_poll_t)(void *, QEMU_IMG_AIO_EVENT *events,
+                                    int max, int wait);
 typedef int (* qemu_img_get_info_t)(void *, int64_t *nsectors, 
                                     unsigned int *sect_size, int64_t *size);
+typedef int (* qemu_img_thread_safe_t)(void);
+typedef int (* qemu_img_get_cache_stats_t)(void *, QEMU_IMG_CACHE_STATS *stats);
 
 qemu_img_open_t qemu_img_open = NULL;
+qemu_img_close_t qemu_img_close = NULL;
 qemu_img_read_t qemu_img_read = NULL;
+qemu_img_readv_t qemu_img_readv = NULL;
+qemu_img_aio_submit_t qemu_img_aio_submit = NULL;
+qemu_img_aio_poll_t qemu_img_aio_poll = NULL;
 qemu_img_get_info_t qemu_img_get_info = NULL;
+qemu_img_thread_safe_t qemu_img_thread_safe = NULL;
+qemu_img_get_cache_stats_t qemu_img_get_cache_stats = NULL;
 
 /* Load DLL/shared library for QEMU stubs */
 int qemu_load_lib(IMG_QEMU_INFO *qemu_info)
@@ -57,6 +70,26 @@ int qemu_load_lib(IMG_QEMU_INFO *qemu_info)
                 QEMU_IMG_LIB_DLL_NAME_WIN, GetLastError());
         return -1;
     }
+
+    /* not exported by older libraries, the image is then left open */
+    qemu_img_close = (qemu_img_close_t)GetProcAddress(hd, "qemu_img_close");
+
+    /* not exported by older libraries, requests are then read one by one */
+    qemu_img_readv = (qemu_img_readv_t)GetProcAddress(hd, "qemu_img_readv");
+
+    /* not exported by older libraries, reads are then queued and batched */
+    qemu_img_aio_submit = (qemu_img_aio_submit_t)GetProcAddress(hd,
+        "qemu_img_aio_submit");
+    qemu_img_aio_poll = (qemu_img_aio_poll_t)GetProcAddress(hd,
+        "qemu_img_aio_poll");
+
+    /* not exported by older libraries, reads are then serialized */
+    qemu_img_thread_safe = (qemu_img_thread_safe_t)GetProcAddress(hd,
+        "qemu_img_thread_safe");
+
+    /* not exported by older libraries, only used for verbose output */
+    qemu_img_get_cache_stats = (qemu_img_get_cache_stats_t)GetProcAddress(hd,
+        "qemu_img_get_cache_stats");
 #else
     void *hd = NULL;
     char *error;
@@ -92,6 +125,30 @@ int qemu_load_lib(IMG_QEMU_INFO *qemu_info)
                 QEMU_IMG_LIB_DLL_NAME_LINUX, error);
         return -1;
     }
+
+    /* not exported by older libraries, the image is then left open */
+    qemu_img_close = (qemu_img_close_t)dlsym(hd, "qemu_img_close");
+    dlerror();
+
+    /* not exported by older libraries, requests are then read one by one */
+    qemu_img_readv = (qemu_img_readv_t)dlsym(hd, "qemu_img_readv");
+    dlerror();
+
+    /* not exported by older libraries, reads are then queued and batched */
+    qemu_img_aio_submit = (qemu_img_aio_submit_t)dlsym(hd,
+        "qemu_img_aio_submit");
+    qemu_img_aio_poll = (qemu_img_aio_poll_t)dlsym(hd, "qemu_img_aio_poll");
+    dlerror();
+
+    /* not exported by older libraries, reads are then serialized */
+    qemu_img_thread_safe = (qemu_img_thread_safe_t)dlsym(hd,
+        "qemu_img_thread_safe");
+    dlerror();
+
+    /* not exported by older libraries, only used for verbose output */
+    qemu_img_get_cache_stats = (qemu_img_get_cache_stats_t)dlsym(hd,
+        "qemu_img_get_cache_stats");
+    dlerror();
 #endif
 
     return 0;
@@ -101,6 +158,26 @@ int qemu_load_lib(IMG_QEMU_INFO *qemu_info)
 void qemu_close(TSK_IMG_INFO * img_info)
 {
     IMG_QEMU_INFO *qemu_info = (IMG_QEMU_INFO *) img_info;
+    QEMU_IMG_CACHE_STATS stats;
+
+    memset(&stats, 0, sizeof(stats));
+    if (tsk_verbose && qemu_info->bs && qemu_img_get_cache_stats
+        && qemu_img_get_cache_stats(qemu_info->bs, &stats) == 0) {
+        tsk_fprintf(stderr,
+            "qemu_close: L2 cache %" PRIu64 " hits, %" PRIu64
+            " misses, %" PRId64 " of %" PRId64 " bytes used\n",
+            stats.hits, stats.misses, stats.used, stats.size);
+        if (stats.data_hits || stats.data_misses)
+            tsk_fprintf(stderr,
+                "qemu_close: cluster cache %" PRIu64 " hits, %" PRIu64
+                " misses, %" PRIu64 " inflated ahead, %" PRId64 " of %"
+                PRId64 " bytes used\n", stats.data_hits,
+                stats.data_misses, stats.data_prefetched,
+                stats.data_used, stats.data_size);
+    }
+
+    if (qemu_info->bs && qemu_img_close)
+        qemu_img_close(qemu_info->bs);
 
 #ifdef TSK_WIN32
     FreeLibrary(qemu_info->dll);
@@ -119,6 +196,82 @@ ssize_t qemu_read(TSK_IMG_INFO * img_info, TSK_OFF_T offset, char *buf,
     return qemu_img_read(qemu_info->bs, offset, (uint8_t*)buf, len);
 }
 
+/* Batch read */
+ssize_t qemu_read_batch(TSK_IMG_INFO * img_info, TSK_IMG_READ_REQ * reqs,
+                        int count)
+{
+    IMG_QEMU_INFO *qemu_info = (IMG_QEMU_INFO *) img_info;
+    QEMU_IMG_IOV *iov;
+    int64_t ret;
+    int i;
+
+    if ((iov = (QEMU_IMG_IOV *) tsk_malloc(sizeof(QEMU_IMG_IOV) * count))
+        == NULL)
+        return -1;
+
+    for (i = 0; i < count; i++) {
+        iov[i].offset = reqs[i].off;
+        iov[i].len = reqs[i].len;
+        iov[i].buf = (uint8_t *) reqs[i].buf;
+    }
+
+    ret = qemu_img_readv(qemu_info->bs, iov, count);
+    free(iov);
+
+    if (ret < 0) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_READ;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "qemu_read_batch: error %" PRId64 " reading %d requests", ret,
+            count);
+        return -1;
+    }
+    return ret;
+}
+
+/* Start an asynchronous read */
+static uint8_t qemu_aio_submit_req(TSK_IMG_INFO * img_info,
+                                   TSK_IMG_READ_REQ * req, void *tag)
+{
+    IMG_QEMU_INFO *qemu_info = (IMG_QEMU_INFO *) img_info;
+    QEMU_IMG_IOV iov;
+    int ret;
+
+    iov.offset = req->off;
+    iov.len = req->len;
+    iov.buf = (uint8_t *) req->buf;
+
+    if ((ret = qemu_img_aio_submit(qemu_info->bs, &iov, tag)) < 0) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_READ;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "qemu_aio_submit_req: error %d starting read at %" PRIuOFF,
+            ret, req->off);
+        return 1;
+    }
+    return 0;
+}
+
+/* Collect completed asynchronous reads */
+static int qemu_aio_poll_req(TSK_IMG_INFO * img_info,
+                             TSK_IMG_AIO_EVENT * events, int max,
+                             uint8_t wait)
+{
+    IMG_QEMU_INFO *qemu_info = (IMG_QEMU_INFO *) img_info;
+    QEMU_IMG_AIO_EVENT ev[16];
+    int i, n;
+
+    if (max > (int) _countof(ev))
+        max = _countof(ev);
+
+    n = qemu_img_aio_poll(qemu_info->bs, ev, max, wait);
+    for (i = 0; i < n; i++) {
+        events[i].tag = ev[i].tag;
+        events[i].ret = ev[i].ret < 0 ? -1 : ev[i].ret;
+    }
+    return n;
+}
+
 /* Open and init image through QEMU */
 TSK_IMG_INFO *qemu_open(const TSK_TCHAR * image, unsigned int a_ssize)
 {
@@ -141,6 +294,14 @@ TSK_IMG_INFO *qemu_open(const TSK_TCHAR * image, unsigned int a_ssize)
 
     img_info->itype = TSK_IMG_TYPE_QEMU;
     img_info->read = qemu_read;
+    if (qemu_img_readv)
+        img_info->read_batch = qemu_read_batch;
+    if (qemu_img_aio_submit && qemu_img_aio_poll) {
+        img_info->aio_submit = qemu_aio_submit_req;
+        img_info->aio_poll = qemu_aio_poll_req;
+    }
+    if (qemu_img_thread_safe && qemu_img_thread_safe())
+        img_info->concurrent_read = 1;
     img_info->close = qemu_close;
 
     //qemu does not take widechar, convert to char
@@ -151,6 +312,14 @@ TSK_IMG_INFO *qemu_open(const TSK_TCHAR * image, unsigned int a_ssize)
     
     //open qemu 
     qemu_info->bs = qemu_img_open(filename);
+    if (qemu_info->bs == NULL) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_OPEN;
+        snprintf(tsk_errstr, TSK_ERRSTR_L, "qemu_open: %.*s",
+            (int) (TSK_ERRSTR_L - sizeof("qemu_open: ")), filename);
+        qemu_close(img_info);
+        return NULL;
+    }
 
     //get required img info
     qemu_img_get_info(qemu_info->bs, &sectors, &img_info->sector_size, &img_info->size);
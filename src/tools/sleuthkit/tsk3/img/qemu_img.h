@@ -14,6 +14,35 @@ extern "C" {
 
     extern TSK_IMG_INFO *qemu_open(const TSK_TCHAR *, unsigned int a_ssize);
 
+    /* Request of a qemu_img_readv() batch, same layout as QEMU_IMG_IOV
+     * in qemu-img-lib.h */
+    typedef struct {
+        int64_t offset;
+        size_t len;
+        uint8_t *buf;
+    } QEMU_IMG_IOV;
+
+    /* Completion of qemu_img_aio_submit(), same layout as
+     * QEMU_IMG_AIO_EVENT in qemu-img-lib.h */
+    typedef struct {
+        void *tag;
+        int ret;
+    } QEMU_IMG_AIO_EVENT;
+
+    /* L2 table and decompressed cluster cache counters, same layout as
+     * QEMU_IMG_CACHE_STATS in qemu-img-lib.h */
+    typedef struct {
+        int64_t size;
+        int64_t used;
+        uint64_t hits;
+        uint64_t misses;
+        int64_t data_size;
+        int64_t data_used;
+        uint64_t data_hits;
+        uint64_t data_misses;
+        uint64_t data_prefetched;
+    } QEMU_IMG_CACHE_STATS;
+
     typedef struct {
         TSK_IMG_INFO img_info;
         void *bs;
@@ -24,6 +24,8 @@
 
 #ifdef TSK_WIN32
 #include "winioctl.h"
+#else
+#include <sys/mman.h>
 #endif
 
 
@@ -89,19 +91,18 @@ raw_read(TSK_IMG_INFO * img_info, TSK_OFF_T offset, char *buf, size_t len)
         }
         cnt = (ssize_t) nread;
     }
+    raw_info->seek_pos += cnt;
 #else
-    if (raw_info->seek_pos != offset) {
-        if (lseek(raw_info->fd, offset, SEEK_SET) != offset) {
-            tsk_error_reset();
-            tsk_errno = TSK_ERR_IMG_SEEK;
-            snprintf(tsk_errstr, TSK_ERRSTR_L,
-                "raw_read - %" PRIuOFF " - %s", offset, strerror(errno));
-            return -1;
-        }
-        raw_info->seek_pos = offset;
+    if (raw_info->map) {
+        if ((TSK_OFF_T) len > img_info->size - offset)
+            len = (size_t) (img_info->size - offset);
+        memcpy(buf, &raw_info->map[offset], len);
+        return (ssize_t) len;
     }
 
-    cnt = read(raw_info->fd, buf, len);
+    /* pread() does not use the file position, so several threads can
+     * read at once (see tsk_img_set_concurrent()) */
+    cnt = pread(raw_info->fd, buf, len, offset);
     if (cnt < 0) {
         tsk_error_reset();
         tsk_errno = TSK_ERR_IMG_READ;
@@ -111,10 +112,95 @@ raw_read(TSK_IMG_INFO * img_info, TSK_OFF_T offset, char *buf, size_t len)
         return -1;
     }
 #endif
-    raw_info->seek_pos += cnt;
     return cnt;
 }
 
+#ifndef TSK_WIN32
+/**
+ * Return a pointer to data in the mapped image.
+ *
+ * @param img_info The image to read from.
+ * @param offset The byte offset in the image of the data
+ * @param len Number of bytes needed
+ * @returns NULL if the range is not inside of the image
+ */
+static const char *
+raw_borrow(TSK_IMG_INFO * img_info, TSK_OFF_T offset, size_t len)
+{
+    IMG_RAW_INFO *raw_info = (IMG_RAW_INFO *) img_info;
+
+    if ((offset < 0) || (offset > img_info->size)
+        || ((TSK_OFF_T) len > img_info->size - offset))
+        return NULL;
+    return &raw_info->map[offset];
+}
+
+static void
+raw_advise(TSK_IMG_INFO * img_info, TSK_IMG_ACCESS_ENUM a_access)
+{
+    IMG_RAW_INFO *raw_info = (IMG_RAW_INFO *) img_info;
+
+    raw_info->access = a_access;
+    if (raw_info->map)
+        tsk_img_madvise(raw_info->map, (size_t) img_info->size, a_access);
+    else
+        tsk_img_fadvise(raw_info->fd, a_access);
+}
+
+/**
+ * Map the whole image into memory or remove the mapping.  Reads of a
+ * mapped image copy from the mapping and never fail.
+ *
+ * @param img_info The image to change
+ * @param a_enable 1 to map the image and 0 to remove the mapping
+ * @returns 1 on error and 0 on success
+ */
+static uint8_t
+raw_map(TSK_IMG_INFO * img_info, uint8_t a_enable)
+{
+    IMG_RAW_INFO *raw_info = (IMG_RAW_INFO *) img_info;
+    void *map;
+
+    if (a_enable == 0) {
+        if (raw_info->map) {
+            img_info->borrow = NULL;
+            munmap(raw_info->map, (size_t) img_info->size);
+            raw_info->map = NULL;
+        }
+        return 0;
+    }
+    else if (raw_info->map) {
+        return 0;
+    }
+
+    // the whole image has to fit into the address space
+    if ((img_info->size <= 0)
+        || ((TSK_OFF_T) (size_t) img_info->size != img_info->size)) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_OPEN;
+        snprintf(tsk_errstr, TSK_ERRSTR_L,
+            "raw_map: image of %" PRIuOFF " bytes cannot be mapped",
+            img_info->size);
+        return 1;
+    }
+
+    map = mmap(NULL, (size_t) img_info->size, PROT_READ, MAP_SHARED,
+        raw_info->fd, 0);
+    if (map == MAP_FAILED) {
+        tsk_error_reset();
+        tsk_errno = TSK_ERR_IMG_OPEN;
+        snprintf(tsk_errstr, TSK_ERRSTR_L, "raw_map: %s", strerror(errno));
+        return 1;
+    }
+    raw_info->map = (char *) map;
+    if (raw_info->access != TSK_IMG_ACCESS_NORMAL)
+        tsk_img_madvise(raw_info->map, (size_t) img_info->size,
+            raw_info->access);
+    img_info->borrow = raw_borrow;
+    return 0;
+}
+#endif
+
 static void
 raw_imgstat(TSK_IMG_INFO * img_info, FILE * hFile)
 {
@@ -132,6 +218,7 @@ raw_close(TSK_IMG_INFO * img_info)
 #ifdef TSK_WIN32
     CloseHandle(raw_info->fd);
 #else
+    raw_map(img_info, 0);
     close(raw_info->fd);
 #endif
     free(raw_info);
@@ -161,6 +248,11 @@ raw_open(const TSK_TCHAR * image, unsigned int a_ssize)
 
     img_info->itype = TSK_IMG_TYPE_RAW_SING;
     img_info->read = raw_read;
+#ifndef TSK_WIN32
+    img_info->concurrent_read = 1;
+    img_info->map = raw_map;
+    img_info->advise = raw_advise;
+#endif
     img_info->close = raw_close;
     img_info->imgstat = raw_imgstat;
 
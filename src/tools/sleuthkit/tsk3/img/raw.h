@@ -27,7 +27,9 @@ extern "C" {
 #else
         int fd;
 #endif
-        TSK_OFF_T seek_pos;
+        TSK_OFF_T seek_pos;     // file position (Windows only, others use pread())
+        char *map;              // mapping of the whole image (NULL if not mapped)
+        TSK_IMG_ACCESS_ENUM access;     // last hint passed to tsk_img_set_access()
     } IMG_RAW_INFO;
 
 #ifdef __cplusplus
@@ -15,6 +15,15 @@
 #include "tsk_img_i.h"
 #include "split.h"
 
+#ifndef TSK_WIN32
+#include <sys/mman.h>
+#endif
+
+/* Size of one of the disk images in the set */
+#define SPLIT_SEG_SIZE(split_info, idx) \
+    ((split_info)->max_off[(idx)] - \
+     (((idx) > 0) ? (split_info)->max_off[(idx) - 1] : 0))
+
 
 /** 
  * \internal
@@ -34,6 +43,18 @@ split_read_segment(IMG_SPLIT_INFO * split_info, int idx, char *buf,
     IMG_SPLIT_CACHE *cimg;
     ssize_t cnt;
 
+    /* Copy from the mapping if the set is mapped */
+    if (split_info->map) {
+        TSK_OFF_T seg_size = SPLIT_SEG_SIZE(split_info, idx);
+
+        if (rel_offset >= seg_size)
+            return 0;
+        if ((TSK_OFF_T) len > seg_size - rel_offset)
+            len = (size_t) (seg_size - rel_offset);
+        memcpy(buf, &split_info->map[idx][rel_offset], len);
+        return (ssize_t) len;
+    }
+
     /* Is the image already open? */
     if (split_info->cptr[idx] == -1) {
         if (tsk_verbose)
@@ -79,6 +100,10 @@ split_read_segment(IMG_SPLIT_INFO * split_info, int idx, char *buf,
                 split_info->images[idx], strerror(errno));
             return -1;
         }
+#endif
+#ifndef TSK_WIN32
+        if (split_info->access != TSK_IMG_ACCESS_NORMAL)
+            tsk_img_fadvise(cimg->fd, split_info->access);
 #endif
         cimg->image = idx;
         cimg->seek_pos = 0;
@@ -227,7 +252,8 @@ split_read(TSK_IMG_INFO * img_info, TSK_OFF_T offset, char *buf,
 
                 len -= read_len;
 
-                while (len > 0) {
+                // stop at the end of the last image
+                while ((len > 0) && (i + 1 < split_info->num_img)) {
                     /* go to the next image */
                     i++;
 
@@ -270,6 +296,165 @@ split_read(TSK_IMG_INFO * img_info, TSK_OFF_T offset, char *buf,
     return -1;
 }
 
+#ifndef TSK_WIN32
+/**
+ * \internal
+ * Return a pointer to data in the mapped set of disk images.
+ *
+ * @param img_info Disk image to read from
+ * @param offset Byte offset in image of the data
+ * @param len Number of bytes needed
+ * @return NULL if the range is not inside of one of the images
+ */
+static const char *
+split_borrow(TSK_IMG_INFO * img_info, TSK_OFF_T offset, size_t len)
+{
+    IMG_SPLIT_INFO *split_info = (IMG_SPLIT_INFO *) img_info;
+    int i;
+
+    if (offset < 0)
+        return NULL;
+
+    for (i = 0; i < split_info->num_img; i++) {
+        if (offset < split_info->max_off[i]) {
+            TSK_OFF_T rel_offset = offset - (split_info->max_off[i] -
+                SPLIT_SEG_SIZE(split_info, i));
+
+            if ((TSK_OFF_T) len > split_info->max_off[i] - offset)
+                return NULL;
+            return &split_info->map[i][rel_offset];
+        }
+    }
+    return NULL;
+}
+
+static void
+split_advise(TSK_IMG_INFO * img_info, TSK_IMG_ACCESS_ENUM a_access)
+{
+    IMG_SPLIT_INFO *split_info = (IMG_SPLIT_INFO *) img_info;
+    int i;
+
+    split_info->access = a_access;
+    if (split_info->map) {
+        for (i = 0; i < split_info->num_img; i++) {
+            if (split_info->map[i])
+                tsk_img_madvise(split_info->map[i],
+                    (size_t) SPLIT_SEG_SIZE(split_info, i), a_access);
+        }
+    }
+    else {
+        for (i = 0; i < SPLIT_CACHE; i++) {
+            if (split_info->cache[i].fd != 0)
+                tsk_img_fadvise(split_info->cache[i].fd, a_access);
+        }
+    }
+}
+
+/** 
+ * \internal
+ * Remove the mappings of the disk images in the set.
+ *
+ * @param split_info Disk image set
+ */
+static void
+split_unmap(IMG_SPLIT_INFO * split_info)
+{
+    int i;
+
+    if (split_info->map == NULL)
+        return;
+
+    split_info->img_info.borrow = NULL;
+    split_info->img_info.concurrent_read = 0;
+    for (i = 0; i < split_info->num_img; i++) {
+        if (split_info->map[i])
+            munmap(split_info->map[i],
+                (size_t) SPLIT_SEG_SIZE(split_info, i));
+    }
+    free(split_info->map);
+    split_info->map = NULL;
+}
+
+/** 
+ * \internal
+ * Map all of the disk images in the set into memory or remove the
+ * mappings.  The files are closed after they are mapped, so the set does
+ * not use file descriptors while it is mapped.
+ *
+ * @param img_info Disk image set to change
+ * @param a_enable 1 to map the images and 0 to remove the mappings
+ * @return 1 on error and 0 on success
+ */
+static uint8_t
+split_map(TSK_IMG_INFO * img_info, uint8_t a_enable)
+{
+    IMG_SPLIT_INFO *split_info = (IMG_SPLIT_INFO *) img_info;
+    int i;
+
+    if (a_enable == 0) {
+        split_unmap(split_info);
+        return 0;
+    }
+    else if (split_info->map) {
+        return 0;
+    }
+
+    if ((split_info->map =
+            (char **) tsk_malloc(split_info->num_img * sizeof(char *))) ==
+        NULL)
+        return 1;
+
+    for (i = 0; i < split_info->num_img; i++) {
+        TSK_OFF_T seg_size = SPLIT_SEG_SIZE(split_info, i);
+        void *map;
+        int fd;
+
+        if (seg_size == 0)
+            continue;
+
+        if ((TSK_OFF_T) (size_t) seg_size != seg_size) {
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_IMG_OPEN;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "split_map: %" PRIttocTSK " is too large to map",
+                split_info->images[i]);
+            split_unmap(split_info);
+            return 1;
+        }
+
+        if ((fd = open(split_info->images[i], O_RDONLY | O_BINARY)) < 0) {
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_IMG_OPEN;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "split_map file: %" PRIttocTSK " msg: %s",
+                split_info->images[i], strerror(errno));
+            split_unmap(split_info);
+            return 1;
+        }
+        map = mmap(NULL, (size_t) seg_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_IMG_OPEN;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "split_map file: %" PRIttocTSK " msg: %s",
+                split_info->images[i], strerror(errno));
+            split_unmap(split_info);
+            return 1;
+        }
+        split_info->map[i] = (char *) map;
+        if (split_info->access != TSK_IMG_ACCESS_NORMAL)
+            tsk_img_madvise(split_info->map[i], (size_t) seg_size,
+                split_info->access);
+    }
+
+    // reads only copy from the mappings now
+    img_info->concurrent_read = 1;
+    img_info->borrow = split_borrow;
+    return 0;
+}
+#endif
+
 /** 
  * \internal
  * Display information about the disk image set.
@@ -312,6 +497,9 @@ split_close(TSK_IMG_INFO * img_info)
 {
     int i;
     IMG_SPLIT_INFO *split_info = (IMG_SPLIT_INFO *) img_info;
+#ifndef TSK_WIN32
+    split_unmap(split_info);
+#endif
     for (i = 0; i < SPLIT_CACHE; i++) {
         if (split_info->cache[i].fd != 0)
 #ifdef TSK_WIN32
@@ -351,6 +539,10 @@ split_open(int num_img, const TSK_TCHAR * const images[],
 
     img_info->itype = TSK_IMG_TYPE_RAW_SPLIT;
     img_info->read = split_read;
+#ifndef TSK_WIN32
+    img_info->map = split_map;
+    img_info->advise = split_advise;
+#endif
     img_info->close = split_close;
     img_info->imgstat = split_imgstat;
 
@@ -41,6 +41,8 @@ extern "C" {
         int *cptr;              /* exists for each image - points to entry in cache */
         IMG_SPLIT_CACHE cache[SPLIT_CACHE];     /* small number of fds for open images */
         int next_slot;
+        char **map;             /* mapping of each image (NULL if the set is not mapped) */
+        TSK_IMG_ACCESS_ENUM access;     /* last hint passed to tsk_img_set_access() */
     } IMG_SPLIT_INFO;
 
 #ifdef __cplusplus
@@ -70,10 +70,50 @@ extern "C" {
         TSK_IMG_TYPE_UNSUPP = 0xffff,   ///< Unsupported disk image type
     } TSK_IMG_TYPE_ENUM;
 
-#define TSK_IMG_INFO_CACHE_NUM  4
-#define TSK_IMG_INFO_CACHE_LEN  65536
+#define TSK_IMG_CACHE_BLOCK_LEN  65536  ///< Size of a read cache block (blocks are aligned to it)
+#define TSK_IMG_CACHE_DEFAULT_SIZE  (16 * 1024 * 1024)  ///< Default read cache budget in bytes
+#define TSK_IMG_READAHEAD_DEFAULT_SIZE  (1024 * 1024)   ///< Default readahead limit in bytes
 
     typedef struct TSK_IMG_INFO TSK_IMG_INFO;
+    typedef struct TSK_IMG_CACHE TSK_IMG_CACHE;
+
+    /**
+     * One request of a batch passed to tsk_img_read_batch().
+     */
+    typedef struct {
+        TSK_OFF_T off;          ///< Byte offset in the image to read from
+        char *buf;              ///< Buffer to read into
+        size_t len;             ///< Number of bytes to read
+    } TSK_IMG_READ_REQ;
+
+    /**
+     * Completion of a read started with tsk_img_aio_submit().
+     */
+    typedef struct {
+        void *tag;              ///< Tag passed to tsk_img_aio_submit()
+        ssize_t ret;            ///< Number of bytes read or -1 on error
+    } TSK_IMG_AIO_EVENT;
+
+    /**
+     * How an image is going to be read, passed to tsk_img_set_access().
+     */
+    typedef enum {
+        TSK_IMG_ACCESS_NORMAL = 0,      ///< No particular order (the default)
+        TSK_IMG_ACCESS_SEQUENTIAL = 1,  ///< Mostly in increasing order, so read far ahead
+        TSK_IMG_ACCESS_RANDOM = 2,      ///< Mostly at scattered offsets, so do not read ahead
+    } TSK_IMG_ACCESS_ENUM;
+
+    /**
+     * Read cache counters, filled in by tsk_img_cache_stats().
+     */
+    typedef struct {
+        size_t size;            ///< Memory budget of the cache in bytes (0 if disabled)
+        size_t used;            ///< Bytes currently allocated for cached blocks
+        uint64_t hits;          ///< Number of block lookups found in the cache
+        uint64_t misses;        ///< Number of block lookups that read the image
+        uint64_t evictions;     ///< Number of blocks replaced to make room
+        uint64_t readahead;     ///< Number of blocks loaded by readahead
+    } TSK_IMG_CACHE_STATS;
 
     /**
      * Created when a disk image has been opened and stores general information and handles.
@@ -84,12 +124,16 @@ extern "C" {
         TSK_OFF_T size;         ///< Total size of image in bytes
         unsigned int sector_size;       ///< sector size of device in bytes (typically 512)
 
-        char cache[TSK_IMG_INFO_CACHE_NUM][TSK_IMG_INFO_CACHE_LEN];     ///< read cache
-        TSK_OFF_T cache_off[TSK_IMG_INFO_CACHE_NUM];    ///< starting byte offset of corresponding cache entry
-        int cache_age[TSK_IMG_INFO_CACHE_NUM];  ///< "Age" of corresponding cache entry, higher means more recently used
-        size_t cache_len[TSK_IMG_INFO_CACHE_NUM];       ///< Length of cache entry used (0 if never used)
+        TSK_IMG_CACHE *cache;   ///< \internal Read cache, created on the first tsk_img_read()
+        uint8_t concurrent_read;        ///< \internal Set by formats whose read functions can be called from several threads at once
 
          ssize_t(*read) (TSK_IMG_INFO * img, TSK_OFF_T off, char *buf, size_t len);     ///< \internal External progs should call tsk_img_read() 
+         ssize_t(*read_batch) (TSK_IMG_INFO * img, TSK_IMG_READ_REQ * reqs, int count);  ///< \internal Optional (NULL if not supported). External progs should call tsk_img_read_batch()
+         uint8_t(*aio_submit) (TSK_IMG_INFO * img, TSK_IMG_READ_REQ * req, void *tag);  ///< \internal Optional (NULL if not supported). External progs should call tsk_img_aio_submit()
+        int (*aio_poll) (TSK_IMG_INFO * img, TSK_IMG_AIO_EVENT * events, int max, uint8_t wait);        ///< \internal Optional (NULL if not supported). External progs should call tsk_img_aio_poll()
+         uint8_t(*map) (TSK_IMG_INFO * img, uint8_t enable);   ///< \internal Optional (NULL if not supported). External progs should call tsk_img_set_mmap()
+        const char *(*borrow) (TSK_IMG_INFO * img, TSK_OFF_T off, size_t len);  ///< \internal Set while the image is mapped (NULL otherwise). External progs should call tsk_img_borrow()
+        void (*advise) (TSK_IMG_INFO * img, TSK_IMG_ACCESS_ENUM access);       ///< \internal Optional (NULL if not supported). External progs should call tsk_img_set_access()
         void (*close) (TSK_IMG_INFO *); ///< \internal Progs should call tsk_img_close()
         void (*imgstat) (TSK_IMG_INFO *, FILE *);       ///< Pointer to file type specific function
     };
@@ -111,6 +155,34 @@ extern "C" {
     // read functions
     extern ssize_t tsk_img_read(TSK_IMG_INFO * img, TSK_OFF_T off,
         char *buf, size_t len);
+    extern uint8_t tsk_img_read_batch(TSK_IMG_INFO * img,
+        TSK_IMG_READ_REQ * reqs, int count);
+    extern uint8_t tsk_img_aio_submit(TSK_IMG_INFO * img,
+        TSK_IMG_READ_REQ * req, void *tag);
+    extern int tsk_img_aio_poll(TSK_IMG_INFO * img,
+        TSK_IMG_AIO_EVENT * events, int max, uint8_t wait);
+    extern int tsk_img_aio_poll_range(TSK_IMG_INFO * img, void *lo,
+        void *hi, TSK_IMG_AIO_EVENT * events, int max, uint8_t wait);
+    extern uint8_t tsk_img_aio_claim(TSK_IMG_INFO * img);
+    extern void tsk_img_aio_release(TSK_IMG_INFO * img);
+
+    // memory mapped images
+    extern uint8_t tsk_img_set_mmap(TSK_IMG_INFO * img, uint8_t a_enable);
+    extern const char *tsk_img_borrow(TSK_IMG_INFO * img, TSK_OFF_T off,
+        size_t len);
+    extern uint8_t tsk_img_set_access(TSK_IMG_INFO * img,
+        TSK_IMG_ACCESS_ENUM a_access);
+
+    // threads
+    extern uint8_t tsk_img_set_concurrent(TSK_IMG_INFO * img);
+
+    // read cache functions
+    extern uint8_t tsk_img_cache_set_size(TSK_IMG_INFO * img,
+        size_t a_size);
+    extern uint8_t tsk_img_cache_set_readahead(TSK_IMG_INFO * img,
+        size_t a_size);
+    extern void tsk_img_cache_stats(TSK_IMG_INFO * img,
+        TSK_IMG_CACHE_STATS * a_stats);
 
     // type conversion functions
     extern TSK_IMG_TYPE_ENUM tsk_img_type_toid(const TSK_TCHAR *);
@@ -32,4 +32,10 @@
 #define O_BINARY 0
 #endif
 
+extern void tsk_img_cache_free(TSK_IMG_INFO *);
+#ifndef TSK_WIN32
+extern void tsk_img_madvise(char *, size_t, TSK_IMG_ACCESS_ENUM);
+extern void tsk_img_fadvise(int, TSK_IMG_ACCESS_ENUM);
+#endif
+
 #endif
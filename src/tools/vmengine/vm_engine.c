@@ -0,0 +1,316 @@
+/*
+ * VM-XRay inspection engine
+ *
+ * One handle per VM disk image.  The image is opened through the QEMU
+ * backend once, the partition holding the guest file system is located
+ * once and the file system stays open until vme_close().  The Python
+ * profilers load this library through ctypes instead of launching
+ * mmls/fls/icat for every path component.
+ */
+
+#include "tsk3/tsk_tools_i.h"
+#include "vm_engine.h"
+
+/* Partition descriptions tried in order when picking the file system,
+ * same preference the profilers used with mmls. */
+static const char *vme_part_desc[] = {
+    "Linux (0x83)",
+    "NTFS (0x07)",
+    NULL
+};
+
+typedef struct {
+    const char *desc;
+    TSK_OFF_T offset;
+    uint8_t found;
+} VME_PART_DATA;
+
+static TSK_WALK_RET_ENUM
+vme_part_act(TSK_VS_INFO * vs, const TSK_VS_PART_INFO * part, void *ptr)
+{
+    VME_PART_DATA *data = (VME_PART_DATA *) ptr;
+
+    if ((part->desc == NULL) || (strstr(part->desc, data->desc) == NULL))
+        return TSK_WALK_CONT;
+
+    data->offset = (TSK_OFF_T) part->start * vs->block_size;
+    data->found = 1;
+    return TSK_WALK_STOP;
+}
+
+/* Open the file system: a known partition type first, then any
+ * allocated partition TSK can read, then the image as a bare file system. */
+static TSK_FS_INFO *
+vme_fs_open(VM_ENGINE * vme)
+{
+    TSK_FS_INFO *fs;
+    TSK_PNUM_T i;
+    int d;
+
+    vme->vs = tsk_vs_open(vme->img, 0, TSK_VS_TYPE_DETECT);
+    if (vme->vs == NULL) {
+        tsk_error_reset();
+        vme->fs_offset = 0;
+        return tsk_fs_open_img(vme->img, 0, TSK_FS_TYPE_DETECT);
+    }
+
+    for (d = 0; vme_part_desc[d] != NULL; d++) {
+        VME_PART_DATA data;
+
+        data.desc = vme_part_desc[d];
+        data.found = 0;
+        if (tsk_vs_part_walk(vme->vs, 0, vme->vs->part_count - 1,
+                TSK_VS_PART_FLAG_ALLOC, vme_part_act, &data))
+            return NULL;
+        if (data.found == 0)
+            continue;
+
+        vme->fs_offset = data.offset;
+        if ((fs = tsk_fs_open_img(vme->img, data.offset,
+                    TSK_FS_TYPE_DETECT)) != NULL)
+            return fs;
+        tsk_error_reset();
+    }
+
+    for (i = 0; i < vme->vs->part_count; i++) {
+        const TSK_VS_PART_INFO *part = tsk_vs_part_get(vme->vs, i);
+
+        if ((part == NULL) || ((part->flags & TSK_VS_PART_FLAG_ALLOC) == 0))
+            continue;
+
+        if ((fs = tsk_fs_open_vol(part, TSK_FS_TYPE_DETECT)) != NULL) {
+            vme->fs_offset = (TSK_OFF_T) part->start * vme->vs->block_size;
+            return fs;
+        }
+        tsk_error_reset();
+    }
+
+    tsk_error_reset();
+    tsk_errno = TSK_ERR_FS_UNKTYPE;
+    snprintf(tsk_errstr, TSK_ERRSTR_L,
+        "vme_open: no readable file system found");
+    return NULL;
+}
+
+/**
+ * Open a VM disk image and the file system inside it.
+ * @returns handle or NULL on error (see vme_error())
+ */
+VME_EXPORT VM_ENGINE *
+vme_open(const char *image)
+{
+    VM_ENGINE *vme;
+
+    if ((vme = (VM_ENGINE *) tsk_malloc(sizeof(VM_ENGINE))) == NULL)
+        return NULL;
+
+    if ((vme->img_ref = (int *) tsk_malloc(sizeof(int))) == NULL) {
+        free(vme);
+        return NULL;
+    }
+    *vme->img_ref = 1;
+
+    vme->img = tsk_img_open_utf8_sing(image, TSK_IMG_TYPE_QEMU, 0);
+    if (vme->img == NULL) {
+        free(vme->img_ref);
+        free(vme);
+        return NULL;
+    }
+
+    if ((vme->fs = vme_fs_open(vme)) == NULL) {
+        vme_close(vme);
+        return NULL;
+    }
+
+    return vme;
+}
+
+/**
+ * Open another handle on the image of vme for use by a different
+ * thread.  The image is switched to concurrent reads on the first call,
+ * so clones must be made before other threads use vme.  The image is
+ * closed with the last handle that shares it.
+ * @returns handle or NULL on error (see vme_error())
+ */
+VME_EXPORT VM_ENGINE *
+vme_clone(VM_ENGINE * vme)
+{
+    VM_ENGINE *clone;
+
+    tsk_error_reset();
+    if (tsk_img_set_concurrent(vme->img))
+        return NULL;
+
+    if ((clone = (VM_ENGINE *) tsk_malloc(sizeof(VM_ENGINE))) == NULL)
+        return NULL;
+
+    clone->img = vme->img;
+    clone->fs_offset = vme->fs_offset;
+    if ((clone->fs = tsk_fs_open_img(clone->img, clone->fs_offset,
+                vme->fs->ftype)) == NULL) {
+        free(clone);
+        return NULL;
+    }
+
+    clone->img_ref = vme->img_ref;
+    __sync_fetch_and_add(clone->img_ref, 1);
+    return clone;
+}
+
+/**
+ * Close the handle and everything that was opened through it.
+ */
+VME_EXPORT void
+vme_close(VM_ENGINE * vme)
+{
+    if (vme == NULL)
+        return;
+
+    if (vme->file)
+        tsk_fs_file_close(vme->file);
+    if (vme->fs)
+        tsk_fs_close(vme->fs);
+    if (vme->vs)
+        tsk_vs_close(vme->vs);
+    if (__sync_sub_and_fetch(vme->img_ref, 1) == 0) {
+        if (vme->img)
+            tsk_img_close(vme->img);
+        free(vme->img_ref);
+    }
+    free(vme);
+}
+
+/**
+ * Resolve a path (relative to the file system root) to its inode.
+ * @returns 0 if found, 1 if not found and -1 on error
+ */
+VME_EXPORT int
+vme_lookup(VM_ENGINE * vme, const char *path, uint64_t * inum)
+{
+    TSK_INUM_T addr;
+    int8_t ret;
+
+    tsk_error_reset();
+    ret = tsk_fs_path2inum(vme->fs, path, &addr, NULL);
+    if (ret == 0)
+        *inum = addr;
+    return ret;
+}
+
+/**
+ * List a directory.  Every entry is returned as "inum\ttype\tname\n" in
+ * one buffer, which the caller releases with vme_free().
+ * @returns buffer or NULL on error
+ */
+VME_EXPORT char *
+vme_list_dir(VM_ENGINE * vme, uint64_t inum)
+{
+    TSK_FS_DIR *fs_dir;
+    size_t i, len = 0, size = 4096;
+    char *buf;
+
+    tsk_error_reset();
+    if ((fs_dir = tsk_fs_dir_open_meta(vme->fs, (TSK_INUM_T) inum)) == NULL)
+        return NULL;
+
+    if ((buf = (char *) tsk_malloc(size)) == NULL) {
+        tsk_fs_dir_close(fs_dir);
+        return NULL;
+    }
+
+    // only the names are listed, so the files' metadata is not loaded
+    for (i = 0; i < tsk_fs_dir_getsize(fs_dir); i++) {
+        const TSK_FS_NAME *fs_name;
+        size_t need;
+
+        if ((fs_name = tsk_fs_dir_get_name(fs_dir, i)) == NULL)
+            continue;
+
+        if ((fs_name->name == NULL)
+            || ((fs_name->flags & TSK_FS_NAME_FLAG_ALLOC) == 0))
+            continue;
+
+        need = strlen(fs_name->name) + 48;
+        if (len + need >= size) {
+            char *tmp;
+
+            size = (size + need) * 2;
+            if ((tmp = (char *) tsk_realloc(buf, size)) == NULL) {
+                tsk_fs_dir_close(fs_dir);
+                free(buf);
+                return NULL;
+            }
+            buf = tmp;
+        }
+
+        len += snprintf(&buf[len], size - len, "%" PRIuINUM "\t%s\t%s\n",
+            fs_name->meta_addr, tsk_fs_name_type_str[fs_name->type],
+            fs_name->name);
+    }
+
+    tsk_fs_dir_close(fs_dir);
+    return buf;
+}
+
+/* Return the open file for inum, reusing the last one when possible. */
+static TSK_FS_FILE *
+vme_file_get(VM_ENGINE * vme, uint64_t inum)
+{
+    if ((vme->file) && (vme->file->meta)
+        && (vme->file->meta->addr == (TSK_INUM_T) inum))
+        return vme->file;
+
+    if (vme->file) {
+        tsk_fs_file_close(vme->file);
+        vme->file = NULL;
+    }
+
+    tsk_error_reset();
+    vme->file = tsk_fs_file_open_meta(vme->fs, NULL, (TSK_INUM_T) inum);
+    return vme->file;
+}
+
+/**
+ * @returns size of the file in bytes or -1 on error
+ */
+VME_EXPORT int64_t
+vme_file_size(VM_ENGINE * vme, uint64_t inum)
+{
+    TSK_FS_FILE *fs_file;
+
+    if ((fs_file = vme_file_get(vme, inum)) == NULL)
+        return -1;
+    if (fs_file->meta == NULL)
+        return -1;
+    return fs_file->meta->size;
+}
+
+/**
+ * Read from the default data attribute of a file.
+ * @returns number of bytes read or -1 on error
+ */
+VME_EXPORT int64_t
+vme_read(VM_ENGINE * vme, uint64_t inum, int64_t offset, char *buf,
+    size_t len)
+{
+    TSK_FS_FILE *fs_file;
+
+    if ((fs_file = vme_file_get(vme, inum)) == NULL)
+        return -1;
+    return tsk_fs_file_read(fs_file, offset, buf, len, 0);
+}
+
+/**
+ * @returns description of the last error (or NULL)
+ */
+VME_EXPORT const char *
+vme_error(void)
+{
+    return tsk_error_get();
+}
+
+VME_EXPORT void
+vme_free(void *ptr)
+{
+    free(ptr);
+}
@@ -0,0 +1,57 @@
+/*
+ * VM-XRay inspection engine
+ *
+ * Keeps a disk image, its volume system and the inspected file system
+ * open for the lifetime of a handle, so that path lookups, directory
+ * listings and file reads do not pay for image/partition/superblock
+ * setup again on every call.
+ *
+ * A handle is used by one thread at a time.  To read a VM from several
+ * threads, give every thread its own handle from vme_clone(): the clones
+ * share the opened image and its read cache and have their own file
+ * system state.
+ */
+
+#ifndef _VM_ENGINE_H
+#define _VM_ENGINE_H
+
+#include "tsk3/libtsk.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _WIN32
+#define VME_EXPORT __declspec(dllexport)
+#else
+#define VME_EXPORT
+#endif
+
+    typedef struct {
+        TSK_IMG_INFO *img;      ///< Opened disk image (QEMU backend)
+        TSK_VS_INFO *vs;        ///< Volume system, NULL for a bare file system image
+        TSK_FS_INFO *fs;        ///< File system that is inspected
+        TSK_OFF_T fs_offset;    ///< Byte offset of the file system in the image
+
+        TSK_FS_FILE *file;      ///< Last file read from (kept open for follow-up reads)
+        int *img_ref;           ///< Number of handles sharing img (see vme_clone())
+    } VM_ENGINE;
+
+    VME_EXPORT VM_ENGINE *vme_open(const char *image);
+    VME_EXPORT VM_ENGINE *vme_clone(VM_ENGINE * vme);
+    VME_EXPORT void vme_close(VM_ENGINE * vme);
+
+    VME_EXPORT int vme_lookup(VM_ENGINE * vme, const char *path,
+        uint64_t * inum);
+    VME_EXPORT char *vme_list_dir(VM_ENGINE * vme, uint64_t inum);
+    VME_EXPORT int64_t vme_file_size(VM_ENGINE * vme, uint64_t inum);
+    VME_EXPORT int64_t vme_read(VM_ENGINE * vme, uint64_t inum,
+        int64_t offset, char *buf, size_t len);
+
+    VME_EXPORT const char *vme_error(void);
+    VME_EXPORT void vme_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
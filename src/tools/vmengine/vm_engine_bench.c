@@ -0,0 +1,259 @@
+/*
+ * VM-XRay inspection daemon load generator
+ *
+ * Sends requests for every image in a directory to a running vm_engined
+ * from a number of concurrent clients and reports requests/sec and the
+ * p50/p99 request latency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define BENCH_MAX_PATHS 64
+
+static const char *sock_path = NULL;
+static const char *request = "READ";
+static char **images = NULL;
+static int image_num = 0;
+static char *paths[BENCH_MAX_PATHS];
+static int path_num = 0;
+static int req_per_client = 100;
+
+typedef struct {
+    int id;
+    double *lat;                ///< Latency of each successful request in ms
+    int ok;                     ///< Number of latencies in lat
+    int errors;
+} BENCH_CLIENT;
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-c clients] [-n requests] [-r request] -s socket -d image_dir path...\n"
+        "\t-c clients: Number of concurrent clients (default 4)\n"
+        "\t-n requests: Requests sent by each client (default 100)\n"
+        "\t-r request: LOOKUP, LIST or READ (default READ)\n"
+        "\t-s socket: Socket vm_engined listens on\n"
+        "\t-d image_dir: Directory with the images to request\n",
+        prog);
+    exit(1);
+}
+
+static double
+now_ms()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static int
+bench_connect()
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Read the reply header and drain the payload.
+ * Returns 0 for an OK reply, 1 for ERR and -1 if the connection failed. */
+static int
+bench_reply(FILE * fp)
+{
+    char line[1024], buf[65536];
+    size_t len;
+
+    if (fgets(line, sizeof(line), fp) == NULL)
+        return -1;
+    if (strncmp(line, "OK ", 3) != 0)
+        return 1;
+
+    len = strtoul(&line[3], NULL, 10);
+    while (len > 0) {
+        size_t cnt = fread(buf, 1, len < sizeof(buf) ? len : sizeof(buf),
+            fp);
+        if (cnt == 0)
+            return -1;
+        len -= cnt;
+    }
+    return 0;
+}
+
+static void *
+bench_client(void *ptr)
+{
+    BENCH_CLIENT *cl = (BENCH_CLIENT *) ptr;
+    FILE *fp;
+    int fd, i;
+
+    if ((fd = bench_connect()) < 0) {
+        fprintf(stderr, "Unable to connect to %s: %s\n", sock_path,
+            strerror(errno));
+        cl->errors = req_per_client;
+        return NULL;
+    }
+    fp = fdopen(fd, "r+");
+
+    for (i = 0; i < req_per_client; i++) {
+        int n = cl->id + i;
+        double start = now_ms();
+        int ret;
+
+        fprintf(fp, "%s\t%s\t%s\n", request, images[n % image_num],
+            paths[(n / image_num) % path_num]);
+        fflush(fp);
+
+        if ((ret = bench_reply(fp)) < 0) {
+            cl->errors += req_per_client - i;
+            break;
+        }
+        if (ret)
+            cl->errors++;
+        else
+            cl->lat[cl->ok++] = now_ms() - start;
+    }
+
+    fclose(fp);
+    return NULL;
+}
+
+static int
+lat_cmp(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static void
+load_images(const char *dir)
+{
+    DIR *dp;
+    struct dirent *de;
+
+    if ((dp = opendir(dir)) == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", dir, strerror(errno));
+        exit(1);
+    }
+
+    while ((de = readdir(dp)) != NULL) {
+        struct stat st;
+        char *path;
+
+        if (de->d_name[0] == '.')
+            continue;
+        path = (char *) malloc(strlen(dir) + strlen(de->d_name) + 2);
+        sprintf(path, "%s/%s", dir, de->d_name);
+        if ((stat(path, &st) < 0) || (!S_ISREG(st.st_mode))) {
+            free(path);
+            continue;
+        }
+        images = (char **) realloc(images, sizeof(char *) * (image_num + 1));
+        images[image_num++] = path;
+    }
+    closedir(dp);
+}
+
+int
+main(int argc, char **argv)
+{
+    BENCH_CLIENT *clients;
+    pthread_t *threads;
+    double *lat, start, elapsed;
+    int client_num = 4;
+    int ch, i, total, ok = 0, errors = 0;
+    const char *image_dir = NULL;
+
+    while ((ch = getopt(argc, argv, "c:d:n:r:s:")) > 0) {
+        switch (ch) {
+        case 'c':
+            client_num = atoi(optarg);
+            break;
+        case 'd':
+            image_dir = optarg;
+            break;
+        case 'n':
+            req_per_client = atoi(optarg);
+            break;
+        case 'r':
+            request = optarg;
+            break;
+        case 's':
+            sock_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ((sock_path == NULL) || (image_dir == NULL) || (optind == argc)
+        || (client_num < 1) || (req_per_client < 1))
+        usage(argv[0]);
+
+    for (; (optind < argc) && (path_num < BENCH_MAX_PATHS); optind++)
+        paths[path_num++] = argv[optind];
+
+    load_images(image_dir);
+    if (image_num == 0) {
+        fprintf(stderr, "No images found in %s\n", image_dir);
+        exit(1);
+    }
+
+    total = client_num * req_per_client;
+    lat = (double *) calloc(total, sizeof(double));
+    clients = (BENCH_CLIENT *) calloc(client_num, sizeof(BENCH_CLIENT));
+    threads = (pthread_t *) calloc(client_num, sizeof(pthread_t));
+
+    start = now_ms();
+    for (i = 0; i < client_num; i++) {
+        clients[i].id = i;
+        clients[i].lat = &lat[i * req_per_client];
+        pthread_create(&threads[i], NULL, bench_client, &clients[i]);
+    }
+    for (i = 0; i < client_num; i++) {
+        pthread_join(threads[i], NULL);
+        errors += clients[i].errors;
+        /* failed requests have no latency, keep the others together */
+        memmove(&lat[ok], clients[i].lat, clients[i].ok * sizeof(double));
+        ok += clients[i].ok;
+    }
+    elapsed = now_ms() - start;
+
+    qsort(lat, ok, sizeof(double), lat_cmp);
+
+    printf("images:      %d\n", image_num);
+    printf("clients:     %d\n", client_num);
+    printf("requests:    %d (%s)\n", total, request);
+    printf("errors:      %d\n", errors);
+    printf("elapsed:     %.1f ms\n", elapsed);
+    // failed requests are often answered quickly, so they do not count
+    printf("requests/s:  %.1f (successful)\n", ok * 1000.0 / elapsed);
+    if (ok > 0) {
+        printf("latency p50: %.3f ms (%d successful requests)\n",
+            lat[ok / 2], ok);
+        printf("latency p99: %.3f ms\n", lat[(ok * 99) / 100]);
+    }
+
+    return errors ? 1 : 0;
+}
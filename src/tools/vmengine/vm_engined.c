@@ -0,0 +1,639 @@
+/*
+ * VM-XRay inspection daemon
+ *
+ * Serves path lookup, directory listing, file read and registry queries
+ * for many disk images over a Unix domain socket.  Opened images (image,
+ * volume system and file system through the inspection engine) and the
+ * registry hives read from them are kept in a bounded LRU, so repeated
+ * scans of the same images are answered from warm state.  Hives are
+ * parsed in place from the image, without being extracted first.
+ *
+ * Protocol: one request per line, fields separated by tabs
+ *
+ *   LOOKUP <image> <path>
+ *   LIST   <image> <path>
+ *   READ   <image> <path>
+ *   READI  <image> <inode>
+ *   REG    <image> <hive path> <string|dword> <subtree 0|1> <key>
+ *   STATS
+ *
+ * Each reply is "OK <length>\n" followed by length bytes of payload, or
+ * "ERR <message>\n".  Requests of a client are answered in order.
+ * Sockets are non-blocking: replies are queued per client and written as
+ * the client takes them, so a slow client does not hold up the others.
+ */
+
+#include "tsk3/tsk_tools_i.h"
+#include "vm_engine.h"
+#include "reglookuplib.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#define VMED_MAX_CLIENTS    64
+#define VMED_MAX_LINE       8192
+#define VMED_MAX_FIELDS     6
+#define VMED_DEF_IMAGES     8
+#define VMED_KEEP_OUT       65536       ///< Output buffer kept when empty
+
+/* Registry hive opened from an image, kept with the image */
+typedef struct VMED_HIVE {
+    struct VMED_HIVE *next;
+    char *path;                 ///< Path of the hive inside the image
+    TSK_FS_FILE *fs_file;       ///< File the hive is read from
+    void *reg;                  ///< reglookup handle
+} VMED_HIVE;
+
+/* Slot of the image LRU */
+typedef struct {
+    char *image;                ///< Image path, NULL if the slot is free
+    VM_ENGINE *vme;
+    VMED_HIVE *hives;
+    uint64_t used;              ///< Tick of last use, lowest is evicted
+} VMED_SLOT;
+
+typedef struct {
+    int fd;
+    char buf[VMED_MAX_LINE];
+    size_t len;
+    char *out;                  ///< Replies not written yet
+    size_t out_pos;             ///< Start of the unwritten part of out
+    size_t out_len;
+    size_t out_size;
+} VMED_CLIENT;
+
+static VMED_SLOT *slots;
+static int slot_num = VMED_DEF_IMAGES;
+static uint64_t tick = 0;
+static const char *sock_path = NULL;
+
+static struct {
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t hive_opens;
+} stats;
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-n max_images] -s socket\n"
+        "\t-n max_images: Number of images kept open (default %d)\n"
+        "\t-s socket: Path of the Unix domain socket to listen on\n",
+        prog, VMED_DEF_IMAGES);
+    exit(1);
+}
+
+static void
+vmed_hives_close(VMED_SLOT * slot)
+{
+    VMED_HIVE *hive, *next;
+
+    for (hive = slot->hives; hive != NULL; hive = next) {
+        next = hive->next;
+        rll_close(hive->reg);
+        tsk_fs_file_close(hive->fs_file);
+        free(hive->path);
+        free(hive);
+    }
+    slot->hives = NULL;
+}
+
+static void
+vmed_slot_free(VMED_SLOT * slot)
+{
+    vmed_hives_close(slot);
+    vme_close(slot->vme);
+    free(slot->image);
+    memset(slot, 0, sizeof(VMED_SLOT));
+}
+
+/* Return the engine slot for image, opening it (and evicting the least
+ * recently used image) if it is not open yet. */
+static VMED_SLOT *
+vmed_slot_get(const char *image)
+{
+    VMED_SLOT *slot = NULL;
+    int i;
+
+    tick++;
+    for (i = 0; i < slot_num; i++) {
+        if ((slots[i].image) && (strcmp(slots[i].image, image) == 0)) {
+            stats.hits++;
+            slots[i].used = tick;
+            return &slots[i];
+        }
+        if ((slot == NULL) || (slots[i].image == NULL)
+            || ((slot->image) && (slots[i].used < slot->used)))
+            slot = &slots[i];
+    }
+
+    stats.misses++;
+    if (slot->image) {
+        stats.evictions++;
+        vmed_slot_free(slot);
+    }
+
+    if ((slot->vme = vme_open(image)) == NULL)
+        return NULL;
+    // an image without its name could never be found or evicted
+    if ((slot->image = (char *) tsk_malloc(strlen(image) + 1)) == NULL) {
+        vme_close(slot->vme);
+        slot->vme = NULL;
+        return NULL;
+    }
+    strcpy(slot->image, image);
+    slot->used = tick;
+    return slot;
+}
+
+/* Read callback of the hives, reads straight from the file in the image */
+static long
+vmed_hive_read(void *state, unsigned int offset, char *buf,
+    unsigned int len)
+{
+    return (long) tsk_fs_file_read((TSK_FS_FILE *) state, offset, buf, len,
+        (TSK_FS_FILE_READ_FLAG_ENUM) 0);
+}
+
+/* Return the reglookup handle of a hive inside the image of slot. */
+static void *
+vmed_hive_get(VMED_SLOT * slot, const char *path)
+{
+    VMED_HIVE *hive;
+    uint64_t inum;
+
+    for (hive = slot->hives; hive != NULL; hive = hive->next) {
+        if (strcmp(hive->path, path) == 0)
+            return hive->reg;
+    }
+
+    if (vme_lookup(slot->vme, path, &inum) != 0)
+        return NULL;
+
+    if ((hive = (VMED_HIVE *) tsk_malloc(sizeof(VMED_HIVE))) == NULL)
+        return NULL;
+
+    // hive offsets are 32 bits
+    if (((hive->fs_file =
+                tsk_fs_file_open_meta(slot->vme->fs, NULL,
+                    (TSK_INUM_T) inum)) == NULL)
+        || (hive->fs_file->meta == NULL)
+        || (hive->fs_file->meta->size > 0xffffffffULL)
+        || ((hive->reg = rll_open_cb(vmed_hive_read,
+                    (unsigned int) hive->fs_file->meta->size,
+                    hive->fs_file)) == NULL)) {
+        tsk_fs_file_close(hive->fs_file);
+        free(hive);
+        return NULL;
+    }
+
+    if ((hive->path = (char *) tsk_malloc(strlen(path) + 1)) == NULL) {
+        rll_close(hive->reg);
+        tsk_fs_file_close(hive->fs_file);
+        free(hive);
+        return NULL;
+    }
+    strcpy(hive->path, path);
+
+    stats.hive_opens++;
+    hive->next = slot->hives;
+    slot->hives = hive;
+    return hive->reg;
+}
+
+/* Queue len bytes of reply for the client.  Returns -1 if out of memory. */
+static int
+vmed_send(VMED_CLIENT * cl, const char *buf, size_t len)
+{
+    if (cl->out_size - cl->out_len < len) {
+        size_t size = cl->out_size ? cl->out_size : VMED_KEEP_OUT;
+        char *out;
+
+        // drop what has been written before growing the buffer
+        if (cl->out_pos) {
+            memmove(cl->out, &cl->out[cl->out_pos],
+                cl->out_len - cl->out_pos);
+            cl->out_len -= cl->out_pos;
+            cl->out_pos = 0;
+        }
+        while (size - cl->out_len < len)
+            size *= 2;
+        if (size != cl->out_size) {
+            if ((out = (char *) realloc(cl->out, size)) == NULL)
+                return -1;
+            cl->out = out;
+            cl->out_size = size;
+        }
+    }
+    memcpy(&cl->out[cl->out_len], buf, len);
+    cl->out_len += len;
+    return 0;
+}
+
+/* Write as much of the queued replies as the client takes without
+ * blocking.  Returns -1 if the client is gone. */
+static int
+vmed_flush(VMED_CLIENT * cl)
+{
+    while (cl->out_pos < cl->out_len) {
+        ssize_t cnt = write(cl->fd, &cl->out[cl->out_pos],
+            cl->out_len - cl->out_pos);
+
+        if (cnt < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                return 0;
+            return -1;
+        }
+        cl->out_pos += cnt;
+    }
+
+    cl->out_pos = cl->out_len = 0;
+    // do not hold on to the buffer of a large reply
+    if (cl->out_size > VMED_KEEP_OUT) {
+        free(cl->out);
+        cl->out = NULL;
+        cl->out_size = 0;
+    }
+    return 0;
+}
+
+static int
+vmed_reply(VMED_CLIENT * cl, const char *data, size_t len)
+{
+    char hdr[32];
+
+    snprintf(hdr, sizeof(hdr), "OK %" PRIuSIZE "\n", len);
+    if (vmed_send(cl, hdr, strlen(hdr)))
+        return -1;
+    return vmed_send(cl, data, len);
+}
+
+static int
+vmed_error(VMED_CLIENT * cl, const char *msg)
+{
+    char buf[512], *p;
+
+    stats.errors++;
+    snprintf(buf, sizeof(buf) - 1, "ERR %s", msg ? msg : "unknown error");
+    // error strings can contain new lines, keep the reply on one line
+    for (p = buf; *p; p++)
+        if (*p == '\n')
+            *p = ' ';
+    strcat(buf, "\n");
+    return vmed_send(cl, buf, strlen(buf));
+}
+
+static int
+vmed_read(VMED_CLIENT * cl, VMED_SLOT * slot, uint64_t inum)
+{
+    int64_t size, cnt;
+    char *data;
+    int ret;
+
+    if ((size = vme_file_size(slot->vme, inum)) < 0)
+        return vmed_error(cl, vme_error());
+
+    if ((data = (char *) tsk_malloc((size_t) size + 1)) == NULL)
+        return vmed_error(cl, "out of memory");
+
+    if ((size > 0)
+        && ((cnt = vme_read(slot->vme, inum, 0, data, (size_t) size))
+            != size)) {
+        free(data);
+        return vmed_error(cl, vme_error());
+    }
+
+    ret = vmed_reply(cl, data, (size_t) size);
+    free(data);
+    return ret;
+}
+
+static int
+vmed_reg(VMED_CLIENT * cl, VMED_SLOT * slot, char **field)
+{
+    char **values, *data;
+    size_t len = 0, size = 0;
+    void *reg;
+    int subtree, i, ret;
+
+    if ((reg = vmed_hive_get(slot, field[2])) == NULL)
+        return vmed_error(cl, "unable to open registry hive");
+
+    subtree = atoi(field[4]);
+    if (strcmp(field[3], "string") == 0)
+        values = rll_get_value_strings(reg, field[5], subtree);
+    else if (strcmp(field[3], "dword") == 0)
+        values = rll_get_value_dwords(reg, field[5], subtree);
+    else
+        return vmed_error(cl, "unknown value type");
+
+    if (values == NULL)
+        return vmed_reply(cl, "", 0);
+
+    for (i = 0; values[i]; i++)
+        size += strlen(values[i]) + 1;
+
+    if ((data = (char *) tsk_malloc(size + 1)) == NULL) {
+        ret = vmed_error(cl, "out of memory");
+    }
+    else {
+        for (i = 0; values[i]; i++)
+            len += snprintf(&data[len], size + 1 - len, "%s\n", values[i]);
+        ret = vmed_reply(cl, data, len);
+        free(data);
+    }
+
+    for (i = 0; values[i]; i++)
+        free(values[i]);
+    free(values);
+    return ret;
+}
+
+static int
+vmed_stats(VMED_CLIENT * cl)
+{
+    char buf[512];
+    int i, open = 0;
+
+    for (i = 0; i < slot_num; i++)
+        if (slots[i].image)
+            open++;
+
+    snprintf(buf, sizeof(buf),
+        "requests %" PRIu64 "\nerrors %" PRIu64 "\nimage_hits %" PRIu64
+        "\nimage_misses %" PRIu64 "\nimage_evictions %" PRIu64
+        "\nhive_opens %" PRIu64 "\nimages_open %d\n", stats.requests,
+        stats.errors, stats.hits, stats.misses, stats.evictions,
+        stats.hive_opens, open);
+    return vmed_reply(cl, buf, strlen(buf));
+}
+
+/* Process one request line.  Returns -1 if the client is to be dropped. */
+static int
+vmed_request(VMED_CLIENT * cl, char *line)
+{
+    char *field[VMED_MAX_FIELDS];
+    char *last;
+    int nfield = 0;
+    VMED_SLOT *slot;
+    uint64_t inum;
+    int8_t ret;
+
+    stats.requests++;
+
+    field[nfield] = strtok_r(line, "\t", &last);
+    while ((field[nfield]) && (++nfield < VMED_MAX_FIELDS))
+        field[nfield] = strtok_r(NULL, "\t", &last);
+
+    if (nfield == 0)
+        return vmed_error(cl, "empty request");
+
+    if (strcmp(field[0], "STATS") == 0)
+        return vmed_stats(cl);
+
+    if (nfield < 3)
+        return vmed_error(cl, "missing arguments");
+
+    if ((slot = vmed_slot_get(field[1])) == NULL)
+        return vmed_error(cl, vme_error());
+
+    if (strcmp(field[0], "READI") == 0)
+        return vmed_read(cl, slot, strtoull(field[2], NULL, 10));
+
+    if (strcmp(field[0], "REG") == 0) {
+        if (nfield < 6)
+            return vmed_error(cl, "missing arguments");
+        return vmed_reg(cl, slot, field);
+    }
+
+    if ((ret = vme_lookup(slot->vme, field[2], &inum)) < 0)
+        return vmed_error(cl, vme_error());
+    else if (ret > 0)
+        return vmed_error(cl, "path not found");
+
+    if (strcmp(field[0], "LOOKUP") == 0) {
+        char buf[32];
+
+        snprintf(buf, sizeof(buf), "%" PRIu64, inum);
+        return vmed_reply(cl, buf, strlen(buf));
+    }
+    else if (strcmp(field[0], "READ") == 0) {
+        return vmed_read(cl, slot, inum);
+    }
+    else if (strcmp(field[0], "LIST") == 0) {
+        char *list;
+        int r;
+
+        if ((list = vme_list_dir(slot->vme, inum)) == NULL)
+            return vmed_error(cl, vme_error());
+        r = vmed_reply(cl, list, strlen(list));
+        vme_free(list);
+        return r;
+    }
+
+    return vmed_error(cl, "unknown request");
+}
+
+/* Process the complete request lines of a client, as long as all earlier
+ * replies could be written.  Returns -1 when the client is to be dropped. */
+static int
+vmed_client_lines(VMED_CLIENT * cl)
+{
+    char *nl;
+
+    while ((cl->out_len == 0) && ((nl = strchr(cl->buf, '\n')) != NULL)) {
+        size_t llen = nl - cl->buf + 1;
+
+        *nl = '\0';
+        if ((nl > cl->buf) && (*(nl - 1) == '\r'))
+            *(nl - 1) = '\0';
+        if (vmed_request(cl, cl->buf))
+            return -1;
+
+        memmove(cl->buf, &cl->buf[llen], cl->len - llen + 1);
+        cl->len -= llen;
+
+        if (vmed_flush(cl))
+            return -1;
+    }
+    return 0;
+}
+
+/* Read what is available from a client and process complete lines.
+ * Returns -1 when the client is gone. */
+static int
+vmed_client_input(VMED_CLIENT * cl)
+{
+    ssize_t cnt;
+
+    cnt = read(cl->fd, &cl->buf[cl->len], sizeof(cl->buf) - cl->len - 1);
+    if (cnt < 0)
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+            || (errno == EINTR)) ? 0 : -1;
+    if (cnt == 0)
+        return -1;
+    cl->len += cnt;
+    cl->buf[cl->len] = '\0';
+
+    if (vmed_client_lines(cl))
+        return -1;
+
+    // a line that does not fit the buffer will never complete
+    if ((cl->out_len == 0) && (cl->len >= sizeof(cl->buf) - 1)) {
+        vmed_error(cl, "request too long");
+        vmed_flush(cl);
+        return -1;
+    }
+    return 0;
+}
+
+/* Write queued replies once the client takes more, then go on with the
+ * requests that came in meanwhile.  Returns -1 when the client is gone. */
+static int
+vmed_client_output(VMED_CLIENT * cl)
+{
+    if (vmed_flush(cl))
+        return -1;
+    return vmed_client_lines(cl);
+}
+
+static void
+vmed_client_close(VMED_CLIENT * cl)
+{
+    close(cl->fd);
+    free(cl->out);
+}
+
+static void
+vmed_exit(int sig)
+{
+    if (sock_path)
+        unlink(sock_path);
+    _exit(0);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    struct pollfd pfd[VMED_MAX_CLIENTS + 1];
+    VMED_CLIENT clients[VMED_MAX_CLIENTS];
+    int nclients = 0;
+    int lfd, ch, i;
+
+    while ((ch = getopt(argc, argv, "n:s:")) > 0) {
+        switch (ch) {
+        case 'n':
+            slot_num = atoi(optarg);
+            if (slot_num < 1)
+                usage(argv[0]);
+            break;
+        case 's':
+            sock_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (sock_path == NULL)
+        usage(argv[0]);
+
+    if ((slots = (VMED_SLOT *) tsk_malloc(sizeof(VMED_SLOT) * slot_num))
+        == NULL) {
+        tsk_error_print(stderr);
+        exit(1);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", sock_path);
+        exit(1);
+    }
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+
+    unlink(sock_path);
+    if (((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        || (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+        || (listen(lfd, 16) < 0)) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", sock_path,
+            strerror(errno));
+        exit(1);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, vmed_exit);
+    signal(SIGTERM, vmed_exit);
+
+    while (1) {
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        for (i = 0; i < nclients; i++) {
+            pfd[i + 1].fd = clients[i].fd;
+            // read no more requests until the replies are taken
+            pfd[i + 1].events = clients[i].out_len ? POLLOUT : POLLIN;
+        }
+
+        if (poll(pfd, nclients + 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            break;
+        }
+
+        // go backwards so that dropping a client does not skip another
+        for (i = nclients - 1; i >= 0; i--) {
+            int ret = 0;
+
+            if (pfd[i + 1].revents & POLLOUT)
+                ret = vmed_client_output(&clients[i]);
+            else if (pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+                ret = vmed_client_input(&clients[i]);
+            else if (pfd[i + 1].revents & POLLNVAL)
+                ret = -1;
+            if (ret) {
+                vmed_client_close(&clients[i]);
+                clients[i] = clients[--nclients];
+            }
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept(lfd, NULL, NULL);
+
+            if (fd < 0)
+                continue;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            if (nclients == VMED_MAX_CLIENTS) {
+                VMED_CLIENT full;
+
+                memset(&full, 0, sizeof(full));
+                full.fd = fd;
+                vmed_error(&full, "too many clients");
+                vmed_flush(&full);
+                vmed_client_close(&full);
+                continue;
+            }
+            memset(&clients[nclients], 0, sizeof(VMED_CLIENT));
+            clients[nclients].fd = fd;
+            nclients++;
+        }
+    }
+
+    for (i = 0; i < nclients; i++)
+        vmed_client_close(&clients[i]);
+    for (i = 0; i < slot_num; i++)
+        if (slots[i].image)
+            vmed_slot_free(&slots[i]);
+    unlink(sock_path);
+    return 0;
+}
@@ -0,0 +1,538 @@
+/*
+ * VM-XRay image read benchmark
+ *
+ * Measures the TSK image layer on a VM disk image: a full metadata scan
+ * (like ils) and, when a path is given, the extraction of one file (like
+ * icat).  Each test runs with readahead disabled and enabled and the
+ * best of a number of runs is reported with the read cache counters.
+ * With -t the file is extracted by several threads at once, each through
+ * its own clone of the engine handle, and the metadata scan parses the
+ * entries on that many threads (tsk_fs_meta_walk_parallel()).  With -s the whole image is also
+ * streamed in order (like img_cat), which on compressed images measures
+ * the decompressed cluster cache and inflate-ahead of qemu-img-lib.
+ * With -l the path is resolved a number of times (like ifind -n), once
+ * through the directory indexes of the file system, once by scanning
+ * every directory on the path and once through the directory cache.
+ * With -m the image is opened as a raw image and streamed and scanned
+ * through read(), through a memory mapping with a copy per read, and
+ * through borrowed pointers into the mapping, and the CPU time per byte
+ * of each is reported next to the throughput.
+ */
+
+#include "tsk3/tsk_tools_i.h"
+#include "vm_engine.h"
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <pthread.h>
+
+static size_t cache_size = TSK_IMG_CACHE_DEFAULT_SIZE;
+static size_t ra_size = TSK_IMG_READAHEAD_DEFAULT_SIZE;
+static int iterations = 3;
+static int drop_caches = 0;
+static int threads = 1;
+static int stream = 0;
+static int lookups = 0;
+static int mapped = 0;
+static volatile uint8_t bench_sink;     /* keeps the loads of bench_borrow() */
+
+/* size of the reads of the streaming test, as used by img_cat */
+#define BENCH_STREAM_CHUNK (64 * 1024)
+
+/* tests */
+#define BENCH_FILE 0            /* ils, or icat when a path is given */
+#define BENCH_STREAM 1          /* img_cat */
+#define BENCH_LOOKUP 2          /* ifind -n through the directory indexes */
+#define BENCH_SCAN 3            /* ifind -n by scanning the directories */
+#define BENCH_CACHED 4          /* ifind -n through the directory cache */
+
+/* ways of reading a raw image for -m */
+#define BENCH_MAP_READ 0        /* read() through the read cache */
+#define BENCH_MAP_COPY 1        /* copied out of the mapping */
+#define BENCH_MAP_BORROW 2      /* borrowed pointers into the mapping */
+#define BENCH_MAP_SEQ 3         /* borrowed, with the sequential hint */
+#define BENCH_MAP_MODES 4
+
+typedef struct {
+    double ms;
+    double cpu_ms;
+    uint64_t bytes;
+    TSK_IMG_CACHE_STATS stats;
+} BENCH_RESULT;
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-dms] [-c cache_size] [-r readahead] [-i iterations] [-t threads] [-l lookups] image [path]\n"
+        "\t-c cache_size: Read cache budget in bytes (default %d)\n"
+        "\t-r readahead: Readahead limit in bytes when enabled (default %d)\n"
+        "\t-i iterations: Runs per test, the best is reported (default 3)\n"
+        "\t-t threads: Threads that extract the file or scan the metadata (default 1)\n"
+        "\t-d: Drop the page cache before every run (Linux, needs root)\n"
+        "\t-s: Also read the whole image in order, like img_cat\n"
+        "\t-l lookups: Also resolve the path this many times, like ifind -n\n"
+        "\t-m: Also compare read() and memory mapped access on the raw image\n"
+        "\tpath: File to extract (only the metadata scan runs without it)\n",
+        prog, TSK_IMG_CACHE_DEFAULT_SIZE, TSK_IMG_READAHEAD_DEFAULT_SIZE);
+    exit(1);
+}
+
+static double
+now_ms()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* user and system time of the process */
+static double
+cpu_ms()
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 +
+        (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
+
+static TSK_WALK_RET_ENUM
+meta_act(TSK_FS_FILE * fs_file, void *ptr)
+{
+    (*(uint64_t *) ptr)++;
+    return TSK_WALK_CONT;
+}
+
+static TSK_WALK_RET_ENUM
+file_act(TSK_FS_FILE * fs_file, TSK_OFF_T a_off, TSK_DADDR_T addr,
+    char *buf, size_t size, TSK_FS_BLOCK_FLAG_ENUM flags, void *ptr)
+{
+    *(uint64_t *) ptr += size;
+    return TSK_WALK_CONT;
+}
+
+/* Start a run from cold storage instead of the page cache */
+static void
+bench_drop_caches()
+{
+    FILE *fp;
+
+    sync();
+    if ((fp = fopen("/proc/sys/vm/drop_caches", "w")) == NULL) {
+        fprintf(stderr, "Unable to drop the page cache: %s\n",
+            strerror(errno));
+        exit(1);
+    }
+    fputs("3\n", fp);
+    fclose(fp);
+}
+
+/* Extract one file through a handle */
+typedef struct {
+    VM_ENGINE *vme;
+    const char *path;
+    uint64_t bytes;
+    uint8_t ret;
+} BENCH_THREAD;
+
+static void *
+bench_extract(void *arg)
+{
+    BENCH_THREAD *thr = (BENCH_THREAD *) arg;
+    TSK_FS_FILE *fs_file;
+
+    if ((fs_file = tsk_fs_file_open(thr->vme->fs, NULL, thr->path)) == NULL) {
+        thr->ret = 1;
+        return NULL;
+    }
+    thr->ret = tsk_fs_file_walk(fs_file, (TSK_FS_FILE_WALK_FLAG_ENUM) 0,
+        file_act, &thr->bytes);
+    tsk_fs_file_close(fs_file);
+    return NULL;
+}
+
+/* Read the whole image in order.  Returns 1 on error. */
+static uint8_t
+bench_stream(TSK_IMG_INFO * img, uint64_t * bytes)
+{
+    char *buf;
+    TSK_OFF_T off;
+    ssize_t cnt;
+
+    if ((buf = (char *) tsk_malloc(BENCH_STREAM_CHUNK)) == NULL)
+        return 1;
+    for (off = 0; off < img->size; off += cnt) {
+        size_t len = BENCH_STREAM_CHUNK;
+
+        if ((TSK_OFF_T) len > img->size - off)
+            len = (size_t) (img->size - off);
+        if ((cnt = tsk_img_read(img, off, buf, len)) <= 0) {
+            free(buf);
+            return 1;
+        }
+        *bytes += cnt;
+    }
+    free(buf);
+    return 0;
+}
+
+/* Read the whole image in order through borrowed pointers, touching
+ * every page like a parser would.  Returns 1 on error. */
+static uint8_t
+bench_borrow(TSK_IMG_INFO * img, uint64_t * bytes)
+{
+    TSK_OFF_T off;
+    uint8_t sum = 0;
+
+    for (off = 0; off < img->size; off += BENCH_STREAM_CHUNK) {
+        size_t len = BENCH_STREAM_CHUNK;
+        const char *ptr;
+        size_t i;
+
+        if ((TSK_OFF_T) len > img->size - off)
+            len = (size_t) (img->size - off);
+        if ((ptr = tsk_img_borrow(img, off, len)) == NULL) {
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_IMG_READ;
+            snprintf(tsk_errstr, TSK_ERRSTR_L,
+                "bench_borrow: %" PRIuOFF " is not mapped", off);
+            return 1;
+        }
+        for (i = 0; i < len; i += 4096)
+            sum += ptr[i];
+        *bytes += len;
+    }
+    bench_sink = sum;
+    return 0;
+}
+
+/* Resolve a path a number of times.  Returns 1 on error. */
+static uint8_t
+bench_lookup(TSK_FS_INFO * fs, const char *path, uint64_t * count)
+{
+    TSK_INUM_T inum;
+    int i;
+
+    for (i = 0; i < lookups; i++) {
+        int8_t ret = tsk_fs_path2inum(fs, path, &inum, NULL);
+        if (ret == -1)
+            return 1;
+        else if (ret == 1) {
+            tsk_error_reset();
+            tsk_errno = TSK_ERR_FS_ARG;
+            snprintf(tsk_errstr, TSK_ERRSTR_L, "%s not found", path);
+            return 1;
+        }
+        (*count)++;
+    }
+    return 0;
+}
+
+/* Run one test on a freshly opened image.  Returns 1 on error. */
+static uint8_t
+bench_run(const char *image, const char *path, int test,
+    size_t readahead, BENCH_RESULT * res)
+{
+    VM_ENGINE *vme;
+    BENCH_THREAD *thr = NULL;
+    double start;
+    uint8_t ret = 0;
+    int i;
+
+    if (drop_caches)
+        bench_drop_caches();
+
+    if ((vme = vme_open(image)) == NULL)
+        return 1;
+
+    if (tsk_img_cache_set_size(vme->img, cache_size)
+        || tsk_img_cache_set_readahead(vme->img, readahead)) {
+        vme_close(vme);
+        return 1;
+    }
+
+    if ((path != NULL) && (test == BENCH_FILE) && (threads > 1)) {
+        if ((thr = (BENCH_THREAD *) tsk_malloc(sizeof(BENCH_THREAD) *
+                    threads)) == NULL) {
+            vme_close(vme);
+            return 1;
+        }
+        thr[0].vme = vme;
+        for (i = 1; i < threads; i++) {
+            if ((thr[i].vme = vme_clone(vme)) == NULL) {
+                while (--i > 0)
+                    vme_close(thr[i].vme);
+                free(thr);
+                vme_close(vme);
+                return 1;
+            }
+        }
+    }
+
+    // scan every directory like a file system without indexes
+    if (test == BENCH_SCAN)
+        vme->fs->dir_lookup = NULL;
+
+    // only the cached test may answer lookups from earlier ones
+    if (((test == BENCH_LOOKUP) || (test == BENCH_SCAN))
+        && (tsk_fs_dir_cache_set_size(vme->fs, 0))) {
+        vme_close(vme);
+        return 1;
+    }
+
+    res->bytes = 0;
+    start = now_ms();
+
+    if (test == BENCH_STREAM) {
+        ret = bench_stream(vme->img, &res->bytes);
+    }
+    else if ((test == BENCH_LOOKUP) || (test == BENCH_SCAN)
+        || (test == BENCH_CACHED)) {
+        ret = bench_lookup(vme->fs, path, &res->bytes);
+    }
+    else if (path == NULL) {
+        ret = tsk_fs_meta_walk_parallel(vme->fs, vme->fs->first_inum,
+            vme->fs->last_inum,
+            TSK_FS_META_FLAG_ALLOC | TSK_FS_META_FLAG_UNALLOC, threads,
+            TSK_FS_META_PWALK_FLAG_NONE, meta_act, &res->bytes);
+    }
+    else if (thr != NULL) {
+        pthread_t *tid = (pthread_t *) tsk_malloc(sizeof(pthread_t) *
+            threads);
+
+        for (i = 0; (tid != NULL) && (i < threads); i++) {
+            thr[i].path = path;
+            pthread_create(&tid[i], NULL, bench_extract, &thr[i]);
+        }
+        for (i = 0; (tid != NULL) && (i < threads); i++) {
+            pthread_join(tid[i], NULL);
+            res->bytes += thr[i].bytes;
+            ret |= thr[i].ret;
+        }
+        if (tid == NULL)
+            ret = 1;
+        free(tid);
+    }
+    else {
+        TSK_FS_FILE *fs_file;
+
+        if ((fs_file = tsk_fs_file_open(vme->fs, NULL, path)) == NULL) {
+            ret = 1;
+        }
+        else {
+            ret = tsk_fs_file_walk(fs_file, (TSK_FS_FILE_WALK_FLAG_ENUM) 0,
+                file_act, &res->bytes);
+            tsk_fs_file_close(fs_file);
+        }
+    }
+
+    res->ms = now_ms() - start;
+    tsk_img_cache_stats(vme->img, &res->stats);
+    if (thr != NULL) {
+        for (i = 1; i < threads; i++)
+            vme_close(thr[i].vme);
+        free(thr);
+    }
+    vme_close(vme);
+    return ret;
+}
+
+/* Stream or scan a raw image in one of the BENCH_MAP_ modes.
+ * Returns 1 on error. */
+static uint8_t
+bench_map_run(const char *image, int test, int mode, BENCH_RESULT * res)
+{
+    TSK_IMG_INFO *img;
+    double start, cpu_start;
+    uint8_t ret = 0;
+
+    if (drop_caches)
+        bench_drop_caches();
+
+    if ((img = tsk_img_open_utf8_sing(image, TSK_IMG_TYPE_RAW_SING,
+                0)) == NULL)
+        return 1;
+
+    if (tsk_img_cache_set_size(img, cache_size)
+        || tsk_img_cache_set_readahead(img, ra_size)
+        || ((mode != BENCH_MAP_READ) && (tsk_img_set_mmap(img, 1)))
+        || tsk_img_set_access(img,
+            (mode == BENCH_MAP_SEQ) ? TSK_IMG_ACCESS_SEQUENTIAL :
+            TSK_IMG_ACCESS_NORMAL)) {
+        tsk_img_close(img);
+        return 1;
+    }
+
+    res->bytes = 0;
+    start = now_ms();
+    cpu_start = cpu_ms();
+
+    if (test == BENCH_STREAM) {
+        if (mode >= BENCH_MAP_BORROW)
+            ret = bench_borrow(img, &res->bytes);
+        else
+            ret = bench_stream(img, &res->bytes);
+    }
+    else {
+        TSK_FS_INFO *fs;
+
+        if ((fs = tsk_fs_open_img(img, 0, TSK_FS_TYPE_DETECT)) == NULL) {
+            ret = 1;
+        }
+        else {
+            ret = tsk_fs_meta_walk(fs, fs->first_inum, fs->last_inum,
+                TSK_FS_META_FLAG_ALLOC | TSK_FS_META_FLAG_UNALLOC,
+                meta_act, &res->bytes);
+            tsk_fs_close(fs);
+        }
+    }
+
+    res->ms = now_ms() - start;
+    res->cpu_ms = cpu_ms() - cpu_start;
+    tsk_img_cache_stats(img, &res->stats);
+    tsk_img_close(img);
+    return ret;
+}
+
+static void
+bench_map_test(const char *image, int test)
+{
+    static const char *names[BENCH_MAP_MODES] =
+        { "read", "mmap", "borrow", "borrow+seq" };
+    int m, i;
+
+    for (m = 0; m < BENCH_MAP_MODES; m++) {
+        BENCH_RESULT best, res;
+
+        // the metadata scan borrows on its own when the image is mapped
+        if ((test != BENCH_STREAM) && (m > BENCH_MAP_COPY))
+            break;
+
+        memset(&best, 0, sizeof(best));
+        best.ms = -1;
+        for (i = 0; i < iterations; i++) {
+            if (bench_map_run(image, test, m, &res)) {
+                tsk_error_print(stderr);
+                exit(1);
+            }
+            if ((best.ms < 0) || (res.ms < best.ms))
+                best = res;
+        }
+
+        if (test == BENCH_STREAM)
+            printf("%-8s %-15s %9.1f ms %10.1f MB/s %8.3f cpu ns/byte\n",
+                "img_cat", names[m], best.ms,
+                best.bytes / 1048.576 / best.ms,
+                best.bytes ? best.cpu_ms * 1e6 / best.bytes : 0.0);
+        else
+            printf("%-8s %-15s %9.1f ms %10.0f inodes/s %8.0f cpu ns/inode\n",
+                "ils", names[m], best.ms, best.bytes * 1000.0 / best.ms,
+                best.bytes ? best.cpu_ms * 1e6 / best.bytes : 0.0);
+    }
+}
+
+static void
+bench_test(const char *image, const char *path, int test)
+{
+    int r, i;
+
+    for (r = 0; r < 2; r++) {
+        size_t readahead = r ? ra_size : 0;
+        BENCH_RESULT best, res;
+
+        memset(&best, 0, sizeof(best));
+        best.ms = -1;
+        for (i = 0; i < iterations; i++) {
+            if (bench_run(image, path, test, readahead, &res)) {
+                tsk_error_print(stderr);
+                exit(1);
+            }
+            if ((best.ms < 0) || (res.ms < best.ms))
+                best = res;
+        }
+
+        if (test == BENCH_STREAM)
+            printf("%-8s readahead %-4s %9.1f ms %10.1f MB/s",
+                "img_cat", r ? "on" : "off", best.ms,
+                best.bytes / 1048.576 / best.ms);
+        else if ((test == BENCH_LOOKUP) || (test == BENCH_SCAN)
+            || (test == BENCH_CACHED))
+            printf("%-8s readahead %-4s %9.1f ms %10.0f lookups/s",
+                (test == BENCH_LOOKUP) ? "ifind" : (test ==
+                    BENCH_SCAN) ? "ifind-sc" : "ifind-dc",
+                r ? "on" : "off", best.ms, best.bytes * 1000.0 / best.ms);
+        else if (path == NULL)
+            printf("%-8s readahead %-4s %9.1f ms %10.0f inodes/s",
+                "ils", r ? "on" : "off", best.ms,
+                best.bytes * 1000.0 / best.ms);
+        else
+            printf("%-8s readahead %-4s %9.1f ms %10.1f MB/s",
+                "icat", r ? "on" : "off", best.ms,
+                best.bytes / 1048.576 / best.ms);
+        printf("  (hits %" PRIu64 ", misses %" PRIu64 ", evictions %"
+            PRIu64 ", readahead %" PRIu64 ")\n", best.stats.hits,
+            best.stats.misses, best.stats.evictions,
+            best.stats.readahead);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int ch;
+
+    while ((ch = getopt(argc, argv, "c:di:l:mr:st:")) > 0) {
+        switch (ch) {
+        case 'c':
+            cache_size = (size_t) strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            drop_caches = 1;
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'l':
+            lookups = atoi(optarg);
+            break;
+        case 'm':
+            mapped = 1;
+            break;
+        case 'r':
+            ra_size = (size_t) strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            stream = 1;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ((optind == argc) || (argc - optind > 2) || (iterations < 1)
+        || (threads < 1) || (lookups < 0))
+        usage(argv[0]);
+
+    bench_test(argv[optind], NULL, BENCH_FILE);
+    if (optind + 1 < argc)
+        bench_test(argv[optind], argv[optind + 1], BENCH_FILE);
+    if (stream)
+        bench_test(argv[optind], NULL, BENCH_STREAM);
+    if ((lookups > 0) && (optind + 1 < argc)) {
+        bench_test(argv[optind], argv[optind + 1], BENCH_LOOKUP);
+        bench_test(argv[optind], argv[optind + 1], BENCH_SCAN);
+        bench_test(argv[optind], argv[optind + 1], BENCH_CACHED);
+    }
+    if (mapped) {
+        bench_map_test(argv[optind], BENCH_STREAM);
+        bench_map_test(argv[optind], BENCH_FILE);
+    }
+
+    return 0;
+}
@@ -0,0 +1,454 @@
+/*
+ * VM-XRay registry hive benchmark
+ *
+ * Measures regfi on a hive file: opening it and walking every key and
+ * value with the iterators (like reglookup).  The hive is opened as a
+ * file, from a buffer holding the whole hive and through read
+ * callbacks (as the engine does for hives inside of an image), and the
+ * best of a number of runs of each is reported as the time to open the
+ * hive and the keys and values visited per second.  With -l the path of
+ * every key is also resolved from the root (like reglookup -p), and the
+ * subkey lookups per second are reported.  With -x the paths are also
+ * resolved with an index of the hive saved to a file, as later runs
+ * over an unchanged hive would.
+ */
+
+#include "regfi.h"
+
+#include <sys/time.h>
+#include <inttypes.h>
+
+static int iterations = 3;
+static int lookups = 0;
+static const char *index_file = NULL;
+
+/* deepest key path collected for the lookup test */
+#define BENCH_MAX_DEPTH 512
+
+/* ways of opening the hive */
+#define BENCH_OPEN_FILE 0       /* regfi_open() */
+#define BENCH_OPEN_BUFFER 1     /* regfi_open_buffer() */
+#define BENCH_OPEN_CB 2         /* regfi_open_cb() */
+#define BENCH_OPEN_MODES 3
+
+static const char *bench_open_names[BENCH_OPEN_MODES] =
+    { "file", "buffer", "callback" };
+
+typedef struct {
+    double open_ms;
+    double walk_ms;
+    uint64_t keys;
+    uint64_t values;
+} BENCH_RESULT;
+
+/* key paths for the lookup test, as NULL terminated name lists */
+typedef struct {
+    char ***paths;
+    size_t num;
+    size_t alloc;
+    uint64_t names;
+} BENCH_PATHS;
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-l] [-i iterations] [-x index] hive\n"
+        "\t-i iterations: Runs per test, the best is reported (default 3)\n"
+        "\t-l: Also resolve the path of every key from the root\n"
+        "\t-x index: Also resolve them with an index saved to this file\n",
+        prog);
+    exit(1);
+}
+
+static double
+now_ms()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* read callback over a stdio stream, standing in for an image file */
+static ssize_t
+bench_cb_read(REGFI_RAW_FILE * self, uint32 offset, void *buf,
+    size_t count)
+{
+    FILE *fp = (FILE *) self->state;
+
+    if (fseek(fp, offset, SEEK_SET) != 0)
+        return -1;
+    return fread(buf, 1, count, fp);
+}
+
+static void
+bench_cb_close(REGFI_RAW_FILE * self)
+{
+    fclose((FILE *) self->state);
+}
+
+static REGF_FILE *
+bench_open(int mode, const char *path, const char *buf, uint32 len)
+{
+    REGFI_RAW_FILE raw;
+
+    switch (mode) {
+    case BENCH_OPEN_FILE:
+        return regfi_open(path);
+    case BENCH_OPEN_BUFFER:
+        return regfi_open_buffer(buf, len);
+    default:
+        memset(&raw, 0, sizeof(raw));
+        if ((raw.state = fopen(path, "rb")) == NULL)
+            return NULL;
+        raw.read = bench_cb_read;
+        raw.close = bench_cb_close;
+        raw.size = len;
+        return regfi_open_cb(&raw);
+    }
+}
+
+/* Save a copy of the path of the current key.  Returns 1 on error. */
+static uint8_t
+bench_add_path(BENCH_PATHS * bp, char **names, int depth)
+{
+    char **path;
+    int d;
+
+    if (bp->num == bp->alloc) {
+        char ***tmp;
+
+        bp->alloc = bp->alloc ? bp->alloc * 2 : 1024;
+        if ((tmp = (char ***) realloc(bp->paths,
+                    bp->alloc * sizeof(char **))) == NULL)
+            return 1;
+        bp->paths = tmp;
+    }
+    if ((path = (char **) calloc(depth + 1, sizeof(char *))) == NULL)
+        return 1;
+    for (d = 0; d < depth; d++) {
+        if ((path[d] = strdup(names[d])) == NULL)
+            return 1;
+    }
+    bp->paths[bp->num++] = path;
+    bp->names += depth;
+    return 0;
+}
+
+static void
+bench_free_paths(BENCH_PATHS * bp)
+{
+    size_t p;
+    int d;
+
+    for (p = 0; p < bp->num; p++) {
+        for (d = 0; bp->paths[p][d] != NULL; d++)
+            free(bp->paths[p][d]);
+        free(bp->paths[p]);
+    }
+    free(bp->paths);
+    memset(bp, 0, sizeof(*bp));
+}
+
+/* Visit every key and value of the hive, depth first, and collect the
+ * key paths in bp if it is not NULL.  Returns 1 on error. */
+static uint8_t
+bench_walk(REGFI_ITERATOR * iter, BENCH_RESULT * res, BENCH_PATHS * bp)
+{
+    const REGF_NK_REC *root, *cur, *sub;
+    const REGF_VK_REC *vk;
+    char *names[BENCH_MAX_DEPTH];
+    int depth = 0;
+    int visit = 1;
+
+    root = cur = regfi_iterator_cur_key(iter);
+    if (root == NULL)
+        return 1;
+    sub = regfi_iterator_first_subkey(iter);
+
+    do {
+        if (visit) {
+            res->keys++;
+            if (bp && (depth > 0) && bench_add_path(bp, names, depth))
+                return 1;
+            for (vk = regfi_iterator_first_value(iter); vk != NULL;
+                vk = regfi_iterator_next_value(iter))
+                res->values++;
+        }
+
+        if (sub == NULL) {
+            if (cur != root) {
+                if (!regfi_iterator_up(iter))
+                    return 1;
+                depth--;
+                if ((cur = regfi_iterator_cur_key(iter)) == NULL)
+                    return 1;
+                sub = regfi_iterator_next_subkey(iter);
+            }
+            visit = 0;
+        }
+        else {
+            if ((depth == BENCH_MAX_DEPTH) || (sub->keyname == NULL))
+                return 1;
+            names[depth++] = sub->keyname;
+            if (!regfi_iterator_down(iter))
+                return 1;
+            cur = sub;
+            sub = regfi_iterator_first_subkey(iter);
+            visit = 1;
+        }
+    } while (!((cur == root) && (sub == NULL)));
+
+    return 0;
+}
+
+/* Open and walk the hive once.  Returns 1 on error. */
+static uint8_t
+bench_run(int mode, const char *path, const char *buf, uint32 len,
+    BENCH_RESULT * res)
+{
+    REGF_FILE *f;
+    REGFI_ITERATOR *iter;
+    double start;
+    uint8_t ret;
+
+    memset(res, 0, sizeof(*res));
+
+    start = now_ms();
+    if ((f = bench_open(mode, path, buf, len)) == NULL)
+        return 1;
+    if ((iter = regfi_iterator_new(f)) == NULL) {
+        regfi_close(f);
+        return 1;
+    }
+    res->open_ms = now_ms() - start;
+
+    start = now_ms();
+    ret = bench_walk(iter, res, NULL);
+    res->walk_ms = now_ms() - start;
+
+    regfi_iterator_free(iter);
+    regfi_close(f);
+    return ret;
+}
+
+/* Resolve every collected path from the root.  Returns 1 on error. */
+static uint8_t
+bench_lookup(const char *path, BENCH_PATHS * bp, double *ms)
+{
+    REGF_FILE *f;
+    REGFI_ITERATOR *iter;
+    double start;
+    size_t p;
+
+    if ((f = regfi_open(path)) == NULL)
+        return 1;
+    if ((iter = regfi_iterator_new(f)) == NULL) {
+        regfi_close(f);
+        return 1;
+    }
+
+    start = now_ms();
+    for (p = 0; p < bp->num; p++) {
+        if (!regfi_iterator_to_root(iter) ||
+            !regfi_iterator_walk_path(iter, (const char **) bp->paths[p]))
+            break;
+    }
+    *ms = now_ms() - start;
+
+    regfi_iterator_free(iter);
+    regfi_close(f);
+    return p != bp->num;
+}
+
+/* Build and save an index of the hive, then open it again and resolve
+ * every collected path with it.  Returns 1 on error. */
+static uint8_t
+bench_index(const char *path, BENCH_PATHS * bp, double *build_ms,
+    double *open_ms, double *ms)
+{
+    REGF_FILE *f;
+    REGFI_INDEX *idx;
+    REGFI_INDEX_KEY key;
+    double start;
+    size_t p;
+
+    if ((f = regfi_open(path)) == NULL)
+        return 1;
+
+    start = now_ms();
+    idx = regfi_index_build(f);
+    *build_ms = now_ms() - start;
+    if ((idx == NULL) || !regfi_index_write(idx, index_file)) {
+        regfi_index_free(idx);
+        regfi_close(f);
+        return 1;
+    }
+    regfi_index_free(idx);
+
+    start = now_ms();
+    idx = regfi_index_open(f, index_file, 0);
+    *open_ms = now_ms() - start;
+    if (idx == NULL) {
+        regfi_close(f);
+        return 1;
+    }
+
+    start = now_ms();
+    for (p = 0; p < bp->num; p++) {
+        if (!regfi_index_find_key(idx, (const char **) bp->paths[p], &key))
+            break;
+    }
+    *ms = now_ms() - start;
+
+    regfi_index_free(idx);
+    regfi_close(f);
+    return p != bp->num;
+}
+
+/* Collect the path of every key.  Returns 1 on error. */
+static uint8_t
+bench_collect(const char *path, BENCH_PATHS * bp)
+{
+    REGF_FILE *f;
+    REGFI_ITERATOR *iter;
+    BENCH_RESULT res;
+    uint8_t ret;
+
+    memset(&res, 0, sizeof(res));
+    if ((f = regfi_open(path)) == NULL)
+        return 1;
+    if ((iter = regfi_iterator_new(f)) == NULL) {
+        regfi_close(f);
+        return 1;
+    }
+    ret = bench_walk(iter, &res, bp);
+    regfi_iterator_free(iter);
+    regfi_close(f);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    int ch, mode, i;
+    char *buf;
+    FILE *fp;
+    long len;
+
+    while ((ch = getopt(argc, argv, "i:lx:")) > 0) {
+        switch (ch) {
+        case 'l':
+            lookups = 1;
+            break;
+        case 'i':
+            if ((iterations = atoi(optarg)) < 1)
+                usage(argv[0]);
+            break;
+        case 'x':
+            lookups = 1;
+            index_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        usage(argv[0]);
+
+    /* the buffer test uses a copy of the whole hive */
+    if ((fp = fopen(argv[optind], "rb")) == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", argv[optind],
+            strerror(errno));
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    if ((len <= 0) || ((buf = (char *) malloc(len)) == NULL)
+        || (fread(buf, 1, len, fp) != (size_t) len)) {
+        fprintf(stderr, "Error reading %s\n", argv[optind]);
+        return 1;
+    }
+    fclose(fp);
+
+    printf("%s: %ld bytes, best of %d runs\n", argv[optind], len,
+        iterations);
+    printf("%-10s %10s %10s %10s %10s %14s\n", "open", "open ms",
+        "walk ms", "keys", "values", "visits/s");
+
+    for (mode = 0; mode < BENCH_OPEN_MODES; mode++) {
+        BENCH_RESULT best, res;
+
+        memset(&best, 0, sizeof(best));
+
+        for (i = 0; i < iterations; i++) {
+            if (bench_run(mode, argv[optind], buf, (uint32) len, &res)) {
+                fprintf(stderr, "Error walking %s (%s)\n", argv[optind],
+                    bench_open_names[mode]);
+                return 1;
+            }
+            if ((i == 0) || (res.open_ms + res.walk_ms <
+                    best.open_ms + best.walk_ms))
+                best = res;
+        }
+
+        printf("%-10s %10.2f %10.2f %10" PRIu64 " %10" PRIu64 " %14.0f\n",
+            bench_open_names[mode], best.open_ms, best.walk_ms,
+            best.keys, best.values,
+            best.walk_ms > 0 ? (best.keys + best.values) * 1000.0 /
+            best.walk_ms : 0.0);
+    }
+
+    if (lookups) {
+        BENCH_PATHS bp;
+        double best = 0, ms;
+
+        memset(&bp, 0, sizeof(bp));
+        if (bench_collect(argv[optind], &bp)) {
+            fprintf(stderr, "Error collecting the key paths of %s\n",
+                argv[optind]);
+            return 1;
+        }
+        for (i = 0; i < iterations; i++) {
+            if (bench_lookup(argv[optind], &bp, &ms)) {
+                fprintf(stderr, "Error resolving the key paths of %s\n",
+                    argv[optind]);
+                return 1;
+            }
+            if ((i == 0) || (ms < best))
+                best = ms;
+        }
+        printf("lookup: %zu paths, %" PRIu64 " subkey lookups in %.2f ms, "
+            "%.0f lookups/s\n", bp.num, bp.names, best,
+            best > 0 ? bp.names * 1000.0 / best : 0.0);
+
+        if (index_file) {
+            double build_ms, open_ms, best_build = 0, best_open = 0;
+
+            for (i = 0; i < iterations; i++) {
+                if (bench_index(argv[optind], &bp, &build_ms, &open_ms,
+                        &ms)) {
+                    fprintf(stderr, "Error indexing %s in %s\n",
+                        argv[optind], index_file);
+                    return 1;
+                }
+                if ((i == 0) || (ms < best))
+                    best = ms;
+                if ((i == 0) || (build_ms < best_build))
+                    best_build = build_ms;
+                if ((i == 0) || (open_ms < best_open))
+                    best_open = open_ms;
+            }
+            printf("index: built in %.2f ms, opened in %.2f ms, "
+                "%" PRIu64 " subkey lookups in %.2f ms, %.0f lookups/s\n",
+                best_build, best_open, bp.names, best,
+                best > 0 ? bp.names * 1000.0 / best : 0.0);
+        }
+        bench_free_paths(&bp);
+    }
+
+    free(buf);
+    return 0;
+}